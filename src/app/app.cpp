@@ -26,6 +26,7 @@
 #include "app/file_system.h"
 #include "app/filename_formatter.h"
 #include "app/gui_xml.h"
+#include "app/image_load_errors.h"
 #include "app/ini_file.h"
 #include "app/log.h"
 #include "app/modules.h"
@@ -213,10 +214,14 @@ void App::initialize(const AppOptions& options)
     ui::Manager::getDefault()->invalidate();
   }
 
+  // Report pixels of lazy images that cannot be loaded
+  m_imageLoadErrors.reset(new ImageLoadErrors);
+
   // Procress options
   LOG("Processing options...\n");
 
   bool ignoreEmpty = false;
+  bool mergeDuplicates = false;
   bool trim = false;
   Params cropParams;
   SpriteSheetType sheetType = SpriteSheetType::None;
@@ -273,6 +278,16 @@ void App::initialize(const AppOptions& options)
           if (m_exporter)
             m_exporter->setTextureHeight(strtol(value.value().c_str(), NULL, 0));
         }
+        // --sheet-max-width <width>
+        else if (opt == &options.sheetMaxWidth()) {
+          if (m_exporter)
+            m_exporter->setMaxTextureWidth(strtol(value.value().c_str(), NULL, 0));
+        }
+        // --sheet-max-height <height>
+        else if (opt == &options.sheetMaxHeight()) {
+          if (m_exporter)
+            m_exporter->setMaxTextureHeight(strtol(value.value().c_str(), NULL, 0));
+        }
         // --sheet-pack
         else if (opt == &options.sheetType()) {
           if (value.value() == "horizontal")
@@ -316,6 +331,10 @@ void App::initialize(const AppOptions& options)
         else if (opt == &options.ignoreEmpty()) {
           ignoreEmpty = true;
         }
+        // --merge-duplicates
+        else if (opt == &options.mergeDuplicates()) {
+          mergeDuplicates = true;
+        }
         // --border-padding
         else if (opt == &options.borderPadding()) {
           if (m_exporter)
@@ -335,6 +354,11 @@ void App::initialize(const AppOptions& options)
         else if (opt == &options.trim()) {
           trim = true;
         }
+        // --allow-rotation
+        else if (opt == &options.allowRotation()) {
+          if (m_exporter)
+            m_exporter->setAllowRotation(true);
+        }
         // --crop x,y,width,height
         else if (opt == &options.crop()) {
           std::vector<std::string> parts;
@@ -631,6 +655,9 @@ void App::initialize(const AppOptions& options)
     if (trim)
       m_exporter->setTrimCels(true);
 
+    if (mergeDuplicates)
+      m_exporter->setMergeDuplicates(true);
+
     std::unique_ptr<Document> spriteSheet(m_exporter->exportSheet());
     m_exporter.reset(NULL);
 
@@ -706,6 +733,9 @@ App::~App()
     // Remove LibreSprite handlers
     LOG("ASE: Uninstalling\n");
 
+    // Its timer must be deleted before the UI manager
+    m_imageLoadErrors.reset(nullptr);
+
     // Delete file formats.
     FileFormatsManager::destroyInstance();
 
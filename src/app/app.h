@@ -29,6 +29,7 @@ namespace app {
   class ContextBar;
   class Document;
   class DocumentExporter;
+  class ImageLoadErrors;
   class INotificationDelegate;
   class InputChain;
   class LegacyModules;
@@ -107,6 +108,7 @@ namespace app {
     FileList m_files;
     std::unique_ptr<DocumentExporter> m_exporter;
     std::unique_ptr<AppBrushes> m_brushes;
+    std::unique_ptr<ImageLoadErrors> m_imageLoadErrors;
   };
 
   void app_refresh_screen();
@@ -36,6 +36,8 @@ AppOptions::AppOptions(int argc, const char* argv[])
   , m_sheet(m_po.add("sheet").requiresValue("<filename.png>").description("Image file to save the texture"))
   , m_sheetWidth(m_po.add("sheet-width").requiresValue("<pixels>").description("Sprite sheet width"))
   , m_sheetHeight(m_po.add("sheet-height").requiresValue("<pixels>").description("Sprite sheet height"))
+  , m_sheetMaxWidth(m_po.add("sheet-max-width").requiresValue("<pixels>").description("Maximum width of each texture, frames\nthat don't fit go to other textures"))
+  , m_sheetMaxHeight(m_po.add("sheet-max-height").requiresValue("<pixels>").description("Maximum height of each texture, frames\nthat don't fit go to other textures"))
   , m_sheetType(m_po.add("sheet-type").requiresValue("<type>").description("Algorithm to create the sprite sheet:\n  horizontal\n  vertical\n  rows\n  columns\n  packed"))
   , m_sheetPack(m_po.add("sheet-pack").description("Same as --sheet-type packed"))
   , m_splitLayers(m_po.add("split-layers").description("Import each layer of the next given sprite as\na separated image in the sheet"))
@@ -44,10 +46,12 @@ AppOptions::AppOptions(int argc, const char* argv[])
   , m_frameTag(m_po.add("frame-tag").requiresValue("<name>").description("Include tagged frames in the sheet"))
   , m_frameRange(m_po.add("frame-range").requiresValue("from,to").description("Only export frames in the [from,to] range"))
   , m_ignoreEmpty(m_po.add("ignore-empty").description("Do not export empty frames/cels"))
+  , m_mergeDuplicates(m_po.add("merge-duplicates").description("Merge all duplicate frames into one in the sprite sheet"))
   , m_borderPadding(m_po.add("border-padding").requiresValue("<value>").description("Add padding on the texture borders"))
   , m_shapePadding(m_po.add("shape-padding").requiresValue("<value>").description("Add padding between frames"))
   , m_innerPadding(m_po.add("inner-padding").requiresValue("<value>").description("Add padding inside each frame"))
   , m_trim(m_po.add("trim").description("Trim all images before exporting"))
+  , m_allowRotation(m_po.add("allow-rotation").description("Rotate frames 90 degrees if they fit better\nin a packed sprite sheet (--sheet-pack)"))
   , m_crop(m_po.add("crop").requiresValue("x,y,width,height").description("Crop all the images to the given rectangle"))
   , m_filenameFormat(m_po.add("filename-format").requiresValue("<fmt>").description("Special format to generate filenames"))
   , m_script(m_po.add("script").requiresValue("<filename>").description("Execute a specific script"))
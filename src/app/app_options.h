@@ -48,6 +48,8 @@ public:
   const Option& sheet() const { return m_sheet; }
   const Option& sheetWidth() const { return m_sheetWidth; }
   const Option& sheetHeight() const { return m_sheetHeight; }
+  const Option& sheetMaxWidth() const { return m_sheetMaxWidth; }
+  const Option& sheetMaxHeight() const { return m_sheetMaxHeight; }
   const Option& sheetType() const { return m_sheetType; }
   const Option& sheetPack() const { return m_sheetPack; }
   const Option& splitLayers() const { return m_splitLayers; }
@@ -56,10 +58,12 @@ public:
   const Option& frameTag() const { return m_frameTag; }
   const Option& frameRange() const { return m_frameRange; }
   const Option& ignoreEmpty() const { return m_ignoreEmpty; }
+  const Option& mergeDuplicates() const { return m_mergeDuplicates; }
   const Option& borderPadding() const { return m_borderPadding; }
   const Option& shapePadding() const { return m_shapePadding; }
   const Option& innerPadding() const { return m_innerPadding; }
   const Option& trim() const { return m_trim; }
+  const Option& allowRotation() const { return m_allowRotation; }
   const Option& crop() const { return m_crop; }
   const Option& filenameFormat() const { return m_filenameFormat; }
   const Option& script() const { return m_script; }
@@ -90,6 +94,8 @@ private:
   Option& m_sheet;
   Option& m_sheetWidth;
   Option& m_sheetHeight;
+  Option& m_sheetMaxWidth;
+  Option& m_sheetMaxHeight;
   Option& m_sheetType;
   Option& m_sheetPack;
   Option& m_splitLayers;
@@ -98,10 +104,12 @@ private:
   Option& m_frameTag;
   Option& m_frameRange;
   Option& m_ignoreEmpty;
+  Option& m_mergeDuplicates;
   Option& m_borderPadding;
   Option& m_shapePadding;
   Option& m_innerPadding;
   Option& m_trim;
+  Option& m_allowRotation;
   Option& m_crop;
   Option& m_filenameFormat;
   Option& m_script;
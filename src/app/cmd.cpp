@@ -82,6 +82,11 @@ size_t Cmd::memSize() const
   return onMemSize();
 }
 
+void Cmd::compact(const CmdCompaction& compaction)
+{
+  onCompact(compaction);
+}
+
 void Cmd::onExecute()
 {
   // Do nothing
@@ -112,4 +117,9 @@ size_t Cmd::onMemSize() const {
   return sizeof(*this);
 }
 
+void Cmd::onCompact(const CmdCompaction& compaction)
+{
+  // Do nothing
+}
+
 } // namespace app
@@ -16,6 +16,7 @@
 
 namespace app {
   class Context;
+  struct CmdCompaction;
 
   class Cmd : public undo::UndoCommand {
   public:
@@ -32,6 +33,11 @@ namespace app {
     std::string label() const;
     size_t memSize() const;
 
+    // Reduces the memory used by the command while it's in an old
+    // undo state (see DocumentUndo). It can be called from a
+    // background thread, but never while the command is used.
+    void compact(const CmdCompaction& compaction);
+
     Context* context() const { return m_ctx; }
 
   protected:
@@ -41,6 +47,7 @@ namespace app {
     virtual void onFireNotifications();
     virtual std::string onLabel() const;
     virtual size_t onMemSize() const;
+    virtual void onCompact(const CmdCompaction& compaction);
 
   private:
     Context* m_ctx;
@@ -31,7 +31,6 @@ using namespace doc;
 AddCel::AddCel(Layer* layer, std::shared_ptr<Cel> cel)
   : WithLayer(layer)
   , WithCel(cel)
-  , m_size(0)
 {
 }
 
@@ -49,14 +48,15 @@ void AddCel::onUndo()
   auto cel = this->cel();
 
   // Save the CelData only if the cel isn't linked
+  std::ostream& os = m_stream.stream();
   bool has_data = (cel->links() == 0);
-  write8(m_stream, has_data ? 1: 0);
+  write8(os, has_data ? 1: 0);
   if (has_data) {
-    write_image(m_stream, cel->image());
-    write_celdata(m_stream, cel->data());
+    write_image(os, cel->image());
+    write_celdata(os, cel->data());
   }
-  write_cel(m_stream, cel.get());
-  m_size = size_t(m_stream.tellp());
+  write_cel(os, cel.get());
+  m_stream.updateSize();
 
   removeCel(layer, cel);
 }
@@ -66,21 +66,20 @@ void AddCel::onRedo()
   Layer* layer = this->layer();
 
   SubObjectsFromSprite io(layer->sprite());
-  bool has_data = (read8(m_stream) != 0);
+  std::istream& is = m_stream.stream();
+  bool has_data = (read8(is) != 0);
   if (has_data) {
-    ImageRef image(read_image(m_stream));
+    ImageRef image(read_image(is));
     io.addImageRef(image);
 
-    CelDataRef celdata(read_celdata(m_stream, &io));
+    CelDataRef celdata(read_celdata(is, &io));
     io.addCelDataRef(celdata);
   }
 
-  std::shared_ptr<Cel> cel{read_cel(m_stream, &io)};
+  std::shared_ptr<Cel> cel{read_cel(is, &io)};
   addCel(layer, cel);
 
-  m_stream.str(std::string());
   m_stream.clear();
-  m_size = 0;
 }
 
 void AddCel::addCel(Layer* layer, std::shared_ptr<Cel> cel)
@@ -8,11 +8,10 @@
 #pragma once
 
 #include "app/cmd.h"
+#include "app/cmd_stream.h"
 #include "app/cmd/with_cel.h"
 #include "app/cmd/with_layer.h"
 
-#include <sstream>
-
 namespace doc {
   class Cel;
   class Layer;
@@ -33,15 +32,17 @@ namespace cmd {
     void onUndo() override;
     void onRedo() override;
     size_t onMemSize() const override {
-      return sizeof(*this) + m_size;
+      return sizeof(*this) + m_stream.memSize();
+    }
+    void onCompact(const CmdCompaction& compaction) override {
+      m_stream.compact(compaction);
     }
 
   private:
     void addCel(Layer* layer, std::shared_ptr<Cel> cel);
     void removeCel(Layer* layer, std::shared_ptr<Cel> cel);
 
-    size_t m_size;
-    std::stringstream m_stream;
+    CmdStream m_stream;
   };
 
 } // namespace cmd
@@ -34,6 +34,10 @@ namespace cmd {
       return sizeof(*this) +
         (m_addCel ? m_addCel->memSize() : 0);
     }
+    void onCompact(const CmdCompaction& compaction) override {
+      if (m_addCel)
+        m_addCel->compact(compaction);
+    }
 
   private:
     void moveFrames(Layer* layer, frame_t fromThis, frame_t delta);
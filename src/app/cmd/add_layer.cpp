@@ -26,7 +26,6 @@ AddLayer::AddLayer(Layer* folder, Layer* newLayer, Layer* afterThis)
   : m_folder(folder)
   , m_newLayer(newLayer)
   , m_afterThis(afterThis)
-  , m_size(0)
 {
 }
 
@@ -44,8 +43,8 @@ void AddLayer::onUndo()
   Layer* folder = m_folder.layer();
   Layer* layer = m_newLayer.layer();
 
-  write_layer(m_stream, layer);
-  m_size = size_t(m_stream.tellp());
+  write_layer(m_stream.stream(), layer);
+  m_stream.updateSize();
 
   removeLayer(folder, layer);
 }
@@ -54,14 +53,12 @@ void AddLayer::onRedo()
 {
   Layer* folder = m_folder.layer();
   SubObjectsFromSprite io(folder->sprite());
-  Layer* newLayer = read_layer(m_stream, &io);
+  Layer* newLayer = read_layer(m_stream.stream(), &io);
   Layer* afterThis = m_afterThis.layer();
 
   addLayer(folder, newLayer, afterThis);
 
-  m_stream.str(std::string());
   m_stream.clear();
-  m_size = 0;
 }
 
 void AddLayer::addLayer(Layer* folder, Layer* newLayer, Layer* afterThis)
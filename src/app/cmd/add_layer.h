@@ -8,10 +8,9 @@
 #pragma once
 
 #include "app/cmd.h"
+#include "app/cmd_stream.h"
 #include "app/cmd/with_layer.h"
 
-#include <sstream>
-
 namespace doc {
   class Layer;
 }
@@ -29,7 +28,10 @@ namespace cmd {
     void onUndo() override;
     void onRedo() override;
     size_t onMemSize() const override {
-      return sizeof(*this) + m_size;
+      return sizeof(*this) + m_stream.memSize();
+    }
+    void onCompact(const CmdCompaction& compaction) override {
+      m_stream.compact(compaction);
     }
 
   private:
@@ -39,8 +41,7 @@ namespace cmd {
     WithLayer m_folder;
     WithLayer m_newLayer;
     WithLayer m_afterThis;
-    size_t m_size;
-    std::stringstream m_stream;
+    CmdStream m_stream;
   };
 
 } // namespace cmd
@@ -27,6 +27,9 @@ namespace cmd {
     size_t onMemSize() const override {
       return sizeof(*this) + m_seq.memSize();
     }
+    void onCompact(const CmdCompaction& compaction) override {
+      m_seq.compact(compaction);
+    }
 
   private:
     CmdSequence m_seq;
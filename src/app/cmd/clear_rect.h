@@ -35,6 +35,9 @@ namespace cmd {
       return sizeof(*this) + m_seq.memSize() +
         (m_copy ? m_copy->getMemSize(): 0);
     }
+    void onCompact(const CmdCompaction& compaction) override {
+      m_seq.compact(compaction);
+    }
 
   private:
     void clear();
@@ -23,7 +23,6 @@ CopyRegion::CopyRegion(Image* dst, const Image* src,
                        const gfx::Point& dstPos,
                        bool alreadyCopied)
   : WithImage(dst)
-  , m_size(0)
   , m_alreadyCopied(alreadyCopied)
 {
   // Create region to save/swap later
@@ -40,15 +39,16 @@ CopyRegion::CopyRegion(Image* dst, const Image* src,
   }
 
   // Save region pixels
+  std::stringstream& stream = m_stream.stream();
   for (const auto& rc : m_region) {
     for (int y=0; y<rc.h; ++y) {
-      m_stream.write(
-        (const char*)src->getPixelAddress(rc.x-dstPos.x,
-                                          rc.y-dstPos.y+y),
+      stream.write(
+        (const char*)src->getConstPixelAddress(rc.x-dstPos.x,
+                                               rc.y-dstPos.y+y),
         src->getRowStrideSize(rc.w));
     }
   }
-  m_size = size_t(m_stream.tellp());
+  m_stream.updateSize();
 }
 
 void CopyRegion::onExecute()
@@ -76,22 +76,23 @@ void CopyRegion::swap()
   for (const auto& rc : m_region)
     for (int y=0; y<rc.h; ++y)
       tmp.write(
-        (const char*)image->getPixelAddress(rc.x, rc.y+y),
+        (const char*)image->getConstPixelAddress(rc.x, rc.y+y),
         image->getRowStrideSize(rc.w));
 
   // Restore m_stream into the image
-  m_stream.seekg(0, std::ios_base::beg);
+  std::stringstream& stream = m_stream.stream();
+  stream.seekg(0, std::ios_base::beg);
   for (const auto& rc : m_region) {
     for (int y=0; y<rc.h; ++y) {
-      m_stream.read(
+      stream.read(
         (char*)image->getPixelAddress(rc.x, rc.y+y),
         image->getRowStrideSize(rc.w));
     }
   }
 
-  // TODO use m_stream.swap(tmp) when clang and gcc support it
-  m_stream.str(tmp.str());
-  m_stream.clear();
+  // TODO use stream.swap(tmp) when clang and gcc support it
+  stream.str(tmp.str());
+  stream.clear();
 
   image->incrementVersion();
 }
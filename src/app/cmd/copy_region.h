@@ -8,12 +8,11 @@
 #pragma once
 
 #include "app/cmd.h"
+#include "app/cmd_stream.h"
 #include "app/cmd/with_image.h"
 #include "gfx/point.h"
 #include "gfx/region.h"
 
-#include <sstream>
-
 namespace app {
 namespace cmd {
   using namespace doc;
@@ -35,16 +34,18 @@ namespace cmd {
     void onUndo() override;
     void onRedo() override;
     size_t onMemSize() const override {
-      return sizeof(*this) + m_size;
+      return sizeof(*this) + m_stream.memSize();
+    }
+    void onCompact(const CmdCompaction& compaction) override {
+      m_stream.compact(compaction);
     }
 
   private:
     void swap();
 
-    size_t m_size;
     bool m_alreadyCopied;
     gfx::Region m_region;
-    std::stringstream m_stream;
+    CmdStream m_stream;
   };
 
 } // namespace cmd
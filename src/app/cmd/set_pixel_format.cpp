@@ -22,6 +22,7 @@
 #include "doc/document_event.h"
 #include "doc/layer.h"
 #include "doc/palette.h"
+#include "doc/rgbmap.h"
 #include "doc/sprite.h"
 #include "render/quantization.h"
 
@@ -43,11 +44,17 @@ SetPixelFormat::SetPixelFormat(Sprite* sprite,
     return;
 
   for (auto cel : sprite->uniqueCels()) {
+    // All pixels of the image are going to be mapped, so it's faster
+    // to calculate the whole table in parallel than entry by entry.
+    RgbMap* rgbmap = sprite->rgbMap(cel->frame());
+    if (newFormat == IMAGE_INDEXED)
+      rgbmap->generateAllEntries();
+
     ImageRef old_image = cel->imageRef();
     ImageRef new_image(
       render::convert_pixel_format
       (old_image.get(), NULL, newFormat, m_dithering,
-       sprite->rgbMap(cel->frame()),
+       rgbmap,
        sprite->palette(cel->frame()),
        cel->layer()->isBackground(),
        old_image->maskColor()));
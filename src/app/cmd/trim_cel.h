@@ -28,6 +28,9 @@ namespace cmd {
     size_t onMemSize() const override {
       return sizeof(*this) + m_subCmd->memSize();
     }
+    void onCompact(const CmdCompaction& compaction) override {
+      m_subCmd->compact(compaction);
+    }
 
   private:
     Cmd* m_subCmd;
@@ -56,6 +56,12 @@ size_t CmdSequence::onMemSize() const
   return size;
 }
 
+void CmdSequence::onCompact(const CmdCompaction& compaction)
+{
+  for (Cmd* cmd : m_cmds)
+    cmd->compact(compaction);
+}
+
 void CmdSequence::executeAndAdd(Cmd* cmd)
 {
   cmd->execute(context());
@@ -25,6 +25,7 @@ namespace app {
     void onUndo() override;
     void onRedo() override;
     size_t onMemSize() const override;
+    void onCompact(const CmdCompaction& compaction) override;
 
     // Helper to create a CmdSequence in the same onExecute() member
     // function.
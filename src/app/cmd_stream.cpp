@@ -0,0 +1,177 @@
+// LibreSprite
+// Copyright (C) 2026  LibreSprite contributors
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/cmd_stream.h"
+
+#include "base/exception.h"
+#include "base/file_handle.h"
+#include "base/fs.h"
+#include "base/path.h"
+#include "base/process.h"
+#include "zlib.h"
+
+namespace app {
+
+CmdSpillFile::CmdSpillFile()
+  : m_file(nullptr)
+  , m_size(0)
+{
+  static std::atomic<int> counter(0);
+
+  char buf[256];
+  std::sprintf(buf, "libresprite-undo-%u-%d.tmp",
+               unsigned(base::get_current_process_id()), ++counter);
+  m_filename = base::join_path(base::get_temp_path(), buf);
+
+  m_file = base::open_file_raw(m_filename, "w+b");
+  if (!m_file)
+    throw base::Exception("Cannot create undo file %s", m_filename.c_str());
+}
+
+CmdSpillFile::~CmdSpillFile()
+{
+  std::fclose(m_file);
+  try {
+    base::delete_file(m_filename);
+  }
+  catch (...) {
+    // Ignore errors, it's a temporary file
+  }
+}
+
+size_t CmdSpillFile::write(const uint8_t* data, size_t size)
+{
+  const size_t offset = m_size;
+  if (std::fseek(m_file, long(offset), SEEK_SET) != 0 ||
+      std::fwrite(data, 1, size, m_file) != size) {
+    throw base::Exception("Error writing undo file %s", m_filename.c_str());
+  }
+  m_size += size;
+  return offset;
+}
+
+void CmdSpillFile::read(size_t offset, uint8_t* data, size_t size)
+{
+  if (std::fseek(m_file, long(offset), SEEK_SET) != 0 ||
+      std::fread(data, 1, size, m_file) != size) {
+    throw base::Exception("Error reading undo file %s", m_filename.c_str());
+  }
+}
+
+CmdStream::CmdStream()
+  : m_state(State::Raw)
+  , m_rawSize(0)
+  , m_fileOffset(0)
+  , m_compressedSize(0)
+  , m_memSize(0)
+{
+}
+
+std::stringstream& CmdStream::stream()
+{
+  if (m_state != State::Raw)
+    restore();
+  return m_stream;
+}
+
+void CmdStream::updateSize()
+{
+  ASSERT(m_state == State::Raw);
+  m_rawSize = size_t(m_stream.tellp());
+  m_memSize = m_rawSize;
+}
+
+void CmdStream::clear()
+{
+  m_state = State::Raw;
+  m_stream.str(std::string());
+  m_stream.clear();
+  m_rawSize = 0;
+  m_compressed.clear();
+  m_compressed.shrink_to_fit();
+  m_file.reset();
+  m_memSize = 0;
+}
+
+void CmdStream::compact(const CmdCompaction& compaction)
+{
+  if (m_state == State::Discarded || m_rawSize == 0)
+    return;
+
+  if (compaction.mode == CmdCompaction::Discard) {
+    clear();
+    m_state = State::Discarded;
+    return;
+  }
+
+  if (m_state == State::Raw) {
+    const std::string raw = m_stream.str();
+    uLongf size = compressBound(uLong(raw.size()));
+    std::vector<uint8_t> compressed(size);
+    int err = compress2(&compressed[0], &size,
+                        (const Bytef*)raw.data(), uLong(raw.size()),
+                        Z_DEFAULT_COMPRESSION);
+    if (err != Z_OK)
+      throw base::Exception("ZLib error %d in compress2().", err);
+
+    compressed.resize(size);
+    compressed.shrink_to_fit();
+
+    m_compressed = std::move(compressed);
+    m_compressedSize = m_compressed.size();
+    m_stream.str(std::string());
+    m_stream.clear();
+    m_state = State::Compressed;
+    m_memSize = m_compressedSize;
+  }
+
+  if (m_state == State::Compressed &&
+      compaction.mode == CmdCompaction::Spill) {
+    ASSERT(compaction.file);
+    m_fileOffset = compaction.file->write(&m_compressed[0], m_compressedSize);
+    m_file = compaction.file;
+    m_compressed.clear();
+    m_compressed.shrink_to_fit();
+    m_state = State::Spilled;
+    m_memSize = 0;
+  }
+}
+
+void CmdStream::restore()
+{
+  ASSERT(m_state != State::Discarded);
+  if (m_state == State::Discarded)
+    throw base::Exception("Undo data was discarded");
+
+  if (m_state == State::Spilled) {
+    std::vector<uint8_t> compressed(m_compressedSize);
+    m_file->read(m_fileOffset, &compressed[0], m_compressedSize);
+    m_compressed = std::move(compressed);
+    m_file.reset();
+    m_state = State::Compressed;
+  }
+
+  std::string raw(m_rawSize, '\0');
+  uLongf size = uLongf(m_rawSize);
+  int err = uncompress((Bytef*)&raw[0], &size,
+                       &m_compressed[0], uLong(m_compressed.size()));
+  if (err != Z_OK || size != m_rawSize)
+    throw base::Exception("ZLib error %d in uncompress().", err);
+
+  m_stream.str(std::move(raw));
+  m_stream.clear();
+  m_compressed.clear();
+  m_compressed.shrink_to_fit();
+  m_state = State::Raw;
+  m_memSize = m_rawSize;
+}
+
+} // namespace app
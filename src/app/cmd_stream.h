@@ -0,0 +1,108 @@
+// LibreSprite
+// Copyright (C) 2026  LibreSprite contributors
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation.
+
+#pragma once
+
+#include "base/disable_copying.h"
+#include "base/ints.h"
+
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace app {
+
+  // Temporary file where the compressed data of old undo states is
+  // moved. The file is deleted when the last CmdStream that uses it
+  // is destroyed or restored.
+  class CmdSpillFile {
+  public:
+    // Throws a base::Exception if the file cannot be created.
+    CmdSpillFile();
+    ~CmdSpillFile();
+
+    // Appends "size" bytes at the end of the file, and returns the
+    // offset where they were written.
+    size_t write(const uint8_t* data, size_t size);
+    void read(size_t offset, uint8_t* data, size_t size);
+
+    size_t size() const { return m_size; }
+
+  private:
+    std::string m_filename;
+    FILE* m_file;
+    size_t m_size;
+
+    DISABLE_COPYING(CmdSpillFile);
+  };
+
+  typedef std::shared_ptr<CmdSpillFile> CmdSpillFilePtr;
+
+  // What to do with the data of the commands of an old undo state
+  // (see Cmd::compact()).
+  struct CmdCompaction {
+    enum Mode {
+      Compress,                 // Compress the data in memory
+      Spill,                    // Compress the data and move it to "file"
+      Discard,                  // Free the data (the command cannot be undone/redone)
+    };
+
+    Mode mode;
+    CmdSpillFilePtr file;
+
+    CmdCompaction(Mode mode, const CmdSpillFilePtr& file = CmdSpillFilePtr())
+      : mode(mode), file(file) { }
+  };
+
+  // Binary data saved by a command to undo/redo it (e.g. the pixels
+  // of an image region). The data can be compacted while the command
+  // is not used, and it's restored when stream() is called again.
+  //
+  // compact() can be called from a background thread, but never at
+  // the same time as other member functions (except memSize()).
+  class CmdStream {
+  public:
+    CmdStream();
+
+    // Returns the stream to write/read the data, restoring the data
+    // if it was compacted. Throws a base::Exception if the data
+    // cannot be restored.
+    std::stringstream& stream();
+
+    // Must be called after writing data in stream() so memSize()
+    // includes it.
+    void updateSize();
+
+    // Removes all the data.
+    void clear();
+
+    // Bytes of the data that are in memory now.
+    size_t memSize() const { return m_memSize; }
+
+    void compact(const CmdCompaction& compaction);
+
+  private:
+    enum class State { Raw, Compressed, Spilled, Discarded };
+
+    void restore();
+
+    State m_state;
+    std::stringstream m_stream;
+    size_t m_rawSize;
+    std::vector<uint8_t> m_compressed;
+    CmdSpillFilePtr m_file;
+    size_t m_fileOffset;
+    size_t m_compressedSize;
+    std::atomic<size_t> m_memSize;
+
+    DISABLE_COPYING(CmdStream);
+  };
+
+} // namespace app
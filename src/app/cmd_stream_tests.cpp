@@ -0,0 +1,76 @@
+// LibreSprite
+// Copyright (C) 2026  LibreSprite contributors
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation.
+
+#include "tests/test.h"
+
+#include "app/cmd_stream.h"
+
+#include <string>
+
+using namespace app;
+
+namespace {
+
+std::string test_data()
+{
+  std::string data;
+  for (int i=0; i<100000; ++i)
+    data.push_back(char(i % 13));
+  return data;
+}
+
+std::string read_all(CmdStream& s)
+{
+  std::stringstream& ss = s.stream();
+  ss.seekg(0, std::ios_base::beg);
+  return std::string(std::istreambuf_iterator<char>(ss),
+                     std::istreambuf_iterator<char>());
+}
+
+} // anonymous namespace
+
+TEST(CmdStream, Compress)
+{
+  const std::string data = test_data();
+  CmdStream s;
+  s.stream().write(data.data(), data.size());
+  s.updateSize();
+  EXPECT_EQ(data.size(), s.memSize());
+
+  s.compact(CmdCompaction(CmdCompaction::Compress));
+  EXPECT_LT(s.memSize(), data.size());
+
+  EXPECT_EQ(data, read_all(s));
+  EXPECT_EQ(data.size(), s.memSize());
+}
+
+TEST(CmdStream, Spill)
+{
+  const std::string data = test_data();
+  CmdSpillFilePtr file = std::make_shared<CmdSpillFile>();
+  CmdStream a, b;
+  for (CmdStream* s : { &a, &b }) {
+    s->stream().write(data.data(), data.size());
+    s->updateSize();
+    s->compact(CmdCompaction(CmdCompaction::Spill, file));
+    EXPECT_EQ(0u, s->memSize());
+  }
+  EXPECT_GT(file->size(), 0u);
+
+  EXPECT_EQ(data, read_all(b));
+  EXPECT_EQ(data, read_all(a));
+}
+
+TEST(CmdStream, Discard)
+{
+  const std::string data = test_data();
+  CmdStream s;
+  s.stream().write(data.data(), data.size());
+  s.updateSize();
+  s.compact(CmdCompaction(CmdCompaction::Discard));
+  EXPECT_EQ(0u, s.memSize());
+}
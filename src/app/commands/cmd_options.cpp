@@ -123,6 +123,16 @@ public:
       dataRecoveryPeriod()->findItemIndexByValue(
         base::convert_to<std::string>(m_pref.general.dataRecoveryPeriod())));
 
+    aseCompressionLevel()->setSelectedItemIndex(
+      aseCompressionLevel()->findItemIndexByValue(
+        base::convert_to<std::string>(m_pref.aseFormat.compressionLevel())));
+
+    if (m_pref.aseFormat.lazyLoading())
+      aseLazyLoading()->setSelected(true);
+
+    if (m_pref.sequenceFormat.compressFrames())
+      sequenceCompressFrames()->setSelected(true);
+
     if (m_pref.editor.zoomFromCenterWithWheel())
       zoomFromCenterWithWheel()->setSelected(true);
 
@@ -144,6 +154,9 @@ public:
     if (m_pref.experimental.flashLayer())
       flashLayer()->setSelected(true);
 
+    if (m_pref.experimental.cacheLowerLayers())
+      cacheLowerLayers()->setSelected(true);
+
     if (m_pref.editor.showScrollbars())
       showScrollbars()->setSelected(true);
 
@@ -240,6 +253,12 @@ public:
     m_pref.general.expandMenubarOnMouseover(expandOnMouseover);
     ui::MenuBar::setExpandOnMouseover(expandOnMouseover);
 
+    if (aseCompressionLevel()->getSelectedItemIndex() >= 0)
+      m_pref.aseFormat.compressionLevel(
+        base::convert_to<int>(aseCompressionLevel()->getValue()));
+    m_pref.aseFormat.lazyLoading(aseLazyLoading()->isSelected());
+    m_pref.sequenceFormat.compressFrames(sequenceCompressFrames()->isSelected());
+
     std::string warnings;
 
     int newPeriod = base::convert_to<int>(dataRecoveryPeriod()->getValue());
@@ -287,6 +306,7 @@ public:
     m_pref.experimental.useNativeCursor(nativeCursor()->isSelected());
     m_pref.experimental.useNativeFileDialog(nativeFileDialog()->isSelected());
     m_pref.experimental.flashLayer(flashLayer()->isSelected());
+    m_pref.experimental.cacheLowerLayers(cacheLowerLayers()->isSelected());
     ui::set_use_native_cursors(
       m_pref.experimental.useNativeCursor());
 
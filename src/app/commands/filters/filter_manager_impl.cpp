@@ -20,12 +20,15 @@
 #include "app/modules/editors.h"
 #include "app/transaction.h"
 #include "app/ui/editor/editor.h"
+#include "base/chrono.h"
+#include "base/thread_pool.h"
 #include "doc/algorithm/shrink_bounds.h"
 #include "doc/cel.h"
 #include "doc/image.h"
 #include "doc/images_collector.h"
 #include "doc/layer.h"
 #include "doc/mask.h"
+#include "doc/rgbmap.h"
 #include "doc/site.h"
 #include "doc/sprite.h"
 #include "filters/filter.h"
@@ -33,15 +36,89 @@
 #include "ui/view.h"
 #include "ui/widget.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cstdlib>
 #include <cstring>
 #include <set>
+#include <thread>
 
 namespace app {
 
 using namespace std;
 using namespace ui;
 
+// Time to filter rows of the preview in each applyPreviewStep(), so
+// the UI can process the messages (e.g. a slider being dragged)
+// between steps.
+static const double kPreviewStepSecs = 0.015;
+
+// Row cursor used by each thread in applyInParallel() and
+// applyPreviewRows(). It filters one row at a time like
+// FilterManagerImpl::applyStep(), but with its own row and mask
+// iterator. The rest of the data is shared (read-only) with the
+// FilterManagerImpl.
+class FilterManagerImpl::RowCursor : public FilterManager
+                                   , public FilterIndexedData {
+public:
+  RowCursor(FilterManagerImpl* filterMgr, Palette* palette, RgbMap* rgbmap)
+    : m_filterMgr(filterMgr)
+    , m_palette(palette)
+    , m_rgbmap(rgbmap)
+    , m_row(0) {
+  }
+
+  // Returns false if the row is outside the mask (so the next rows
+  // are outside too).
+  bool applyRow(int row) {
+    m_row = row;
+    if (!m_filterMgr->lockMaskRow(m_row, m_maskBits, m_maskIterator))
+      return false;
+
+    m_filterMgr->applyFilter(this);
+    return true;
+  }
+
+  // FilterManager implementation
+  const void* getSourceAddress() override {
+    return m_filterMgr->m_src->getConstPixelAddress(x(), y());
+  }
+
+  void* getDestinationAddress() override {
+    return m_filterMgr->m_dst->getPixelAddress(x(), y());
+  }
+
+  int getWidth() override { return m_filterMgr->m_bounds.w; }
+  Target getTarget() override { return m_filterMgr->m_target; }
+  FilterIndexedData* getIndexedData() override { return this; }
+
+  bool skipPixel() override {
+    const Mask* mask = m_filterMgr->m_mask;
+    if (!mask || !mask->bitmap())
+      return false;
+
+    bool skip = !*m_maskIterator;
+    ++m_maskIterator;
+    return skip;
+  }
+
+  const Image* getSourceImage() override { return m_filterMgr->m_src.get(); }
+  int x() override { return m_filterMgr->m_bounds.x; }
+  int y() override { return m_filterMgr->m_bounds.y+m_row; }
+
+  // FilterIndexedData implementation
+  Palette* getPalette() override { return m_palette; }
+  RgbMap* getRgbMap() override { return m_rgbmap; }
+
+private:
+  FilterManagerImpl* m_filterMgr;
+  Palette* m_palette;
+  RgbMap* m_rgbmap;
+  int m_row;
+  ImageBits<BitmapTraits> m_maskBits;
+  ImageBits<BitmapTraits>::const_iterator m_maskIterator;
+};
+
 FilterManagerImpl::FilterManagerImpl(Context* context, Filter* filter)
   : m_context(context)
   , m_site(context->activeSite())
@@ -51,6 +128,9 @@ FilterManagerImpl::FilterManagerImpl(Context* context, Filter* filter)
   , m_dst(nullptr)
   , m_mask(nullptr)
   , m_previewMask(nullptr)
+  , m_previewPos(0)
+  , m_dirtyRow1(0)
+  , m_dirtyRow2(-1)
   , m_progressDelegate(NULL)
 {
   m_row = 0;
@@ -114,8 +194,15 @@ void FilterManagerImpl::beginForPreview()
   m_row = 0;
   m_mask = m_previewMask.get();
 
+  // Stale rows of a previous preview (e.g. with other filter
+  // parameters) aren't filtered anymore.
+  m_previewRows.clear();
+  m_previewPos = 0;
+  m_dirtyRow1 = 0;
+  m_dirtyRow2 = -1;
+
+  Editor* editor = current_editor;
   {
-    Editor* editor = current_editor;
     Sprite* sprite = m_site.sprite();
     gfx::Rect vp = View::getView(editor)->viewportBounds();
     vp = editor->screenToEditor(vp);
@@ -135,6 +222,26 @@ void FilterManagerImpl::beginForPreview()
     m_row = -1;
     return;
   }
+
+  // When the editor is zoomed out, only one of each "step" rows is
+  // displayed (see composite_image_scale_down()), so those rows are
+  // filtered first (a preview with the final result at the current
+  // zoom level), and then the rest of rows.
+  const int step = std::max(1, editor->zoom().remove(1));
+  m_previewRows.reserve(m_bounds.h);
+  for (int pass=0; pass<(step > 1 ? 2: 1); ++pass) {
+    for (int row=0; row<m_bounds.h; ++row) {
+      const bool displayed = ((m_bounds.y+row) % step == 0);
+      if (displayed == (pass == 0))
+        m_previewRows.push_back(row);
+    }
+  }
+
+  // Each band of the destination image is copied from the source
+  // image the first time it's modified (copy-on-write), which cannot
+  // be done from several threads at the same time, so the preview
+  // bands are copied here.
+  m_dst->unshareRows(m_bounds.y, m_bounds.y2());
 }
 
 void FilterManagerImpl::end()
@@ -147,42 +254,93 @@ bool FilterManagerImpl::applyStep()
   if (m_row < 0 || m_row >= m_bounds.h)
     return false;
 
-  if (m_mask && m_mask->bitmap()) {
-    int x = m_bounds.x - m_mask->bounds().x;
-    int y = m_bounds.y - m_mask->bounds().y + m_row;
-    if ((x >= m_bounds.w) ||
-        (y >= m_bounds.h))
-      return false;
+  if (!lockMaskRow(m_row, m_maskBits, m_maskIterator))
+    return false;
 
-    m_maskBits = m_mask->bitmap()
-      ->lockBits<BitmapTraits>(Image::ReadLock,
-        gfx::Rect(x, y, m_bounds.w - x, m_bounds.h - y));
+  applyFilter(this);
+  ++m_row;
 
-    m_maskIterator = m_maskBits.begin();
-  }
+  return true;
+}
 
-  switch (m_site.sprite()->pixelFormat()) {
-    case IMAGE_RGB:       m_filter->applyToRgba(this); break;
-    case IMAGE_GRAYSCALE: m_filter->applyToGrayscale(this); break;
-    case IMAGE_INDEXED:   m_filter->applyToIndexed(this); break;
-  }
-  ++m_row;
+bool FilterManagerImpl::applyPreviewStep()
+{
+  const int size = int(m_previewRows.size());
+  if (m_previewPos >= size)
+    return false;
+
+  // The sprite RgbMap (for indexed images) cannot be used from
+  // several threads.
+  const bool parallel =
+    (m_filter->isThreadSafe() &&
+     m_site.sprite()->pixelFormat() != IMAGE_INDEXED &&
+     base::thread_pool::instance().concurrency() > 1);
+  const int batch = (parallel ? 4*base::thread_pool::instance().concurrency(): 1);
+
+  base::Chrono chrono;
+  do {
+    applyPreviewRows(std::min(batch, size-m_previewPos), parallel);
+  } while (m_previewPos < size && chrono.elapsed() < kPreviewStepSecs);
 
   return true;
 }
 
+// Filters the next "n" rows of the preview. The destination bands
+// were already copied in beginForPreview(), so any row can be
+// filtered from any thread.
+void FilterManagerImpl::applyPreviewRows(int n, bool parallel)
+{
+  const int* rows = &m_previewRows[m_previewPos];
+  Palette* palette = getPalette();
+
+  if (parallel) {
+    base::thread_pool::instance().parallel_for(
+      n,
+      [this, rows, palette](int i){
+        RowCursor cursor(this, palette, nullptr);
+        cursor.applyRow(rows[i]);
+      });
+  }
+  else {
+    RowCursor cursor(this, palette, getRgbMap());
+    for (int i=0; i<n; ++i)
+      cursor.applyRow(rows[i]);
+  }
+
+  auto minmax = std::minmax_element(rows, rows+n);
+  if (m_dirtyRow1 > m_dirtyRow2) {
+    m_dirtyRow1 = *minmax.first;
+    m_dirtyRow2 = *minmax.second;
+  }
+  else {
+    m_dirtyRow1 = std::min(m_dirtyRow1, *minmax.first);
+    m_dirtyRow2 = std::max(m_dirtyRow2, *minmax.second);
+  }
+  m_previewPos += n;
+}
+
 void FilterManagerImpl::apply(Transaction& transaction)
 {
   bool cancelled = false;
 
   begin();
-  while (!cancelled && applyStep()) {
-    if (m_progressDelegate) {
-      // Report progress.
-      m_progressDelegate->reportProgress(m_progressBase + m_progressWidth * (m_row+1) / m_bounds.h);
 
-      // Does the user cancelled the whole process?
-      cancelled = m_progressDelegate->isCancelled();
+  // Filters that support it are applied using all cores when there
+  // are at least two bands of rows.
+  if (m_filter->isThreadSafe() &&
+      m_bounds.h > kImageBandHeight &&
+      base::thread_pool::instance().concurrency() > 1) {
+    cancelled = !applyInParallel();
+  }
+  else {
+    while (!cancelled && applyStep()) {
+      if (m_progressDelegate) {
+        // Report progress.
+        m_progressDelegate->reportProgress(m_progressBase + m_progressWidth * (m_row+1) / m_bounds.h);
+
+        // Does the user cancelled the whole process?
+        cancelled = m_progressDelegate->isCancelled();
+      }
     }
   }
 
@@ -200,6 +358,86 @@ void FilterManagerImpl::apply(Transaction& transaction)
   }
 }
 
+// Applies the filter to all rows in parallel. Each task filters the
+// rows of one band of the destination image (see
+// doc::kImageBandHeight), so each shared band is copied by one thread
+// only. Returns false if the user cancelled the process.
+bool FilterManagerImpl::applyInParallel()
+{
+  // Sprite::rgbMap() cannot be called from several threads, so the
+  // cursors share the RgbMap of the frame with all its entries
+  // already calculated (which makes RgbMap::mapColor() thread-safe).
+  Palette* palette = getPalette();
+  RgbMap* rgbmap = nullptr;
+  if (m_site.sprite()->pixelFormat() == IMAGE_INDEXED) {
+    rgbmap = getRgbMap();
+    rgbmap->generateAllEntries();
+  }
+
+  const std::thread::id mainThread = std::this_thread::get_id();
+  const int firstBand = m_bounds.y / kImageBandHeight;
+  const int nbands = (m_bounds.y2()-1) / kImageBandHeight - firstBand + 1;
+  std::atomic<int> rows(0);
+  std::atomic<bool> cancelled(false);
+
+  base::thread_pool::instance().parallel_for(
+    nbands,
+    [&](int i){
+      const int y1 = std::max(m_bounds.y, (firstBand+i)*kImageBandHeight);
+      const int y2 = std::min(m_bounds.y2(), (firstBand+i+1)*kImageBandHeight);
+      RowCursor cursor(this, palette, rgbmap);
+
+      for (int y=y1; y<y2 && !cancelled; ++y) {
+        if (!cursor.applyRow(y - m_bounds.y))
+          break;
+
+        ++rows;
+
+        // The progress delegate is used from this thread only.
+        if (m_progressDelegate && std::this_thread::get_id() == mainThread) {
+          m_progressDelegate->reportProgress(m_progressBase + m_progressWidth * rows / m_bounds.h);
+          if (m_progressDelegate->isCancelled())
+            cancelled = true;
+        }
+      }
+    });
+
+  return !cancelled;
+}
+
+void FilterManagerImpl::applyFilter(FilterManager* filterMgr)
+{
+  switch (m_site.sprite()->pixelFormat()) {
+    case IMAGE_RGB:       m_filter->applyToRgba(filterMgr); break;
+    case IMAGE_GRAYSCALE: m_filter->applyToGrayscale(filterMgr); break;
+    case IMAGE_INDEXED:   m_filter->applyToIndexed(filterMgr); break;
+  }
+}
+
+// Prepares the iterator to get the mask bits of the given row in
+// skipPixel(). Returns false if the row is outside the mask.
+bool FilterManagerImpl::lockMaskRow(int row,
+                                    ImageBits<BitmapTraits>& bits,
+                                    ImageBits<BitmapTraits>::const_iterator& it) const
+{
+  if (m_mask && m_mask->bitmap()) {
+    int x = m_bounds.x - m_mask->bounds().x;
+    int y = m_bounds.y - m_mask->bounds().y + row;
+    if ((x >= m_bounds.w) ||
+        (y >= m_bounds.h))
+      return false;
+
+    bits = m_mask->bitmap()
+      ->lockBits<BitmapTraits>(Image::ReadLock,
+        gfx::Rect(x, y, m_bounds.w - x, m_bounds.h - y));
+
+    // A const iterator doesn't unshare the bands of the bitmap, so
+    // several threads can read it.
+    it = static_cast<const ImageBits<BitmapTraits>&>(bits).begin();
+  }
+  return true;
+}
+
 void FilterManagerImpl::applyToTarget()
 {
   bool cancelled = false;
@@ -248,17 +486,28 @@ void FilterManagerImpl::applyToTarget()
 
 void FilterManagerImpl::flush()
 {
-  if (m_row >= 0) {
+  if (m_dirtyRow1 <= m_dirtyRow2) {
     Editor* editor = current_editor;
-    gfx::Rect rect(
-      editor->editorToScreen(
-        gfx::Point(
-          m_bounds.x,
-          m_bounds.y+m_row-1)),
-      gfx::Size(
-        editor->zoom().apply(m_bounds.w),
-        (editor->zoom().scale() >= 1 ? editor->zoom().apply(1):
-                                       editor->zoom().remove(1))));
+
+    // A zoomed out pixel is at least one pixel on the screen.
+    const int px = std::max(1, editor->zoom().apply(1));
+    const gfx::Point pt1 =
+      editor->editorToScreen(gfx::Point(m_bounds.x,
+                                        m_bounds.y+m_dirtyRow1));
+    const gfx::Point pt2 =
+      editor->editorToScreen(gfx::Point(m_bounds.x2()-1,
+                                        m_bounds.y+m_dirtyRow2));
+    gfx::Rect rect(pt1, gfx::Point(pt2.x+px, pt2.y+px));
+
+    // The pixels of the preview image aren't part of the render key
+    // of the editor back buffer, so the filtered rows must be
+    // rendered again explicitly.
+    editor->invalidateBackBuffer(
+      gfx::Region(gfx::Rect(m_bounds.x, m_bounds.y+m_dirtyRow1,
+                            m_bounds.w, m_dirtyRow2-m_dirtyRow1+1)));
+
+    m_dirtyRow1 = 0;
+    m_dirtyRow2 = -1;
 
     gfx::Region reg1(rect);
     gfx::Region reg2;
@@ -271,7 +520,7 @@ void FilterManagerImpl::flush()
 
 const void* FilterManagerImpl::getSourceAddress()
 {
-  return m_src->getPixelAddress(m_bounds.x, m_bounds.y+m_row);
+  return m_src->getConstPixelAddress(m_bounds.x, m_bounds.y+m_row);
 }
 
 void* FilterManagerImpl::getDestinationAddress()
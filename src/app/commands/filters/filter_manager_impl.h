@@ -18,6 +18,7 @@
 
 #include <cstring>
 #include <memory>
+#include <vector>
 
 namespace doc {
   class Cel;
@@ -65,6 +66,9 @@ namespace app {
 
       // Should return true if the user wants to cancel the filter.
       virtual bool isCancelled() = 0;
+
+      // Both functions are called only from the thread that called
+      // applyToTarget(), even when the filter is applied in parallel.
     };
 
     FilterManagerImpl(Context* context, Filter* filter);
@@ -81,6 +85,11 @@ namespace app {
     bool applyStep();
     void applyToTarget();
 
+    // Filters the next rows of the preview (see beginForPreview())
+    // for a few milliseconds. Returns false when all rows of the
+    // preview are already filtered.
+    bool applyPreviewStep();
+
     app::Document* document();
     doc::Sprite* sprite() { return m_site.sprite(); }
     doc::Layer* layer() { return m_site.layer(); }
@@ -88,7 +97,8 @@ namespace app {
     doc::Image* destinationImage() const { return m_dst.get(); }
     gfx::Point position() const { return gfx::Point(0, 0); }
 
-    // Updates the current editor to show the progress of the preview.
+    // Updates the current editor to show the rows of the preview
+    // filtered since the last flush().
     void flush();
 
     // FilterManager implementation
@@ -107,8 +117,16 @@ namespace app {
     doc::RgbMap* getRgbMap() override;
 
   private:
+    class RowCursor;
+
     void init(std::shared_ptr<doc::Cel> cel);
     void apply(Transaction& transaction);
+    bool applyInParallel();
+    void applyFilter(FilterManager* filterMgr);
+    void applyPreviewRows(int n, bool parallel);
+    bool lockMaskRow(int row,
+                     doc::ImageBits<doc::BitmapTraits>& bits,
+                     doc::ImageBits<doc::BitmapTraits>::const_iterator& it) const;
     void applyToCel(Transaction& transaction, std::shared_ptr<doc::Cel> cel);
     bool updateBounds(doc::Mask* mask);
 
@@ -123,7 +141,10 @@ namespace app {
     doc::Mask* m_mask;
     std::unique_ptr<doc::Mask> m_previewMask;
     doc::ImageBits<doc::BitmapTraits> m_maskBits;
-    doc::ImageBits<doc::BitmapTraits>::iterator m_maskIterator;
+    doc::ImageBits<doc::BitmapTraits>::const_iterator m_maskIterator;
+    std::vector<int> m_previewRows; // Rows to filter in the preview
+    int m_previewPos;               // Next row of m_previewRows to filter
+    int m_dirtyRow1, m_dirtyRow2;   // Rows to flush() (inclusive range)
     Target m_targetOrig;          // Original targets
     Target m_target;              // Filtered targets
 
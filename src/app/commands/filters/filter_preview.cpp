@@ -83,7 +83,7 @@ bool FilterPreview::onProcessMessage(Message* msg)
 
     case kTimerMessage:
       if (m_filterMgr) {
-        if (m_filterMgr->applyStep())
+        if (m_filterMgr->applyPreviewStep())
           m_filterMgr->flush();
         else
           m_timer.stop();
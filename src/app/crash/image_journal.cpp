@@ -0,0 +1,168 @@
+// LibreSprite
+// Copyright (C) 2026  LibreSprite contributors
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/crash/image_journal.h"
+
+#include "app/crash/internals.h"
+#include "base/exception.h"
+#include "base/serialization.h"
+#include "doc/image.h"
+#include "gfx/rect.h"
+#include "zlib.h"
+
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <string_view>
+
+namespace app {
+namespace crash {
+
+using namespace base::serialization;
+using namespace base::serialization::little_endian;
+using namespace doc;
+
+namespace {
+
+int tile_columns(const Image* image)
+{
+  return (image->width()+TILE_SIZE-1) / TILE_SIZE;
+}
+
+int tile_count(const Image* image)
+{
+  return tile_columns(image) * ((image->height()+TILE_SIZE-1) / TILE_SIZE);
+}
+
+gfx::Rect tile_bounds(const Image* image, int tile)
+{
+  const int cols = tile_columns(image);
+  return gfx::Rect((tile % cols) * TILE_SIZE,
+                   (tile / cols) * TILE_SIZE,
+                   TILE_SIZE, TILE_SIZE).createIntersection(image->bounds());
+}
+
+std::size_t tile_bytes(const Image* image, int tile)
+{
+  const gfx::Rect rc = tile_bounds(image, tile);
+  return std::size_t(image->getRowStrideSize(rc.w)) * rc.h;
+}
+
+} // anonymous namespace
+
+TileHashes hash_image_tiles(const Image* image)
+{
+  TileHashes hashes(tile_count(image));
+
+  for (int tile=0; tile<int(hashes.size()); ++tile) {
+    const gfx::Rect rc = tile_bounds(image, tile);
+    const std::size_t rowBytes = image->getRowStrideSize(rc.w);
+    std::size_t hash = 0;
+
+    for (int y=rc.y; y<rc.y2(); ++y) {
+      std::string_view row((const char*)image->getConstPixelAddress(rc.x, y), rowBytes);
+      hash = hash*31 ^ std::hash<std::string_view>()(row);
+    }
+    hashes[tile] = hash;
+  }
+
+  return hashes;
+}
+
+std::size_t write_image_tiles(std::ostream& os, const Image* image,
+                              const std::vector<int>& tiles)
+{
+  // Pixels of all tiles, one row after the other
+  std::vector<uint8_t> pixels;
+  for (int tile : tiles) {
+    const gfx::Rect rc = tile_bounds(image, tile);
+    const std::size_t rowBytes = image->getRowStrideSize(rc.w);
+
+    for (int y=rc.y; y<rc.y2(); ++y) {
+      const uint8_t* row = image->getConstPixelAddress(rc.x, y);
+      pixels.insert(pixels.end(), row, row+rowBytes);
+    }
+  }
+
+  uLongf compressedSize = compressBound(pixels.size());
+  std::vector<uint8_t> compressed(compressedSize);
+  int err = compress2(&compressed[0], &compressedSize,
+                      pixels.data(), pixels.size(),
+                      Z_DEFAULT_COMPRESSION);
+  if (err != Z_OK)
+    throw base::Exception("ZLib error %d in compress2().", err);
+
+  write32(os, tiles.size());
+  for (int tile : tiles)
+    write32(os, tile);
+  write32(os, compressedSize);
+  os.write((const char*)&compressed[0], compressedSize);
+
+  // The magic number is written at the end, so the record is ignored
+  // if it's incomplete.
+  write32(os, MAGIC_NUMBER);
+
+  if (os.fail())
+    throw base::Exception("Error writing the journal of image #%d.", image->id());
+
+  return 4*(tiles.size()+3) + compressedSize;
+}
+
+bool read_image_journal(std::istream& is, Image* image)
+{
+  const int ntiles = tile_count(image);
+
+  while (true) {
+    const int n = read32(is);
+    if (is.eof())
+      return true;              // No more records
+
+    if (n < 1 || n > ntiles)
+      return false;
+
+    std::vector<int> tiles(n);
+    std::size_t pixelsSize = 0;
+    for (int& tile : tiles) {
+      tile = read32(is);
+      if (tile < 0 || tile >= ntiles)
+        return false;
+      pixelsSize += tile_bytes(image, tile);
+    }
+
+    const uint32_t compressedSize = read32(is);
+    if (!is || compressedSize > compressBound(pixelsSize))
+      return false;
+
+    std::vector<uint8_t> compressed(compressedSize);
+    is.read((char*)compressed.data(), compressedSize);
+    if (!is || read32(is) != MAGIC_NUMBER)
+      return false;
+
+    std::vector<uint8_t> pixels(pixelsSize);
+    uLongf uncompressedSize = pixelsSize;
+    if (uncompress(pixels.data(), &uncompressedSize,
+                   compressed.data(), compressedSize) != Z_OK ||
+        uncompressedSize != pixelsSize)
+      return false;
+
+    const uint8_t* src = pixels.data();
+    for (int tile : tiles) {
+      const gfx::Rect rc = tile_bounds(image, tile);
+      const std::size_t rowBytes = image->getRowStrideSize(rc.w);
+
+      for (int y=rc.y; y<rc.y2(); ++y, src+=rowBytes)
+        std::memcpy(image->getPixelAddress(rc.x, y), src, rowBytes);
+    }
+  }
+}
+
+} // namespace crash
+} // namespace app
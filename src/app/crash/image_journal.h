@@ -0,0 +1,45 @@
+// LibreSprite
+// Copyright (C) 2026  LibreSprite contributors
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation.
+
+#pragma once
+
+#include <cstddef>
+#include <iosfwd>
+#include <vector>
+
+namespace doc {
+  class Image;
+}
+
+namespace app {
+namespace crash {
+
+  // Images are split in tiles of TILE_SIZE x TILE_SIZE pixels, so only
+  // the modified tiles are saved in the journal of the image (a file
+  // next to the full copy of the image, see write_document.cpp).
+  const int TILE_SIZE = 64;
+
+  typedef std::vector<std::size_t> TileHashes;
+
+  // Returns a hash of the pixels of each tile of the image (tiles are
+  // ordered by rows).
+  TileHashes hash_image_tiles(const doc::Image* image);
+
+  // Appends a record with the pixels of the given tiles (indexes in
+  // the vector returned by hash_image_tiles()). Returns the number of
+  // written bytes.
+  std::size_t write_image_tiles(std::ostream& os, const doc::Image* image,
+                                const std::vector<int>& tiles);
+
+  // Copies to the image the tiles of each record of the journal, from
+  // the oldest to the newest one. Returns false if a record is
+  // incomplete or invalid (e.g. the program crashed when it was
+  // written), in that case the next records are ignored.
+  bool read_image_journal(std::istream& is, doc::Image* image);
+
+} // namespace crash
+} // namespace app
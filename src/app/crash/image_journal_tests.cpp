@@ -0,0 +1,162 @@
+// LibreSprite
+// Copyright (C) 2026  LibreSprite contributors
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation.
+
+#include "tests/test.h"
+
+#include "app/context.h"
+#include "app/crash/image_journal.h"
+#include "app/crash/read_document.h"
+#include "app/crash/write_document.h"
+#include "app/document.h"
+#include "base/fs.h"
+#include "base/path.h"
+#include "doc/doc.h"
+
+#include <cstdlib>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace app;
+using namespace app::crash;
+using namespace doc;
+
+static void fill_random(Image* image, const gfx::Rect& bounds, int seed)
+{
+  std::srand(seed);
+  for (int y=bounds.y; y<bounds.y2(); ++y)
+    for (int x=bounds.x; x<bounds.x2(); ++x)
+      put_pixel(image, x, y, rgba(std::rand()%256, std::rand()%256,
+                                  std::rand()%256, 255));
+}
+
+// Returns the tiles with different hashes.
+static std::vector<int> modified_tiles(const TileHashes& a, const TileHashes& b)
+{
+  std::vector<int> tiles;
+  for (int i=0; i<int(a.size()); ++i)
+    if (a[i] != b[i])
+      tiles.push_back(i);
+  return tiles;
+}
+
+TEST(ImageJournal, RoundTrip)
+{
+  ImageRef original(Image::create(IMAGE_RGB, 3*TILE_SIZE+10, 2*TILE_SIZE+5));
+  fill_random(original.get(), original->bounds(), 1);
+
+  // Two records: the first one modifies one tile and the second one
+  // two tiles (one of them at the right/bottom edges of the image)
+  ImageRef image(Image::createCopy(original.get()));
+  std::stringstream journal;
+  TileHashes hashes = hash_image_tiles(image.get());
+
+  fill_random(image.get(), gfx::Rect(TILE_SIZE+3, 5, 7, 11), 2);
+  TileHashes hashes2 = hash_image_tiles(image.get());
+  std::vector<int> tiles = modified_tiles(hashes, hashes2);
+  ASSERT_EQ(std::vector<int>{ 1 }, tiles);
+  write_image_tiles(journal, image.get(), tiles);
+
+  fill_random(image.get(), gfx::Rect(5, TILE_SIZE+2, 3*TILE_SIZE, 3), 3);
+  TileHashes hashes3 = hash_image_tiles(image.get());
+  tiles = modified_tiles(hashes2, hashes3);
+  ASSERT_EQ((std::vector<int>{ 4, 5, 6, 7 }), tiles);
+  write_image_tiles(journal, image.get(), tiles);
+
+  ImageRef restored(Image::createCopy(original.get()));
+  EXPECT_TRUE(read_image_journal(journal, restored.get()));
+  EXPECT_EQ(0, count_diff_between_images(image.get(), restored.get()));
+}
+
+TEST(ImageJournal, TruncatedRecord)
+{
+  ImageRef original(Image::create(IMAGE_RGB, 2*TILE_SIZE, 2*TILE_SIZE));
+  fill_random(original.get(), original->bounds(), 1);
+
+  ImageRef image(Image::createCopy(original.get()));
+  std::stringstream journal;
+  fill_random(image.get(), gfx::Rect(0, 0, 4, 4), 2);
+  write_image_tiles(journal, image.get(), std::vector<int>{ 0 });
+  ImageRef firstRecord(Image::createCopy(image.get()));
+
+  fill_random(image.get(), gfx::Rect(TILE_SIZE, TILE_SIZE, 4, 4), 3);
+  write_image_tiles(journal, image.get(), std::vector<int>{ 3 });
+
+  // The program crashed before the end of the last record was written
+  const std::string data = journal.str();
+  for (std::size_t cut : { std::size_t(1), std::size_t(4), std::size_t(20) }) {
+    std::stringstream truncated(data.substr(0, data.size()-cut));
+
+    ImageRef restored(Image::createCopy(original.get()));
+    EXPECT_FALSE(read_image_journal(truncated, restored.get()));
+    EXPECT_EQ(0, count_diff_between_images(firstRecord.get(), restored.get()));
+  }
+}
+
+TEST(ImageJournal, NewFullCopy)
+{
+  const std::string dir =
+    base::join_path(base::get_temp_path(), "libresprite_journal_tests");
+  auto remove_dir = [&dir]() {
+    if (base::is_directory(dir)) {
+      for (const auto& fn : base::list_files(dir))
+        base::delete_file(base::join_path(dir, fn));
+      base::remove_directory(dir);
+    }
+  };
+  remove_dir();
+  base::make_directory(dir);
+
+  app::Context ctx;
+  std::unique_ptr<doc::Document> doc(
+    ctx.documents().add(4*TILE_SIZE, 4*TILE_SIZE, doc::ColorMode::RGB));
+  Image* image = doc->sprite()->layer(0)->cel(0)->image();
+  fill_random(image, image->bounds(), 1);
+  write_document(dir, static_cast<app::Document*>(doc.get()));
+
+  // Returns the number of full copies or journals of images
+  auto count_files = [&dir](bool journals) {
+    int n = 0;
+    for (const auto& fn : base::list_files(dir))
+      if (fn.find("img-") == 0 &&
+          (base::get_file_extension(fn) == "delta") == journals)
+        ++n;
+    return n;
+  };
+  EXPECT_EQ(1, count_files(false));
+  EXPECT_EQ(0, count_files(true));
+
+  // Small changes are saved in the journal of the full copy, until the
+  // journal is bigger than the image. Then a new full copy is saved
+  // (and the old one and its journal are deleted).
+  bool fullCopy = false;
+  for (int i=0; i<40 && !fullCopy; ++i) {
+    fill_random(image, gfx::Rect(0, 0, 2*TILE_SIZE, 2*TILE_SIZE), i+2);
+    image->incrementVersion();
+    write_document(dir, static_cast<app::Document*>(doc.get()));
+
+    EXPECT_EQ(1, count_files(false));
+    if (i == 0) {
+      EXPECT_EQ(1, count_files(true));
+    }
+    else if (count_files(true) == 0) {
+      fullCopy = true;
+    }
+
+    std::unique_ptr<app::Document> restored(read_document(dir));
+    ASSERT_TRUE(restored != nullptr);
+    EXPECT_EQ(0, count_diff_between_images(
+                image, restored->sprite()->layer(0)->cel(0)->image()));
+    restored->close();
+  }
+  EXPECT_TRUE(fullCopy);
+
+  delete_document_internals(static_cast<app::Document*>(doc.get()));
+  doc->close();
+  remove_dir();
+}
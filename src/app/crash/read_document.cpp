@@ -12,6 +12,7 @@
 #include "app/crash/read_document.h"
 
 #include "app/console.h"
+#include "app/crash/image_journal.h"
 #include "app/crash/internals.h"
 #include "app/document.h"
 #include "base/convert_to.h"
@@ -49,6 +50,15 @@ using namespace doc;
 
 namespace {
 
+// Applies the modified tiles saved after the full copy of the image.
+void readImageJournal(const std::string& imageFilename, Image* image)
+{
+  std::ifstream s(FSTREAM_PATH(imageFilename + ".delta"), std::ifstream::binary);
+  if (s && !read_image_journal(s, image)) {
+    TRACE(" - Journal of img #%d is incomplete\n", image->id());
+  }
+}
+
 class Reader : public SubObjectsIO {
 public:
   Reader(const std::string& dir)
@@ -62,6 +72,9 @@ public:
       if (i == std::string::npos)
         continue;               // Has no ID
 
+      if (base::get_file_extension(fn) == "delta")
+        continue;               // Journal of an image (see readImage())
+
       auto j = fn.find('.', ++i);
       if (j == std::string::npos)
         continue;               // Has no version
@@ -149,7 +162,9 @@ private:
       fn.push_back('.');
       fn += base::convert_to<std::string>(ver);
 
-      std::ifstream s(FSTREAM_PATH(base::join_path(m_dir, fn)), std::ifstream::binary);
+      m_objectFilename = base::join_path(m_dir, fn);
+
+      std::ifstream s(FSTREAM_PATH(m_objectFilename), std::ifstream::binary);
       T obj = nullptr;
       if (read32(s) == MAGIC_NUMBER)
         obj = (this->*readMember)(s);
@@ -319,7 +334,10 @@ private:
   }
 
   Image* readImage(std::ifstream& s) {
-    return read_image(s, false);
+    Image* image = read_image(s, false);
+    if (image)
+      readImageJournal(m_objectFilename, image);
+    return image;
   }
 
   Palette* readPalette(std::ifstream& s) {
@@ -355,6 +373,7 @@ private:
 
   Sprite* m_sprite;    // Used to pass the sprite in LayerImage() ctor
   std::string m_dir;
+  std::string m_objectFilename; // File of the object being loaded
   ObjectVersion m_docId;
   ObjVersionsMap m_objVersions;
   ObjVersions* m_docVersions;
@@ -400,7 +419,8 @@ app::Document* read_document_with_raw_images(const std::string& dir,
 
   frame_t frame = 0;
   for (const auto& fn : base::list_files(dir)) {
-    if (fn.compare(0, 3, "img") != 0)
+    if (fn.compare(0, 3, "img") != 0 ||
+        base::get_file_extension(fn) == "delta")
       continue;
 
     std::ifstream s(FSTREAM_PATH(base::join_path(dir, fn)), std::ifstream::binary);
@@ -411,6 +431,9 @@ app::Document* read_document_with_raw_images(const std::string& dir,
     if (read32(s) == MAGIC_NUMBER)
       img.reset(read_image(s, false));
 
+    if (img)
+      readImageJournal(base::join_path(dir, fn), img.get());
+
     if (img) {
         lay->addCel(std::make_shared<Cel>(frame, img));
     }
@@ -11,6 +11,7 @@
 
 #include "app/crash/write_document.h"
 
+#include "app/crash/image_journal.h"
 #include "app/crash/internals.h"
 #include "app/document.h"
 #include "base/convert_to.h"
@@ -45,14 +46,31 @@ using namespace doc;
 
 namespace {
 
+// State of the last backup of an image: a full copy of the image
+// ("img-ID.VER" file) plus the journal of modified tiles saved after
+// that copy ("img-ID.VER.delta" file).
+struct ImageBackup {
+  ObjectVersion version = 0;    // Last saved version
+  ObjectVersion base = 0;       // Version of the full copy
+  PixelFormat format = IMAGE_RGB;
+  int width = 0;
+  int height = 0;
+  TileHashes hashes;            // Tiles of the last saved version
+  std::size_t journalSize = 0;
+};
+
+typedef std::map<ObjectId, ImageBackup> ImageBackupsMap;
+
 static std::map<ObjectId, ObjVersionsMap> g_docVersions;
+static std::map<ObjectId, ImageBackupsMap> g_docImages;
 
 class Writer {
 public:
   Writer(const std::string& dir, app::Document* doc)
     : m_dir(dir)
     , m_doc(doc)
-    , m_objVersions(g_docVersions[doc->id()]) {
+    , m_objVersions(g_docVersions[doc->id()])
+    , m_images(g_docImages[doc->id()]) {
   }
 
   void saveDocument() {
@@ -68,7 +86,7 @@ public:
       saveObject("frtag", frtag, &Writer::writeFrameTag);
 
     for (auto cel : spr->uniqueCels()) {
-      saveObject("img", cel->image(), &Writer::writeImage);
+      saveImage(cel->image());
       saveObject("celdata", cel->data(), &Writer::writeCelData);
     }
 
@@ -157,6 +175,79 @@ private:
     write_frame_tag(s, frameTag);
   }
 
+  // Appends the modified tiles of the image to the journal of its
+  // last full copy. A new full copy is saved when the image size or
+  // format changes, or when the journal is bigger than the image.
+  void saveImage(Image* img) {
+    if (!img->version())
+      img->incrementVersion();
+
+    ImageBackup& backup = m_images[img->id()];
+    if (backup.version == img->version())
+      return;
+
+    // Pixels of lazy images that weren't loaded yet are not hashed
+    // (it would load them), write_image() copies their compressed
+    // data from the file.
+    TileHashes hashes;
+    if (!img->hasPendingPixels())
+      hashes = hash_image_tiles(img);
+    const std::size_t imageSize =
+      std::size_t(img->getRowStrideSize()) * img->height();
+
+    if (backup.base &&
+        backup.base == m_objVersions[img->id()].newer() &&
+        !hashes.empty() &&
+        backup.hashes.size() == hashes.size() &&
+        backup.format == img->pixelFormat() &&
+        backup.width == img->width() &&
+        backup.height == img->height() &&
+        backup.journalSize < imageSize) {
+      std::vector<int> tiles;
+      for (int i=0; i<int(hashes.size()); ++i) {
+        if (hashes[i] != backup.hashes[i])
+          tiles.push_back(i);
+      }
+
+      if (!tiles.empty()) {
+        std::string fn = objectFilename("img", img->id(), backup.base) + ".delta";
+        std::ofstream s(FSTREAM_PATH(fn), std::ofstream::binary | std::ofstream::app);
+        try {
+          backup.journalSize += write_image_tiles(s, img, tiles);
+        }
+        catch (...) {
+          // Save a full copy the next time
+          backup = ImageBackup();
+          throw;
+        }
+      }
+
+      backup.version = img->version();
+      backup.hashes = std::move(hashes);
+
+      TRACE(" - Saved %d tiles of img #%d v%d\n", int(tiles.size()), img->id(), img->version());
+      return;
+    }
+
+    saveObject("img", img, &Writer::writeImage);
+
+    backup.version = backup.base = img->version();
+    backup.format = img->pixelFormat();
+    backup.width = img->width();
+    backup.height = img->height();
+    backup.hashes = std::move(hashes);
+    backup.journalSize = 0;
+  }
+
+  std::string objectFilename(const char* prefix, ObjectId id, ObjectVersion ver) const {
+    std::string fn = prefix;
+    fn.push_back('-');
+    fn += base::convert_to<std::string>(id);
+    fn.push_back('.');
+    fn += base::convert_to<std::string>(ver);
+    return base::join_path(m_dir, fn);
+  }
+
   template<typename T>
   void saveObject(const char* prefix, T* obj, void (Writer::*writeMember)(std::ofstream&, T*)) {
     if (!obj->version())
@@ -166,13 +257,8 @@ private:
     if (versions.newer() == obj->version())
       return;
 
-    std::string fn = prefix;
-    fn.push_back('-');
-    fn += base::convert_to<std::string>(obj->id());
-
-    std::string fullfn = base::join_path(m_dir, fn);
-    std::string oldfn = fullfn + "." + base::convert_to<std::string>(versions.older());
-    fullfn += "." + base::convert_to<std::string>(obj->version());
+    std::string oldfn = objectFilename(prefix, obj->id(), versions.older());
+    std::string fullfn = objectFilename(prefix, obj->id(), obj->version());
 
     std::ofstream s(FSTREAM_PATH(fullfn), std::ofstream::binary);
     write32(s, 0);                // Leave a room for the magic number
@@ -190,6 +276,10 @@ private:
     try {
       if (versions.older() && base::is_file(oldfn))
         base::delete_file(oldfn);
+
+      // Journal of modified tiles of the older image
+      if (versions.older() && base::is_file(oldfn + ".delta"))
+        base::delete_file(oldfn + ".delta");
     }
     catch (const std::exception&) {
       TRACE(" - Cannot delete %s #%d v%d\n", prefix, obj->id(), versions.older());
@@ -204,6 +294,7 @@ private:
   std::string m_dir;
   app::Document* m_doc;
   ObjVersionsMap& m_objVersions;
+  ImageBackupsMap& m_images;
 };
 
 } // anonymous namespace
@@ -226,6 +317,8 @@ void delete_document_internals(app::Document* doc)
   // never saved by the backup process.
   if (it != g_docVersions.end())
     g_docVersions.erase(it);
+
+  g_docImages.erase(doc->id());
 }
 
 } // namespace crash
@@ -25,6 +25,7 @@
 #include "base/replace_string.h"
 #include "base/shared_ptr.h"
 #include "base/string.h"
+#include "base/thread_pool.h"
 #include "doc/algorithm/shrink_bounds.h"
 #include "doc/cel.h"
 #include "doc/dithering_method.h"
@@ -38,11 +39,21 @@
 #include "gfx/size.h"
 #include "render/render.h"
 
+#include <algorithm>
+#include <cstdint>
 #include <cstdio>
+#include <cstring>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
 #include <list>
+#include <map>
+#include <memory>
+#include <set>
+#include <string_view>
+#include <tuple>
+#include <unordered_map>
 
 using namespace doc;
 
@@ -74,6 +85,38 @@ std::ostream& operator<<(std::ostream& os, const doc::UserData& data)
   return os;
 }
 
+// Calls func(begin, end) for slices of [0, n) in parallel, so each
+// slice can reuse its own render buffers.
+void parallel_slices(int n, const std::function<void(int, int)>& func)
+{
+  if (n <= 0)
+    return;
+
+  base::thread_pool& pool = base::thread_pool::instance();
+  const int slices = std::min(n, 4*pool.concurrency());
+  pool.parallel_for(
+    slices,
+    [n, slices, &func](int i){
+      func(int(std::int64_t(n)*i/slices),
+           int(std::int64_t(n)*(i+1)/slices));
+    });
+}
+
+// Adds the page index before the extension of the texture filename
+// (e.g. "sheet.png" -> "sheet-1.png") when there are several pages.
+std::string page_filename(const std::string& filename, int page, int pages)
+{
+  if (pages <= 1)
+    return filename;
+
+  std::string ext = base::get_file_extension(filename);
+  std::string res = filename.substr(0, filename.size() - (ext.empty() ? 0: ext.size()+1));
+  res += "-" + base::convert_to<std::string>(page);
+  if (!ext.empty())
+    res += "." + ext;
+  return res;
+}
+
 } // anonymous namespace
 
 namespace app {
@@ -83,7 +126,9 @@ public:
   SampleBounds(Sprite* sprite) :
     m_originalSize(sprite->width(), sprite->height()),
     m_trimmedBounds(0, 0, sprite->width(), sprite->height()),
-    m_inTextureBounds(0, 0, sprite->width(), sprite->height()) {
+    m_inTextureBounds(0, 0, sprite->width(), sprite->height()),
+    m_rotated(false),
+    m_page(0) {
   }
 
   bool trimmed() const {
@@ -96,18 +141,97 @@ public:
   const gfx::Size& originalSize() const { return m_originalSize; }
   const gfx::Rect& trimmedBounds() const { return m_trimmedBounds; }
   const gfx::Rect& inTextureBounds() const { return m_inTextureBounds; }
+  bool rotated() const { return m_rotated; }
+  int page() const { return m_page; }
 
   void setTrimmedBounds(const gfx::Rect& bounds) { m_trimmedBounds = bounds; }
   void setInTextureBounds(const gfx::Rect& bounds) { m_inTextureBounds = bounds; }
+  void setRotated(bool rotated) { m_rotated = rotated; }
+  void setPage(int page) { m_page = page; }
 
 private:
   gfx::Size m_originalSize;
   gfx::Rect m_trimmedBounds;
   gfx::Rect m_inTextureBounds;
+  bool m_rotated;               // Rotated 90 degrees clockwise in the texture
+  int m_page;                   // Index of the texture
 };
 
 typedef base::SharedPtr<SampleBounds> SampleBoundsPtr;
 
+// Finds samples with the same rendered pixels (in their trimmed
+// bounds), so all of them can use the same region of the texture.
+class SampleImages {
+public:
+  // Returns the bounds of a previous sample with the same pixels as
+  // "image" (the rendered sample in its trimmed bounds), or nullptr if
+  // there is no one (in that case the sample is added to the table).
+  SampleBoundsPtr findOrAdd(const Sprite* sprite, frame_t frame,
+                            const SampleBoundsPtr& bounds, const ImageRef& image) {
+    const gfx::Rect& rc = bounds->trimmedBounds();
+    const std::size_t hash = hashPixels(image.get());
+
+    auto range = m_entries.equal_range(hash);
+    for (auto it=range.first; it!=range.second; ++it) {
+      const Entry& entry = it->second;
+      if (entry.bounds->trimmedBounds() == rc &&
+          entry.bounds->originalSize() == bounds->originalSize() &&
+          sameColors(entry, sprite, frame) &&
+          samePixels(entry.pixels.get(), image.get()))
+        return entry.bounds;
+    }
+
+    Entry entry;
+    entry.sprite = sprite;
+    entry.frame = frame;
+    entry.bounds = bounds;
+    entry.pixels = image;
+    m_entries.insert(std::make_pair(hash, entry));
+    return SampleBoundsPtr();
+  }
+
+private:
+  struct Entry {
+    const Sprite* sprite;
+    frame_t frame;
+    SampleBoundsPtr bounds;
+    ImageRef pixels;            // Trimmed pixels of the sample
+  };
+
+  static std::size_t hashPixels(const Image* image) {
+    const std::size_t rowBytes = image->getRowStrideSize(image->width());
+    std::size_t hash = 0;
+    for (int y=0; y<image->height(); ++y) {
+      std::string_view row((const char*)image->getConstPixelAddress(0, y), rowBytes);
+      hash = hash*31 ^ std::hash<std::string_view>()(row);
+    }
+    return hash;
+  }
+
+  static bool samePixels(const Image* pixels, const Image* image) {
+    const std::size_t rowBytes = image->getRowStrideSize(image->width());
+    for (int y=0; y<image->height(); ++y) {
+      if (std::memcmp(pixels->getConstPixelAddress(0, y),
+                      image->getConstPixelAddress(0, y), rowBytes) != 0)
+        return false;
+    }
+    return true;
+  }
+
+  // Indexed pixels are the same colors only with the same palette.
+  static bool sameColors(const Entry& entry, const Sprite* sprite, frame_t frame) {
+    if (entry.sprite->pixelFormat() != sprite->pixelFormat())
+      return false;
+    if (sprite->pixelFormat() != IMAGE_INDEXED)
+      return true;
+    return (entry.sprite->transparentColor() == sprite->transparentColor() &&
+            entry.sprite->palette(entry.frame)->countDiff(
+              sprite->palette(frame), nullptr, nullptr) == 0);
+  }
+
+  std::unordered_multimap<std::size_t, Entry> m_entries;
+};
+
 int DocumentExporter::Item::frames() const
 {
   if (frameTag) {
@@ -156,6 +280,13 @@ public:
   const gfx::Size& originalSize() const { return m_bounds->originalSize(); }
   const gfx::Rect& trimmedBounds() const { return m_bounds->trimmedBounds(); }
   const gfx::Rect& inTextureBounds() const { return m_bounds->inTextureBounds(); }
+  bool rotated() const { return m_bounds->rotated(); }
+  int page() const { return m_bounds->page(); }
+
+  // Pixels of the sample in its trimmed bounds, rendered by
+  // captureSamples() (or nullptr if it wasn't rendered there).
+  const ImageRef& image() const { return m_image; }
+  void setImage(const ImageRef& image) { m_image = image; }
 
   gfx::Size requiredSize() const {
     gfx::Size size = m_bounds->trimmedBounds().size();
@@ -170,6 +301,8 @@ public:
 
   void setTrimmedBounds(const gfx::Rect& bounds) { m_bounds->setTrimmedBounds(bounds); }
   void setInTextureBounds(const gfx::Rect& bounds) { m_bounds->setInTextureBounds(bounds); }
+  void setRotated(bool rotated) { m_bounds->setRotated(rotated); }
+  void setPage(int page) { m_bounds->setPage(page); }
 
   bool isDuplicated() const { return m_isDuplicated; }
   SampleBoundsPtr sharedBounds() const { return m_bounds; }
@@ -192,6 +325,7 @@ private:
   int m_innerPadding;
   SampleBoundsPtr m_bounds;
   bool m_isDuplicated;
+  ImageRef m_image;
 };
 
 class DocumentExporter::Samples {
@@ -399,10 +533,12 @@ private:
 class DocumentExporter::BestFitLayoutSamples :
     public DocumentExporter::LayoutSamples {
 public:
-  void layoutSamples(Samples& samples, int borderPadding, int shapePadding, int& width, int& height) override {
-    gfx::PackingRects pr;
+  BestFitLayoutSamples(bool allowRotation)
+    : m_allowRotation(allowRotation) {
+  }
 
-    // TODO Add support for shape paddings
+  void layoutSamples(Samples& samples, int borderPadding, int shapePadding, int& width, int& height) override {
+    gfx::PackingRects pr(shapePadding, m_allowRotation);
 
     for (auto& sample : samples) {
       if (sample.isDuplicated())
@@ -413,22 +549,44 @@ public:
 
     if (width == 0 || height == 0) {
       gfx::Size sz = pr.bestFit();
-      width = sz.w;
-      height = sz.h;
+      width = sz.w + 2*borderPadding;
+      height = sz.h + 2*borderPadding;
     }
     else
-      pr.pack(gfx::Size(width, height));
+      pr.packPartially(gfx::Size(width - 2*borderPadding,
+                                 height - 2*borderPadding));
 
     auto it = samples.begin();
-    for (auto& rc : pr) {
-      if (it->isDuplicated())
-        continue;
+    for (int i=0; i<int(pr.size()); ++i) {
+      while (it != samples.end() && it->isDuplicated())
+        ++it;
 
       ASSERT(it != samples.end());
-      it->setInTextureBounds(rc);
+      gfx::Rect rc = pr[i];
+      rc.offset(borderPadding, borderPadding);
+
+      // Samples that don't fit in the texture have empty bounds
+      it->setInTextureBounds(pr.isPacked(i) ? rc: gfx::Rect());
+      it->setRotated(pr.isRotated(i));
       ++it;
     }
   }
+
+private:
+  bool m_allowRotation;
+};
+
+// One of the textures of the sprite sheet.
+class DocumentExporter::Page {
+public:
+  Samples samples;
+  // Fixed size of the texture, or 0 to use the bounds of the samples
+  int width = 0;
+  int height = 0;
+  std::string filename;
+  std::unique_ptr<Document> document;
+  Image* image = nullptr;
+  std::unique_ptr<FileOp> fop;
 };
 
 DocumentExporter::DocumentExporter()
@@ -436,6 +594,8 @@ DocumentExporter::DocumentExporter()
  , m_textureFormat(DefaultTextureFormat)
  , m_textureWidth(0)
  , m_textureHeight(0)
+ , m_maxTextureWidth(0)
+ , m_maxTextureHeight(0)
  , m_sheetType(SpriteSheetType::None)
  , m_scale(1.0)
  , m_scaleMode(DefaultScaleMode)
@@ -445,6 +605,8 @@ DocumentExporter::DocumentExporter()
  , m_shapePadding(0)
  , m_innerPadding(0)
  , m_trimCels(false)
+ , m_mergeDuplicates(false)
+ , m_allowRotation(false)
  , m_listFrameTags(false)
  , m_listLayers(false)
 {
@@ -476,59 +638,101 @@ Document* DocumentExporter::exportSheet()
     return nullptr;
   }
 
-  // 2) Layout those samples in a texture field.
-  switch (m_sheetType) {
-    case SpriteSheetType::Packed: {
-      BestFitLayoutSamples layout;
-      layout.layoutSamples(
-        samples, m_borderPadding, m_shapePadding,
-        m_textureWidth, m_textureHeight);
-      break;
-    }
-    default: {
-      if(m_perTag){
-        PerTagLayoutSamples layout(m_sheetType);
-        layout.layoutSamples(
-          samples, m_borderPadding, m_shapePadding,
-          m_textureWidth, m_textureHeight);
-      }
-      else{
-        SimpleLayoutSamples layout(m_sheetType);
-        layout.layoutSamples(
-          samples, m_borderPadding, m_shapePadding,
-          m_textureWidth, m_textureHeight);
-      }
-      break;
+  // 2) Layout those samples in a texture field (or in several
+  // textures if they don't fit in the maximum texture size).
+  Pages pages;
+  layoutPages(samples, pages);
+
+  // 3) Create and render the textures. All of them use the same
+  // pixel format, so the sprites are converted (if needed) before
+  // rendering the pages in parallel.
+  Palette* palette = nullptr;
+  const PixelFormat pixelFormat = calculateTextureFormat(samples, palette);
+
+  for (const auto& sample : samples) {
+    // Make the sprite compatible with the texture so the render()
+    // works correctly.
+    if (sample.sprite()->pixelFormat() != pixelFormat) {
+      cmd::SetPixelFormat(
+        sample.sprite(),
+        pixelFormat,
+        DitheringMethod::NONE).execute(UIContext::instance());
     }
   }
 
-  // 3) Create and render the texture.
-  std::unique_ptr<Document> textureDocument(
-    createEmptyTexture(samples));
-
-  Sprite* texture = textureDocument->sprite();
-  Image* textureImage = texture->folder()->getFirstLayer()
-    ->cel(frame_t(0))->image();
+  for (int i=0; i<int(pages.size()); ++i) {
+    Page& page = pages[i];
+    page.document.reset(
+      createEmptyTexture(page.samples, page.width, page.height,
+                         pixelFormat, palette));
+    page.image = page.document->sprite()->folder()->getFirstLayer()
+      ->cel(frame_t(0))->image();
+    page.filename = page_filename(m_textureFilename, i, int(pages.size()));
+  }
 
-  renderTexture(samples, textureImage);
+  base::thread_pool::instance().parallel_for(
+    int(pages.size()),
+    [this, &pages](int i){
+      renderTexture(pages[i].samples, pages[i].image);
+    });
 
   // Save the metadata.
   if (osbuf)
-    createDataFile(samples, os, textureImage);
+    createDataFile(samples, os, pages);
 
-  // Save the image files.
+  // Save the image files. The FileOps are created in this thread (as
+  // they can ask something to the user), and the textures are encoded
+  // in parallel.
   if (!m_textureFilename.empty()) {
-    textureDocument->setFilename(m_textureFilename.c_str());
-    int ret = save_document(UIContext::instance(), textureDocument.get());
-    if (ret == 0)
-      textureDocument->markAsSaved();
+    for (auto& page : pages) {
+      page.document->setFilename(page.filename.c_str());
+      page.fop.reset(
+        FileOp::createSaveDocumentOperation(
+          UIContext::instance(), page.document.get(),
+          page.filename.c_str(), ""));
+    }
+
+    base::thread_pool::instance().parallel_for(
+      int(pages.size()),
+      [&pages](int i){
+        if (pages[i].fop)
+          pages[i].fop->operate();
+      });
+
+    for (auto& page : pages) {
+      if (!page.fop)
+        continue;
+
+      page.fop->done();
+      if (page.fop->hasError()) {
+        Console console;
+        console.printf(page.fop->error().c_str());
+      }
+      else
+        page.document->markAsSaved();
+    }
   }
 
-  return textureDocument.release();
+  return pages.front().document.release();
 }
 
 void DocumentExporter::captureSamples(Samples& samples)
 {
+  // A sprite+frame pair that can be a sample of the sheet
+  struct Capture {
+    Sample sample;
+    bool emptyCel = false;      // Image layer without cel in this frame
+    bool linked = false;        // Can re-use the bounds of a previous sample
+    bool rendered = false;
+    bool empty = false;         // Nothing to export (see renderCapturedSample())
+    ImageRef image;
+    Capture(const Sample& sample) : sample(sample) { }
+  };
+  std::vector<Capture> captures;
+
+  // Samples already captured, to detect linked cels
+  std::set<std::tuple<const Sprite*, const Layer*, frame_t>> capturedKeys;
+
   for (auto& item : m_documents) {
     Document* doc = item.doc;
     Sprite* sprite = doc->sprite();
@@ -567,10 +771,9 @@ void DocumentExporter::captureSamples(Samples& samples)
 
       std::string filename = filename_formatter(format, fnInfo);
 
-      Sample sample(doc, sprite, layer, frame, filename, m_innerPadding);
+      Capture capture(Sample(doc, sprite, layer, frame, filename, m_innerPadding));
       std::shared_ptr<Cel> cel;
       std::shared_ptr<Cel> link;
-      bool done = false;
 
       if (layer && layer->isImage())
         cel = layer->cel(frame);
@@ -578,108 +781,326 @@ void DocumentExporter::captureSamples(Samples& samples)
       if (cel)
         link = cel->link();
 
-      // Re-use linked samples
-      if (link) {
-        for (const Sample& other : samples) {
-          if (other.sprite() == sprite &&
-              other.layer() == layer &&
-              other.frame() == link->frame()) {
-            ASSERT(!other.isDuplicated());
+      capture.emptyCel = (layer && layer->isImage() && !cel);
+      capture.linked = (link &&
+                        capturedKeys.find(std::make_tuple(sprite, layer, link->frame()))
+                        != capturedKeys.end());
 
-            sample.setSharedBounds(other.sharedBounds());
-            done = true;
-            break;
-          }
+      capturedKeys.insert(std::make_tuple(sprite, layer, frame));
+      captures.push_back(capture);
+    }
+  }
+
+  // Render the samples in parallel to trim them and find duplicates.
+  const bool renderSamples = (m_ignoreEmptyCels || m_trimCels || m_mergeDuplicates);
+  if (renderSamples) {
+    parallel_slices(
+      int(captures.size()),
+      [this, &captures](int begin, int end){
+        render::Render render;
+        ImageBufferPtr buffer(new ImageBuffer);
+
+        for (int i=begin; i<end; ++i) {
+          Capture& capture = captures[i];
+          if (capture.linked)
+            continue;
+
+          capture.empty = !renderCapturedSample(
+            render, capture.sample, capture.emptyCel, buffer, capture.image);
+          capture.rendered = true;
         }
-        // "done" variable can be false here, e.g. when we export a
-        // frame tag and the first linked cel is outside the tag range.
-        ASSERT(done || (!done && frameTag));
+      });
+  }
+
+  // Bounds of each captured sample, to re-use them in linked cels
+  std::map<std::tuple<const Sprite*, const Layer*, frame_t>, SampleBoundsPtr> capturedBounds;
+  SampleImages sampleImages;
+
+  for (auto& capture : captures) {
+    Sample& sample = capture.sample;
+    Sprite* sprite = sample.sprite();
+    Layer* layer = sample.layer();
+    const frame_t frame = sample.frame();
+
+    // Re-use linked samples
+    if (capture.linked) {
+      std::shared_ptr<Cel> link = layer->cel(frame)->link();
+      auto it = capturedBounds.find(std::make_tuple(sprite, layer, link->frame()));
+      if (it != capturedBounds.end()) {
+        sample.setSharedBounds(it->second);
+        capturedBounds[std::make_tuple(sprite, layer, frame)] = sample.sharedBounds();
+        samples.addSample(sample);
+        continue;
       }
 
-      if (!done && (m_ignoreEmptyCels || m_trimCels)) {
-        // Ignore empty cels
-        if (layer && layer->isImage() && !cel)
-          continue;
+      // The linked sample was ignored (e.g. it's empty), so we have
+      // to render this one.
+      if (renderSamples) {
+        render::Render render;
+        capture.empty = !renderCapturedSample(
+          render, sample, capture.emptyCel, ImageBufferPtr(), capture.image);
+        capture.rendered = true;
+      }
+    }
 
-        std::unique_ptr<Image> sampleRender(
-          Image::create(sprite->pixelFormat(),
-            sprite->width(),
-            sprite->height(),
-            m_sampleRenderBuf));
-
-        sampleRender->setMaskColor(sprite->transparentColor());
-        clear_image(sampleRender.get(), sprite->transparentColor());
-        renderSample(sample, sampleRender.get(), 0, 0);
-
-        gfx::Rect frameBounds;
-        doc::color_t refColor = 0;
-
-        if (m_trimCels) {
-          if ((layer &&
-               layer->isBackground()) ||
-              (!layer &&
-               sprite->backgroundLayer() &&
-               sprite->backgroundLayer()->isVisible())) {
-            refColor = get_pixel(sampleRender.get(), 0, 0);
-          }
-          else {
-            refColor = sprite->transparentColor();
-          }
-        }
-        else if (m_ignoreEmptyCels)
-          refColor = sprite->transparentColor();
+    if (capture.empty)
+      continue;
 
-        if (!algorithm::shrink_bounds(sampleRender.get(), frameBounds, refColor)) {
-          // If shrink_bounds() returns false, it's because the whole
-          // image is transparent (equal to the mask color).
-          continue;
-        }
+    if (capture.rendered) {
+      // Samples with the same pixels (from any layer, tag, or
+      // document) use the same region of the texture
+      if (m_mergeDuplicates) {
+        SampleBoundsPtr bounds =
+          sampleImages.findOrAdd(sprite, frame, sample.sharedBounds(),
+                                 capture.image);
+        if (bounds)
+          sample.setSharedBounds(bounds);
+      }
+
+      // The rendered pixels are re-used to create the texture
+      if (!sample.isDuplicated())
+        sample.setImage(capture.image);
+      capture.image.reset();
+    }
 
-        if (m_trimCels)
-          sample.setTrimmedBounds(frameBounds);
+    capturedBounds[std::make_tuple(sprite, layer, frame)] = sample.sharedBounds();
+    samples.addSample(sample);
+  }
+}
+
+// Renders the whole sample to calculate its trimmed bounds. Returns
+// false if the sample must be ignored (it's empty), or true and its
+// pixels in the trimmed bounds in "image".
+bool DocumentExporter::renderCapturedSample(render::Render& render,
+                                            Sample& sample, bool emptyCel,
+                                            const ImageBufferPtr& buffer,
+                                            ImageRef& image)
+{
+  Sprite* sprite = sample.sprite();
+  Layer* layer = sample.layer();
+
+  // Ignore empty cels
+  if ((m_ignoreEmptyCels || m_trimCels) && emptyCel)
+    return false;
+
+  std::unique_ptr<Image> sampleRender(
+    Image::create(sprite->pixelFormat(),
+      sprite->width(),
+      sprite->height(),
+      buffer));
+
+  sampleRender->setMaskColor(sprite->transparentColor());
+  clear_image(sampleRender.get(), sprite->transparentColor());
+  renderSample(render, sample, sampleRender.get(), 0, 0);
+
+  if (m_ignoreEmptyCels || m_trimCels) {
+    gfx::Rect frameBounds;
+    doc::color_t refColor = 0;
+
+    if (m_trimCels) {
+      if ((layer &&
+           layer->isBackground()) ||
+          (!layer &&
+           sprite->backgroundLayer() &&
+           sprite->backgroundLayer()->isVisible())) {
+        refColor = get_pixel(sampleRender.get(), 0, 0);
+      }
+      else {
+        refColor = sprite->transparentColor();
       }
+    }
+    else if (m_ignoreEmptyCels)
+      refColor = sprite->transparentColor();
+
+    if (!algorithm::shrink_bounds(sampleRender.get(), frameBounds, refColor)) {
+      // If shrink_bounds() returns false, it's because the whole
+      // image is transparent (equal to the mask color).
+      return false;
+    }
+
+    if (m_trimCels)
+      sample.setTrimmedBounds(frameBounds);
+  }
 
-      samples.addSample(sample);
+  // Keep only the trimmed pixels (the render buffer is re-used)
+  image.reset(crop_image(sampleRender.get(), sample.trimmedBounds(),
+                         sprite->transparentColor()));
+  return true;
+}
+
+void DocumentExporter::layoutSamples(Samples& samples, int& width, int& height)
+{
+  switch (m_sheetType) {
+    case SpriteSheetType::Packed: {
+      BestFitLayoutSamples layout(m_allowRotation);
+      layout.layoutSamples(
+        samples, m_borderPadding, m_shapePadding,
+        width, height);
+      break;
+    }
+    default: {
+      if(m_perTag){
+        PerTagLayoutSamples layout(m_sheetType);
+        layout.layoutSamples(
+          samples, m_borderPadding, m_shapePadding,
+          width, height);
+      }
+      else{
+        SimpleLayoutSamples layout(m_sheetType);
+        layout.layoutSamples(
+          samples, m_borderPadding, m_shapePadding,
+          width, height);
+      }
+      break;
+    }
+  }
+}
+
+void DocumentExporter::layoutPages(const Samples& samples, Pages& pages)
+{
+  // Without a maximum texture size all samples go to one texture. The
+  // per-tag layout doesn't support several textures.
+  if ((m_maxTextureWidth <= 0 && m_maxTextureHeight <= 0) || m_perTag) {
+    Page page;
+    page.samples = samples;
+    page.width = m_textureWidth;
+    page.height = m_textureHeight;
+    layoutSamples(page.samples, page.width, page.height);
+    pages.push_back(std::move(page));
+    return;
+  }
+
+  // Duplicated samples use the page of their original sample (they
+  // share the bounds), so they aren't laid out.
+  Samples remaining;
+  for (const auto& sample : samples) {
+    if (!sample.isDuplicated())
+      remaining.addSample(sample);
+  }
+
+  // Size of the texture to lay out the samples that don't fit in one
+  // texture. A packed texture needs both sizes, so a missing one is
+  // the same as the other one.
+  int maxWidth = m_textureWidth;
+  int maxHeight = m_textureHeight;
+  if (m_maxTextureWidth > 0 && (maxWidth == 0 || maxWidth > m_maxTextureWidth))
+    maxWidth = m_maxTextureWidth;
+  if (m_maxTextureHeight > 0 && (maxHeight == 0 || maxHeight > m_maxTextureHeight))
+    maxHeight = m_maxTextureHeight;
+  if (m_sheetType == SpriteSheetType::Packed) {
+    if (maxWidth == 0) maxWidth = maxHeight;
+    if (maxHeight == 0) maxHeight = maxWidth;
+  }
+
+  while (!remaining.empty()) {
+    Page page;
+    page.samples = std::move(remaining);
+    page.width = m_textureWidth;
+    page.height = m_textureHeight;
+    remaining = Samples();
+
+    // First we try to put all remaining samples in the same way that
+    // they are laid out in one texture.
+    layoutSamples(page.samples, page.width, page.height);
+
+    bool fits = ((m_maxTextureWidth <= 0 || page.width <= m_maxTextureWidth) &&
+                 (m_maxTextureHeight <= 0 || page.height <= m_maxTextureHeight));
+    for (auto it=page.samples.begin(); fits && it!=page.samples.end(); ++it)
+      fits = fitsInPage(*it);
+
+    // In other case the samples are laid out in the maximum size, and
+    // the ones that don't fit go to the next pages.
+    if (!fits) {
+      int width = maxWidth;
+      int height = maxHeight;
+      layoutSamples(page.samples, width, height);
+
+      Samples fitted;
+      for (const auto& sample : page.samples) {
+        if (fitsInPage(sample))
+          fitted.addSample(sample);
+        else
+          remaining.addSample(sample);
+      }
+
+      page.width = page.height = 0;
+      page.samples = std::move(fitted);
+
+      // A sample bigger than the maximum size goes alone in a page
+      if (page.samples.empty()) {
+        Samples rest;
+        for (const auto& sample : remaining) {
+          if (page.samples.empty())
+            page.samples.addSample(sample);
+          else
+            rest.addSample(sample);
+        }
+        remaining = std::move(rest);
+        layoutSamples(page.samples, page.width, page.height);
+      }
     }
+
+    for (auto& sample : page.samples)
+      sample.setPage(int(pages.size()));
+
+    pages.push_back(std::move(page));
   }
 }
 
-Document* DocumentExporter::createEmptyTexture(const Samples& samples)
+bool DocumentExporter::fitsInPage(const Sample& sample) const
+{
+  const gfx::Rect& rc = sample.inTextureBounds();
+  return (!rc.isEmpty() &&
+          (m_maxTextureWidth <= 0 || rc.x2()+m_borderPadding <= m_maxTextureWidth) &&
+          (m_maxTextureHeight <= 0 || rc.y2()+m_borderPadding <= m_maxTextureHeight));
+}
+
+PixelFormat DocumentExporter::calculateTextureFormat(const Samples& samples, Palette*& palette)
 {
-  Palette* palette = NULL;
   PixelFormat pixelFormat = IMAGE_INDEXED;
-  gfx::Rect fullTextureBounds(0, 0, m_textureWidth, m_textureHeight);
-  int maxColors = 256;
+  palette = NULL;
 
-  for (Samples::const_iterator
-         it = samples.begin(),
-         end = samples.end(); it != end; ++it) {
+  for (const auto& sample : samples) {
     // We try to render an indexed image. But if we find a sprite with
     // two or more palettes, or two of the sprites have different
     // palettes, we've to use RGB format.
-    if (pixelFormat == IMAGE_INDEXED) {
-      if (it->sprite()->pixelFormat() != IMAGE_INDEXED) {
-        pixelFormat = IMAGE_RGB;
-      }
-      else if (it->sprite()->getPalettes().size() > 1) {
-        pixelFormat = IMAGE_RGB;
-      }
-      else if (palette != NULL
-        && palette->countDiff(it->sprite()->palette(frame_t(0)), NULL, NULL) > 0) {
-        pixelFormat = IMAGE_RGB;
-      }
-      else
-        palette = it->sprite()->palette(frame_t(0));
+    if (sample.sprite()->pixelFormat() != IMAGE_INDEXED) {
+      pixelFormat = IMAGE_RGB;
+    }
+    else if (sample.sprite()->getPalettes().size() > 1) {
+      pixelFormat = IMAGE_RGB;
+    }
+    else if (palette != NULL
+      && palette->countDiff(sample.sprite()->palette(frame_t(0)), NULL, NULL) > 0) {
+      pixelFormat = IMAGE_RGB;
     }
+    else
+      palette = sample.sprite()->palette(frame_t(0));
+
+    if (pixelFormat != IMAGE_INDEXED)
+      break;
+  }
+
+  return pixelFormat;
+}
 
-    gfx::Rect sampleBounds = it->inTextureBounds();
+Document* DocumentExporter::createEmptyTexture(const Samples& samples,
+                                               int width, int height,
+                                               PixelFormat pixelFormat,
+                                               Palette* palette)
+{
+  gfx::Rect fullTextureBounds(0, 0, width, height);
+  int maxColors = 256;
+
+  for (const auto& sample : samples) {
+    gfx::Rect sampleBounds = sample.inTextureBounds();
 
     // If the user specified a fixed sprite sheet size, we add the
     // border padding in the sample size to do an union between
     // fullTextureBounds and sample's inTextureBounds (generally, it
     // shouldn't make fullTextureBounds bigger).
-    if (m_textureWidth > 0) sampleBounds.w += m_borderPadding;
-    if (m_textureHeight > 0) sampleBounds.h += m_borderPadding;
+    if (width > 0) sampleBounds.w += m_borderPadding;
+    if (height > 0) sampleBounds.h += m_borderPadding;
 
     fullTextureBounds |= sampleBounds;
   }
@@ -687,8 +1108,8 @@ Document* DocumentExporter::createEmptyTexture(const Samples& samples)
   // If the user didn't specified the sprite sheet size, the border is
   // added right here (the left/top border padding should be added by
   // the DocumentExporter::LayoutSamples() impl).
-  if (m_textureWidth == 0) fullTextureBounds.w += m_borderPadding;
-  if (m_textureHeight == 0) fullTextureBounds.h += m_borderPadding;
+  if (width == 0) fullTextureBounds.w += m_borderPadding;
+  if (height == 0) fullTextureBounds.h += m_borderPadding;
 
   std::unique_ptr<Sprite> sprite(
     Sprite::createBasicSprite(
@@ -706,27 +1127,62 @@ void DocumentExporter::renderTexture(const Samples& samples, Image* textureImage
 {
   textureImage->clear(0);
 
+  std::vector<const Sample*> uniqueSamples;
   for (const auto& sample : samples) {
-    if (sample.isDuplicated())
-      continue;
-
-    // Make the sprite compatible with the texture so the render()
-    // works correctly.
-    if (sample.sprite()->pixelFormat() != textureImage->pixelFormat()) {
-      cmd::SetPixelFormat(
-        sample.sprite(),
-        textureImage->pixelFormat(),
-        DitheringMethod::NONE).execute(UIContext::instance());
-    }
-
-    renderSample(sample, textureImage,
-      sample.inTextureBounds().x+m_innerPadding,
-      sample.inTextureBounds().y+m_innerPadding);
+    if (!sample.isDuplicated())
+      uniqueSamples.push_back(&sample);
   }
+
+  // Each sample is in its own region of the texture, so they can be
+  // rendered in parallel.
+  parallel_slices(
+    int(uniqueSamples.size()),
+    [this, &uniqueSamples, textureImage](int begin, int end){
+      render::Render render;
+
+      for (int i=begin; i<end; ++i) {
+        const Sample& sample = *uniqueSamples[i];
+
+        // The sprites must be compatible with the texture
+        ASSERT(sample.sprite()->pixelFormat() == textureImage->pixelFormat());
+
+        const int x = sample.inTextureBounds().x+m_innerPadding;
+        const int y = sample.inTextureBounds().y+m_innerPadding;
+
+        // We can copy the pixels rendered in captureSamples() if they
+        // have the same format, and the same background of the texture
+        // (renderLayer() doesn't fill the background).
+        ImageRef sampleRender = sample.image();
+        if (sampleRender &&
+            (sampleRender->pixelFormat() != textureImage->pixelFormat() ||
+             (sample.layer() && sample.sprite()->transparentColor() != 0)))
+          sampleRender.reset();
+
+        if (sample.rotated()) {
+          const gfx::Size size = sample.trimmedBounds().size();
+          if (!sampleRender) {
+            sampleRender.reset(
+              Image::create(textureImage->pixelFormat(), size.w, size.h));
+            sampleRender->clear(0);
+            renderSample(render, sample, sampleRender.get(), 0, 0);
+          }
+          std::unique_ptr<Image> rotatedRender(
+            Image::create(textureImage->pixelFormat(), size.h, size.w));
+          rotate_image(sampleRender.get(), rotatedRender.get(), 90);
+          copy_image(textureImage, rotatedRender.get(), x, y);
+        }
+        else if (sampleRender)
+          copy_image(textureImage, sampleRender.get(), x, y);
+        else
+          renderSample(render, sample, textureImage, x, y);
+      }
+    });
 }
 
-void DocumentExporter::createDataFile(const Samples& samples, std::ostream& os, Image* textureImage)
+void DocumentExporter::createDataFile(const Samples& samples, std::ostream& os, const Pages& pages)
 {
+  const Image* textureImage = pages.front().image;
+  const bool multiPage = ((m_maxTextureWidth > 0 || m_maxTextureHeight > 0) && !m_perTag);
   std::string frames_begin;
   std::string frames_end;
   bool filename_as_key = false;
@@ -757,6 +1213,10 @@ void DocumentExporter::createDataFile(const Samples& samples, std::ostream& os,
     gfx::Rect spriteSourceBounds = sample.trimmedBounds();
     gfx::Rect frameBounds = sample.inTextureBounds();
 
+    // The size of rotated frames is the size before the rotation
+    if (sample.rotated())
+      std::swap(frameBounds.w, frameBounds.h);
+
     if (filename_as_key)
       os << "   \"" << escape_for_json(sample.filename()) << "\": {\n";
     else if (filename_as_attr)
@@ -767,8 +1227,12 @@ void DocumentExporter::createDataFile(const Samples& samples, std::ostream& os,
        << "\"x\": " << frameBounds.x << ", "
        << "\"y\": " << frameBounds.y << ", "
        << "\"w\": " << frameBounds.w << ", "
-       << "\"h\": " << frameBounds.h << " },\n"
-       << "    \"rotated\": false,\n"
+       << "\"h\": " << frameBounds.h << " },\n";
+
+    if (multiPage)
+      os << "    \"page\": " << sample.page() << ",\n";
+
+    os << "    \"rotated\": " << (sample.rotated() ? "true": "false") << ",\n"
        << "    \"trimmed\": " << (sample.trimmed() ? "true": "false") << ",\n"
        << "    \"spriteSourceSize\": { "
        << "\"x\": " << spriteSourceBounds.x << ", "
@@ -803,6 +1267,24 @@ void DocumentExporter::createDataFile(const Samples& samples, std::ostream& os,
      << "\"h\": " << textureImage->height() << " },\n"
      << "  \"scale\": \"" << m_scale << "\"";
 
+  // meta.pages
+  if (multiPage) {
+    os << ",\n"
+       << "  \"pages\": [";
+
+    for (std::size_t i=0; i<pages.size(); ++i) {
+      if (i > 0)
+        os << ",";
+      os << "\n   { ";
+      if (!m_textureFilename.empty())
+        os << "\"image\": \"" << escape_for_json(pages[i].filename) << "\", ";
+      os << "\"size\": { "
+         << "\"w\": " << pages[i].image->width() << ", "
+         << "\"h\": " << pages[i].image->height() << " } }";
+    }
+    os << "\n  ]";
+  }
+
   // meta.frameTags
   if (m_listFrameTags) {
     os << ",\n"
@@ -893,9 +1375,8 @@ void DocumentExporter::createDataFile(const Samples& samples, std::ostream& os,
      << "}\n";
 }
 
-void DocumentExporter::renderSample(const Sample& sample, doc::Image* dst, int x, int y)
+void DocumentExporter::renderSample(render::Render& render, const Sample& sample, doc::Image* dst, int x, int y)
 {
-  render::Render render;
   gfx::Clip clip(x, y, sample.trimmedBounds());
 
   if (sample.layer()) {
@@ -12,6 +12,8 @@
 #include "app/sprite_sheet_type.h"
 #include "base/disable_copying.h"
 #include "doc/image_buffer.h"
+#include "doc/image_ref.h"
+#include "doc/pixel_format.h"
 #include "gfx/fwd.h"
 
 #include <iosfwd>
@@ -22,6 +24,11 @@ namespace doc {
   class FrameTag;
   class Image;
   class Layer;
+  class Palette;
+}
+
+namespace render {
+  class Render;
 }
 
 namespace app {
@@ -52,6 +59,8 @@ namespace app {
     void setTextureFilename(const std::string& filename) { m_textureFilename = filename; }
     void setTextureWidth(int width) { m_textureWidth = width; }
     void setTextureHeight(int height) { m_textureHeight = height; }
+    void setMaxTextureWidth(int width) { m_maxTextureWidth = width; }
+    void setMaxTextureHeight(int height) { m_maxTextureHeight = height; }
     void setSpriteSheetType(SpriteSheetType type) { m_sheetType = type; }
     void setScale(double scale) { m_scale = scale; }
     void setScaleMode(ScaleMode mode) { m_scaleMode = mode; }
@@ -61,6 +70,8 @@ namespace app {
     void setShapePadding(int padding) { m_shapePadding = padding; }
     void setInnerPadding(int padding) { m_innerPadding = padding; }
     void setTrimCels(bool trim) { m_trimCels = trim; }
+    void setMergeDuplicates(bool merge) { m_mergeDuplicates = merge; }
+    void setAllowRotation(bool allow) { m_allowRotation = allow; }
     void setFilenameFormat(const std::string& format) { m_filenameFormat = format; }
     void setListFrameTags(bool value) { m_listFrameTags = value; }
     void setListLayers(bool value) { m_listLayers = value; }
@@ -72,6 +83,9 @@ namespace app {
       m_documents.push_back(Item(document, layer, tag, temporalTag));
     }
 
+    // Returns the document of the first texture. If a maximum texture
+    // size is given, the samples that don't fit in the first texture
+    // are saved in other textures (pages).
     Document* exportSheet();
 
   private:
@@ -81,12 +95,21 @@ namespace app {
     class SimpleLayoutSamples;
     class PerTagLayoutSamples;
     class BestFitLayoutSamples;
+    class Page;
+    typedef std::vector<Page> Pages;
 
     void captureSamples(Samples& samples);
-    Document* createEmptyTexture(const Samples& samples);
+    bool renderCapturedSample(render::Render& render, Sample& sample, bool emptyCel,
+                              const doc::ImageBufferPtr& buffer, doc::ImageRef& image);
+    void layoutSamples(Samples& samples, int& width, int& height);
+    void layoutPages(const Samples& samples, Pages& pages);
+    bool fitsInPage(const Sample& sample) const;
+    doc::PixelFormat calculateTextureFormat(const Samples& samples, doc::Palette*& palette);
+    Document* createEmptyTexture(const Samples& samples, int width, int height,
+                                 doc::PixelFormat pixelFormat, doc::Palette* palette);
     void renderTexture(const Samples& samples, doc::Image* textureImage);
-    void createDataFile(const Samples& samples, std::ostream& os, doc::Image* textureImage);
-    void renderSample(const Sample& sample, doc::Image* dst, int x, int y);
+    void createDataFile(const Samples& samples, std::ostream& os, const Pages& pages);
+    void renderSample(render::Render& render, const Sample& sample, doc::Image* dst, int x, int y);
 
     class Item {
     public:
@@ -115,6 +138,8 @@ namespace app {
     std::string m_textureFilename;
     int m_textureWidth;
     int m_textureHeight;
+    int m_maxTextureWidth;
+    int m_maxTextureHeight;
     SpriteSheetType m_sheetType;
     double m_scale;
     ScaleMode m_scaleMode;
@@ -124,9 +149,10 @@ namespace app {
     int m_shapePadding;
     int m_innerPadding;
     bool m_trimCels;
+    bool m_mergeDuplicates;
+    bool m_allowRotation;
     Items m_documents;
     std::string m_filenameFormat;
-    doc::ImageBufferPtr m_sampleRenderBuf;
     bool m_listFrameTags;
     bool m_listLayers;
 
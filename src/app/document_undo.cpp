@@ -13,6 +13,7 @@
 
 #include "app/app.h"
 #include "app/cmd.h"
+#include "app/cmd_stream.h"
 #include "app/cmd_transaction.h"
 #include "app/document_undo_observer.h"
 #include "app/pref/preferences.h"
@@ -20,23 +21,170 @@
 #include "undo/undo_history.h"
 #include "undo/undo_state.h"
 
+#include <algorithm>
 #include <cassert>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
 #include <stdexcept>
+#include <thread>
 
 namespace app {
 
+// Number of states before and after the current one that are never
+// compacted, so the next undo/redo steps don't need to restore data.
+static const int kHotStates = 4;
+
+// Data smaller than this is not moved to a temporary file.
+static const size_t kMinSpillSize = 64*1024;
+
+// Compacted states can use up to this number of times the memory
+// limit in temporary files, then the oldest states are dropped.
+static const size_t kSpillFactor = 8;
+
+// Snapshot of the history to compact some states of it.
+struct DocumentUndo::CompactionJob {
+  DocumentUndo* undo;
+  int id;
+  std::vector<const undo::UndoState*> states;
+  int current;
+  size_t sizeLimit;
+  size_t hotSize;
+  bool canDrop;
+};
+
+// Runs the queued compaction jobs of all documents one by one. Each
+// job compacts one state at a time, checking if it was cancelled
+// before each state.
+class DocumentUndo::CompactionWorker {
+public:
+  static CompactionWorker& instance() {
+    static CompactionWorker worker;
+    return worker;
+  }
+
+  // Guards the queue and the compaction fields of all documents.
+  std::mutex mutex;
+
+  // Notified when a job is queued, or a state/job is completed.
+  std::condition_variable cv;
+
+  // Document with the job that is running now.
+  const DocumentUndo* running() const { return m_running; }
+
+  // Queues a job replacing the previous one of the same document
+  // (it was made with an older snapshot of the history). The mutex
+  // must be locked.
+  void push(std::unique_ptr<CompactionJob>&& job) {
+    remove(job->undo);
+    m_jobs.push_back(std::move(job));
+    if (!m_thread.joinable())
+      m_thread = std::thread([this]{ run(); });
+    cv.notify_all();
+  }
+
+  // Returns true if "undo" has a queued or running job. The mutex
+  // must be locked.
+  bool hasJob(const DocumentUndo* undo) const {
+    return (m_running == undo ||
+            std::find_if(m_jobs.begin(), m_jobs.end(),
+                         [undo](const std::unique_ptr<CompactionJob>& job){
+                           return job->undo == undo;
+                         }) != m_jobs.end());
+  }
+
+  // Removes the queued job of "undo". The mutex must be locked.
+  void remove(const DocumentUndo* undo) {
+    m_jobs.erase(
+      std::remove_if(m_jobs.begin(), m_jobs.end(),
+                     [undo](const std::unique_ptr<CompactionJob>& job){
+                       return job->undo == undo;
+                     }),
+      m_jobs.end());
+  }
+
+private:
+  CompactionWorker() : m_running(nullptr), m_exit(false) { }
+
+  ~CompactionWorker() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      m_exit = true;
+    }
+    cv.notify_all();
+    if (m_thread.joinable())
+      m_thread.join();
+  }
+
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      cv.wait(lock, [this]{ return m_exit || !m_jobs.empty(); });
+      if (m_exit)
+        break;
+
+      std::unique_ptr<CompactionJob> job(std::move(m_jobs.front()));
+      m_jobs.pop_front();
+      m_running = job->undo;
+      lock.unlock();
+
+      job->undo->compactStates(*job);
+
+      lock.lock();
+      m_running = nullptr;
+      cv.notify_all();
+    }
+  }
+
+  std::deque<std::unique_ptr<CompactionJob>> m_jobs;
+  const DocumentUndo* m_running;
+  std::thread m_thread;
+  bool m_exit;
+};
+
 DocumentUndo::DocumentUndo()
   : m_ctx(NULL)
+  , m_compactionJobId(0)
+  , m_compactingState(nullptr)
+  , m_hasSizeLimit(false)
+  , m_sizeLimit(0)
+  , m_canDrop(false)
+  , m_lastDroppedState(nullptr)
   , m_savedCounter(0)
   , m_savedStateIsLost(false)
 {
 }
 
+DocumentUndo::~DocumentUndo()
+{
+  // Our job cannot be running when the history is deleted
+  CompactionWorker& worker = CompactionWorker::instance();
+  std::unique_lock<std::mutex> lock(worker.mutex);
+  ++m_compactionJobId;
+  worker.remove(this);
+  worker.cv.wait(lock, [this, &worker]{ return worker.running() != this; });
+}
+
 void DocumentUndo::setContext(doc::Context* ctx)
 {
   m_ctx = ctx;
 }
 
+void DocumentUndo::setSizeLimit(size_t sizeLimit, bool canDrop)
+{
+  m_hasSizeLimit = true;
+  m_sizeLimit = sizeLimit;
+  m_canDrop = canDrop;
+}
+
+void DocumentUndo::waitCompaction()
+{
+  CompactionWorker& worker = CompactionWorker::instance();
+  std::unique_lock<std::mutex> lock(worker.mutex);
+  worker.cv.wait(lock, [this, &worker]{ return !worker.hasJob(this); });
+}
+
 void DocumentUndo::add(CmdTransaction* cmd)
 {
   ASSERT(cmd);
@@ -49,11 +197,13 @@ void DocumentUndo::add(CmdTransaction* cmd)
 
   m_undoHistory.add(cmd);
   notifyObservers(&DocumentUndoObserver::onAddUndoState, this);
+
+  startCompaction();
 }
 
 bool DocumentUndo::canUndo() const
 {
-  return m_undoHistory.canUndo();
+  return (m_undoHistory.canUndo() && !isDropped(nextUndo()));
 }
 
 bool DocumentUndo::canRedo() const
@@ -63,18 +213,37 @@ bool DocumentUndo::canRedo() const
 
 void DocumentUndo::undo()
 {
+  const undo::UndoState* state = nextUndo();
+  cancelCompaction([state](const undo::UndoState* compacting){
+      return (compacting == state);
+    });
+  if (isDropped(state))
+    return;
+
   m_undoHistory.undo();
   notifyObservers(&DocumentUndoObserver::onAfterUndo, this);
 }
 
 void DocumentUndo::redo()
 {
+  const undo::UndoState* state = nextRedo();
+  cancelCompaction([state](const undo::UndoState* compacting){
+      return (compacting == state);
+    });
   m_undoHistory.redo();
   notifyObservers(&DocumentUndoObserver::onAfterRedo, this);
 }
 
 void DocumentUndo::clearRedo()
 {
+  // All states after the current one are deleted
+  const undo::UndoState* first = nextRedo();
+  cancelCompaction([first](const undo::UndoState* compacting){
+      for (const undo::UndoState* state=first; state; state=state->next())
+        if (state == compacting)
+          return true;
+      return false;
+    });
   m_undoHistory.clearRedo();
   notifyObservers(&DocumentUndoObserver::onClearRedo, this);
 }
@@ -144,6 +313,15 @@ Cmd* DocumentUndo::lastExecutedCmd() const
 
 void DocumentUndo::moveToState(const undo::UndoState* state)
 {
+  // We don't know which states are undone/redone to reach "state" in
+  // a non-linear history, so we wait the one being compacted
+  cancelCompaction([](const undo::UndoState*){ return true; });
+
+  // Dropped states cannot be undone, so we can go back only to the
+  // last dropped state
+  if (m_lastDroppedState && (!state || isDropped(state)))
+    state = m_lastDroppedState;
+
   m_undoHistory.moveTo(state);
 }
 
@@ -161,4 +339,197 @@ const undo::UndoState* DocumentUndo::nextRedo() const
     return m_undoHistory.firstState();
 }
 
+// Returns true if "state" was dropped, i.e. its data was freed and
+// it cannot be undone.
+bool DocumentUndo::isDropped(const undo::UndoState* state) const
+{
+  const undo::UndoState* lastDropped = m_lastDroppedState;
+  for (; lastDropped && state; state = state->next()) {
+    if (state == lastDropped)
+      return true;
+  }
+  return false;
+}
+
+void DocumentUndo::startCompaction()
+{
+  size_t sizeLimit = m_sizeLimit;
+  bool canDrop = m_canDrop;
+  if (!m_hasSizeLimit) {
+    if (!App::instance())
+      return;
+
+    // Only in a linear history all the states before the current one
+    // are undone to reach a previous state, so the oldest states can
+    // be dropped.
+    Preferences& pref = App::instance()->preferences();
+    sizeLimit = size_t(pref.undo.sizeLimit()) * 1024 * 1024;
+    canDrop = !pref.undo.allowNonlinearHistory();
+  }
+  if (sizeLimit == 0)
+    return;
+
+  std::vector<const undo::UndoState*> states;
+  int current = -1;
+  for (const undo::UndoState* state = m_undoHistory.firstState();
+       state; state = state->next()) {
+    if (state == m_undoHistory.currentState())
+      current = int(states.size());
+    states.push_back(state);
+  }
+
+  // The memory used by the states near the current one is calculated
+  // here, because they are not compacted and the last one can be
+  // modified while the worker is running (e.g. the palette editor
+  // adds commands to the last transaction).
+  const int hot1 = std::max(0, current-kHotStates);
+  const int hot2 = std::min(current+kHotStates, int(states.size())-1);
+  cancelCompaction([&states, hot1, hot2](const undo::UndoState* compacting){
+      return std::find(states.begin()+hot1, states.begin()+hot2+1,
+                       compacting) != states.begin()+hot2+1;
+    });
+
+  size_t hotSize = 0;
+  for (int i=hot1; i<=hot2; ++i)
+    hotSize += static_cast<const Cmd*>(states[i]->cmd())->memSize();
+
+  CompactionWorker& worker = CompactionWorker::instance();
+  std::lock_guard<std::mutex> lock(worker.mutex);
+  worker.push(std::unique_ptr<CompactionJob>(
+                new CompactionJob{ this, m_compactionJobId, std::move(states),
+                                   current, sizeLimit, hotSize, canDrop }));
+}
+
+// Cancels the queued/running compaction job. If the state that is
+// being compacted is needed (needsState() returns true) we wait for
+// it, the other states are not touched until a new job is started.
+void DocumentUndo::cancelCompaction(const std::function<bool(const undo::UndoState*)>& needsState)
+{
+  CompactionWorker& worker = CompactionWorker::instance();
+  std::unique_lock<std::mutex> lock(worker.mutex);
+  ++m_compactionJobId;
+  worker.remove(this);
+  worker.cv.wait(lock, [this, &needsState]{
+      return (!m_compactingState || !needsState(m_compactingState));
+    });
+}
+
+// Runs in the worker thread. The UI thread can modify the history at
+// the same time, but it cancels the job first, and waits if it needs
+// the state that is being compacted.
+void DocumentUndo::compactStates(const CompactionJob& job)
+{
+  CompactionWorker& worker = CompactionWorker::instance();
+
+  // Calls func() with the command of "state", returns false if the
+  // job was cancelled (or func() failed).
+  auto compact = [this, &job, &worker](const undo::UndoState* state,
+                                       const std::function<void(Cmd*)>& func) -> bool {
+    {
+      std::lock_guard<std::mutex> lock(worker.mutex);
+      if (job.id != m_compactionJobId)
+        return false;
+      m_compactingState = state;
+    }
+
+    bool ok = true;
+    try {
+      func(static_cast<Cmd*>(state->cmd()));
+    }
+    catch (const std::exception& e) {
+      LOG("Error compacting undo history: %s\n", e.what());
+      ok = false;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(worker.mutex);
+      m_compactingState = nullptr;
+    }
+    worker.cv.notify_all();
+    return ok;
+  };
+
+  // Cold states, from the oldest one, skipping the dropped ones
+  const std::vector<const undo::UndoState*>& states = job.states;
+  std::vector<int> indexes;
+  for (int i=0; i<int(states.size()); ++i) {
+    if (states[i] == m_lastDroppedState)
+      indexes.clear();
+    else if (std::abs(i - job.current) > kHotStates)
+      indexes.push_back(i);
+  }
+
+  // Compress all cold states in memory
+  size_t memSize = job.hotSize;
+  for (int i : indexes) {
+    if (!compact(states[i], [&memSize](Cmd* cmd){
+          cmd->compact(CmdCompaction(CmdCompaction::Compress));
+          memSize += cmd->memSize();
+        }))
+      return;
+  }
+
+  // Move the oldest ones to temporary files
+  size_t diskSize = spilledSize();
+  for (int i : indexes) {
+    if (memSize <= job.sizeLimit)
+      break;
+
+    if (!compact(states[i], [this, &memSize, &diskSize](Cmd* cmd){
+          const size_t before = cmd->memSize();
+          if (before < kMinSpillSize)
+            return;
+
+          auto file = std::make_shared<CmdSpillFile>();
+          cmd->compact(CmdCompaction(CmdCompaction::Spill, file));
+          memSize -= before - cmd->memSize();
+
+          if (file->size() > 0) {
+            diskSize += file->size();
+            m_spillFiles.push_back(file);
+          }
+        }))
+      return;
+  }
+
+  if (!job.canDrop)
+    return;
+
+  // Drop the oldest states if the temporary files are too big too
+  for (int i : indexes) {
+    if (i >= job.current ||
+        memSize + diskSize <= job.sizeLimit*kSpillFactor)
+      break;
+
+    // The state is marked as dropped before the UI thread can use it
+    const undo::UndoState* state = states[i];
+    if (!compact(state, [this, state, &memSize](Cmd* cmd){
+          const size_t before = cmd->memSize();
+          cmd->compact(CmdCompaction(CmdCompaction::Discard));
+          memSize -= before - cmd->memSize();
+          m_lastDroppedState = state;
+        }))
+      return;
+
+    // Temporary files of the dropped state were deleted
+    diskSize = spilledSize();
+  }
+}
+
+// Returns the size of the temporary files used by the history.
+size_t DocumentUndo::spilledSize()
+{
+  size_t size = 0;
+  for (auto it=m_spillFiles.begin(); it!=m_spillFiles.end(); ) {
+    CmdSpillFilePtr file = it->lock();
+    if (file) {
+      size += file->size();
+      ++it;
+    }
+    else
+      it = m_spillFiles.erase(it);
+  }
+  return size;
+}
+
 } // namespace app
@@ -12,7 +12,11 @@
 #include "doc/sprite_position.h"
 #include "undo/undo_history.h"
 
+#include <atomic>
+#include <functional>
+#include <memory>
 #include <string>
+#include <vector>
 
 namespace doc {
   class Context;
@@ -22,15 +26,25 @@ namespace app {
   using namespace doc;
 
   class Cmd;
+  class CmdSpillFile;
   class CmdTransaction;
   class DocumentUndoObserver;
 
   class DocumentUndo : public base::Observable<DocumentUndoObserver> {
   public:
     DocumentUndo();
+    ~DocumentUndo();
 
     void setContext(doc::Context* ctx);
 
+    // Memory limit of the history in bytes (0 = no limit), and if the
+    // oldest states can be dropped to keep the temporary files below
+    // it. By default they are taken from the "undo" preferences.
+    void setSizeLimit(size_t sizeLimit, bool canDrop);
+
+    // Waits until the queued compaction of the history is done.
+    void waitCompaction();
+
     void add(CmdTransaction* cmd);
 
     bool canUndo() const;
@@ -60,12 +74,39 @@ namespace app {
     void moveToState(const undo::UndoState* state);
 
   private:
+    struct CompactionJob;
+    class CompactionWorker;
+
     const undo::UndoState* nextUndo() const;
     const undo::UndoState* nextRedo() const;
+    bool isDropped(const undo::UndoState* state) const;
+    void startCompaction();
+    void cancelCompaction(const std::function<bool(const undo::UndoState*)>& needsState);
+    void compactStates(const CompactionJob& job);
+    size_t spilledSize();
 
     undo::UndoHistory m_undoHistory;
     doc::Context* m_ctx;
 
+    // Old undo states are compressed, moved to temporary files, or
+    // dropped in a worker thread (shared by all documents) to keep
+    // the memory used by the history below the "undo.size_limit"
+    // preference. These two fields are guarded by the worker mutex:
+    // the job is cancelled incrementing its ID, and the state being
+    // compacted is the only one that the UI thread must wait.
+    int m_compactionJobId;
+    const undo::UndoState* m_compactingState;
+    std::vector<std::weak_ptr<CmdSpillFile>> m_spillFiles;
+
+    // Values given in setSizeLimit() (used instead of the preferences)
+    bool m_hasSizeLimit;
+    size_t m_sizeLimit;
+    bool m_canDrop;
+
+    // Last state that cannot be undone because its data was dropped
+    // (all previous states are dropped too).
+    std::atomic<const undo::UndoState*> m_lastDroppedState;
+
     // This counter is equal to 0 if we are in the "saved state", i.e.
     // the document on memory is equal to the document on disk. This
     // value is less than 0 if we're in a past version of the document
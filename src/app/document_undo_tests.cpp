@@ -0,0 +1,135 @@
+// LibreSprite
+// Copyright (C) 2026  LibreSprite contributors
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation.
+
+#include "tests/test.h"
+
+#include "app/cmd.h"
+#include "app/cmd/copy_region.h"
+#include "app/context.h"
+#include "app/document.h"
+#include "app/document_undo.h"
+#include "app/transaction.h"
+#include "base/fs.h"
+#include "base/process.h"
+#include "doc/doc.h"
+#include "doc/test_context.h"
+#include "undo/undo_state.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+using namespace app;
+using namespace doc;
+
+typedef std::unique_ptr<app::Document> DocumentPtr;
+
+namespace {
+
+const int kSize = 256;
+const size_t kRawSize = kSize*kSize*4;
+
+// Fills the image with a constant color and a block of noise, so
+// the undo data of each step is compressed to ~160KB.
+void fill_step(Image* image, int step)
+{
+  clear_image(image, rgba(step, 0, 0, 255));
+  std::srand(step);
+  for (int y=0; y<200; ++y)
+    for (int x=0; x<200; ++x)
+      put_pixel(image, x, y, rgba(std::rand()%256, std::rand()%256,
+                                  std::rand()%256, 255));
+}
+
+// Returns the number of undo temporary files of this process.
+int count_spill_files()
+{
+  char prefix[64];
+  std::sprintf(prefix, "libresprite-undo-%u-",
+               unsigned(base::get_current_process_id()));
+
+  int n = 0;
+  for (const auto& fn : base::list_files(base::get_temp_path()))
+    if (fn.find(prefix) == 0)
+      ++n;
+  return n;
+}
+
+} // anonymous namespace
+
+TEST(DocumentUndo, Compaction)
+{
+  const int nsteps = 100;
+  TestContextT<app::Context> ctx;
+  DocumentPtr doc(static_cast<app::Document*>(
+                    ctx.documents().add(kSize, kSize, ColorMode::RGB)));
+  Image* image = doc->sprite()->layer(0)->cel(0)->image();
+  fill_step(image, 0);
+
+  // The hot states use ~1.25MB of 1.5MB, so a few cold states are kept
+  // compressed in memory, the next ones are moved to temporary files
+  // and the oldest ones are dropped (when more than 12MB are used).
+  DocumentUndo* history = doc->undoHistory();
+  history->setSizeLimit(6*kRawSize, true);
+
+  ImageRef src(Image::create(IMAGE_RGB, kSize, kSize));
+  for (int step=1; step<=nsteps; ++step) {
+    fill_step(src.get(), step);
+    Transaction transaction(&ctx, "Step");
+    transaction.execute(
+      new cmd::CopyRegion(image, src.get(),
+                          gfx::Region(image->bounds()), gfx::Point(0, 0)));
+    transaction.commit();
+  }
+  history->waitCompaction();
+
+  int compressed = 0;
+  for (const undo::UndoState* state=history->firstState(); state; state=state->next()) {
+    const size_t size = static_cast<const Cmd*>(state->cmd())->memSize();
+    if (size > 64*1024 && size < kRawSize)
+      ++compressed;
+  }
+  EXPECT_GT(compressed, 0);
+
+  const int spillFiles = count_spill_files();
+  EXPECT_GT(spillFiles, 0);
+
+  // Undo until the last dropped state
+  ImageRef expected(Image::create(IMAGE_RGB, kSize, kSize));
+  int step = nsteps;
+  while (history->canUndo()) {
+    history->undo();
+    --step;
+    fill_step(expected.get(), step);
+    ASSERT_EQ(0, count_diff_between_images(expected.get(), image))
+      << "step " << step;
+  }
+  EXPECT_GT(step, 0);
+  EXPECT_TRUE(history->currentState() != nullptr);
+
+  // Temporary files of dropped states were deleted
+  EXPECT_LE(spillFiles, nsteps-step);
+
+  // Nothing happens undoing a dropped state
+  history->undo();
+  EXPECT_FALSE(history->canUndo());
+  EXPECT_EQ(0, count_diff_between_images(expected.get(), image));
+
+  while (history->canRedo()) {
+    history->redo();
+    ++step;
+    fill_step(expected.get(), step);
+    ASSERT_EQ(0, count_diff_between_images(expected.get(), image))
+      << "step " << step;
+  }
+  EXPECT_EQ(nsteps, step);
+
+  doc->close();
+  doc.reset();
+  EXPECT_EQ(0, count_spill_files());
+}
@@ -17,13 +17,22 @@
 #include "base/cfile.h"
 #include "base/exception.h"
 #include "base/file_handle.h"
+#include "base/fs.h"
+#include "base/mapped_file.h"
 #include "base/path.h"
+#include "base/thread_pool.h"
 #include "doc/doc.h"
 #include "ui/alert.h"
 #include "zlib.h"
 
+#include <algorithm>
 #include <cstdio>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
 
 #define ASE_FILE_MAGIC                      0xA5E0
 #define ASE_FILE_FRAME_MAGIC                0xF1FA
@@ -89,6 +98,9 @@ struct ASE_Chunk {
   int start;
 };
 
+class CelsDecoder;
+class CelsEncoder;
+
 static bool ase_file_read_header(FILE* f, ASE_Header* header);
 static void ase_file_prepare_header(FILE* f, ASE_Header* header, const Sprite* sprite);
 static void ase_file_write_header(FILE* f, ASE_Header* header);
@@ -99,7 +111,7 @@ static void ase_file_prepare_frame_header(FILE* f, ASE_FrameHeader* frame_header
 static void ase_file_write_frame_header(FILE* f, ASE_FrameHeader* frame_header);
 
 static void ase_file_write_layers(FILE* f, ASE_FrameHeader* frame_header, const Layer* layer);
-static void ase_file_write_cels(FILE* f, ASE_FrameHeader* frame_header, const Sprite* sprite, const Layer* layer, frame_t frame);
+static void ase_file_write_cels(FILE* f, ASE_FrameHeader* frame_header, const Sprite* sprite, const Layer* layer, frame_t frame, CelsEncoder* encoder);
 
 static void ase_file_read_padding(FILE* f, int bytes);
 static void ase_file_write_padding(FILE* f, int bytes);
@@ -116,8 +128,8 @@ static void ase_file_write_color2_chunk(FILE* f, ASE_FrameHeader* frame_header,
 static void ase_file_write_palette_chunk(FILE* f, ASE_FrameHeader* frame_header, const Palette* pal, int from, int to);
 static Layer* ase_file_read_layer_chunk(FILE* f, ASE_Header* header, Sprite* sprite, Layer** previous_layer, int* current_level);
 static void ase_file_write_layer_chunk(FILE* f, ASE_FrameHeader* frame_header, const Layer* layer);
-static Cel* ase_file_read_cel_chunk(FILE* f, Sprite* sprite, frame_t frame, PixelFormat pixelFormat, FileOp* fop, ASE_Header* header, size_t chunk_end);
-static void ase_file_write_cel_chunk(FILE* f, ASE_FrameHeader* frame_header, const Cel* cel, const LayerImage* layer, const Sprite* sprite);
+static Cel* ase_file_read_cel_chunk(FILE* f, Sprite* sprite, frame_t frame, PixelFormat pixelFormat, FileOp* fop, ASE_Header* header, size_t chunk_end, CelsDecoder* decoder);
+static void ase_file_write_cel_chunk(FILE* f, ASE_FrameHeader* frame_header, const Cel* cel, const LayerImage* layer, const Sprite* sprite, CelsEncoder* encoder);
 static Mask* ase_file_read_mask_chunk(FILE* f);
 #if 0
 static void ase_file_write_mask_chunk(FILE* f, ASE_FrameHeader* frame_header, Mask* mask);
@@ -144,6 +156,138 @@ private:
   ASE_Chunk m_chunk;
 };
 
+// Inflates the pixels of compressed cels using all cores. The cel
+// chunks are read sequentially from the file, their images are
+// created empty and their compressed data is queued here to be
+// decoded all together before the sprite is used.
+//
+// If the file is memory-mapped (lazy loading), images are not
+// decoded here, each one is decoded from the mapped file the first
+// time its pixels are used.
+class CelsDecoder {
+public:
+  // Maximum compressed bytes waiting to be decoded, so big files
+  // don't need all their compressed data in memory at once.
+  static const size_t kMaxPendingBytes = 64*1024*1024;
+
+  CelsDecoder(FileOp* fop, const std::shared_ptr<base::mapped_file>& file);
+
+  // Creates the image of a compressed cel, its data starts at the
+  // current position of "f" and ends at "chunk_end".
+  ImageRef readImage(FILE* f, PixelFormat pixelFormat, int w, int h, size_t chunk_end);
+
+  // Decodes all queued images. Errors are reported to the FileOp (in
+  // the same order as the cels were read), in that case the cel is
+  // kept anyway as when cels were decoded one by one.
+  void decode();
+
+private:
+  struct Item {
+    ImageRef image;
+    std::vector<uint8_t> compressed;
+    std::string error;
+  };
+
+  void add(const ImageRef& image, std::vector<uint8_t>&& compressed);
+
+  FileOp* m_fop;
+  std::shared_ptr<base::mapped_file> m_file;
+  std::string m_canonicalFilename;
+  std::vector<Item> m_items;
+  size_t m_pendingBytes;
+};
+
+// Decodes the pixels of a compressed cel from the memory-mapped
+// file when the lazy image needs them.
+class CelLoader : public ImageLoader {
+public:
+  CelLoader(const std::shared_ptr<base::mapped_file>& file,
+            const std::string& filename,
+            size_t offset, size_t size,
+            PixelFormat pixelFormat, int w, int h)
+    : m_file(file), m_filename(filename), m_offset(offset), m_size(size)
+    , m_pixelFormat(pixelFormat), m_width(w), m_height(h) { }
+
+  Image* loadImage() override;
+
+  // The compressed pixels of .ase cels are rows in the same byte
+  // order as in memory, like the pixels of write_image().
+  bool getCompressedPixels(std::vector<uint8_t>& data) override;
+
+  // Copies the compressed pixels from the mapped file to memory, so
+  // the file can be overwritten.
+  void detachFile();
+
+  // Calls detachFile() for all loaders of the given file that are
+  // still waiting to be used.
+  static void detachAll(const std::string& filename);
+
+private:
+  std::shared_ptr<base::mapped_file> m_file;
+  std::string m_filename;
+  std::vector<uint8_t> m_compressed; // Used when m_file is detached
+  size_t m_offset;
+  size_t m_size;
+  PixelFormat m_pixelFormat;
+  int m_width;
+  int m_height;
+  std::mutex m_mutex;
+};
+
+// Loaders of cels that weren't used yet, by the canonical path of
+// their file.
+static std::mutex cel_loaders_mutex;
+static std::multimap<std::string, std::weak_ptr<CelLoader>> cel_loaders;
+
+// Forgets loaders of images that were already loaded or deleted.
+static void remove_expired_cel_loaders()
+{
+  std::lock_guard<std::mutex> lock(cel_loaders_mutex);
+  for (auto it=cel_loaders.begin(); it!=cel_loaders.end(); ) {
+    if (it->second.expired())
+      it = cel_loaders.erase(it);
+    else
+      ++it;
+  }
+}
+
+static void add_cel_loader(const std::shared_ptr<CelLoader>& loader,
+                           const std::string& canonicalFilename)
+{
+  std::lock_guard<std::mutex> lock(cel_loaders_mutex);
+  cel_loaders.insert(std::make_pair(canonicalFilename, loader));
+}
+
+// Compresses the pixels of cels using all cores before they are
+// written in the file (in order).
+class CelsEncoder {
+public:
+  // Maximum uncompressed bytes encoded in advance.
+  static const size_t kMaxPendingBytes = 64*1024*1024;
+
+  // "level" is the zlib compression level, from 0 (no compression,
+  // fastest) to 9 (smallest files), or Z_DEFAULT_COMPRESSION.
+  explicit CelsEncoder(int level);
+
+  // Compresses the images of the cels from "fromFrame" to the frame
+  // where kMaxPendingBytes is reached (at least one frame). Returns
+  // the next frame that wasn't encoded.
+  frame_t encode(const Sprite* sprite, frame_t fromFrame);
+
+  // Writes the compressed pixels of the cel (compressing them now if
+  // they weren't encoded in advance).
+  void writeImage(FILE* f, const Cel* cel);
+
+private:
+  struct Item {
+    std::vector<uint8_t> compressed;
+    std::string error;
+  };
+
+  int m_level;
+  std::map<const Cel*, Item> m_items;
+};
+
 class AseFormat : public FileFormat {
   const char* onGetName() const override { return "ase"; }
   const char* onGetExtensions() const override { return "ase,aseprite"; }
@@ -198,6 +342,16 @@ bool AseFormat::onLoad(FileOp* fop)
   // Set transparent entry
   sprite->setTransparentColor(header.transparent_index);
 
+  // Compressed cels are decoded in parallel, or when they are used
+  // if the file can be memory-mapped
+  std::shared_ptr<base::mapped_file> mappedFile;
+  if (fop->config().aseLazyLoading) {
+    mappedFile = std::make_shared<base::mapped_file>();
+    if (!mappedFile->open(fop->filename()))
+      mappedFile.reset();
+  }
+  CelsDecoder decoder(fop, mappedFile);
+
   // Prepare variables for layer chunks
   Layer* last_layer = sprite->folder();
   WithUserData* last_object_with_user_data = nullptr;
@@ -267,7 +421,7 @@ bool AseFormat::onLoad(FileOp* fop)
             Cel* cel =
               ase_file_read_cel_chunk(f, sprite.get(), frame,
                                       sprite->pixelFormat(), fop, &header,
-                                      chunk_pos+chunk_size);
+                                      chunk_pos+chunk_size, &decoder);
             if (cel) {
               last_object_with_user_data = cel->data();
             }
@@ -320,6 +474,8 @@ bool AseFormat::onLoad(FileOp* fop)
       break;
   }
 
+  decoder.decode();
+
   fop->createDocument(sprite.get());
   sprite.release();
 
@@ -363,6 +519,11 @@ bool AseFormat::onPostLoad(FileOp* fop)
 bool AseFormat::onSave(FileOp* fop)
 {
   const Sprite* sprite = fop->document()->sprite();
+
+  // Lazy cels of any document could be loaded from the same file
+  // that we are going to overwrite
+  CelLoader::detachAll(fop->filename());
+
   FileHandle handle(open_file_with_exception(fop->filename(), "wb"));
   FILE* f = handle.get();
 
@@ -371,6 +532,12 @@ bool AseFormat::onSave(FileOp* fop)
   ase_file_prepare_header(f, &header, sprite);
   ase_file_write_header(f, &header);
 
+  // Cels are compressed in parallel some frames in advance
+  CelsEncoder encoder(MID(Z_DEFAULT_COMPRESSION,
+                          fop->config().aseCompressionLevel,
+                          Z_BEST_COMPRESSION));
+  frame_t encodedFrames = 0;
+
   bool require_new_palette_chunk = false;
   for (Palette* pal : sprite->getPalettes()) {
     if (pal->size() != 256 || pal->hasAlpha()) {
@@ -381,6 +548,9 @@ bool AseFormat::onSave(FileOp* fop)
 
   // Write frames
   for (frame_t frame(0); frame<sprite->totalFrames(); ++frame) {
+    if (frame >= encodedFrames)
+      encodedFrames = encoder.encode(sprite, frame);
+
     // Prepare the frame header
     ASE_FrameHeader frame_header;
     ase_file_prepare_frame_header(f, &frame_header);
@@ -418,7 +588,7 @@ bool AseFormat::onSave(FileOp* fop)
     }
 
     // Write cel chunks
-    ase_file_write_cels(f, &frame_header, sprite, sprite->folder(), frame);
+    ase_file_write_cels(f, &frame_header, sprite, sprite->folder(), frame, &encoder);
 
     // Write the frame header
     ase_file_write_frame_header(f, &frame_header);
@@ -582,14 +752,14 @@ static void ase_file_write_layers(FILE* f, ASE_FrameHeader* frame_header, const
   }
 }
 
-static void ase_file_write_cels(FILE* f, ASE_FrameHeader* frame_header, const Sprite* sprite, const Layer* layer, frame_t frame)
+static void ase_file_write_cels(FILE* f, ASE_FrameHeader* frame_header, const Sprite* sprite, const Layer* layer, frame_t frame, CelsEncoder* encoder)
 {
   if (layer->isImage()) {
     if (auto cel = layer->cel(frame)) {
 /*       fop->setError("New cel in frame %d, in layer %d\n", */
 /*                   frame, sprite_layer2index(sprite, layer)); */
 
-      ase_file_write_cel_chunk(f, frame_header, cel.get(), static_cast<const LayerImage*>(layer), sprite);
+      ase_file_write_cel_chunk(f, frame_header, cel.get(), static_cast<const LayerImage*>(layer), sprite, encoder);
 
       if (!cel->link() &&
           !cel->data()->userData().isEmpty()) {
@@ -604,7 +774,7 @@ static void ase_file_write_cels(FILE* f, ASE_FrameHeader* frame_header, const Sp
          end = static_cast<const LayerFolder*>(layer)->getLayerEnd();
 
     for (; it != end; ++it)
-      ase_file_write_cels(f, frame_header, sprite, *it, frame);
+      ase_file_write_cels(f, frame_header, sprite, *it, frame, encoder);
   }
 }
 
@@ -888,7 +1058,7 @@ public:
   typename ImageTraits::pixel_t read_pixel(FILE* f);
   void write_pixel(FILE* f, typename ImageTraits::pixel_t c);
   void read_scanline(typename ImageTraits::address_t address, int w, uint8_t* buffer);
-  void write_scanline(typename ImageTraits::address_t address, int w, uint8_t* buffer);
+  void write_scanline(typename ImageTraits::const_address_t address, int w, uint8_t* buffer);
 };
 
 template<>
@@ -918,7 +1088,7 @@ public:
       *(address++) = rgba(r, g, b, a);
     }
   }
-  void write_scanline(RgbTraits::address_t address, int w, uint8_t* buffer)
+  void write_scanline(RgbTraits::const_address_t address, int w, uint8_t* buffer)
   {
     for (int x=0; x<w; ++x) {
       *(buffer++) = rgba_getr(*address);
@@ -951,7 +1121,7 @@ public:
       *(address++) = graya(k, a);
     }
   }
-  void write_scanline(GrayscaleTraits::address_t address, int w, uint8_t* buffer)
+  void write_scanline(GrayscaleTraits::const_address_t address, int w, uint8_t* buffer)
   {
     for (int x=0; x<w; ++x) {
       *(buffer++) = graya_getv(*address);
@@ -974,7 +1144,7 @@ public:
   {
     memcpy(address, buffer, w);
   }
-  void write_scanline(IndexedTraits::address_t address, int w, uint8_t* buffer)
+  void write_scanline(IndexedTraits::const_address_t address, int w, uint8_t* buffer)
   {
     memcpy(buffer, address, w);
   }
@@ -999,13 +1169,13 @@ static void read_raw_image(FILE* f, Image* image, FileOp* fop, ASE_Header* heade
 }
 
 template<typename ImageTraits>
-static void write_raw_image(FILE* f, const Image* image)
+static void write_raw_image(FILE* f, const Image* image, const gfx::Rect& bounds)
 {
   PixelIO<ImageTraits> pixel_io;
   int x, y;
 
-  for (y=0; y<image->height(); y++)
-    for (x=0; x<image->width(); x++)
+  for (y=bounds.y; y<bounds.y2(); y++)
+    for (x=bounds.x; x<bounds.x2(); x++)
       pixel_io.write_pixel(f, get_pixel_fast<ImageTraits>(image, x, y));
 }
 
@@ -1014,7 +1184,7 @@ static void write_raw_image(FILE* f, const Image* image)
 //////////////////////////////////////////////////////////////////////
 
 template<typename ImageTraits>
-static void read_compressed_image(FILE* f, Image* image, size_t chunk_end, FileOp* fop, ASE_Header* header)
+static void inflate_compressed_image(const uint8_t* compressed, size_t size, Image* image)
 {
   PixelIO<ImageTraits> pixel_io;
   z_stream zstream;
@@ -1028,68 +1198,207 @@ static void read_compressed_image(FILE* f, Image* image, size_t chunk_end, FileO
   if (err != Z_OK)
     throw base::Exception("ZLib error %d in inflateInit().", err);
 
-  std::vector<uint8_t> scanline(ImageTraits::getRowStrideBytes(image->width()));
-  std::vector<uint8_t> uncompressed(static_cast<long>(image->height()) * ImageTraits::getRowStrideBytes(image->width()));
-  std::vector<uint8_t> compressed(4096);
-  int uncompressed_offset = 0;
+  const int rowStride = ImageTraits::getRowStrideBytes(image->width());
+  std::vector<uint8_t> uncompressed(static_cast<size_t>(image->height()) * rowStride);
+
+  zstream.next_in = (Bytef*)compressed;
+  zstream.avail_in = size;
+  zstream.next_out = (Bytef*)&uncompressed[0];
+  zstream.avail_out = uncompressed.size();
+
+  err = inflate(&zstream, Z_FINISH);
+  const bool overflow = (err != Z_STREAM_END &&
+                         zstream.avail_out == 0 &&
+                         zstream.avail_in > 0);
+  // The chunk ends before all pixels were decompressed (truncated
+  // file), the missing pixels are kept in zero.
+  const bool truncated = (err == Z_BUF_ERROR &&
+                          zstream.avail_out > 0);
+  const int endErr = inflateEnd(&zstream);
+
+  if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR)
+    throw base::Exception("ZLib error %d in inflate().", err);
+  if (overflow)
+    throw base::Exception("Bad compressed image.");
+  if (endErr != Z_OK)
+    throw base::Exception("ZLib error %d in inflateEnd().", endErr);
 
-  while (true) {
-    size_t input_bytes;
+  for (y=0; y<image->height(); y++) {
+    typename ImageTraits::address_t address =
+      (typename ImageTraits::address_t)image->getPixelAddress(0, y);
 
-    if (ftell(f)+compressed.size() > chunk_end) {
-      input_bytes = chunk_end - ftell(f); // Remaining bytes
-      ASSERT(input_bytes < compressed.size());
+    pixel_io.read_scanline(address, image->width(), &uncompressed[y*rowStride]);
+  }
 
-      if (input_bytes == 0)
-        break;                  // Done, we consumed all chunk
-    }
-    else
-      input_bytes = compressed.size();
+  if (truncated)
+    throw base::Exception("Incomplete compressed image.");
+}
 
-    size_t bytes_read = fread(&compressed[0], 1, input_bytes, f);
-    zstream.next_in = (Bytef*)&compressed[0];
-    zstream.avail_in = bytes_read;
+CelsDecoder::CelsDecoder(FileOp* fop, const std::shared_ptr<base::mapped_file>& file)
+  : m_fop(fop)
+  , m_file(file)
+  , m_pendingBytes(0)
+{
+  if (m_file) {
+    m_canonicalFilename = base::get_canonical_path(m_fop->filename());
+    remove_expired_cel_loaders();
+  }
+}
 
-    do {
-      zstream.next_out = (Bytef*)&scanline[0];
-      zstream.avail_out = scanline.size();
+ImageRef CelsDecoder::readImage(FILE* f, PixelFormat pixelFormat, int w, int h, size_t chunk_end)
+{
+  long pos = ftell(f);
+  if (pos < 0 || size_t(pos) >= chunk_end)
+    return ImageRef(Image::create(pixelFormat, w, h));
+
+  if (m_file) {
+    size_t end = std::min(chunk_end, m_file->size());
+    if (size_t(pos) < end) {
+      auto loader = std::make_shared<CelLoader>(m_file, m_fop->filename(),
+                                                pos, end - pos,
+                                                pixelFormat, w, h);
+      add_cel_loader(loader, m_canonicalFilename);
+      return ImageRef(Image::createLazy(pixelFormat, w, h, loader));
+    }
+  }
 
-      err = inflate(&zstream, Z_NO_FLUSH);
-      if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR)
-        throw base::Exception("ZLib error %d in inflate().", err);
+  // Read the compressed pixel data, it's decoded later
+  ImageRef image(Image::create(pixelFormat, w, h));
+  std::vector<uint8_t> compressed(chunk_end - pos);
+  compressed.resize(fread(&compressed[0], 1, compressed.size(), f));
+  add(image, std::move(compressed));
+  return image;
+}
 
-      size_t uncompressed_bytes = scanline.size() - zstream.avail_out;
-      if (uncompressed_bytes > 0) {
-        if (uncompressed_offset+uncompressed_bytes > uncompressed.size())
-          throw base::Exception("Bad compressed image.");
+void CelsDecoder::add(const ImageRef& image, std::vector<uint8_t>&& compressed)
+{
+  if (compressed.empty())
+    return;
 
-        std::copy(scanline.begin(), scanline.begin()+uncompressed_bytes,
-                  uncompressed.begin()+uncompressed_offset);
+  m_pendingBytes += compressed.size();
+  m_items.push_back(Item{ image, std::move(compressed), std::string() });
+  if (m_pendingBytes >= kMaxPendingBytes)
+    decode();
+}
 
-        uncompressed_offset += uncompressed_bytes;
+void CelsDecoder::decode()
+{
+  if (m_items.empty())
+    return;
+
+  base::thread_pool::instance().parallel_for(
+    int(m_items.size()),
+    [this](int i){
+      Item& item = m_items[i];
+      Image* image = item.image.get();
+      try {
+        switch (image->pixelFormat()) {
+          case IMAGE_RGB:
+            inflate_compressed_image<RgbTraits>(&item.compressed[0], item.compressed.size(), image);
+            break;
+          case IMAGE_GRAYSCALE:
+            inflate_compressed_image<GrayscaleTraits>(&item.compressed[0], item.compressed.size(), image);
+            break;
+          case IMAGE_INDEXED:
+            inflate_compressed_image<IndexedTraits>(&item.compressed[0], item.compressed.size(), image);
+            break;
+        }
+      }
+      catch (const std::exception& e) {
+        item.error = e.what();
       }
-    } while (zstream.avail_out == 0);
+    });
 
-    fop->setProgress((float)ftell(f) / (float)header->size);
+  for (const Item& item : m_items)
+    if (!item.error.empty())
+      m_fop->setError("%s\n", item.error.c_str());
+
+  m_items.clear();
+  m_pendingBytes = 0;
+}
+
+Image* CelLoader::loadImage()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  const uint8_t* data = nullptr;
+  if (m_file && !m_file->modified())
+    data = m_file->data() + m_offset;
+  else if (!m_file && m_compressed.size() == m_size)
+    data = &m_compressed[0];
+
+  // Reading a truncated mapped file would crash the program
+  if (!data)
+    throw base::Exception("The pixels of a cel cannot be loaded because\n"
+                          "the file was modified after it was opened:\n%s",
+                          m_filename.c_str());
+
+  std::unique_ptr<Image> image(Image::create(m_pixelFormat, m_width, m_height));
+  switch (m_pixelFormat) {
+    case IMAGE_RGB:
+      inflate_compressed_image<RgbTraits>(data, m_size, image.get());
+      break;
+    case IMAGE_GRAYSCALE:
+      inflate_compressed_image<GrayscaleTraits>(data, m_size, image.get());
+      break;
+    case IMAGE_INDEXED:
+      inflate_compressed_image<IndexedTraits>(data, m_size, image.get());
+      break;
   }
+  return image.release();
+}
 
-  uncompressed_offset = 0;
-  for (y=0; y<image->height(); y++) {
-    typename ImageTraits::address_t address =
-      (typename ImageTraits::address_t)image->getPixelAddress(0, y);
+bool CelLoader::getCompressedPixels(std::vector<uint8_t>& data)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  if (m_file && !m_file->modified())
+    data.assign(m_file->data() + m_offset,
+                m_file->data() + m_offset + m_size);
+  else if (!m_file && m_compressed.size() == m_size)
+    data = m_compressed;
+  else
+    return false;
+
+  return true;
+}
 
-    pixel_io.read_scanline(address, image->width(), &uncompressed[uncompressed_offset]);
+void CelLoader::detachFile()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (!m_file)
+    return;
+
+  // If the file was already modified the pixels are lost (an empty
+  // m_compressed is reported as an error by loadImage())
+  if (!m_file->modified())
+    m_compressed.assign(m_file->data() + m_offset,
+                        m_file->data() + m_offset + m_size);
+
+  // The file is unmapped when all its loaders are detached
+  m_file.reset();
+}
 
-    uncompressed_offset += ImageTraits::getRowStrideBytes(image->width());
+// static
+void CelLoader::detachAll(const std::string& filename)
+{
+  std::vector<std::shared_ptr<CelLoader>> loaders;
+  {
+    std::lock_guard<std::mutex> lock(cel_loaders_mutex);
+    auto range = cel_loaders.equal_range(base::get_canonical_path(filename));
+    for (auto it=range.first; it!=range.second; ++it)
+      if (auto loader = it->second.lock())
+        loaders.push_back(loader);
+    cel_loaders.erase(range.first, range.second);
   }
 
-  err = inflateEnd(&zstream);
-  if (err != Z_OK)
-    throw base::Exception("ZLib error %d in inflateEnd().", err);
+  for (auto& loader : loaders)
+    loader->detachFile();
 }
 
 template<typename ImageTraits>
-static void write_compressed_image(FILE* f, const Image* image)
+static void compress_image(const Image* image, const gfx::Rect& bounds, int level,
+                           std::vector<uint8_t>& compressed)
 {
   PixelIO<ImageTraits> pixel_io;
   z_stream zstream;
@@ -1098,53 +1407,139 @@ static void write_compressed_image(FILE* f, const Image* image)
   zstream.zalloc = (alloc_func)0;
   zstream.zfree  = (free_func)0;
   zstream.opaque = (voidpf)0;
-  err = deflateInit(&zstream, Z_DEFAULT_COMPRESSION);
+  err = deflateInit(&zstream, level);
   if (err != Z_OK)
     throw base::Exception("ZLib error %d in deflateInit().", err);
 
-  std::vector<uint8_t> scanline(ImageTraits::getRowStrideBytes(image->width()));
-  std::vector<uint8_t> compressed(4096);
+  std::vector<uint8_t> scanline(ImageTraits::getRowStrideBytes(bounds.w));
 
-  for (y=0; y<image->height(); y++) {
-    typename ImageTraits::address_t address =
-      (typename ImageTraits::address_t)image->getPixelAddress(0, y);
+  // deflateBound() is enough to compress the whole image in one pass
+  compressed.resize(deflateBound(&zstream, static_cast<uLong>(scanline.size()) * bounds.h));
+  zstream.next_out = (Bytef*)&compressed[0];
+  zstream.avail_out = compressed.size();
 
-    pixel_io.write_scanline(address, image->width(), &scanline[0]);
+  for (y=bounds.y; y<bounds.y2(); y++) {
+    typename ImageTraits::const_address_t address =
+      (typename ImageTraits::const_address_t)image->getConstPixelAddress(bounds.x, y);
+
+    pixel_io.write_scanline(address, bounds.w, &scanline[0]);
 
     zstream.next_in = (Bytef*)&scanline[0];
     zstream.avail_in = scanline.size();
-    int flush = (y == image->height()-1 ? Z_FINISH: Z_NO_FLUSH);
-
-    do {
-      zstream.next_out = (Bytef*)&compressed[0];
-      zstream.avail_out = compressed.size();
-
-      // Compress
-      err = deflate(&zstream, flush);
-      if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR)
-        throw base::Exception("ZLib error %d in deflate().", err);
-
-      int output_bytes = compressed.size() - zstream.avail_out;
-      if (output_bytes > 0) {
-        if ((fwrite(&compressed[0], 1, output_bytes, f) != (size_t)output_bytes)
-            || ferror(f))
-          throw base::Exception("Error writing compressed image pixels.\n");
-      }
-    } while (zstream.avail_out == 0);
+    int flush = (y == bounds.y2()-1 ? Z_FINISH: Z_NO_FLUSH);
+
+    // Compress
+    err = deflate(&zstream, flush);
+    if ((err != Z_OK && err != Z_STREAM_END) ||
+        (flush == Z_FINISH && err != Z_STREAM_END)) {
+      deflateEnd(&zstream);
+      throw base::Exception("ZLib error %d in deflate().", err);
+    }
   }
 
+  compressed.resize(compressed.size() - zstream.avail_out);
+
   err = deflateEnd(&zstream);
   if (err != Z_OK)
     throw base::Exception("ZLib error %d in deflateEnd().", err);
 }
 
+static void write_compressed_data(FILE* f, const std::vector<uint8_t>& compressed)
+{
+  if (!compressed.empty() &&
+      ((fwrite(&compressed[0], 1, compressed.size(), f) != compressed.size())
+       || ferror(f)))
+    throw base::Exception("Error writing compressed image pixels.\n");
+}
+
+static void compress_cel_image(const Cel* cel, int level, std::vector<uint8_t>& compressed)
+{
+  const Image* image = cel->image();
+  const gfx::Rect bounds = image->bounds();
+
+  switch (image->pixelFormat()) {
+
+    case IMAGE_RGB:
+      compress_image<RgbTraits>(image, bounds, level, compressed);
+      break;
+
+    case IMAGE_GRAYSCALE:
+      compress_image<GrayscaleTraits>(image, bounds, level, compressed);
+      break;
+
+    case IMAGE_INDEXED:
+      compress_image<IndexedTraits>(image, bounds, level, compressed);
+      break;
+  }
+}
+
+CelsEncoder::CelsEncoder(int level)
+  : m_level(level)
+{
+}
+
+frame_t CelsEncoder::encode(const Sprite* sprite, frame_t fromFrame)
+{
+  m_items.clear();
+
+  // Collect the cels of the next frames until we've enough pixels
+  frame_t frame = fromFrame;
+  size_t bytes = 0;
+  for (; frame<sprite->totalFrames() && bytes < kMaxPendingBytes; ++frame) {
+    for (auto cel : sprite->cels(frame)) {
+      if (cel->link() || !cel->image())
+        continue;
+
+      const Image* image = cel->image();
+      bytes += size_t(image->getRowStrideSize()) * image->height();
+      m_items[cel.get()];
+    }
+  }
+
+  std::vector<std::pair<const Cel* const, Item>*> items;
+  for (auto& it : m_items)
+    items.push_back(&it);
+
+  base::thread_pool::instance().parallel_for(
+    int(items.size()),
+    [this, &items](int i){
+      Item& item = items[i]->second;
+      try {
+        compress_cel_image(items[i]->first, m_level, item.compressed);
+      }
+      catch (const std::exception& e) {
+        item.error = e.what();
+      }
+    });
+
+  return frame;
+}
+
+void CelsEncoder::writeImage(FILE* f, const Cel* cel)
+{
+  auto it = m_items.find(cel);
+  if (it == m_items.end()) {
+    // Not encoded in advance
+    std::vector<uint8_t> compressed;
+    compress_cel_image(cel, m_level, compressed);
+    write_compressed_data(f, compressed);
+    return;
+  }
+
+  if (!it->second.error.empty())
+    throw base::Exception(it->second.error);
+
+  write_compressed_data(f, it->second.compressed);
+}
+
 //////////////////////////////////////////////////////////////////////
 // Cel Chunk
 //////////////////////////////////////////////////////////////////////
 
 static Cel* ase_file_read_cel_chunk(FILE* f, Sprite* sprite, frame_t frame,
                                     PixelFormat pixelFormat,
-                                    FileOp* fop, ASE_Header* header, size_t chunk_end)
+                                    FileOp* fop, ASE_Header* header, size_t chunk_end,
+                                    CelsDecoder* decoder)
 {
   /* read chunk data */
   LayerIndex layer_index = LayerIndex(fgetw(f));
@@ -1216,6 +1611,9 @@ static Cel* ase_file_read_cel_chunk(FILE* f, Sprite* sprite, frame_t frame,
           cel->setFrame(frame);
         }
         else {
+          // The copy needs the pixels of the linked cel
+          decoder->decode();
+
           cel = Cel::createCopy(link);
           cel->setFrame(frame);
           cel->setPosition(x, y);
@@ -1234,30 +1632,8 @@ static Cel* ase_file_read_cel_chunk(FILE* f, Sprite* sprite, frame_t frame,
       int h = fgetw(f);
 
       if (w > 0 && h > 0) {
-        ImageRef image(Image::create(pixelFormat, w, h));
-
-        // Try to read pixel data
-        try {
-          switch (image->pixelFormat()) {
-
-            case IMAGE_RGB:
-              read_compressed_image<RgbTraits>(f, image.get(), chunk_end, fop, header);
-              break;
-
-            case IMAGE_GRAYSCALE:
-              read_compressed_image<GrayscaleTraits>(f, image.get(), chunk_end, fop, header);
-              break;
-
-            case IMAGE_INDEXED:
-              read_compressed_image<IndexedTraits>(f, image.get(), chunk_end, fop, header);
-              break;
-          }
-        }
-        // OK, in case of error we can show the problem, but continue
-        // loading more cels.
-        catch (const std::exception& e) {
-          fop->setError(e.what());
-        }
+        ImageRef image(decoder->readImage(f, pixelFormat, w, h, chunk_end));
+        fop->setProgress((float)ftell(f) / (float)header->size);
 
         cel = std::make_shared<Cel>(frame, image);
         cel->setPosition(x, y);
@@ -1275,7 +1651,8 @@ static Cel* ase_file_read_cel_chunk(FILE* f, Sprite* sprite, frame_t frame,
 }
 
 static void ase_file_write_cel_chunk(FILE* f, ASE_FrameHeader* frame_header,
-                                     const Cel* cel, const LayerImage* layer, const Sprite* sprite)
+                                     const Cel* cel, const LayerImage* layer, const Sprite* sprite,
+                                     CelsEncoder* encoder)
 {
   ChunkWriter chunk(f, frame_header, ASE_FILE_CHUNK_CEL);
 
@@ -1283,6 +1660,11 @@ static void ase_file_write_cel_chunk(FILE* f, ASE_FrameHeader* frame_header,
   auto link = cel->link();
   int cel_type = (link ? ASE_FILE_LINK_CEL: ASE_FILE_COMPRESSED_CEL);
 
+  const Image* image = cel->image();
+  gfx::Rect bounds;
+  if (image)
+    bounds = image->bounds();
+
   fputw(layer_index, f);
   fputw(cel->x(), f);
   fputw(cel->y(), f);
@@ -1293,26 +1675,24 @@ static void ase_file_write_cel_chunk(FILE* f, ASE_FrameHeader* frame_header,
   switch (cel_type) {
 
     case ASE_FILE_RAW_CEL: {
-      const Image* image = cel->image();
-
       if (image) {
         // Width and height
-        fputw(image->width(), f);
-        fputw(image->height(), f);
+        fputw(bounds.w, f);
+        fputw(bounds.h, f);
 
         // Pixel data
         switch (image->pixelFormat()) {
 
           case IMAGE_RGB:
-            write_raw_image<RgbTraits>(f, image);
+            write_raw_image<RgbTraits>(f, image, bounds);
             break;
 
           case IMAGE_GRAYSCALE:
-            write_raw_image<GrayscaleTraits>(f, image);
+            write_raw_image<GrayscaleTraits>(f, image, bounds);
             break;
 
           case IMAGE_INDEXED:
-            write_raw_image<IndexedTraits>(f, image);
+            write_raw_image<IndexedTraits>(f, image, bounds);
             break;
         }
       }
@@ -1330,28 +1710,13 @@ static void ase_file_write_cel_chunk(FILE* f, ASE_FrameHeader* frame_header,
       break;
 
     case ASE_FILE_COMPRESSED_CEL: {
-      const Image* image = cel->image();
-
       if (image) {
         // Width and height
-        fputw(image->width(), f);
-        fputw(image->height(), f);
+        fputw(bounds.w, f);
+        fputw(bounds.h, f);
 
         // Pixel data
-        switch (image->pixelFormat()) {
-
-          case IMAGE_RGB:
-            write_compressed_image<RgbTraits>(f, image);
-            break;
-
-          case IMAGE_GRAYSCALE:
-            write_compressed_image<GrayscaleTraits>(f, image);
-            break;
-
-          case IMAGE_INDEXED:
-            write_compressed_image<IndexedTraits>(f, image);
-            break;
-        }
+        encoder->writeImage(f, cel);
       }
       else {
         // Width and height
@@ -21,20 +21,26 @@
 #include "app/filename_formatter.h"
 #include "app/modules/gui.h"
 #include "app/modules/palettes.h"
+#include "app/pref/preferences.h"
 #include "app/ui/status_bar.h"
+#include "base/exception.h"
 #include "base/fs.h"
 #include "base/mutex.h"
 #include "base/path.h"
 #include "base/scoped_lock.h"
 #include "base/shared_ptr.h"
 #include "base/string.h"
+#include "base/thread_pool.h"
 #include "doc/doc.h"
 #include "render/quantization.h"
 #include "render/render.h"
 #include "ui/alert.h"
+#include "zlib.h"
 
 #include <cstring>
 #include <cstdarg>
+#include <memory>
+#include <vector>
 
 namespace app {
 
@@ -70,10 +76,11 @@ std::string get_writable_extensions()
   return buf;
 }
 
-Document* load_document(Context* context, const char* filename)
+Document* load_document(Context* context, const char* filename,
+                        const FileOpConfig* config)
 {
   /* TODO add a option to configure what to do with the sequence */
-  std::unique_ptr<FileOp> fop(FileOp::createLoadDocumentOperation(context, filename, FILE_LOAD_SEQUENCE_NONE));
+  std::unique_ptr<FileOp> fop(FileOp::createLoadDocumentOperation(context, filename, FILE_LOAD_SEQUENCE_NONE, config));
   if (!fop)
     return nullptr;
 
@@ -96,7 +103,8 @@ Document* load_document(Context* context, const char* filename)
   return document;
 }
 
-int save_document(Context* context, doc::Document* document)
+int save_document(Context* context, doc::Document* document,
+                  const FileOpConfig* config)
 {
   ASSERT(dynamic_cast<app::Document*>(document));
 
@@ -104,7 +112,7 @@ int save_document(Context* context, doc::Document* document)
     FileOp::createSaveDocumentOperation(
       context,
       static_cast<app::Document*>(document),
-      document->filename().c_str(), ""));
+      document->filename().c_str(), "", config));
   if (!fop)
     return -1;
 
@@ -121,10 +129,11 @@ int save_document(Context* context, doc::Document* document)
 }
 
 // static
-FileOp* FileOp::createLoadDocumentOperation(Context* context, const char* filename, int flags)
+FileOp* FileOp::createLoadDocumentOperation(Context* context, const char* filename, int flags,
+                                            const FileOpConfig* config)
 {
   std::unique_ptr<FileOp> fop(
-    new FileOp(FileOpLoad, context));
+    new FileOp(FileOpLoad, context, config));
   if (!fop)
     return nullptr;
 
@@ -208,6 +217,12 @@ FileOp* FileOp::createLoadDocumentOperation(Context* context, const char* filena
   else
     fop->m_filename = filename;
 
+  // Long sequences can be kept compressed in memory
+  if (fop->m_seq.filename_list.size() > 1 &&
+      fop->m_config.compressSequenceFrames) {
+    fop->m_seq.compress_frames = true;
+  }
+
   /* load just one frame */
   if (flags & FILE_LOAD_ONE_FRAME)
     fop->m_oneframe = true;
@@ -220,10 +235,11 @@ done:;
 FileOp* FileOp::createSaveDocumentOperation(const Context* context,
                                             const Document* document,
                                             const char* filename,
-                                            const char* fn_format_arg)
+                                            const char* fn_format_arg,
+                                            const FileOpConfig* config)
 {
   std::unique_ptr<FileOp> fop(
-    new FileOp(FileOpSave, const_cast<Context*>(context)));
+    new FileOp(FileOpSave, const_cast<Context*>(context), config));
 
   // Document to save
   fop->m_document = const_cast<Document*>(document);
@@ -477,6 +493,87 @@ FileOp* FileOp::createSaveDocumentOperation(const Context* context,
   return fop.release();
 }
 
+// Keeps the pixels of a frame loaded from a sequence of files
+// compressed in memory until the frame is used (see the
+// "sequence_format.compress_frames" preference).
+class CompressedFrameLoader : public ImageLoader {
+public:
+  // Compresses the pixels of "image" (it's not needed after this).
+  explicit CompressedFrameLoader(const Image* image);
+
+  Image* loadImage() override;
+
+private:
+  PixelFormat m_pixelFormat;
+  int m_width;
+  int m_height;
+  std::vector<uint8_t> m_compressed;
+};
+
+CompressedFrameLoader::CompressedFrameLoader(const Image* image)
+  : m_pixelFormat(image->pixelFormat())
+  , m_width(image->width())
+  , m_height(image->height())
+{
+  const int rowBytes = image->getRowStrideSize();
+  z_stream zstream;
+  std::memset(&zstream, 0, sizeof(zstream));
+
+  int err = deflateInit(&zstream, Z_BEST_SPEED);
+  if (err != Z_OK)
+    throw base::Exception("ZLib error %d in deflateInit().", err);
+
+  m_compressed.resize(deflateBound(&zstream, uLong(rowBytes) * m_height));
+  zstream.next_out = (Bytef*)&m_compressed[0];
+  zstream.avail_out = uInt(m_compressed.size());
+
+  for (int y=0; y<m_height && err == Z_OK; ++y) {
+    zstream.next_in = (Bytef*)image->getConstPixelAddress(0, y);
+    zstream.avail_in = rowBytes;
+    err = deflate(&zstream, (y+1 < m_height ? Z_NO_FLUSH: Z_FINISH));
+  }
+
+  const uLong size = zstream.total_out;
+  deflateEnd(&zstream);
+  if (err != Z_STREAM_END)
+    throw base::Exception("ZLib error %d in deflate().", err);
+
+  m_compressed.resize(size);
+  m_compressed.shrink_to_fit();
+}
+
+Image* CompressedFrameLoader::loadImage()
+{
+  std::unique_ptr<Image> image(Image::create(m_pixelFormat, m_width, m_height));
+  const int rowBytes = image->getRowStrideSize();
+  z_stream zstream;
+  std::memset(&zstream, 0, sizeof(zstream));
+
+  int err = inflateInit(&zstream);
+  if (err != Z_OK)
+    throw base::Exception("ZLib error %d in inflateInit().", err);
+
+  zstream.next_in = (Bytef*)&m_compressed[0];
+  zstream.avail_in = uInt(m_compressed.size());
+
+  for (int y=0; y<m_height && err == Z_OK; ++y) {
+    zstream.next_out = (Bytef*)image->getPixelAddress(0, y);
+    zstream.avail_out = rowBytes;
+    err = inflate(&zstream, Z_SYNC_FLUSH);
+    if ((err == Z_OK || err == Z_STREAM_END) && zstream.avail_out > 0)
+      err = Z_DATA_ERROR;
+  }
+
+  // Errors are reported to the user by the lazy image (see
+  // doc::set_image_load_error_handler())
+  inflateEnd(&zstream);
+  if (err != Z_STREAM_END)
+    throw base::Exception("Error decompressing the pixels of a frame "
+                          "(ZLib error %d in inflate()).", err);
+
+  return image.release();
+}
+
 // Executes the file operation: loads or saves the sprite.
 //
 // It can be called from a different thread of the one used
@@ -524,13 +621,46 @@ void FileOp::operate(IFileOpProgress* progress)
       m_seq.progress_offset = 0.0f;
       m_seq.progress_fraction = 1.0f / (double)frames;
 
-      auto it = m_seq.filename_list.begin(),
-           end = m_seq.filename_list.end();
-      for (; it != end; ++it) {
-        m_filename = it->c_str();
+      // The first file is loaded directly in this FileOp (it creates
+      // the document), the next files are decoded in parallel in
+      // groups of "prefetch" files and added in order.
+      base::thread_pool& pool = base::thread_pool::instance();
+      const int prefetch = pool.concurrency();
+      std::vector<std::unique_ptr<FileOp>> decoded;
+      std::vector<int> decodedRes;
+
+      for (; frame < frames; ++frame) {
+        m_filename = m_seq.filename_list[frame];
+
+        bool loadres;
+        if (frame == 0) {
+          // Call the "load" procedure to read the first bitmap.
+          loadres = m_format->load(this);
+        }
+        else {
+          const int i = (frame-1) % prefetch;
+          if (i == 0) {
+            if (isStop())
+              break;
+
+            const frame_t first = frame;
+            decoded.clear();
+            decoded.resize(std::min<int>(prefetch, frames-first));
+            decodedRes.assign(decoded.size(), false);
+            pool.parallel_for(
+              int(decoded.size()),
+              [this, first, &decoded, &decodedRes](int j){
+                bool res;
+                decoded[j].reset(
+                  decodeSequenceFrame(m_seq.filename_list[first+j], res));
+                decodedRes[j] = res;
+              });
+          }
+
+          loadres = takeSequenceFrame(decoded[i].get(), decodedRes[i] != 0);
+          decoded[i].reset();
+        }
 
-        // Call the "load" procedure to read the first bitmap.
-        bool loadres = m_format->load(this);
         if (!loadres) {
           setError("Error loading frame %d from file \"%s\"\n",
                    frame+1, m_filename.c_str());
@@ -580,9 +710,15 @@ void FileOp::operate(IFileOpProgress* progress)
 #endif
         }
 
-        ++frame;
+        setProgress(1.0);
         m_seq.progress_offset += m_seq.progress_fraction;
       }
+
+      // Frames decoded after an error are discarded
+      for (auto& fop : decoded) {
+        if (fop)
+          delete fop->releaseDocument();
+      }
       m_filename = *m_seq.filename_list.begin();
 
       // Final setup
@@ -724,9 +860,13 @@ void FileOp::postLoad()
     if (sprite->pixelFormat() == IMAGE_RGB &&
         sprite->getPalettes().size() <= 1 &&
         sprite->palette(frame_t(0))->isBlack()) {
+      // Compressed frames are not decompressed just to create the
+      // palette, the first frame is used in that case.
+      frame_t toFrame = (m_seq.compress_frames ? frame_t(0):
+                                                 sprite->lastFrame());
       base::SharedPtr<Palette> palette(
         render::create_palette_from_sprite(
-          sprite, frame_t(0), sprite->lastFrame(), true,
+          sprite, frame_t(0), toFrame, true,
           nullptr, nullptr));
 
       sprite->resetPalettes();
@@ -867,7 +1007,7 @@ void FileOp::setProgress(double progress)
   }
 
   if (m_progressInterface)
-    m_progressInterface->ackFileOpProgress(progress);
+    m_progressInterface->ackFileOpProgress(m_progress);
 }
 
 double FileOp::progress() const
@@ -902,7 +1042,7 @@ bool FileOp::isStop() const
   return stop;
 }
 
-FileOp::FileOp(FileOpType type, Context* context)
+FileOp::FileOp(FileOpType type, Context* context, const FileOpConfig* config)
   : m_type(type)
   , m_format(nullptr)
   , m_context(context)
@@ -920,6 +1060,12 @@ FileOp::FileOp(FileOpType type, Context* context)
   m_seq.frame = frame_t(0);
   m_seq.layer = nullptr;
   m_seq.last_cel = nullptr;
+  m_seq.compress_frames = false;
+
+  if (config)
+    m_config = *config;
+  else
+    m_config.fillFromPreferences();
 }
 
 void FileOp::prepareForSequence()
@@ -928,4 +1074,65 @@ void FileOp::prepareForSequence()
   m_seq.format_options.reset();
 }
 
+// Decodes one file of the sequence in a new FileOp, as if it were the
+// first file of a sequence. It can be called from several threads at
+// the same time.
+FileOp* FileOp::decodeSequenceFrame(const std::string& filename, bool& loadres) const
+{
+  std::unique_ptr<FileOp> fop(new FileOp(FileOpLoad, m_context, &m_config));
+  fop->m_format = m_format;
+  fop->prepareForSequence();
+  fop->m_seq.filename_list.push_back(filename);
+  fop->m_filename = filename;
+
+  try {
+    loadres = m_format->load(fop.get());
+
+    const Image* image = fop->m_seq.image.get();
+    if (loadres && image && m_seq.compress_frames) {
+      ImageLoaderPtr loader(new CompressedFrameLoader(image));
+      fop->m_seq.image.reset(
+        Image::createLazy(image->pixelFormat(),
+                          image->width(),
+                          image->height(), loader));
+    }
+  }
+  catch (const std::exception& e) {
+    fop->setError("%s\n", e.what());
+    loadres = false;
+  }
+
+  return fop.release();
+}
+
+// Adds the frame decoded by decodeSequenceFrame() to this FileOp as
+// if it were loaded with m_format->load(this). Returns the result of
+// the load.
+bool FileOp::takeSequenceFrame(FileOp* fop, bool loadres)
+{
+  if (fop->hasError())
+    setError("%s", fop->error().c_str());
+
+  std::unique_ptr<Document> doc(fop->releaseDocument());
+  if (!doc || !fop->m_seq.image)
+    return loadres;
+
+  // All frames must have the same pixel format (as in sequenceImage())
+  Sprite* sprite = m_document->sprite();
+  if (fop->m_seq.image->pixelFormat() != sprite->pixelFormat())
+    return false;
+
+  if (fop->m_seq.has_alpha)
+    m_seq.has_alpha = true;
+
+  if (doc->sprite()->transparentColor() != 0)
+    sprite->setTransparentColor(doc->sprite()->transparentColor());
+
+  fop->m_seq.palette->copyColorsTo(m_seq.palette);
+
+  m_seq.image = fop->m_seq.image;
+  m_seq.last_cel = std::make_shared<Cel>(m_seq.frame++, ImageRef(nullptr));
+  return loadres;
+}
+
 } // namespace app
@@ -7,6 +7,7 @@
 
 #pragma once
 
+#include "app/file/file_op_config.h"
 #include "base/mutex.h"
 #include "base/shared_ptr.h"
 #include "doc/frame.h"
@@ -59,8 +60,11 @@ namespace app {
   // Structure to load & save files.
   class FileOp {
   public:
-    static FileOp* createLoadDocumentOperation(Context* context, const char* filename, int flags);
-    static FileOp* createSaveDocumentOperation(const Context* context, const Document* document, const char* filename, const char* fn_format);
+    // Without a config the options are taken from the preferences.
+    static FileOp* createLoadDocumentOperation(Context* context, const char* filename, int flags,
+                                               const FileOpConfig* config = nullptr);
+    static FileOp* createSaveDocumentOperation(const Context* context, const Document* document, const char* filename, const char* fn_format,
+                                               const FileOpConfig* config = nullptr);
 
     ~FileOp();
 
@@ -69,6 +73,7 @@ namespace app {
 
     const std::string& filename() const { return m_filename; }
     Context* context() const { return m_context; }
+    const FileOpConfig& config() const { return m_config; }
     Document* document() const { return m_document; }
     Document* releaseDocument() {
       Document* doc = m_document;
@@ -115,7 +120,7 @@ namespace app {
 
   private:
     FileOp();                   // Undefined
-    FileOp(FileOpType type, Context* context);
+    FileOp(FileOpType type, Context* context, const FileOpConfig* config);
 
     FileOpType m_type;          // Operation type: 0=load, 1=save.
     FileFormat* m_format;
@@ -124,6 +129,7 @@ namespace app {
     //      releaseDocument() member function)
     Document* m_document;       // Loaded document, or document to be saved.
     std::string m_filename;     // File-name to load/save.
+    FileOpConfig m_config;
 
     // Shared fields between threads.
     mutable base::mutex m_mutex; // Mutex to access to the next two fields.
@@ -150,9 +156,14 @@ namespace app {
       LayerImage* layer;
       std::shared_ptr<Cel> last_cel;
       base::SharedPtr<FormatOptions> format_options;
+      // Keep loaded frames (except the first one) compressed in
+      // memory until they are used.
+      bool compress_frames;
     } m_seq;
 
     void prepareForSequence();
+    FileOp* decodeSequenceFrame(const std::string& filename, bool& loadres) const;
+    bool takeSequenceFrame(FileOp* fop, bool loadres);
   };
 
   // Available extensions for each load/save operation.
@@ -162,7 +173,9 @@ namespace app {
 
   // High-level routines to load/save documents.
 
-  app::Document* load_document(Context* context, const char* filename);
-  int save_document(Context* context, doc::Document* document);
+  app::Document* load_document(Context* context, const char* filename,
+                               const FileOpConfig* config = nullptr);
+  int save_document(Context* context, doc::Document* document,
+                    const FileOpConfig* config = nullptr);
 
 } // namespace app
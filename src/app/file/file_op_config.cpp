@@ -0,0 +1,30 @@
+// LibreSprite
+// Copyright (C) 2026  LibreSprite contributors
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/file/file_op_config.h"
+
+#include "app/app.h"
+#include "app/pref/preferences.h"
+
+namespace app {
+
+void FileOpConfig::fillFromPreferences()
+{
+  if (!App::instance())
+    return;
+
+  Preferences& pref = App::instance()->preferences();
+  aseLazyLoading = pref.aseFormat.lazyLoading();
+  aseCompressionLevel = pref.aseFormat.compressionLevel();
+  compressSequenceFrames = pref.sequenceFormat.compressFrames();
+}
+
+} // namespace app
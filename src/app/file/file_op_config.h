@@ -0,0 +1,29 @@
+// LibreSprite
+// Copyright (C) 2026  LibreSprite contributors
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation.
+
+#pragma once
+
+namespace app {
+
+  // Options of a FileOp that come from the user preferences. Tests
+  // (where there is no App instance) can give their own options to
+  // FileOp::createLoadDocumentOperation()/createSaveDocumentOperation().
+  struct FileOpConfig {
+    // Load the pixels of .ase cels the first time they are used.
+    bool aseLazyLoading = false;
+
+    // zlib compression level of .ase cels (-1 is the zlib default).
+    int aseCompressionLevel = -1;
+
+    // Keep the frames of long sequences compressed in memory.
+    bool compressSequenceFrames = false;
+
+    // Uses the preferences of the App instance (if there is one).
+    void fillFromPreferences();
+  };
+
+} // namespace app
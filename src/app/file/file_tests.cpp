@@ -12,14 +12,182 @@
 #include "app/document.h"
 #include "app/file/file.h"
 #include "app/file/file_formats_manager.h"
+#include "app/file/file_op_config.h"
+#include "base/fs.h"
+#include "base/thread_pool.h"
 #include "doc/doc.h"
+#include "render/render.h"
 
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
 #include <vector>
 
 using namespace app;
 
+// Fills the image with runs of random colors (so it can be compressed).
+static void fill_random_runs(Image* image, int seed)
+{
+  std::srand(seed);
+  color_t c = 0;
+  for (int y=0; y<image->height(); ++y) {
+    for (int x=0; x<image->width(); ++x) {
+      if ((std::rand() & 7) == 0)
+        c = rgba(std::rand()%256, std::rand()%256, std::rand()%256, 255);
+      put_pixel_fast<RgbTraits>(image, x, y, c);
+    }
+  }
+}
+
+// Creates a RGB sprite with two layers of random cels. The cel of
+// each third frame is a link to the cel of the previous frame.
+static doc::Document* create_document_with_cels(app::Context* ctx, int w, int h, int nframes)
+{
+  doc::Document* doc = ctx->documents().add(w, h, doc::ColorMode::RGB);
+  Sprite* sprite = doc->sprite();
+  sprite->setTotalFrames(frame_t(nframes));
+
+  LayerImage* layer2 = new LayerImage(sprite);
+  sprite->folder()->addLayer(layer2);
+
+  int seed = 1;
+  for (int i=0; i<2; ++i) {
+    LayerImage* layer = static_cast<LayerImage*>(sprite->layer(i));
+    for (frame_t frame(0); frame<nframes; ++frame) {
+      if (frame > 0 && (frame % 3) == 0) {
+        std::shared_ptr<Cel> link = Cel::createLink(layer->cel(frame-1));
+        link->setFrame(frame);
+        layer->addCel(link);
+        continue;
+      }
+
+      std::shared_ptr<Cel> cel = layer->cel(frame);
+      if (!cel) {
+        cel = std::make_shared<Cel>(frame, ImageRef(Image::create(IMAGE_RGB, w, h)));
+        layer->addCel(cel);
+      }
+      fill_random_runs(cel->image(), seed++);
+    }
+  }
+  return doc;
+}
+
+static void expect_same_cels(const Sprite* expected, const Sprite* sprite)
+{
+  ASSERT_EQ(expected->totalFrames(), sprite->totalFrames());
+  for (int i=0; i<2; ++i) {
+    for (frame_t frame(0); frame<expected->totalFrames(); ++frame) {
+      std::shared_ptr<Cel> a = expected->layer(i)->cel(frame);
+      std::shared_ptr<Cel> b = sprite->layer(i)->cel(frame);
+      ASSERT_TRUE(b != nullptr) << "layer " << i << " frame " << frame;
+      EXPECT_EQ(a->position(), b->position());
+      EXPECT_EQ(0, count_diff_between_images(a->image(), b->image()))
+        << "layer " << i << " frame " << frame;
+      EXPECT_EQ(a->link() != nullptr, b->link() != nullptr)
+        << "layer " << i << " frame " << frame;
+      if (b->link()) {
+        EXPECT_EQ(b->link()->image(), b->image());
+      }
+    }
+  }
+}
+
+static std::vector<uint8_t> read_file_bytes(const char* filename)
+{
+  std::ifstream f(filename, std::ios::binary);
+  return std::vector<uint8_t>(std::istreambuf_iterator<char>(f),
+                              std::istreambuf_iterator<char>());
+}
+
+static void write_file_bytes(const char* filename, const std::vector<uint8_t>& data)
+{
+  std::ofstream f(filename, std::ios::binary | std::ios::trunc);
+  f.write((const char*)&data[0], data.size());
+}
+
+// Returns the file offset of the last cel chunk of each frame of the
+// given .ase file data.
+static std::vector<size_t> find_ase_cel_chunks(const std::vector<uint8_t>& data)
+{
+  auto word = [&data](size_t i) -> size_t {
+    return data[i] | (data[i+1] << 8);
+  };
+  auto dword = [&word](size_t i) -> size_t {
+    return word(i) | (word(i+2) << 16);
+  };
+
+  std::vector<size_t> cels;
+  size_t frame_pos = 128;                // After the file header
+  for (size_t frame=0; frame<word(6); ++frame) {
+    size_t chunk_pos = frame_pos+16;     // After the frame header
+    size_t cel_pos = 0;
+    for (size_t c=0; c<word(frame_pos+6); ++c) {
+      if (word(chunk_pos+4) == 0x2005)   // Cel chunk
+        cel_pos = chunk_pos;
+      chunk_pos += dword(chunk_pos);
+    }
+    cels.push_back(cel_pos);
+    frame_pos += dword(frame_pos);
+  }
+  return cels;
+}
+
+// Frame information of a .gif file read directly from its blocks.
+struct GifFrameInfo {
+  int disposal = 0;
+  int delay = 0;                        // In 1/100th of second
+  gfx::Rect bounds;
+  std::vector<color_t> colormap;        // Local color table
+};
+
+static std::vector<GifFrameInfo> read_gif_frames(const std::vector<uint8_t>& data)
+{
+  auto word = [&data](size_t i) -> int {
+    return data[i] | (data[i+1] << 8);
+  };
+  auto skip_sub_blocks = [&data](size_t i) -> size_t {
+    while (i < data.size() && data[i] != 0)
+      i += data[i]+1;
+    return i+1;
+  };
+
+  std::vector<GifFrameInfo> frames;
+  GifFrameInfo frame;
+  size_t i = 13;                        // After the screen descriptor
+  if (data[10] & 0x80)
+    i += 3*(1 << ((data[10] & 7)+1));   // Global color table
+
+  while (i < data.size() && data[i] != 0x3b) {
+    if (data[i] == 0x21) {              // Extension
+      if (data[i+1] == 0xf9) {          // Graphic control extension
+        frame.disposal = (data[i+3] >> 2) & 7;
+        frame.delay = word(i+4);
+      }
+      i = skip_sub_blocks(i+2);
+    }
+    else if (data[i] == 0x2c) {         // Image descriptor
+      frame.bounds = gfx::Rect(word(i+1), word(i+3), word(i+5), word(i+7));
+      const int flags = data[i+9];
+      i += 10;
+      if (flags & 0x80) {
+        const int n = 1 << ((flags & 7)+1);
+        for (int c=0; c<n; ++c, i+=3)
+          frame.colormap.push_back(rgba(data[i], data[i+1], data[i+2], 255));
+      }
+      i = skip_sub_blocks(i+1);         // Skip LZW code size and data
+      frames.push_back(frame);
+      frame = GifFrameInfo();
+    }
+    else
+      break;
+  }
+  return frames;
+}
+
 TEST(File, SeveralSizes)
 {
   // Register all possible image formats.
@@ -80,3 +248,386 @@ TEST(File, SeveralSizes)
     }
   }
 }
+
+TEST(File, AseCompressedAndLinkedCels)
+{
+  FileFormatsManager::instance()->registerAllFormats();
+  app::Context ctx;
+  std::unique_ptr<doc::Document> expected(
+    create_document_with_cels(&ctx, 97, 64, 10));
+  expected->setFilename("test_cels.ase");
+
+  size_t sizes[2];
+  int i = 0;
+  for (int level : { 0, 9 }) {
+    FileOpConfig config;
+    config.aseCompressionLevel = level;
+    ASSERT_EQ(0, save_document(&ctx, expected.get(), &config));
+    sizes[i++] = base::file_size("test_cels.ase");
+
+    std::unique_ptr<app::Document> doc(
+      load_document(&ctx, "test_cels.ase", &config));
+    ASSERT_TRUE(doc != nullptr);
+    expect_same_cels(expected->sprite(), doc->sprite());
+    doc->close();
+  }
+  EXPECT_GT(sizes[0], sizes[1]);
+
+  expected->close();
+  base::delete_file("test_cels.ase");
+}
+
+TEST(File, AseBadCels)
+{
+  FileFormatsManager::instance()->registerAllFormats();
+  app::Context ctx;
+
+  // Each cel takes 8 MB without compression, so queued cels are
+  // decoded two times (see CelsDecoder::kMaxPendingBytes).
+  std::unique_ptr<doc::Document> expected(
+    create_document_with_cels(&ctx, 1448, 1448, 6));
+  expected->setFilename("test_bad_cels.ase");
+
+  FileOpConfig config;
+  config.aseCompressionLevel = 0;
+  ASSERT_EQ(0, save_document(&ctx, expected.get(), &config));
+
+  // Break the zlib header of the layer 2 cel in the 2nd frame, and
+  // truncate the data of the layer 2 cel in the last frame (its
+  // chunk size is reduced, it's the last chunk of the frame so the
+  // rest of the file can be read).
+  std::vector<uint8_t> data = read_file_bytes("test_bad_cels.ase");
+  std::vector<size_t> cels = find_ase_cel_chunks(data);
+  ASSERT_EQ(6, int(cels.size()));
+
+  const size_t celDataOffset = 6+16+4; // Chunk header + cel header + size
+  data[cels[1]+celDataOffset] = 0xff;
+  data[cels[1]+celDataOffset+1] = 0xff;
+
+  size_t chunkSize = data[cels[5]] | (data[cels[5]+1] << 8) |
+    (data[cels[5]+2] << 16) | (data[cels[5]+3] << 24);
+  chunkSize -= (chunkSize - celDataOffset) / 2;
+  for (int j=0; j<4; ++j)
+    data[cels[5]+j] = (chunkSize >> (8*j)) & 0xff;
+  write_file_bytes("test_bad_cels.ase", data);
+
+  std::unique_ptr<FileOp> fop(
+    FileOp::createLoadDocumentOperation(&ctx, "test_bad_cels.ase",
+                                        FILE_LOAD_SEQUENCE_NONE, &config));
+  fop->operate();
+  fop->done();
+  fop->postLoad();
+
+  // Errors are reported in the same order as the cels in the file
+  EXPECT_EQ("ZLib error -3 in inflate().\n"
+            "Incomplete compressed image.\n", fop->error());
+
+  std::unique_ptr<app::Document> doc(fop->releaseDocument());
+  ASSERT_TRUE(doc != nullptr);
+
+  const Sprite* a = expected->sprite();
+  const Sprite* b = doc->sprite();
+  ASSERT_EQ(a->totalFrames(), b->totalFrames());
+  for (int i=0; i<2; ++i) {
+    for (frame_t frame(0); frame<a->totalFrames(); ++frame) {
+      std::shared_ptr<Cel> bcel = b->layer(i)->cel(frame);
+      ASSERT_TRUE(bcel != nullptr) << "layer " << i << " frame " << frame;
+      if (i == 1 && (frame == 1 || frame == 5))
+        continue;
+
+      EXPECT_EQ(0, count_diff_between_images(a->layer(i)->cel(frame)->image(),
+                                             bcel->image()))
+        << "layer " << i << " frame " << frame;
+    }
+  }
+
+  // The first rows of the truncated cel are loaded
+  const Image* truncated = b->layer(1)->cel(5)->image();
+  const Image* original = a->layer(1)->cel(5)->image();
+  for (int x=0; x<original->width(); ++x)
+    ASSERT_EQ(get_pixel(original, x, 0), get_pixel(truncated, x, 0));
+
+  doc->close();
+  expected->close();
+  base::delete_file("test_bad_cels.ase");
+}
+
+static app::Document* load_lazy_document(app::Context* ctx, const char* filename)
+{
+  FileOpConfig config;
+  config.aseLazyLoading = true;
+
+  std::unique_ptr<FileOp> fop(
+    FileOp::createLoadDocumentOperation(ctx, filename,
+                                        FILE_LOAD_SEQUENCE_NONE, &config));
+  fop->operate();
+  fop->done();
+  fop->postLoad();
+  EXPECT_EQ("", fop->error());
+  return fop->releaseDocument();
+}
+
+TEST(File, AseLazyLoading)
+{
+  FileFormatsManager::instance()->registerAllFormats();
+  app::Context ctx;
+  std::unique_ptr<doc::Document> expected(
+    create_document_with_cels(&ctx, 64, 80, 5));
+  expected->setFilename("test_lazy.ase");
+  ASSERT_EQ(0, save_document(&ctx, expected.get()));
+
+  std::unique_ptr<app::Document> doc(load_lazy_document(&ctx, "test_lazy.ase"));
+  ASSERT_TRUE(doc != nullptr);
+
+  // Pixels are loaded the first time they are used
+  const Image* image = doc->sprite()->layer(1)->cel(2)->image();
+  EXPECT_TRUE(image->hasPendingPixels());
+  expect_same_cels(expected->sprite(), doc->sprite());
+  EXPECT_FALSE(image->hasPendingPixels());
+
+  doc->close();
+  expected->close();
+  base::delete_file("test_lazy.ase");
+}
+
+TEST(File, AseLazyLoadingOverwrite)
+{
+  FileFormatsManager::instance()->registerAllFormats();
+  app::Context ctx;
+  std::unique_ptr<doc::Document> expected(
+    create_document_with_cels(&ctx, 64, 80, 5));
+  expected->setFilename("test_lazy.ase");
+  ASSERT_EQ(0, save_document(&ctx, expected.get()));
+
+  std::unique_ptr<app::Document> doc(load_lazy_document(&ctx, "test_lazy.ase"));
+  ASSERT_TRUE(doc != nullptr);
+
+  // Overwrite the file with other sprite, the cels that weren't used
+  // yet keep a copy of their compressed pixels (CelLoader::detachAll())
+  std::unique_ptr<doc::Document> other(
+    create_document_with_cels(&ctx, 32, 32, 1));
+  other->setFilename("test_lazy.ase");
+  ASSERT_EQ(0, save_document(&ctx, other.get()));
+
+  EXPECT_TRUE(doc->sprite()->layer(1)->cel(2)->image()->hasPendingPixels());
+  expect_same_cels(expected->sprite(), doc->sprite());
+
+  doc->close();
+  other->close();
+  expected->close();
+  base::delete_file("test_lazy.ase");
+}
+
+TEST(File, AseLazyLoadingBadCel)
+{
+  FileFormatsManager::instance()->registerAllFormats();
+  app::Context ctx;
+  std::unique_ptr<doc::Document> expected(
+    create_document_with_cels(&ctx, 64, 80, 3));
+  expected->setFilename("test_lazy.ase");
+  ASSERT_EQ(0, save_document(&ctx, expected.get()));
+
+  // Break the zlib header of the layer 2 cel in the 2nd frame
+  std::vector<uint8_t> data = read_file_bytes("test_lazy.ase");
+  std::vector<size_t> cels = find_ase_cel_chunks(data);
+  ASSERT_EQ(3, int(cels.size()));
+  data[cels[1]+6+16+4] = 0xff;
+  data[cels[1]+6+16+5] = 0xff;
+  write_file_bytes("test_lazy.ase", data);
+
+  // The error is found when the pixels are used
+  std::unique_ptr<app::Document> doc(load_lazy_document(&ctx, "test_lazy.ase"));
+  ASSERT_TRUE(doc != nullptr);
+
+  std::vector<std::string> errors;
+  doc::set_image_load_error_handler(
+    [&errors](const std::exception& e){
+      errors.push_back(e.what());
+    });
+
+  const Sprite* a = expected->sprite();
+  const Sprite* b = doc->sprite();
+  for (int i=0; i<2; ++i) {
+    for (frame_t frame(0); frame<a->totalFrames(); ++frame) {
+      const Image* image = b->layer(i)->cel(frame)->image();
+      if (i == 1 && frame == 1) {
+        EXPECT_EQ(0, get_pixel(image, 0, 0));
+        ASSERT_EQ(1, int(errors.size()));
+        EXPECT_EQ("ZLib error -3 in inflate().", errors[0]);
+      }
+      else {
+        EXPECT_EQ(0, count_diff_between_images(a->layer(i)->cel(frame)->image(),
+                                               image))
+          << "layer " << i << " frame " << frame;
+      }
+    }
+  }
+  EXPECT_EQ(1, int(errors.size()));
+
+  doc::set_image_load_error_handler(doc::ImageLoadErrorHandler());
+  doc->close();
+  expected->close();
+  base::delete_file("test_lazy.ase");
+}
+
+TEST(File, GifFrames)
+{
+  FileFormatsManager::instance()->registerAllFormats();
+  app::Context ctx;
+
+  // Frames of more than two groups of the encoder. Each third frame
+  // is the background, the next one has a big rectangle (which should
+  // be restored to the previous frame), and the next one a small
+  // rectangle inside it (the last frame is one of these, as there
+  // is no next frame to restore the big rectangle).
+  const int nframes = 6*base::thread_pool::instance().concurrency()+3;
+  const gfx::Rect bigRc(4, 6, 20, 18), smallRc(9, 10, 5, 4);
+  const color_t bg = rgba(0, 0, 0, 255);
+  auto frame_color = [](int frame) {
+    return rgba((37*frame) % 256, (91*frame) % 256, 200, 255);
+  };
+
+  std::unique_ptr<doc::Document> expected(
+    ctx.documents().add(32, 32, doc::ColorMode::RGB));
+  expected->setFilename("test_frames.gif");
+  Sprite* sprite = expected->sprite();
+  sprite->setTotalFrames(frame_t(nframes));
+  LayerImage* layer = static_cast<LayerImage*>(sprite->layer(0));
+  layer->configureAsBackground();
+  for (frame_t frame(0); frame<nframes; ++frame) {
+    std::shared_ptr<Cel> cel = layer->cel(frame);
+    if (!cel) {
+      cel = std::make_shared<Cel>(frame, ImageRef(Image::create(IMAGE_RGB, 32, 32)));
+      layer->addCel(cel);
+    }
+    clear_image(cel->image(), bg);
+    if (frame % 3 == 1)
+      fill_rect(cel->image(), bigRc, frame_color(frame));
+    else if (frame % 3 == 2)
+      fill_rect(cel->image(), smallRc, frame_color(frame));
+    sprite->setFrameDuration(frame, 10*(frame%5+1));
+  }
+  ASSERT_EQ(0, save_document(&ctx, expected.get()));
+
+  std::vector<GifFrameInfo> frames =
+    read_gif_frames(read_file_bytes("test_frames.gif"));
+  ASSERT_EQ(nframes, int(frames.size()));
+  for (int frame=0; frame<nframes; ++frame) {
+    const GifFrameInfo& info = frames[frame];
+    const color_t color = (frame % 3 == 0 ? bg: frame_color(frame));
+    EXPECT_EQ(frame%5+1, info.delay) << "frame " << frame;
+
+    // Only the changed area is saved, and the big rectangle is
+    // disposed restoring the previous frame.
+    if (frame == 0) {
+      EXPECT_EQ(sprite->bounds(), info.bounds);
+    }
+    else {
+      EXPECT_EQ(frame % 3 == 1 ? bigRc: smallRc, info.bounds) << "frame " << frame;
+    }
+    EXPECT_EQ(frame % 3 == 1 ? 3: 1, info.disposal) << "frame " << frame;
+
+    // RGB frames are saved with their own palette
+    EXPECT_FALSE(info.colormap.empty()) << "frame " << frame;
+    EXPECT_TRUE(std::find(info.colormap.begin(), info.colormap.end(),
+                          color) != info.colormap.end()) << "frame " << frame;
+  }
+
+  std::unique_ptr<app::Document> doc(load_document(&ctx, "test_frames.gif"));
+  ASSERT_TRUE(doc != nullptr);
+  ASSERT_EQ(nframes, int(doc->sprite()->totalFrames()));
+
+  ImageRef a(Image::create(IMAGE_RGB, 32, 32));
+  ImageRef b(Image::create(IMAGE_RGB, 32, 32));
+  render::Render render;
+  for (frame_t frame(0); frame<nframes; ++frame) {
+    clear_image(a.get(), 0);
+    clear_image(b.get(), 0);
+    render.renderSprite(a.get(), sprite, frame);
+    render.renderSprite(b.get(), doc->sprite(), frame);
+    EXPECT_EQ(0, count_diff_between_images(a.get(), b.get()))
+      << "frame " << frame;
+    EXPECT_EQ(sprite->frameDuration(frame), doc->sprite()->frameDuration(frame))
+      << "frame " << frame;
+  }
+
+  doc->close();
+  expected->close();
+  base::delete_file("test_frames.gif");
+}
+
+TEST(File, CompressedSequenceWithBadFrame)
+{
+  FileFormatsManager::instance()->registerAllFormats();
+  app::Context ctx;
+
+  // Frames of two groups of files decoded in parallel, the broken
+  // file is in the second group.
+  const int concurrency = base::thread_pool::instance().concurrency();
+  const int nframes = 2*concurrency+2;
+  const int badFrame = concurrency+2;
+
+  std::vector<ImageRef> expected;
+  for (int frame=0; frame<nframes; ++frame) {
+    char filename[64];
+    std::sprintf(filename, "test_seq%d.png", frame+1);
+
+    std::unique_ptr<doc::Document> doc(
+      ctx.documents().add(32, 24, doc::ColorMode::RGB));
+    doc->setFilename(filename);
+    Image* image = doc->sprite()->layer(0)->cel(0)->image();
+    fill_random_runs(image, frame+1);
+    expected.push_back(ImageRef(Image::createCopy(image)));
+    ASSERT_EQ(0, save_document(&ctx, doc.get()));
+    doc->close();
+
+    if (frame == badFrame)
+      write_file_bytes(filename, std::vector<uint8_t>(64, 0xff));
+  }
+
+  FileOpConfig config;
+  config.compressSequenceFrames = true;
+
+  std::unique_ptr<FileOp> fop(
+    FileOp::createLoadDocumentOperation(&ctx, "test_seq1.png",
+                                        FILE_LOAD_SEQUENCE_YES, &config));
+  ASSERT_TRUE(fop != nullptr);
+  fop->operate();
+  fop->done();
+  fop->postLoad();
+
+  // The error is reported, and the frames before it are loaded
+  char error[128];
+  std::sprintf(error, "Error loading frame %d from file \"test_seq%d.png\"",
+               badFrame+1, badFrame+1);
+  EXPECT_NE(std::string::npos, fop->error().find(error)) << fop->error();
+
+  std::unique_ptr<app::Document> doc(fop->releaseDocument());
+  ASSERT_TRUE(doc != nullptr);
+  const Sprite* sprite = doc->sprite();
+  ASSERT_EQ(badFrame, int(sprite->totalFrames()));
+
+  std::vector<std::string> errors;
+  doc::set_image_load_error_handler(
+    [&errors](const std::exception& e){
+      errors.push_back(e.what());
+    });
+
+  for (frame_t frame(0); frame<sprite->totalFrames(); ++frame) {
+    const Image* image = sprite->layer(0)->cel(frame)->image();
+    if (frame > 0) {
+      EXPECT_TRUE(image->hasPendingPixels()) << "frame " << frame;
+    }
+    EXPECT_EQ(0, count_diff_between_images(expected[frame].get(), image))
+      << "frame " << frame;
+  }
+  EXPECT_TRUE(errors.empty());
+
+  doc::set_image_load_error_handler(doc::ImageLoadErrorHandler());
+  doc->close();
+  for (int frame=0; frame<nframes; ++frame) {
+    char filename[64];
+    std::sprintf(filename, "test_seq%d.png", frame+1);
+    base::delete_file(filename);
+  }
+}
@@ -81,7 +81,7 @@ bool FliFormat::onLoad(FileOp* fop)
 
   flic::Frame fliFrame;
   flic::Colormap oldFliColormap;
-  fliFrame.pixels = bmp->getPixelAddress(0, 0);
+  fliFrame.pixels = bmp->getBitsAddress();
   fliFrame.rowstride = IndexedTraits::getRowStrideBytes(bmp->width());
 
   frame_t frame_out = 0;
@@ -197,7 +197,7 @@ bool FliFormat::onSave(FileOp* fop)
 
   // Write frame by frame
   flic::Frame fliFrame;
-  fliFrame.pixels = bmp->getPixelAddress(0, 0);
+  fliFrame.pixels = bmp->getBitsAddress();
   fliFrame.rowstride = IndexedTraits::getRowStrideBytes(bmp->width());
   for (frame_t frame_it=0;
        frame_it <= sprite->totalFrames();
@@ -21,6 +21,7 @@
 #include "app/util/autocrop.h"
 #include "base/file_handle.h"
 #include "base/fs.h"
+#include "base/thread_pool.h"
 #include "doc/doc.h"
 #include "render/quantization.h"
 #include "render/render.h"
@@ -30,7 +31,9 @@
 #include "gif_options.xml.h"
 
 #include <gif_lib.h>
+#include <algorithm>
 #include <memory>
+#include <vector>
 
 #ifdef _WIN32
   #include <io.h>
@@ -808,7 +811,8 @@ public:
     , m_hasBackground(m_sprite->backgroundLayer() ? true: false)
     , m_bitsPerPixel(1)
     , m_globalColormap(nullptr)
-    , m_quantizeColormaps(false) {
+    , m_quantizeColormaps(false)
+    , m_rgbmap(nullptr) {
     if (m_sprite->pixelFormat() == IMAGE_INDEXED) {
       for (Palette* palette : m_sprite->getPalettes()) {
         int bpp = GifBitSizeLimited(palette->size());
@@ -859,10 +863,19 @@ public:
     m_interlaced = gifOptions->interlaced();
     m_loop = (gifOptions->loop() ? 0: -1);
 
-    for (int i=0; i<3; ++i)
-      m_images[i].reset(Image::create(IMAGE_RGB,
-                                      m_spriteBounds.w,
-                                      m_spriteBounds.h));
+    // Frames are converted in several threads with the same RgbMap of
+    // the sprite, so all its entries are calculated here.
+    if (!m_quantizeColormaps) {
+      m_rgbmap = m_sprite->rgbMap(0);
+      m_rgbmap->generateAllEntries();
+    }
+
+    m_previousImage.reset(Image::create(IMAGE_RGB,
+                                        m_spriteBounds.w,
+                                        m_spriteBounds.h));
+    m_disposedImage.reset(Image::create(IMAGE_RGB,
+                                        m_spriteBounds.w,
+                                        m_spriteBounds.h));
   }
 
   ~GifEncoder() {
@@ -875,49 +888,129 @@ public:
     if (m_loop >= 0)
       writeLoopExtension();
 
-    // Previous and next images are used to decide the best disposal
-    // method (e.g. if it's more convenient to restore the background
-    // color or to restore the previous frame to reach the next one).
-    m_previousImage = m_images[0].get();
-    m_currentImage = m_images[1].get();
-    m_nextImage = m_images[2].get();
-
-    int nframes = m_sprite->totalFrames();
-    for (int frameNum=0; frameNum<nframes; ++frameNum) {
-      if (frameNum == 0)
-        renderFrame(0, m_nextImage);
-      else if (frameNum > 0)
-        std::swap(m_previousImage, m_currentImage);
-
-      std::swap(m_currentImage, m_nextImage);
-      if (frameNum+1 < nframes)
-        renderFrame(frameNum+1, m_nextImage);
-
-      gfx::Rect frameBounds;
-      DisposalMethod disposal;
+    // Frames are processed in groups. The frames of the next group are
+    // rendered, compared, and converted to indexed images using all
+    // cores while the frames of the current group are LZW-encoded and
+    // written in the file.
+    base::thread_pool& pool = base::thread_pool::instance();
+    const int nframes = m_sprite->totalFrames();
+    const int groupSize = 2*pool.concurrency();
+
+    std::vector<Frame> frames, nextFrames;
+    prepareFrames(0, groupSize, frames);
+
+    for (int first=0; first<nframes; first+=groupSize) {
+      const int next = first+groupSize;
+      pool.parallel_for(
+        2,
+        [&](int task){
+          if (task == 0)
+            writeFrames(first, frames);
+          else if (next < nframes)
+            prepareFrames(next, groupSize, nextFrames);
+        });
+
+      std::swap(frames, nextFrames);
+      nextFrames.clear();
+    }
+    return true;
+  }
+
+private:
+
+  struct ColorMapDeleter {
+    void operator()(ColorMapObject* colormap) const {
+      GifFreeMapObject(colormap);
+    }
+  };
+
+  // A frame ready to be written in the file.
+  struct Frame {
+    gfx::Rect bounds;
+    DisposalMethod disposal;
+    ImageRef image;             // Indexes to write in the "bounds" area
+    std::unique_ptr<ColorMapObject, ColorMapDeleter> colormap; // Local colormap or nullptr
+    int transparentIndex;
+  };
+
+  // Renders the frames [first, first+n), and calculates the bounds,
+  // the disposal method, and the indexed pixels of each one.
+  void prepareFrames(int first, int n, std::vector<Frame>& frames) {
+    base::thread_pool& pool = base::thread_pool::instance();
+    const int nframes = m_sprite->totalFrames();
+    n = std::min(n, nframes-first);
+    frames.resize(n);
+
+    // Render the frames of this group and the first one of the next
+    // group (the first frame of this group was rendered with the
+    // previous group).
+    std::vector<ImageRef> images(n+1);
+    images[0] = m_nextFrameImage;
+    pool.parallel_for(
+      n+1,
+      [this, first, nframes, &images](int i){
+        if (!images[i] && first+i < nframes) {
+          images[i].reset(Image::create(IMAGE_RGB,
+                                        m_spriteBounds.w,
+                                        m_spriteBounds.h));
+          renderFrame(first+i, images[i].get());
+        }
+      });
+    m_nextFrameImage = images[n];
+
+    // Changes from each frame to the next one
+    std::vector<gfx::Rect> nextBounds(n);
+    if (!m_hasBackground) {
+      pool.parallel_for(
+        n,
+        [&images, &nextBounds](int i){
+          if (images[i+1])
+            nextBounds[i] = calculateFrameBounds(images[i].get(), images[i+1].get());
+        });
+    }
+
+    // The previous image of each frame depends on the disposal method
+    // of the previous frame, so this is calculated in order.
+    for (int i=0; i<n; ++i) {
+      Frame& frame = frames[i];
       calculateBestDisposalMethod(
-        frameNum, frameBounds, disposal);
+        first+i, images[i].get(), images[i+1].get(), nextBounds[i],
+        frame.bounds, frame.disposal);
 
       // TODO We could join both frames in a longer one (with more duration)
-      if (frameBounds.isEmpty())
-        frameBounds = gfx::Rect(0, 0, 1, 1);
+      if (frame.bounds.isEmpty())
+        frame.bounds = gfx::Rect(0, 0, 1, 1);
+
+      // Dispose/clear frame content (the result is the previous image
+      // of the next frame)
+      copy_image(m_disposedImage.get(), images[i].get());
+      process_disposal_method(m_previousImage.get(),
+                              m_disposedImage.get(),
+                              frame.disposal,
+                              frame.bounds,
+                              m_clearColor);
+      std::swap(m_previousImage, m_disposedImage);
+    }
+
+    pool.parallel_for(
+      n,
+      [this, first, &images, &frames](int i){
+        convertFrame(first+i, images[i].get(), frames[i]);
+      });
+  }
 
-      writeImage(frameNum, frameBounds, disposal);
+  void writeFrames(int first, std::vector<Frame>& frames) {
+    const int nframes = m_sprite->totalFrames();
+    for (int i=0; i<int(frames.size()); ++i) {
+      writeFrame(first+i, frames[i]);
 
-      // Dispose/clear frame content
-      process_disposal_method(m_previousImage,
-                              m_currentImage,
-                              disposal,
-                              frameBounds,
-                              m_clearColor);
+      frames[i].image.reset();
+      frames[i].colormap.reset();
 
-      m_fop->setProgress(double(frameNum+1) / double(nframes));
+      m_fop->setProgress(double(first+i+1) / double(nframes));
     }
-    return true;
   }
 
-private:
-
   void writeHeader() {
     if (EGifPutScreenDesc(m_gifFile,
                           m_spriteBounds.w,
@@ -994,7 +1087,12 @@ private:
     return frameBounds;
   }
 
+  // "next" is the image of the next frame (or nullptr if this is the
+  // last frame), and "nextBounds" the changes from this frame to it.
   void calculateBestDisposalMethod(int frameNum,
+                                   Image* current,
+                                   Image* next,
+                                   const gfx::Rect& nextBounds,
                                    gfx::Rect& frameBounds,
                                    DisposalMethod& disposal) {
     if (m_hasBackground) {
@@ -1008,22 +1106,18 @@ private:
       frameBounds = m_spriteBounds;
     }
     else {
-      gfx::Rect prev, next;
+      gfx::Rect prev;
 
       if (frameNum-1 >= 0)
-        prev = calculateFrameBounds(m_currentImage, m_previousImage);
+        prev = calculateFrameBounds(current, m_previousImage.get());
 
-      if (!m_hasBackground &&
-          frameNum+1 < m_sprite->totalFrames())
-        next = calculateFrameBounds(m_currentImage, m_nextImage);
-
-      frameBounds = prev.createUnion(next);
+      frameBounds = prev.createUnion(nextBounds);
 
       // Special case were it's better to restore the previous frame
       // when we dispose the current one than clearing with the bg
       // color.
-      if (m_hasBackground && !prev.isEmpty()) {
-        gfx::Rect prevNext = calculateFrameBounds(m_previousImage, m_nextImage);
+      if (m_hasBackground && !prev.isEmpty() && next) {
+        gfx::Rect prevNext = calculateFrameBounds(m_previousImage.get(), next);
         if (!prevNext.isEmpty() &&
             frameBounds.contains(prevNext) &&
             prevNext.w*prevNext.h < frameBounds.w*frameBounds.h) {
@@ -1034,38 +1128,42 @@ private:
       TRACE("[GifEncoder] frameBounds=%d %d %d %d  prev=%d %d %d %d  next=%d %d %d %d\n",
             frameBounds.x, frameBounds.y, frameBounds.w, frameBounds.h,
             prev.x, prev.y, prev.w, prev.h,
-            next.x, next.y, next.w, next.h);
+            nextBounds.x, nextBounds.y, nextBounds.w, nextBounds.h);
     }
   }
 
-  void writeImage(int frameNum, const gfx::Rect& frameBounds, DisposalMethod disposal) {
+  // Converts the frame bounds of the rendered image (RGB) to the
+  // indexes that must be stored in the GIF file for this frame. It's
+  // called from several threads at the same time.
+  void convertFrame(int frameNum, const Image* image, Frame& frame) {
+    const gfx::Rect& frameBounds = frame.bounds;
     std::unique_ptr<Palette> framePaletteRef;
     std::unique_ptr<RgbMap> rgbmapRef;
     Palette* framePalette = m_sprite->palette(frameNum);
-    RgbMap* rgbmap = m_sprite->rgbMap(frameNum);
+    RgbMap* rgbmap = m_rgbmap;
 
     // Create optimized palette for RGB/Grayscale images
     if (m_quantizeColormaps) {
-      framePaletteRef.reset(createOptimizedPalette(frameBounds));
+      framePaletteRef.reset(createOptimizedPalette(image, frameBounds));
       framePalette = framePaletteRef.get();
 
+      // With big frames most entries of the table are used, so it's
+      // faster to calculate all of them in parallel than one by one.
       rgbmapRef.reset(new RgbMap);
       rgbmap = rgbmapRef.get();
-      rgbmap->regenerate(framePalette, m_transparentIndex);
+      rgbmap->regenerate(framePalette, m_transparentIndex,
+                         frameBounds.w*frameBounds.h > 512*512 ?
+                         RgbMap::Fill::Eager: RgbMap::Fill::Lazy);
     }
 
     // We will store the frameBounds pixels in frameImage, with the
     // indexes that must be stored in the GIF file for this specific
     // frame.
-    if (!m_frameImageBuf)
-      m_frameImageBuf.reset(new ImageBuffer);
-
     ImageRef frameImage(Image::create(IMAGE_INDEXED,
                                       frameBounds.w,
-                                      frameBounds.h,
-                                      m_frameImageBuf));
+                                      frameBounds.h));
 
-    // Convert the frameBounds area of m_currentImage (RGB) to frameImage (Indexed)
+    // Convert the frameBounds area of the image (RGB) to frameImage (Indexed)
     // bool needsTransparent = false;
     PalettePicks usedColors(framePalette->size());
 
@@ -1081,7 +1179,7 @@ private:
     }
 
     {
-      LockImageBits<RgbTraits> bits(m_currentImage, frameBounds);
+      const LockImageBits<RgbTraits> bits(image, frameBounds);
       auto it = bits.begin();
       for (int y=0; y<frameBounds.h; ++y) {
         for (int x=0; x<frameBounds.w; ++x, ++it) {
@@ -1132,8 +1230,7 @@ private:
       remap.map(i, i);
 
     int localTransparent = m_transparentIndex;
-    ColorMapObject* colormap = m_globalColormap;
-    if (!colormap) {
+    if (!m_globalColormap) {
       Palette reducedPalette(frameNum, usedNColors);
 
       for (int i=0, j=0; i<framePalette->size(); ++i) {
@@ -1144,7 +1241,7 @@ private:
         }
       }
 
-      colormap = createColorMap(&reducedPalette);
+      frame.colormap.reset(createColorMap(&reducedPalette));
       if (localTransparent >= 0)
         localTransparent = remap[localTransparent];
     }
@@ -1152,58 +1249,61 @@ private:
     if (localTransparent >= 0 && m_transparentIndex != localTransparent)
       remap.map(m_transparentIndex, localTransparent);
 
+    // Store the final indexes in the image
+    for (int y=0; y<frameBounds.h; ++y) {
+      IndexedTraits::address_t addr =
+        (IndexedTraits::address_t)frameImage->getPixelAddress(0, y);
+
+      for (int i=0; i<frameBounds.w; ++i, ++addr)
+        *addr = remap[*addr];
+    }
+
+    frame.image = frameImage;
+    frame.transparentIndex = localTransparent;
+  }
+
+  void writeFrame(int frameNum, const Frame& frame) {
+    const gfx::Rect& frameBounds = frame.bounds;
+
     // Write extension record.
-    writeExtension(frameNum, localTransparent, disposal);
+    writeExtension(frameNum, frame.transparentIndex, frame.disposal);
 
     // Write the image record.
     if (EGifPutImageDesc(m_gifFile,
                          frameBounds.x, frameBounds.y,
                          frameBounds.w, frameBounds.h,
                          m_interlaced ? 1: 0,
-                         (colormap != m_globalColormap ? colormap: nullptr)) == GIF_ERROR) {
+                         frame.colormap.get()) == GIF_ERROR) {
       throw Exception("Error writing GIF frame %d.\n", (int)frameNum);
     }
 
-    std::vector<uint8_t> scanline(frameBounds.w);
-
     // Write the image data (pixels).
     if (m_interlaced) {
       // Need to perform 4 passes on the images.
       for (int i=0; i<4; ++i)
         for (int y=interlaced_offset[i]; y<frameBounds.h; y+=interlaced_jumps[i]) {
-          IndexedTraits::address_t addr =
-            (IndexedTraits::address_t)frameImage->getPixelAddress(0, y);
-
-          for (int i=0; i<frameBounds.w; ++i, ++addr)
-            scanline[i] = remap[*addr];
+          GifPixelType* addr = (GifPixelType*)frame.image->getPixelAddress(0, y);
 
-          if (EGifPutLine(m_gifFile, &scanline[0], frameBounds.w) == GIF_ERROR)
+          if (EGifPutLine(m_gifFile, addr, frameBounds.w) == GIF_ERROR)
             throw Exception("Error writing GIF image scanlines for frame %d.\n", (int)frameNum);
         }
     }
     else {
       // Write all image scanlines (not interlaced in this case).
       for (int y=0; y<frameBounds.h; ++y) {
-        IndexedTraits::address_t addr =
-          (IndexedTraits::address_t)frameImage->getPixelAddress(0, y);
+        GifPixelType* addr = (GifPixelType*)frame.image->getPixelAddress(0, y);
 
-        for (int i=0; i<frameBounds.w; ++i, ++addr)
-          scanline[i] = remap[*addr];
-
-        if (EGifPutLine(m_gifFile, &scanline[0], frameBounds.w) == GIF_ERROR)
+        if (EGifPutLine(m_gifFile, addr, frameBounds.w) == GIF_ERROR)
           throw Exception("Error writing GIF image scanlines for frame %d.\n", (int)frameNum);
       }
     }
-
-    if (colormap && colormap != m_globalColormap)
-      GifFreeMapObject(colormap);
   }
 
-  Palette* createOptimizedPalette(const gfx::Rect& frameBounds) {
+  Palette* createOptimizedPalette(const Image* image, const gfx::Rect& frameBounds) {
     render::PaletteOptimizer optimizer;
 
     // Feed the palette optimizer with pixels inside frameBounds
-    for (const auto& color : LockImageBits<RgbTraits>(m_currentImage, frameBounds)) {
+    for (const auto& color : LockImageBits<RgbTraits>(image, frameBounds)) {
       if (rgba_geta(color) >= 128)
         optimizer.feedWithRgbaColor(
           rgba(rgba_getr(color),
@@ -1257,11 +1357,13 @@ private:
   bool m_quantizeColormaps;
   bool m_interlaced;
   int m_loop;
-  ImageBufferPtr m_frameImageBuf;
-  ImageRef m_images[3];
-  Image* m_previousImage;
-  Image* m_currentImage;
-  Image* m_nextImage;
+  RgbMap* m_rgbmap;
+  // Previous and next images are used to decide the best disposal
+  // method (e.g. if it's more convenient to restore the background
+  // color or to restore the previous frame to reach the next one).
+  ImageRef m_previousImage;
+  ImageRef m_disposedImage;
+  ImageRef m_nextFrameImage;
 };
 
 bool GifFormat::onSave(FileOp* fop)
@@ -325,8 +325,8 @@ bool PixlyFormat::onSave(FileOp* fop)
           for (int y = 0; y < celHeight; y++) {
             // RGB_ALPHA
             int y0_down = (sheetHeight - 1) - y0 - (frameHeight - 1) + celY + y;
-            uint32_t* src_begin = (uint32_t*)image->getPixelAddress(0, y);
-            uint32_t* src_end   = src_begin + celWidth;
+            const uint32_t* src_begin = (const uint32_t*)image->getConstPixelAddress(0, y);
+            const uint32_t* src_end   = src_begin + celWidth;
             uint32_t* dst_begin = (uint32_t*)sheet->getPixelAddress(x0 + celX, y0_down);
 
             std::copy(src_begin, src_end, dst_begin);
@@ -117,7 +117,7 @@ bool WebPFormat::onLoad(FileOp* fop)
   Image* image = fop->sequenceImage(IMAGE_RGB, config.input.width, config.input.height);
 
   config.output.colorspace = MODE_RGBA;
-  config.output.u.RGBA.rgba = (uint8_t*)image->getPixelAddress(0, 0);
+  config.output.u.RGBA.rgba = image->getBitsAddress();
   config.output.u.RGBA.stride = config.input.width * sizeof(uint32_t);
   config.output.u.RGBA.size = config.input.width * config.input.height * sizeof(uint32_t);
   config.output.is_external_memory = 1;
@@ -290,7 +290,10 @@ bool WebPFormat::onSave(FileOp* fop)
 
   ScopedWebPPicture scopedPic(pic); // Calls WebPPictureFree automatically
 
-  if (!WebPPictureImportRGBA(&pic, (uint8_t*)image->getPixelAddress(0, 0), image->width() * sizeof(uint32_t))) {
+  // WebP imports all rows from one block of memory, getBitsAddress()
+  // joins the image bands of a copy (the sequence image is const).
+  ImageRef bits(Image::createCopy(image));
+  if (!WebPPictureImportRGBA(&pic, (const uint8_t*)bits->getBitsAddress(), image->width() * sizeof(uint32_t))) {
     fop->setError("Error converting RGBA data into a WebP picture\n");
     return false;
   }
@@ -0,0 +1,74 @@
+// LibreSprite
+// Copyright (C) 2026  LibreSprite contributors
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/image_load_errors.h"
+
+#include "app/app.h"
+#include "app/console.h"
+#include "doc/image_loader.h"
+#include "ui/timer.h"
+
+namespace app {
+
+ImageLoadErrors::ImageLoadErrors()
+{
+  if (App::instance()->isGui()) {
+    m_timer.reset(new ui::Timer(250));
+    m_timer->Tick.connect(&ImageLoadErrors::onTick, this);
+    m_timer->start();
+  }
+
+  doc::set_image_load_error_handler(
+    [this](const std::exception& e){
+      onError(e);
+    });
+}
+
+ImageLoadErrors::~ImageLoadErrors()
+{
+  doc::set_image_load_error_handler(doc::ImageLoadErrorHandler());
+}
+
+void ImageLoadErrors::onError(const std::exception& e)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (m_timer) {
+    m_errors.push_back(e.what());
+  }
+  else {
+    Console console;
+    console.printf("Error loading image pixels:\n%s\n", e.what());
+  }
+}
+
+void ImageLoadErrors::onTick()
+{
+  std::vector<std::string> errors;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::swap(errors, m_errors);
+  }
+  if (errors.empty())
+    return;
+
+  // The console can run a modal loop, we don't want to show it again
+  // from there
+  m_timer->stop();
+  {
+    Console console;
+    console.printf("Some images couldn't be loaded, they are shown transparent.\n\n");
+    for (const auto& error : errors)
+      console.printf("%s\n", error.c_str());
+  }
+  m_timer->start();
+}
+
+} // namespace app
@@ -0,0 +1,44 @@
+// LibreSprite
+// Copyright (C) 2026  LibreSprite contributors
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation.
+
+#pragma once
+
+#include "base/disable_copying.h"
+
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace ui {
+  class Timer;
+}
+
+namespace app {
+
+  // Shows in the console the errors loading the pixels of lazy images
+  // (e.g. cels of a file that was modified after it was opened). The
+  // errors can happen in any thread that reads pixels, so in GUI mode
+  // they are queued and shown later from the UI thread.
+  class ImageLoadErrors {
+  public:
+    ImageLoadErrors();
+    ~ImageLoadErrors();
+
+  private:
+    void onError(const std::exception& e);
+    void onTick();
+
+    std::mutex m_mutex;
+    std::vector<std::string> m_errors;
+    std::unique_ptr<ui::Timer> m_timer;
+
+    DISABLE_COPYING(ImageLoadErrors);
+  };
+
+} // namespace app
@@ -54,12 +54,12 @@ public:
       std::cout << "Data size mismatch: " << data.size() << std::endl;
       return;
     }
-    std::memcpy(m_image->getPixelAddress(0, 0), data.data(), data.size());
+    std::memcpy(m_image->getBitsAddress(), data.data(), data.size());
   }
 
   script::Value getImageData() {
     return {
-      m_image->getPixelAddress(0, 0),
+      m_image->getBitsAddress(),
       std::size_t(m_image->getRowStrideSize()*m_image->height()),
       false
     };
@@ -89,7 +89,7 @@ template<typename Derived, typename ImageTraits>
 class DoubleInkProcessing : public InkProcessing<Derived> {
 public:
   void initIterators(ToolLoop* loop, int x1, int y) {
-    m_srcAddress = (typename ImageTraits::address_t)loop->getSrcImage()->getPixelAddress(x1, y);
+    m_srcAddress = (typename ImageTraits::const_address_t)loop->getSrcImage()->getConstPixelAddress(x1, y);
     m_dstAddress = (typename ImageTraits::address_t)loop->getDstImage()->getPixelAddress(x1, y);
   }
 
@@ -99,7 +99,7 @@ public:
   }
 
 protected:
-  typename ImageTraits::address_t m_srcAddress;
+  typename ImageTraits::const_address_t m_srcAddress;
   typename ImageTraits::address_t m_dstAddress;
 };
 
@@ -339,6 +339,10 @@ void DocumentView::onSpritePixelsModified(doc::DocumentEvent& ev)
   if (m_editor->isVisible() &&
       m_editor->frame() == ev.frame())
     m_editor->drawSpriteClipped(ev.region());
+  // Hidden editors (or editors showing other frames with onion skin)
+  // render the region again when they are painted
+  else
+    m_editor->invalidateBackBuffer(ev.region());
 }
 
 void DocumentView::onLayerMergedDown(doc::DocumentEvent& ev)
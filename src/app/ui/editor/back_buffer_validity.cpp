@@ -0,0 +1,65 @@
+// LibreSprite
+// Copyright (C) 2026  LibreSprite contributors
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/ui/editor/back_buffer_validity.h"
+
+namespace app {
+
+BackBufferValidity::BackBufferValidity()
+  : m_key(0)
+{
+}
+
+void BackBufferValidity::setKey(std::uint64_t key)
+{
+  if (key != m_key) {
+    m_key = key;
+    m_valid.clear();
+  }
+}
+
+void BackBufferValidity::setBounds(const gfx::Rect& bounds)
+{
+  m_valid &= gfx::Region(bounds);
+}
+
+void BackBufferValidity::invalidate(const gfx::Region& spriteRegion,
+                                    const render::Zoom& zoom)
+{
+  for (gfx::Rect rc : spriteRegion) {
+    rc = zoom.apply(rc);
+    // Cels can be drawn in the pixels around the modified area when
+    // the zoom level is less than 100% (see the expose notification
+    // in Editor::updateBackBuffer())
+    if (zoom.scale() < 1.0)
+      rc.enlarge(1);
+    m_valid -= gfx::Region(rc);
+  }
+}
+
+void BackBufferValidity::invalidateAll()
+{
+  m_valid.clear();
+}
+
+void BackBufferValidity::validate(const gfx::Rect& rc)
+{
+  m_valid |= gfx::Region(rc);
+}
+
+gfx::Region BackBufferValidity::dirtyRegion(const gfx::Rect& rc) const
+{
+  gfx::Region dirty(rc);
+  dirty -= m_valid;
+  return dirty;
+}
+
+} // namespace app
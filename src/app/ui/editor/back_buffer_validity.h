@@ -0,0 +1,49 @@
+// LibreSprite
+// Copyright (C) 2026  LibreSprite contributors
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation.
+
+#pragma once
+
+#include "gfx/rect.h"
+#include "gfx/region.h"
+#include "render/zoom.h"
+
+#include <cstdint>
+
+namespace app {
+
+  // Keeps the area of the Editor back buffer (in zoomed sprite
+  // coordinates) that is up to date, so only the rest is rendered
+  // again.
+  class BackBufferValidity {
+  public:
+    BackBufferValidity();
+
+    // Everything is invalid when the render key changes (see
+    // render::Render::renderKey()).
+    void setKey(std::uint64_t key);
+
+    // Keeps only the valid area inside the new bounds of the buffer.
+    void setBounds(const gfx::Rect& bounds);
+
+    // Marks the given sprite region to be rendered again. It must be
+    // used when pixels that aren't included in the render key are
+    // modified (e.g. the preview image of a filter).
+    void invalidate(const gfx::Region& spriteRegion, const render::Zoom& zoom);
+    void invalidateAll();
+
+    // The given zoomed area was rendered.
+    void validate(const gfx::Rect& rc);
+
+    // Returns the part of "rc" that must be rendered.
+    gfx::Region dirtyRegion(const gfx::Rect& rc) const;
+
+  private:
+    gfx::Region m_valid;
+    std::uint64_t m_key;
+  };
+
+} // namespace app
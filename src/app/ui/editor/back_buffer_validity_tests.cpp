@@ -0,0 +1,68 @@
+// LibreSprite
+// Copyright (C) 2026  LibreSprite contributors
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation.
+
+#include "tests/test.h"
+
+#include "app/ui/editor/back_buffer_validity.h"
+#include "gfx/point.h"
+#include "gfx/rect_io.h"
+
+using namespace app;
+using namespace gfx;
+
+TEST(BackBufferValidity, Key)
+{
+  BackBufferValidity v;
+  v.setKey(1);
+  v.validate(Rect(0, 0, 32, 32));
+  EXPECT_TRUE(v.dirtyRegion(Rect(0, 0, 32, 32)).isEmpty());
+
+  v.setKey(1);
+  EXPECT_TRUE(v.dirtyRegion(Rect(0, 0, 32, 32)).isEmpty());
+
+  v.setKey(2);
+  EXPECT_EQ(Rect(0, 0, 32, 32), v.dirtyRegion(Rect(0, 0, 32, 32)).bounds());
+}
+
+TEST(BackBufferValidity, Bounds)
+{
+  BackBufferValidity v;
+  v.validate(Rect(0, 0, 32, 32));
+  v.setBounds(Rect(16, 0, 32, 32));
+  EXPECT_EQ(Rect(0, 0, 16, 32), v.dirtyRegion(Rect(0, 0, 32, 32)).bounds());
+}
+
+// Rows of a preview image (which aren't included in the render key)
+// are rendered again after invalidate().
+TEST(BackBufferValidity, PreviewRows)
+{
+  const Rect rows(0, 8, 64, 2);
+
+  // 200%
+  {
+    BackBufferValidity v;
+    v.validate(Rect(0, 0, 128, 128));
+    v.invalidate(Region(rows), render::Zoom(2, 1));
+    EXPECT_EQ(Rect(0, 16, 128, 4), v.dirtyRegion(Rect(0, 0, 128, 128)).bounds());
+  }
+
+  // 25%, the only displayed row is the row 8
+  {
+    BackBufferValidity v;
+    v.validate(Rect(0, 0, 16, 16));
+    v.invalidate(Region(rows), render::Zoom(1, 4));
+    Region dirty = v.dirtyRegion(Rect(0, 0, 16, 16));
+    EXPECT_TRUE(dirty.contains(Point(0, 2)));
+    EXPECT_TRUE(dirty.contains(Point(15, 2)));
+    EXPECT_FALSE(dirty.contains(Point(0, 8)));
+  }
+
+  BackBufferValidity v;
+  v.validate(Rect(0, 0, 64, 64));
+  v.invalidateAll();
+  EXPECT_EQ(Rect(0, 0, 64, 64), v.dirtyRegion(Rect(0, 0, 64, 64)).bounds());
+}
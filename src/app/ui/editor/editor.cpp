@@ -55,6 +55,8 @@
 
 #include <cmath>
 #include <cstdio>
+#include <cstdint>
+#include <functional>
 
 namespace app {
 
@@ -63,11 +65,15 @@ using namespace gfx;
 using namespace ui;
 using namespace render;
 
+// The image to decorate is created only if the decorator uses it, so
+// usually the back buffer of the editor can be drawn directly.
 class EditorPreRenderImpl : public EditorPreRender {
 public:
-  EditorPreRenderImpl(Editor* editor, Image* image, const Point& offset, Zoom zoom)
+  EditorPreRenderImpl(Editor* editor, const std::function<Image*()>& createImage,
+                      const Point& offset, Zoom zoom)
     : m_editor(editor)
-    , m_image(image)
+    , m_createImage(createImage)
+    , m_image(nullptr)
     , m_offset(offset)
     , m_zoom(zoom)
   {
@@ -80,12 +86,14 @@ public:
 
   Image* getImage() override
   {
+    if (!m_image)
+      m_image = m_createImage();
     return m_image;
   }
 
   void fillRect(const gfx::Rect& rect, uint32_t rgbaColor, int opacity) override
   {
-    blend_rect(m_image,
+    blend_rect(getImage(),
       m_offset.x + m_zoom.apply(rect.x),
       m_offset.y + m_zoom.apply(rect.y),
       m_offset.x + m_zoom.apply(rect.x+rect.w) - 1,
@@ -94,6 +102,7 @@ public:
 
 private:
   Editor* m_editor;
+  std::function<Image*()> m_createImage;
   Image* m_image;
   Point m_offset;
   Zoom m_zoom;
@@ -167,6 +176,7 @@ Editor::Editor(Document* document, EditorFlags flags)
   , m_flags(flags)
   , m_secondaryButton(false)
   , m_aniSpeed(1.0)
+  , m_backSurface(nullptr)
 {
   // Add the first state into the history.
   m_statesHistory.push(m_state);
@@ -220,6 +230,9 @@ Editor::~Editor()
   setCustomizationDelegate(NULL);
 
   m_antsTimer.stop();
+
+  if (m_backSurface)
+    m_backSurface->dispose();
 }
 
 void Editor::destroyEditorSharedInternals()
@@ -436,92 +449,43 @@ void Editor::drawOneSpriteUnclippedRect(ui::Graphics* g, const gfx::Rect& sprite
   if (rc.isEmpty())
     return;
 
-  // Generate the rendered image
-  if (!m_renderBuffer)
-    m_renderBuffer.reset(new doc::ImageBuffer());
-
-  std::unique_ptr<Image> rendered = nullptr;
   try {
-    // Generate a "expose sprite pixels" notification. This is used by
-    // tool managers that need to validate this region (copy pixels from
-    // the original cel) before it can be used by the RenderEngine.
-    {
-      gfx::Rect expose = m_zoom.remove(rc);
-      // If the zoom level is less than 100%, we add extra pixels to
-      // the exposed area. Those pixels could be shown in the
-      // rendering process depending on each cel position.
-      // E.g. when we are drawing in a cel with position < (0,0)
-      if (m_zoom.scale() < 1.0) {
-        expose.enlarge(int(1./m_zoom.scale()));
-      }
-      // If the zoom level is more than %100 we add an extra pixel to
-      // expose just in case the zoom requires to display it.  Note:
-      // this is really necessary to avoid showing invalid destination
-      // areas in ToolLoopImpl.
-      else if (m_zoom.scale() > 1.0) {
-        expose.enlarge(1);
-      }
-      m_document->notifyExposeSpritePixels(m_sprite, gfx::Region(expose));
-    }
-
-    // Create a temporary RGB bitmap to draw all to it
-    rendered.reset(Image::create(IMAGE_RGB, rc.w, rc.h, m_renderBuffer));
-    m_renderEngine.setupBackground(m_document, rendered->pixelFormat());
-    m_renderEngine.disableOnionskin();
-
-    if ((m_flags & kShowOnionskin) == kShowOnionskin) {
-      if (m_docPref.onionskin.active()) {
-        OnionskinOptions opts(
-          (m_docPref.onionskin.type() == app::gen::OnionskinType::MERGE ?
-           render::OnionskinType::MERGE:
-           (m_docPref.onionskin.type() == app::gen::OnionskinType::RED_BLUE_TINT ?
-            render::OnionskinType::RED_BLUE_TINT:
-            render::OnionskinType::NONE)));
-
-        opts.position(m_docPref.onionskin.position());
-        opts.prevFrames(m_docPref.onionskin.prevFrames());
-        opts.nextFrames(m_docPref.onionskin.nextFrames());
-        opts.opacityBase(m_docPref.onionskin.opacityBase());
-        opts.opacityStep(m_docPref.onionskin.opacityStep());
-        opts.layer(m_docPref.onionskin.currentLayer() ? m_layer: nullptr);
-
-        FrameTag* tag = nullptr;
-        if (m_docPref.onionskin.loopTag())
-          tag = m_sprite->frameTags().innerTag(m_frame);
-        opts.loopTag(tag);
-
-        m_renderEngine.setOnionskin(opts);
-      }
-    }
-
-    ExtraCelRef extraCel = m_document->extraCel();
-    if (extraCel && extraCel->type() != render::ExtraType::NONE) {
-      m_renderEngine.setExtraImage(
-        extraCel->type(),
-        extraCel->cel(),
-        extraCel->image(),
-        extraCel->blendMode(),
-        m_layer, m_frame);
-    }
-
-    m_renderEngine.renderSprite(rendered.get(), m_sprite, m_frame,
-      gfx::Clip(0, 0, rc), m_zoom);
-
-    m_renderEngine.removeExtraImage();
+    updateBackBuffer(rc);
   }
   catch (const std::exception& e) {
     Console::showException(e);
+    return;
   }
 
-  if (rendered) {
-    // Pre-render decorator.
-    if ((m_flags & kShowDecorators) && m_decorator) {
-      EditorPreRenderImpl preRender(this, rendered.get(),
-        Point(-rc.x, -rc.y), m_zoom);
-      m_decorator->preRenderDecorator(&preRender);
-    }
+  // Pre-render decorator, it draws on a copy of the back buffer (so
+  // the decoration is not part of it)
+  std::unique_ptr<Image> decorated;
+  if ((m_flags & kShowDecorators) && m_decorator) {
+    EditorPreRenderImpl preRender(
+      this,
+      [this, &rc, &decorated]() -> Image* {
+        if (!m_renderBuffer)
+          m_renderBuffer.reset(new doc::ImageBuffer());
+
+        decorated.reset(Image::create(IMAGE_RGB, rc.w, rc.h, m_renderBuffer));
+        decorated->copy(
+          m_backBuffer.get(),
+          gfx::Clip(0, 0,
+                    rc.x - m_backBufferBounds.x,
+                    rc.y - m_backBufferBounds.y,
+                    rc.w, rc.h));
+        return decorated.get();
+      },
+      Point(-rc.x, -rc.y), m_zoom);
+    m_decorator->preRenderDecorator(&preRender);
+  }
 
-    // Convert the render to a she::Surface
+  // Without decorations the pixels were already converted to the back
+  // buffer surface
+  she::Surface* src = m_backSurface;
+  int src_x = rc.x - m_backBufferBounds.x;
+  int src_y = rc.y - m_backBufferBounds.y;
+  if (decorated) {
     static she::Surface* tmp;
     if (!tmp || tmp->width() < rc.w || tmp->height() < rc.h) {
       if (tmp)
@@ -530,17 +494,175 @@ void Editor::drawOneSpriteUnclippedRect(ui::Graphics* g, const gfx::Rect& sprite
       tmp = she::instance()->createRgbaSurface(rc.w, rc.h);
     }
 
-    if (tmp->nativeHandle()) {
-      convert_image_to_surface(rendered.get(), m_sprite->palette(m_frame),
+    if (tmp->nativeHandle())
+      convert_image_to_surface(decorated.get(), m_sprite->palette(m_frame),
         tmp, 0, 0, 0, 0, rc.w, rc.h);
 
-      g->blit(tmp, 0, 0, dest_x, dest_y, rc.w, rc.h);
+    src = tmp;
+    src_x = src_y = 0;
+  }
+
+  if (src && src->nativeHandle()) {
+    g->blit(src, src_x, src_y, dest_x, dest_y, rc.w, rc.h);
+
+    m_brushPreview.invalidateRegion(
+      gfx::Region(
+        gfx::Rect(dest_x, dest_y, rc.w, rc.h)));
+  }
+}
+
+void Editor::updateBackBuffer(const gfx::Rect& rc)
+{
+  m_renderEngine.setupBackground(m_document, IMAGE_RGB);
+  m_renderEngine.setParallel(true);
+  m_renderEngine.disableOnionskin();
+
+  if ((m_flags & kShowOnionskin) == kShowOnionskin) {
+    if (m_docPref.onionskin.active()) {
+      OnionskinOptions opts(
+        (m_docPref.onionskin.type() == app::gen::OnionskinType::MERGE ?
+         render::OnionskinType::MERGE:
+         (m_docPref.onionskin.type() == app::gen::OnionskinType::RED_BLUE_TINT ?
+          render::OnionskinType::RED_BLUE_TINT:
+          render::OnionskinType::NONE)));
+
+      opts.position(m_docPref.onionskin.position());
+      opts.prevFrames(m_docPref.onionskin.prevFrames());
+      opts.nextFrames(m_docPref.onionskin.nextFrames());
+      opts.opacityBase(m_docPref.onionskin.opacityBase());
+      opts.opacityStep(m_docPref.onionskin.opacityStep());
+      opts.layer(m_docPref.onionskin.currentLayer() ? m_layer: nullptr);
+
+      FrameTag* tag = nullptr;
+      if (m_docPref.onionskin.loopTag())
+        tag = m_sprite->frameTags().innerTag(m_frame);
+      opts.loopTag(tag);
+
+      m_renderEngine.setOnionskin(opts);
+    }
+  }
+
+  // Everything is rendered again if something that is not notified
+  // with drawSpriteClipped() was changed (frame, zoom, layers,
+  // versions of cels/images, background/onion skin options, etc.)
+  m_backBufferValid.setKey(
+    m_renderEngine.renderKey(m_sprite, m_frame, m_zoom, IMAGE_RGB));
+
+  // The back buffer covers the visible part of the sprite, when it's
+  // scrolled, the pixels that are still visible are kept.
+  if (!m_backBuffer || !m_backBufferBounds.contains(rc)) {
+    gfx::Rect newBounds = rc;
+    if (View* view = View::getView(this)) {
+      // Viewport in zoomed sprite coordinates
+      gfx::Rect vp = view->viewportBounds();
+      vp.offset(-bounds().origin() - m_padding);
+      newBounds |= vp.createIntersection(m_zoom.apply(m_sprite->bounds()));
+    }
 
-      m_brushPreview.invalidateRegion(
-        gfx::Region(
-          gfx::Rect(dest_x, dest_y, rc.w, rc.h)));
+    ImageRef newBuffer(Image::create(IMAGE_RGB, newBounds.w, newBounds.h));
+    she::Surface* newSurface =
+      she::instance()->createRgbaSurface(newBounds.w, newBounds.h);
+    if (m_backBuffer) {
+      newBuffer->copy(
+        m_backBuffer.get(),
+        gfx::Clip(m_backBufferBounds.x - newBounds.x,
+                  m_backBufferBounds.y - newBounds.y,
+                  0, 0,
+                  m_backBufferBounds.w, m_backBufferBounds.h));
+
+      const gfx::Rect kept = m_backBufferBounds.createIntersection(newBounds);
+      if (m_backSurface && !kept.isEmpty())
+        m_backSurface->blitTo(newSurface,
+                              kept.x - m_backBufferBounds.x,
+                              kept.y - m_backBufferBounds.y,
+                              kept.x - newBounds.x,
+                              kept.y - newBounds.y,
+                              kept.w, kept.h);
     }
+    if (m_backSurface)
+      m_backSurface->dispose();
+    m_backSurface = newSurface;
+    m_backBuffer = newBuffer;
+    m_backBufferBounds = newBounds;
+    m_backBufferValid.setBounds(newBounds);
+  }
+
+  gfx::Region dirty = m_backBufferValid.dirtyRegion(rc);
+  if (dirty.isEmpty())
+    return;
+
+  ExtraCelRef extraCel = m_document->extraCel();
+  if (extraCel && extraCel->type() != render::ExtraType::NONE) {
+    m_renderEngine.setExtraImage(
+      extraCel->type(),
+      extraCel->cel(),
+      extraCel->image(),
+      extraCel->blendMode(),
+      m_layer, m_frame);
   }
+
+  m_renderEngine.setLayersCache(
+    (Preferences::instance().experimental.cacheLowerLayers() ?
+     &m_layersCache: nullptr), m_layer);
+
+  try {
+    for (const gfx::Rect& dirtyRc : dirty) {
+      // Generate a "expose sprite pixels" notification. This is used by
+      // tool managers that need to validate this region (copy pixels from
+      // the original cel) before it can be used by the RenderEngine.
+      {
+        gfx::Rect expose = m_zoom.remove(dirtyRc);
+        // If the zoom level is less than 100%, we add extra pixels to
+        // the exposed area. Those pixels could be shown in the
+        // rendering process depending on each cel position.
+        // E.g. when we are drawing in a cel with position < (0,0)
+        if (m_zoom.scale() < 1.0) {
+          expose.enlarge(int(1./m_zoom.scale()));
+        }
+        // If the zoom level is more than %100 we add an extra pixel to
+        // expose just in case the zoom requires to display it.  Note:
+        // this is really necessary to avoid showing invalid destination
+        // areas in ToolLoopImpl.
+        else if (m_zoom.scale() > 1.0) {
+          expose.enlarge(1);
+        }
+        m_document->notifyExposeSpritePixels(m_sprite, gfx::Region(expose));
+      }
+
+      m_renderEngine.renderSprite(
+        m_backBuffer.get(), m_sprite, m_frame,
+        gfx::Clip(dirtyRc.x - m_backBufferBounds.x,
+                  dirtyRc.y - m_backBufferBounds.y,
+                  dirtyRc),
+        m_zoom);
+
+      // Only the rendered area is converted to the screen format
+      if (m_backSurface->nativeHandle()) {
+        convert_image_to_surface(
+          m_backBuffer.get(), m_sprite->palette(m_frame), m_backSurface,
+          dirtyRc.x - m_backBufferBounds.x,
+          dirtyRc.y - m_backBufferBounds.y,
+          dirtyRc.x - m_backBufferBounds.x,
+          dirtyRc.y - m_backBufferBounds.y,
+          dirtyRc.w, dirtyRc.h);
+      }
+
+      m_backBufferValid.validate(dirtyRc);
+    }
+  }
+  catch (...) {
+    m_renderEngine.removeExtraImage();
+    m_renderEngine.setLayersCache(nullptr, nullptr);
+    throw;
+  }
+
+  m_renderEngine.removeExtraImage();
+  m_renderEngine.setLayersCache(nullptr, nullptr);
+}
+
+void Editor::invalidateBackBuffer(const gfx::Region& spriteRegion)
+{
+  m_backBufferValid.invalidate(spriteRegion, m_zoom);
 }
 
 void Editor::drawSpriteUnclippedRect(ui::Graphics* g, const gfx::Rect& _rc)
@@ -709,6 +831,8 @@ void Editor::drawSpriteClipped(const gfx::Region& updateRegion)
   Region screenRegion;
   getDrawableRegion(screenRegion, kCutTopWindows);
 
+  invalidateBackBuffer(updateRegion);
+
   ScreenGraphics screenGraphics;
   GraphicsPtr editorGraphics = getGraphics(clientBounds());
 
@@ -867,6 +991,7 @@ void Editor::flashCurrentLayer()
       m_document->setExtraCel(oldExtraCel);
     }
 
+    invalidateBackBuffer(gfx::Region(m_sprite->bounds()));
     invalidate();
   }
 }
@@ -1393,6 +1518,12 @@ void Editor::onShowExtrasChange()
   invalidate();
 }
 
+void Editor::onGeneralUpdate(doc::DocumentEvent& ev)
+{
+  // Anything could be changed (e.g. the extra cel was removed)
+  m_backBufferValid.invalidateAll();
+}
+
 void Editor::onExposeSpritePixels(doc::DocumentEvent& ev)
 {
   if (m_state && ev.sprite() == m_sprite)
@@ -14,6 +14,7 @@
 #include "app/tools/active_tool_observer.h"
 #include "app/tools/tool_loop_modifiers.h"
 #include "app/ui/color_source.h"
+#include "app/ui/editor/back_buffer_validity.h"
 #include "app/ui/editor/brush_preview.h"
 #include "app/ui/editor/editor_observers.h"
 #include "app/ui/editor/editor_state.h"
@@ -22,8 +23,12 @@
 #include "doc/document_observer.h"
 #include "doc/frame.h"
 #include "doc/image_buffer.h"
+#include "doc/image_ref.h"
 #include "filters/tiled_mode.h"
 #include "gfx/fwd.h"
+#include "gfx/rect.h"
+#include "gfx/region.h"
+#include "render/layers_cache.h"
 #include "render/zoom.h"
 #include "ui/base.h"
 #include "ui/cursor_type.h"
@@ -39,6 +44,9 @@ namespace doc {
 namespace gfx {
   class Region;
 }
+namespace she {
+  class Surface;
+}
 namespace ui {
   class Graphics;
   class View;
@@ -223,6 +231,13 @@ namespace app {
 
     AppRender& renderEngine() { return m_renderEngine; }
 
+    // Marks the given sprite region to be rendered again. It must be
+    // called when pixels of the preview image are modified (they are
+    // not included in Render::renderKey()), before invalidating the
+    // editor region to paint it, or when sprite pixels are modified
+    // while the editor is hidden.
+    void invalidateBackBuffer(const gfx::Region& spriteRegion);
+
     // IColorSource
     app::Color getColorByPosition(const gfx::Point& pos) override;
 
@@ -235,6 +250,7 @@ namespace app {
     void onFgColorChange();
     void onContextBarBrushChange();
     void onShowExtrasChange();
+    void onGeneralUpdate(doc::DocumentEvent& ev) override;
     void onExposeSpritePixels(doc::DocumentEvent& ev) override;
 
     // ActiveToolObserver impl
@@ -258,6 +274,10 @@ namespace app {
     // routine.
     void drawOneSpriteUnclippedRect(ui::Graphics* g, const gfx::Rect& rc, int dx, int dy);
 
+    // Renders the parts of "rc" (in zoomed sprite coordinates) that
+    // are not valid in the back buffer.
+    void updateBackBuffer(const gfx::Rect& rc);
+
     gfx::Point calcExtraPadding(const render::Zoom& zoom);
 
     void invalidateIfActive();
@@ -328,6 +348,20 @@ namespace app {
 
     static doc::ImageBufferPtr m_renderBuffer;
 
+    // Rendered sprite (in zoomed sprite coordinates) reused between
+    // paints, so only the areas that were modified are rendered
+    // again. m_backBufferValid is the area that is up to date.
+    // m_backSurface has the same pixels converted to the screen format
+    // (converted when they are rendered, not on each paint).
+    doc::ImageRef m_backBuffer;
+    she::Surface* m_backSurface;
+    gfx::Rect m_backBufferBounds;
+    BackBufferValidity m_backBufferValid;
+
+    // Background and layers below m_layer already composited (only
+    // used if the "cache_lower_layers" experimental option is on).
+    render::LayersCache m_layersCache;
+
     // The render engine must be shared between all editors so when a
     // DrawingState is being used in one editor, other editors for the
     // same document can show the same preview image/stroke being drawn
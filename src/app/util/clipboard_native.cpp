@@ -24,6 +24,7 @@
 #include "she/system.h"
 #include "ui/alert.h"
 
+#include <algorithm>
 #include <memory>
 #include <sstream>
 #include <vector>
@@ -118,8 +119,13 @@ bool set_native_clipboard_bitmap(const doc::Image* image,
 
   switch (image->pixelFormat()) {
     case doc::IMAGE_RGB: {
-      // We use the RGB image data directly
-      clip::image img(image->getPixelAddress(0, 0), spec);
+      // We copy the RGB image data row by row (rows of an image can
+      // be in different blocks of memory)
+      clip::image img(spec);
+      for (int y=0; y<image->height(); ++y)
+        std::copy(image->getConstPixelAddress(0, y),
+                  image->getConstPixelAddress(0, y) + spec.bytes_per_row,
+                  (uint8_t*)img.data() + y*spec.bytes_per_row);
       l.set_image(img);
       break;
     }
@@ -0,0 +1,175 @@
+// LibreSprite Base Library
+// Copyright (c) 2026 LibreSprite contributors
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "base/mapped_file.h"
+
+#ifdef _WIN32
+  #include <windows.h>
+  #include "base/string.h"
+#else
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+namespace base {
+
+mapped_file::mapped_file()
+  : m_data(nullptr)
+  , m_size(0)
+  , m_mtime(0)
+#ifdef _WIN32
+  , m_file(INVALID_HANDLE_VALUE)
+  , m_mapping(nullptr)
+#else
+  , m_fd(-1)
+#endif
+{
+}
+
+mapped_file::~mapped_file()
+{
+  close();
+}
+
+#ifdef _WIN32
+
+static int64_t file_mtime(HANDLE file)
+{
+  FILETIME mtime;
+  if (!::GetFileTime(file, nullptr, nullptr, &mtime))
+    return -1;
+  return (int64_t(mtime.dwHighDateTime) << 32) | mtime.dwLowDateTime;
+}
+
+bool mapped_file::open(const std::string& filename)
+{
+  close();
+
+  m_file = ::CreateFile(from_utf8(filename).c_str(),
+                        GENERIC_READ, FILE_SHARE_READ, nullptr,
+                        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (m_file == INVALID_HANDLE_VALUE)
+    return false;
+
+  LARGE_INTEGER size;
+  if (!::GetFileSizeEx(m_file, &size) || size.QuadPart <= 0) {
+    close();
+    return false;
+  }
+
+  m_mapping = ::CreateFileMapping(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (!m_mapping) {
+    close();
+    return false;
+  }
+
+  m_data = (const uint8_t*)::MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+  if (!m_data) {
+    close();
+    return false;
+  }
+
+  m_size = std::size_t(size.QuadPart);
+  m_mtime = file_mtime(m_file);
+  return true;
+}
+
+bool mapped_file::modified() const
+{
+  LARGE_INTEGER size;
+  return (!m_data ||
+          !::GetFileSizeEx(m_file, &size) ||
+          std::size_t(size.QuadPart) != m_size ||
+          file_mtime(m_file) != m_mtime);
+}
+
+void mapped_file::close()
+{
+  if (m_data)
+    ::UnmapViewOfFile(m_data);
+  if (m_mapping)
+    ::CloseHandle(m_mapping);
+  if (m_file != INVALID_HANDLE_VALUE)
+    ::CloseHandle(m_file);
+
+  m_data = nullptr;
+  m_size = 0;
+  m_mtime = 0;
+  m_file = INVALID_HANDLE_VALUE;
+  m_mapping = nullptr;
+}
+
+#else
+
+static int64_t file_mtime(const struct stat& sts)
+{
+#ifdef __APPLE__
+  const struct timespec& mtime = sts.st_mtimespec;
+#else
+  const struct timespec& mtime = sts.st_mtim;
+#endif
+  return int64_t(mtime.tv_sec)*1000000000 + mtime.tv_nsec;
+}
+
+bool mapped_file::open(const std::string& filename)
+{
+  close();
+
+  // The file is kept open to check if it's modified (the mapping
+  // doesn't need it)
+  m_fd = ::open(filename.c_str(), O_RDONLY);
+  if (m_fd == -1)
+    return false;
+
+  struct stat sts;
+  if (::fstat(m_fd, &sts) != 0 || sts.st_size <= 0) {
+    close();
+    return false;
+  }
+
+  void* data = ::mmap(nullptr, std::size_t(sts.st_size), PROT_READ, MAP_PRIVATE, m_fd, 0);
+  if (data == MAP_FAILED) {
+    close();
+    return false;
+  }
+
+  m_data = (const uint8_t*)data;
+  m_size = std::size_t(sts.st_size);
+  m_mtime = file_mtime(sts);
+  return true;
+}
+
+bool mapped_file::modified() const
+{
+  struct stat sts;
+  return (!m_data ||
+          ::fstat(m_fd, &sts) != 0 ||
+          std::size_t(sts.st_size) != m_size ||
+          file_mtime(sts) != m_mtime);
+}
+
+void mapped_file::close()
+{
+  if (m_data)
+    ::munmap(const_cast<uint8_t*>(m_data), m_size);
+  if (m_fd != -1)
+    ::close(m_fd);
+
+  m_data = nullptr;
+  m_size = 0;
+  m_mtime = 0;
+  m_fd = -1;
+}
+
+#endif
+
+} // namespace base
@@ -0,0 +1,56 @@
+// LibreSprite Base Library
+// Copyright (c) 2026 LibreSprite contributors
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#pragma once
+
+#include "base/disable_copying.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace base {
+
+  // Maps the whole content of a file in memory (read-only). Pages of
+  // the file are read by the OS when they are accessed and can be
+  // discarded at any time (they are backed by the file itself).
+  //
+  // The file must not be truncated while it's mapped: accessing
+  // pages beyond the new end of the file crashes the program. Use
+  // modified() before reading the data if other processes could
+  // write the file (it cannot detect a change made after the call).
+  class mapped_file {
+  public:
+    mapped_file();
+    ~mapped_file();
+
+    // Returns false if the file cannot be opened or mapped.
+    bool open(const std::string& filename);
+    void close();
+
+    const uint8_t* data() const { return m_data; }
+    std::size_t size() const { return m_size; }
+
+    // Returns true if the size or the modification time of the
+    // mapped file changed since it was opened (or if it's closed),
+    // i.e. its data cannot be trusted anymore.
+    bool modified() const;
+
+  private:
+    const uint8_t* m_data;
+    std::size_t m_size;
+    int64_t m_mtime;
+#ifdef _WIN32
+    void* m_file;
+    void* m_mapping;
+#else
+    int m_fd;
+#endif
+
+    DISABLE_COPYING(mapped_file);
+  };
+
+} // namespace base
@@ -0,0 +1,73 @@
+// LibreSprite Base Library
+// Copyright (c) 2026 LibreSprite contributors
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#include <gtest/gtest.h>
+
+#include "base/file_handle.h"
+#include "base/fs.h"
+#include "base/mapped_file.h"
+
+#include <cstring>
+
+using namespace base;
+
+TEST(MappedFile, ReadContent)
+{
+  const char* fn = "mapped_file_test.bin";
+
+  {
+    FileHandle f(open_file_with_exception(fn, "wb"));
+    EXPECT_EQ(11u, fwrite("hello world", 1, 11, f.get()));
+  }
+
+  {
+    mapped_file file;
+    ASSERT_TRUE(file.open(fn));
+    ASSERT_EQ(11u, file.size());
+    EXPECT_EQ(0, std::memcmp("hello world", file.data(), 11));
+    EXPECT_FALSE(file.modified());
+
+    file.close();
+    EXPECT_EQ(nullptr, file.data());
+    EXPECT_EQ(0u, file.size());
+    EXPECT_TRUE(file.modified());
+  }
+
+  delete_file(fn);
+
+  mapped_file file;
+  EXPECT_FALSE(file.open(fn));
+  EXPECT_EQ(nullptr, file.data());
+}
+
+TEST(MappedFile, Modified)
+{
+  const char* fn = "mapped_file_test.bin";
+
+  {
+    FileHandle f(open_file_with_exception(fn, "wb"));
+    EXPECT_EQ(5u, fwrite("hello", 1, 5, f.get()));
+  }
+
+  mapped_file file;
+  ASSERT_TRUE(file.open(fn));
+  EXPECT_FALSE(file.modified());
+
+  // Truncate the file (we don't touch the mapped data after this)
+  {
+    FileHandle f(open_file_with_exception(fn, "wb"));
+  }
+  EXPECT_TRUE(file.modified());
+
+  file.close();
+  delete_file(fn);
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
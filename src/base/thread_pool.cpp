@@ -0,0 +1,150 @@
+// LibreSprite Base Library
+// Copyright (c) 2026 LibreSprite contributors
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "base/thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <exception>
+
+namespace base {
+
+class thread_pool::job {
+public:
+  job(int n, int nslices, const std::function<void(int)>& func)
+    : m_func(func)
+    , m_slices(nslices)
+    , m_nextSlot(0)
+    , m_pending(n) {
+    for (int i=0; i<nslices; ++i) {
+      m_slices[i].next = int(std::int64_t(n) * i / nslices);
+      m_slices[i].end = int(std::int64_t(n) * (i+1) / nslices);
+    }
+  }
+
+  // Runs iterations until all slices are empty.
+  void run() {
+    const int nslices = int(m_slices.size());
+    const int slot = m_nextSlot++ % nslices;
+
+    for (int k=0; k<nslices; ++k) {
+      slice& s = m_slices[(slot+k) % nslices];
+      for (int i=s.next++; i<s.end; i=s.next++) {
+        try {
+          m_func(i);
+        }
+        catch (...) {
+          std::lock_guard<std::mutex> lock(m_mutex);
+          if (!m_exception)
+            m_exception = std::current_exception();
+        }
+
+        if (--m_pending == 0) {
+          std::lock_guard<std::mutex> lock(m_mutex);
+          m_cv.notify_all();
+        }
+      }
+    }
+  }
+
+  void wait() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [this]{ return m_pending == 0; });
+    if (m_exception)
+      std::rethrow_exception(m_exception);
+  }
+
+private:
+  struct slice {
+    std::atomic<int> next;
+    int end;
+  };
+
+  const std::function<void(int)>& m_func;
+  std::vector<slice> m_slices;
+  std::atomic<int> m_nextSlot;
+  std::atomic<int> m_pending;
+  std::exception_ptr m_exception;
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+};
+
+thread_pool::thread_pool(int nthreads)
+  : m_running(true)
+{
+  if (nthreads <= 0)
+    nthreads = int(std::thread::hardware_concurrency())-1;
+
+  for (int i=0; i<nthreads; ++i)
+    m_workers.emplace_back([this]{ worker_loop(); });
+}
+
+thread_pool::~thread_pool()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_running = false;
+  }
+  m_cv.notify_all();
+
+  for (auto& worker : m_workers)
+    worker.join();
+}
+
+void thread_pool::parallel_for(int n, const std::function<void(int)>& func)
+{
+  if (n <= 0)
+    return;
+
+  const int nslices = std::min(n, concurrency());
+  if (nslices == 1) {
+    for (int i=0; i<n; ++i)
+      func(i);
+    return;
+  }
+
+  auto j = std::make_shared<job>(n, nslices, func);
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (int i=1; i<nslices; ++i)
+      m_tickets.push_back(j);
+  }
+  m_cv.notify_all();
+
+  j->run();
+  j->wait();
+}
+
+void thread_pool::worker_loop()
+{
+  while (true) {
+    std::shared_ptr<job> j;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_cv.wait(lock, [this]{ return !m_running || !m_tickets.empty(); });
+      if (!m_running)
+        break;
+
+      j = m_tickets.front();
+      m_tickets.pop_front();
+    }
+    j->run();
+  }
+}
+
+// static
+thread_pool& thread_pool::instance()
+{
+  static thread_pool pool;
+  return pool;
+}
+
+} // namespace base
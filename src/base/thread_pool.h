@@ -0,0 +1,58 @@
+// LibreSprite Base Library
+// Copyright (c) 2026 LibreSprite contributors
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#pragma once
+
+#include "base/disable_copying.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace base {
+
+  // A fixed set of worker threads used to split CPU-bound loops
+  // (rendering, compositing, filters, etc.) between all cores.
+  class thread_pool {
+  public:
+    // Creates "nthreads" workers, or one worker per core (minus the
+    // calling thread) if nthreads is 0.
+    explicit thread_pool(int nthreads = 0);
+    ~thread_pool();
+
+    // Number of threads that can run iterations at the same time
+    // (workers + the thread calling parallel_for()).
+    int concurrency() const { return int(m_workers.size())+1; }
+
+    // Calls func(i) for each i in [0, n). The range is split in one
+    // slice per thread, each thread consumes its own slice and then
+    // steals iterations from the slices of the other threads. The
+    // calling thread participates too, and the function returns
+    // when all iterations are done, so it can be nested safely.
+    void parallel_for(int n, const std::function<void(int)>& func);
+
+    // Shared pool for the whole program.
+    static thread_pool& instance();
+
+  private:
+    class job;
+
+    void worker_loop();
+
+    std::vector<std::thread> m_workers;
+    std::deque<std::shared_ptr<job>> m_tickets;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_running;
+
+    DISABLE_COPYING(thread_pool);
+  };
+
+} // namespace base
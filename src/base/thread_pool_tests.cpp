@@ -0,0 +1,57 @@
+// LibreSprite Base Library
+// Copyright (c) 2026 LibreSprite contributors
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#include <gtest/gtest.h>
+
+#include "base/thread_pool.h"
+
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+using namespace base;
+
+TEST(ThreadPool, EachIterationOnce)
+{
+  thread_pool pool(3);
+  std::vector<std::atomic<int>> hits(1000);
+  for (auto& h : hits)
+    h = 0;
+
+  pool.parallel_for(int(hits.size()), [&](int i){ ++hits[i]; });
+
+  for (auto& h : hits)
+    EXPECT_EQ(1, h);
+}
+
+TEST(ThreadPool, Nested)
+{
+  thread_pool pool(2);
+  std::atomic<int> count(0);
+
+  pool.parallel_for(8, [&](int){
+    pool.parallel_for(8, [&](int){ ++count; });
+  });
+
+  EXPECT_EQ(64, count);
+}
+
+TEST(ThreadPool, Exception)
+{
+  thread_pool pool(2);
+  EXPECT_THROW(
+    pool.parallel_for(16, [](int i){
+      if (i == 7)
+        throw std::runtime_error("error");
+    }),
+    std::runtime_error);
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
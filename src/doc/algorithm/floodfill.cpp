@@ -152,7 +152,7 @@ static int flooder(const Image* image,
 
     case IMAGE_RGB:
       {
-        uint32_t* address = reinterpret_cast<uint32_t*>(image->getPixelAddress(0, y));
+        const uint32_t* address = reinterpret_cast<const uint32_t*>(image->getPixelAddress(0, y));
 
         // Check start pixel
         if (!color_equal_32((int)*(address+x), src_color, tolerance) || MASKED(x, y))
@@ -174,7 +174,7 @@ static int flooder(const Image* image,
 
     case IMAGE_GRAYSCALE:
       {
-        uint16_t* address = reinterpret_cast<uint16_t*>(image->getPixelAddress(0, y));
+        const uint16_t* address = reinterpret_cast<const uint16_t*>(image->getPixelAddress(0, y));
 
         // Check start pixel
         if (!color_equal_16((int)*(address+x), src_color, tolerance) || MASKED(x, y))
@@ -196,7 +196,7 @@ static int flooder(const Image* image,
 
     case IMAGE_INDEXED:
       {
-        uint8_t* address = image->getPixelAddress(0, y);
+        const uint8_t* address = image->getPixelAddress(0, y);
 
         // Check start pixel
         if (!color_equal_8((int)*(address+x), src_color, tolerance) || MASKED(x, y))
@@ -315,10 +315,10 @@ static int check_flood_line(const Image* image,
 template<typename ImageTraits>
 static void replace_color(const Image* image, const gfx::Rect& bounds, int src_color, int tolerance, void* data, AlgoHLine proc)
 {
-  typename ImageTraits::address_t address;
+  typename ImageTraits::const_address_t address;
 
   for (int y=bounds.y; y<bounds.y2(); ++y) {
-    address = reinterpret_cast<typename ImageTraits::address_t>(image->getPixelAddress(bounds.x, y));
+    address = reinterpret_cast<typename ImageTraits::const_address_t>(image->getPixelAddress(bounds.x, y));
 
     for (int x=bounds.x; x<bounds.x2(); ++x, ++address) {
       int right = -1;
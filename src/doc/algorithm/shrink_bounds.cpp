@@ -56,6 +56,14 @@ bool shrink_bounds_templ(const Image* image, gfx::Rect& bounds, color_t refpixel
   bool shrink;
   int u, v;
 
+  // Rows that weren't modified after clearing the image with
+  // "refpixel" don't need to be scanned.
+  if (is_same_pixel<ImageTraits>(image->clearColor(), refpixel)) {
+    bounds &= image->modifiedBounds();
+    if (bounds.isEmpty())
+      return false;
+  }
+
   // Shrink left side
   for (u=bounds.x; u<bounds.x+bounds.w; ++u) {
     shrink = true;
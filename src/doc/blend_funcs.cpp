@@ -21,6 +21,7 @@
 #include "base/base.h"
 #include "base/debug.h"
 #include "doc/blend_internals.h"
+#include "doc/simd_level.h"
 
 #include <cmath>
 
@@ -720,4 +721,67 @@ BlendFunc get_indexed_blender(BlendMode blendmode)
   return indexed_blender_src;
 }
 
+//////////////////////////////////////////////////////////////////////
+// Row blenders
+
+#ifdef DOC_HAVE_SIMD
+
+// Defined in blend_rows_sse2.cpp and blend_rows_avx2.cpp, they return
+// nullptr for the blend modes without a SIMD kernel.
+BlendRowFunc get_rgba_row_blender_sse2(BlendMode blendmode);
+BlendRowFunc get_rgba_row_blender_avx2(BlendMode blendmode);
+
+#endif // DOC_HAVE_SIMD
+
+template<BlendFunc blender>
+static void rgba_row_blender(color_t* dst, const color_t* src, int n,
+                             int opacity, color_t maskColor)
+{
+  for (int i=0; i<n; ++i, ++dst, ++src) {
+    if (*src != maskColor)
+      *dst = (*blender)(*dst, *src, opacity);
+  }
+}
+
+BlendRowFunc get_rgba_row_blender(BlendMode blendmode)
+{
+#ifdef DOC_HAVE_SIMD
+  BlendRowFunc func = nullptr;
+  switch (simd_level()) {
+    case SimdLevel::AVX2: func = get_rgba_row_blender_avx2(blendmode); break;
+    case SimdLevel::SSE2: func = get_rgba_row_blender_sse2(blendmode); break;
+    case SimdLevel::NONE: break;
+  }
+  if (func)
+    return func;
+#endif
+
+  switch (blendmode) {
+    case BlendMode::SRC:            return rgba_row_blender<rgba_blender_src>;
+    case BlendMode::MERGE:          return rgba_row_blender<rgba_blender_merge>;
+    case BlendMode::NEG_BW:         return rgba_row_blender<rgba_blender_neg_bw>;
+    case BlendMode::RED_TINT:       return rgba_row_blender<rgba_blender_red_tint>;
+    case BlendMode::BLUE_TINT:      return rgba_row_blender<rgba_blender_blue_tint>;
+
+    case BlendMode::NORMAL:         return rgba_row_blender<rgba_blender_normal>;
+    case BlendMode::MULTIPLY:       return rgba_row_blender<rgba_blender_multiply>;
+    case BlendMode::SCREEN:         return rgba_row_blender<rgba_blender_screen>;
+    case BlendMode::OVERLAY:        return rgba_row_blender<rgba_blender_overlay>;
+    case BlendMode::DARKEN:         return rgba_row_blender<rgba_blender_darken>;
+    case BlendMode::LIGHTEN:        return rgba_row_blender<rgba_blender_lighten>;
+    case BlendMode::COLOR_DODGE:    return rgba_row_blender<rgba_blender_color_dodge>;
+    case BlendMode::COLOR_BURN:     return rgba_row_blender<rgba_blender_color_burn>;
+    case BlendMode::HARD_LIGHT:     return rgba_row_blender<rgba_blender_hard_light>;
+    case BlendMode::SOFT_LIGHT:     return rgba_row_blender<rgba_blender_soft_light>;
+    case BlendMode::DIFFERENCE:     return rgba_row_blender<rgba_blender_difference>;
+    case BlendMode::EXCLUSION:      return rgba_row_blender<rgba_blender_exclusion>;
+    case BlendMode::HSL_HUE:        return rgba_row_blender<rgba_blender_hsl_hue>;
+    case BlendMode::HSL_SATURATION: return rgba_row_blender<rgba_blender_hsl_saturation>;
+    case BlendMode::HSL_COLOR:      return rgba_row_blender<rgba_blender_hsl_color>;
+    case BlendMode::HSL_LUMINOSITY: return rgba_row_blender<rgba_blender_hsl_luminosity>;
+  }
+  ASSERT(false);
+  return rgba_row_blender<rgba_blender_src>;
+}
+
 } // namespace doc
@@ -13,6 +13,13 @@ namespace doc {
 
   typedef color_t (*BlendFunc)(color_t backdrop, color_t src, int opacity);
 
+  // Blends "n" pixels of "src" into "dst" (the "src" pixels equal to
+  // "maskColor" are skipped). It's the same as calling the BlendFunc
+  // of the blend mode for each pixel, but some modes use SIMD kernels
+  // selected at runtime depending on the CPU.
+  typedef void (*BlendRowFunc)(color_t* dst, const color_t* src, int n,
+                               int opacity, color_t maskColor);
+
   color_t rgba_blender_normal(color_t backdrop, color_t src, int opacity);
   color_t rgba_blender_normal(color_t backdrop, color_t src);
   color_t rgba_blender_merge(color_t backdrop, color_t src, int opacity);
@@ -27,4 +34,6 @@ namespace doc {
   BlendFunc get_graya_blender(BlendMode blendmode);
   BlendFunc get_indexed_blender(BlendMode blendmode);
 
+  BlendRowFunc get_rgba_row_blender(BlendMode blendmode);
+
 } // namespace doc
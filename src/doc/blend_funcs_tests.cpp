@@ -0,0 +1,79 @@
+// LibreSprite Document Library
+// Copyright (c) 2026 LibreSprite contributors
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#include <gtest/gtest.h>
+
+#include "doc/blend_funcs.h"
+#include "doc/color.h"
+
+#include <cstdlib>
+#include <vector>
+
+using namespace doc;
+
+namespace {
+
+color_t random_color()
+{
+  // Use extreme alpha values more often (they follow special paths in
+  // the normal blender).
+  int a;
+  switch (std::rand() % 4) {
+    case 0: a = 0; break;
+    case 1: a = 255; break;
+    default: a = std::rand() % 256; break;
+  }
+  return rgba(std::rand() % 256, std::rand() % 256, std::rand() % 256, a);
+}
+
+} // anonymous namespace
+
+TEST(BlendFuncs, RowBlendersMatchPixelBlenders)
+{
+  const BlendMode modes[] = {
+    BlendMode::NORMAL,
+    BlendMode::MULTIPLY,
+    BlendMode::SCREEN,
+    BlendMode::OVERLAY,
+    BlendMode::DARKEN,
+    BlendMode::DIFFERENCE,
+    BlendMode::MERGE };
+
+  const int n = 1027;           // Not a multiple of the SIMD width
+  const color_t maskColor = rgba(1, 2, 3, 0);
+  std::srand(5);
+
+  std::vector<color_t> src(n), backdrop(n);
+  for (int i=0; i<n; ++i) {
+    src[i] = (i % 17 == 0 ? maskColor: random_color());
+    backdrop[i] = random_color();
+  }
+
+  for (BlendMode mode : modes) {
+    BlendFunc blender = get_rgba_blender(mode);
+    BlendRowFunc rowBlender = get_rgba_row_blender(mode);
+
+    for (int opacity : { 0, 1, 128, 254, 255 }) {
+      std::vector<color_t> expected = backdrop;
+      for (int i=0; i<n; ++i)
+        if (src[i] != maskColor)
+          expected[i] = blender(expected[i], src[i], opacity);
+
+      std::vector<color_t> result = backdrop;
+      rowBlender(&result[0], &src[0], n, opacity, maskColor);
+
+      for (int i=0; i<n; ++i)
+        ASSERT_EQ(expected[i], result[i])
+          << "Mode " << int(mode) << " opacity " << opacity << " pixel " << i;
+    }
+  }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
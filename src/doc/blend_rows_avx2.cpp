@@ -0,0 +1,55 @@
+// LibreSprite Document Library
+// Copyright (C) 2026  LibreSprite contributors
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+//
+// Compiled with AVX2 enabled, only called when the CPU supports it
+// (see get_rgba_row_blender() in blend_funcs.cpp).
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <immintrin.h>
+
+#include "doc/blend_rows_simd.h"
+
+namespace doc {
+
+namespace {
+
+  struct Avx2 {
+    typedef __m256i I;
+    typedef __m256 F;
+    enum { N = 8 };
+
+    static I load(const color_t* p) { return _mm256_loadu_si256((const I*)p); }
+    static void store(color_t* p, I v) { _mm256_storeu_si256((I*)p, v); }
+    static I set1(int v) { return _mm256_set1_epi32(v); }
+    static I and_(I a, I b) { return _mm256_and_si256(a, b); }
+    static I or_(I a, I b) { return _mm256_or_si256(a, b); }
+    static I andnot(I a, I b) { return _mm256_andnot_si256(a, b); }
+    static I add(I a, I b) { return _mm256_add_epi32(a, b); }
+    static I sub(I a, I b) { return _mm256_sub_epi32(a, b); }
+    static I mul16(I a, I b) { return _mm256_mullo_epi16(a, b); }
+    static I cmpeq(I a, I b) { return _mm256_cmpeq_epi32(a, b); }
+    static I cmplt(I a, I b) { return _mm256_cmpgt_epi32(b, a); }
+    template<int S> static I srl(I a) { return _mm256_srli_epi32(a, S); }
+    template<int S> static I sll(I a) { return _mm256_slli_epi32(a, S); }
+    static F tof(I a) { return _mm256_cvtepi32_ps(a); }
+    static I trunc(F a) { return _mm256_cvttps_epi32(a); }
+    static F mulf(F a, F b) { return _mm256_mul_ps(a, b); }
+    static F divf(F a, F b) { return _mm256_div_ps(a, b); }
+    static F maxf(F a, F b) { return _mm256_max_ps(a, b); }
+    static F set1f(float v) { return _mm256_set1_ps(v); }
+  };
+
+} // anonymous namespace
+
+BlendRowFunc get_rgba_row_blender_avx2(BlendMode blendmode)
+{
+  return simd::get_rgba_row_blender<Avx2>(blendmode);
+}
+
+} // namespace doc
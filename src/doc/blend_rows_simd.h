@@ -0,0 +1,172 @@
+// LibreSprite Document Library
+// Copyright (C) 2026  LibreSprite contributors
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+//
+// SIMD row blenders. This header is included by blend_rows_sse2.cpp
+// and blend_rows_avx2.cpp, which are compiled with specific
+// instruction sets and define the "V" type with the vector
+// operations. The results must be the same as the scalar blenders in
+// blend_funcs.cpp.
+//
+// Each color_t is in one 32-bit lane. Channel values are in [0,255],
+// so the product of two channels fits in 16 bits and mul16() can be
+// used to multiply 32-bit lanes (the high 16 bits of each lane are
+// zero). The division of the normal blender is done with floats: the
+// numerator fits in 24 bits, so the truncated quotient is exactly the
+// same as the integer division.
+
+#pragma once
+
+#include "doc/blend_funcs.h"
+#include "doc/color.h"
+
+namespace doc {
+namespace simd {
+
+  // (mask ? x: y)
+  template<typename V>
+  inline typename V::I select(typename V::I mask, typename V::I x, typename V::I y) {
+    return V::or_(V::and_(mask, x), V::andnot(mask, y));
+  }
+
+  // MUL_UN8(a, b)
+  template<typename V>
+  inline typename V::I mul_un8(typename V::I a, typename V::I b) {
+    typename V::I t = V::add(V::mul16(a, b), V::set1(0x80));
+    return V::template srl<8>(V::add(V::template srl<8>(t), t));
+  }
+
+  template<typename V, int shift>
+  inline typename V::I channel(typename V::I c) {
+    return V::and_(V::template srl<shift>(c), V::set1(0xff));
+  }
+
+  // rgba_blender_normal(b, s, opacity)
+  template<typename V>
+  inline typename V::I blend_normal(typename V::I b, typename V::I s, typename V::I opacity) {
+    typedef typename V::I I;
+    typedef typename V::F F;
+
+    const I zero = V::set1(0);
+    const I Ba = V::template srl<24>(b);
+    const I Sa0 = V::template srl<24>(s);
+    const I Sa = mul_un8<V>(Sa0, opacity);
+
+    // Result when the backdrop is transparent
+    const I transparentBackdrop =
+      V::or_(V::and_(s, V::set1(rgba_rgb_mask)),
+             V::template sll<24>(Sa));
+
+    const I Ra = V::sub(V::add(Ba, Sa), mul_un8<V>(Ba, Sa));
+    const F SaF = V::tof(Sa);
+    const F RaF = V::maxf(V::tof(Ra), V::set1f(1.0f));
+
+    // Rc = Bc + (Sc-Bc) * Sa / Ra
+    I Br = channel<V, 0>(b), Bg = channel<V, 8>(b), Bb = channel<V, 16>(b);
+    I Rr = V::add(Br, V::trunc(V::divf(V::mulf(V::tof(V::sub(channel<V, 0>(s), Br)), SaF), RaF)));
+    I Rg = V::add(Bg, V::trunc(V::divf(V::mulf(V::tof(V::sub(channel<V, 8>(s), Bg)), SaF), RaF)));
+    I Rb = V::add(Bb, V::trunc(V::divf(V::mulf(V::tof(V::sub(channel<V, 16>(s), Bb)), SaF), RaF)));
+
+    I res = V::or_(V::or_(Rr, V::template sll<8>(Rg)),
+                   V::or_(V::template sll<16>(Rb), V::template sll<24>(Ra)));
+
+    res = select<V>(V::cmpeq(Sa0, zero), b, res);
+    res = select<V>(V::cmpeq(Ba, zero), transparentBackdrop, res);
+    return res;
+  }
+
+  template<typename V>
+  struct Multiply {
+    static inline typename V::I blend(typename V::I b, typename V::I s) {
+      return mul_un8<V>(b, s);
+    }
+  };
+
+  template<typename V>
+  struct Screen {
+    static inline typename V::I blend(typename V::I b, typename V::I s) {
+      return V::sub(V::add(b, s), mul_un8<V>(b, s));
+    }
+  };
+
+  // blend_overlay(b, s) = blend_hard_light(s, b)
+  template<typename V>
+  struct Overlay {
+    static inline typename V::I blend(typename V::I b, typename V::I s) {
+      typename V::I b2 = V::template sll<1>(b);
+      typename V::I b3 = V::sub(b2, V::set1(255));
+      typename V::I lo = mul_un8<V>(s, b2);
+      typename V::I hi = V::sub(V::add(s, b3), mul_un8<V>(s, b3));
+      return select<V>(V::cmplt(b, V::set1(128)), lo, hi);
+    }
+  };
+
+  // Applies the separable blend mode "Mode" to the RGB channels and
+  // then composites the result with the normal blender.
+  template<typename V, typename Mode>
+  inline typename V::I blend_separable(typename V::I b, typename V::I s, typename V::I opacity) {
+    typename V::I rgb =
+      V::or_(V::or_(Mode::blend(channel<V, 0>(b), channel<V, 0>(s)),
+                    V::template sll<8>(Mode::blend(channel<V, 8>(b), channel<V, 8>(s)))),
+             V::template sll<16>(Mode::blend(channel<V, 16>(b), channel<V, 16>(s))));
+    s = V::or_(rgb, V::and_(s, V::set1(rgba_a_mask)));
+    return blend_normal<V>(b, s, opacity);
+  }
+
+  template<typename V>
+  struct Normal {
+    static inline typename V::I composite(typename V::I b, typename V::I s, typename V::I opacity) {
+      return blend_normal<V>(b, s, opacity);
+    }
+  };
+
+  template<typename V, typename Mode>
+  struct Separable {
+    static inline typename V::I composite(typename V::I b, typename V::I s, typename V::I opacity) {
+      return blend_separable<V, Mode>(b, s, opacity);
+    }
+  };
+
+  template<typename V, typename Composite, BlendMode mode>
+  void row_blender(color_t* dst, const color_t* src, int n,
+                   int opacity, color_t maskColor) {
+    const typename V::I opacityV = V::set1(opacity);
+    const typename V::I maskV = V::set1(int(maskColor));
+
+    int i = 0;
+    for (; i+V::N <= n; i+=V::N) {
+      typename V::I b = V::load(dst+i);
+      typename V::I s = V::load(src+i);
+      typename V::I r = Composite::composite(b, s, opacityV);
+      V::store(dst+i, select<V>(V::cmpeq(s, maskV), b, r));
+    }
+
+    // Remaining pixels
+    if (i < n) {
+      BlendFunc blender = get_rgba_blender(mode);
+      for (; i<n; ++i) {
+        if (src[i] != maskColor)
+          dst[i] = (*blender)(dst[i], src[i], opacity);
+      }
+    }
+  }
+
+  template<typename V>
+  BlendRowFunc get_rgba_row_blender(BlendMode blendmode) {
+    switch (blendmode) {
+      case BlendMode::NORMAL:
+        return row_blender<V, Normal<V>, BlendMode::NORMAL>;
+      case BlendMode::MULTIPLY:
+        return row_blender<V, Separable<V, Multiply<V> >, BlendMode::MULTIPLY>;
+      case BlendMode::SCREEN:
+        return row_blender<V, Separable<V, Screen<V> >, BlendMode::SCREEN>;
+      case BlendMode::OVERLAY:
+        return row_blender<V, Separable<V, Overlay<V> >, BlendMode::OVERLAY>;
+    }
+    return nullptr;
+  }
+
+} // namespace simd
+} // namespace doc
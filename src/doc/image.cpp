@@ -37,6 +37,14 @@ int Image::getMemSize() const
   return sizeof(Image) + static_cast<long>(getRowStrideSize())*m_height;
 }
 
+gfx::Rect Image::opaqueBounds() const
+{
+  if (clearColor() == m_maskColor)
+    return modifiedBounds();
+  else
+    return bounds();
+}
+
 int Image::getRowStrideSize() const
 {
   return getRowStrideSize(m_width);
@@ -60,10 +68,47 @@ Image* Image::create(PixelFormat format, int width, int height,
   return NULL;
 }
 
+// static
+Image* Image::createLazy(PixelFormat format, int width, int height,
+                         const ImageLoaderPtr& loader)
+{
+  switch (format) {
+    case IMAGE_RGB:       return new ImageImpl<RgbTraits>(width, height, loader);
+    case IMAGE_GRAYSCALE: return new ImageImpl<GrayscaleTraits>(width, height, loader);
+    case IMAGE_INDEXED:   return new ImageImpl<IndexedTraits>(width, height, loader);
+    case IMAGE_BITMAP:    return new ImageImpl<BitmapTraits>(width, height, loader);
+  }
+  return NULL;
+}
+
+template<typename ImageTraits>
+static Image* create_shared_copy(const Image* image)
+{
+  auto src = static_cast<const ImageImpl<ImageTraits>*>(image);
+  src->loadPixels();
+  if (src->canShareBands())
+    return new ImageImpl<ImageTraits>(*src);
+  else
+    return nullptr;
+}
+
 // static
 Image* Image::createCopy(const Image* image, const ImageBufferPtr& buffer)
 {
   ASSERT(image);
+
+  if (!buffer) {
+    Image* copy = nullptr;
+    switch (image->pixelFormat()) {
+      case IMAGE_RGB:       copy = create_shared_copy<RgbTraits>(image); break;
+      case IMAGE_GRAYSCALE: copy = create_shared_copy<GrayscaleTraits>(image); break;
+      case IMAGE_INDEXED:   copy = create_shared_copy<IndexedTraits>(image); break;
+      case IMAGE_BITMAP:    copy = create_shared_copy<BitmapTraits>(image); break;
+    }
+    if (copy)
+      return copy;
+  }
+
   return crop_image(image, 0, 0, image->width(), image->height(),
     image->maskColor(), buffer);
 }
@@ -8,6 +8,7 @@
 
 #include "doc/color.h"
 #include "doc/image_buffer.h"
+#include "doc/image_loader.h"
 #include "doc/object.h"
 #include "doc/pixel_format.h"
 #include "gfx/clip.h"
@@ -31,8 +32,16 @@ namespace doc {
 
     static Image* create(PixelFormat format, int width, int height,
                          const ImageBufferPtr& buffer = ImageBufferPtr());
+    // Creates a copy of the given image. If no buffer is specified,
+    // the copy shares the pixels with the original image until one
+    // of them is modified (copy-on-write).
     static Image* createCopy(const Image* image,
                              const ImageBufferPtr& buffer = ImageBufferPtr());
+    // Creates an image whose pixels are loaded by "loader" the first
+    // time they are accessed (e.g. when the image is rendered), so
+    // an image that is never used doesn't take memory.
+    static Image* createLazy(PixelFormat format, int width, int height,
+                             const ImageLoaderPtr& loader);
 
     virtual ~Image();
 
@@ -48,6 +57,39 @@ namespace doc {
     int getRowStrideSize() const;
     int getRowStrideSize(int pixels_per_row) const;
 
+    // Returns the address of the first pixel of an image where all
+    // rows are contiguous in memory (getRowStrideSize() bytes per
+    // row). It's useful to read/write the whole image at once.
+    virtual uint8_t* getBitsAddress() = 0;
+
+    // Returns the bounds of the rows modified after the last clear()
+    // call, without scanning pixels. All pixels outside of these
+    // bounds are equal to clearColor(). If the image was never
+    // cleared, it returns the whole image bounds.
+    virtual gfx::Rect modifiedBounds() const = 0;
+    virtual color_t clearColor() const = 0;
+
+    // True if the image was created with createLazy() and its pixels
+    // weren't loaded yet. Any access to pixels loads them, or they
+    // can be loaded explicitly with loadPixels().
+    virtual bool hasPendingPixels() const = 0;
+    virtual void loadPixels() const = 0;
+
+    // Gets the compressed pixels of a lazy image that weren't loaded
+    // yet from its loader (see ImageLoader::getCompressedPixels()).
+    virtual bool getPendingCompressedPixels(std::vector<uint8_t>& data) const = 0;
+
+    // Gives to this image its own copy of the memory of the rows in
+    // [y1, y2) if it's shared with other images (see createCopy()),
+    // so then the pixels of those rows can be modified from several
+    // threads at the same time.
+    virtual void unshareRows(int y1, int y2) = 0;
+
+    // Returns bounds that contain all pixels different from
+    // maskColor(), it's modifiedBounds() if the image was cleared
+    // with the mask color.
+    gfx::Rect opaqueBounds() const;
+
     template<typename ImageTraits>
     ImageBits<ImageTraits> lockBits(LockType lockType, const gfx::Rect& bounds) {
       return ImageBits<ImageTraits>(this, bounds);
@@ -66,7 +108,16 @@ namespace doc {
     // Warning: These functions doesn't have (and shouldn't have)
     // bounds checks. Use the primitives defined in doc/primitives.h
     // in case that you need bounds check.
-    virtual uint8_t* getPixelAddress(int x, int y) const = 0;
+    //
+    // getPixelAddress() returns an address to modify pixels, so the
+    // image memory is unshared from copies of this image (see
+    // createCopy()). Use getConstPixelAddress() (or getPixelAddress()
+    // of a const image) to only read pixels.
+    virtual uint8_t* getPixelAddress(int x, int y) = 0;
+    const uint8_t* getPixelAddress(int x, int y) const {
+      return getConstPixelAddress(x, y);
+    }
+    virtual const uint8_t* getConstPixelAddress(int x, int y) const = 0;
     virtual color_t getPixel(int x, int y) const = 0;
     virtual void putPixel(int x, int y, color_t color) = 0;
     virtual void clear(color_t color) = 0;
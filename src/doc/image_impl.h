@@ -7,8 +7,12 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
 #include <cstdlib>
 #include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 #include "doc/blend_funcs.h"
 #include "doc/image.h"
@@ -20,70 +24,228 @@ namespace doc {
 
   template<typename ImageTraits> class LockImageBits;
 
+  // Number of rows in each band of an ImageImpl. Bands are the unit
+  // of memory shared between an image and its copies.
+  const int kImageBandHeight = 64;
+
   template<class Traits>
   class ImageImpl : public Image {
   private:
     typedef typename Traits::address_t address_t;
     typedef typename Traits::const_address_t const_address_t;
 
-    ImageBufferPtr m_buffer;
-    address_t m_bits;
-    address_t* m_rows;
+    // The rows of the image are stored in bands of kImageBandHeight
+    // rows. Image::createCopy() shares the bands between both images,
+    // and a band is copied only when one of the images modifies it
+    // (copy-on-write). A shared band must not be modified from
+    // several threads at the same time.
+    //
+    // Bands are also used to know which rows were modified after the
+    // last clear() (see modifiedBounds()), even if the image uses an
+    // external buffer.
+    struct Band {
+      std::shared_ptr<uint8_t> bits;
+    };
+    typedef std::shared_ptr<Band> BandPtr;
+
+    ImageBufferPtr m_buffer;         // External buffer (no bands)
+    std::vector<BandPtr> m_bands;
+    std::vector<address_t> m_rows;
+    mutable std::atomic<bool> m_shared; // Bands could be shared
+    std::unique_ptr<std::atomic<bool>[]> m_clearBands;
+    std::atomic<int> m_clearBandsCount;
+    color_t m_clearColor;
+
+    // Lazy images (see Image::createLazy()) don't have bands until
+    // their pixels are accessed for first time.
+    mutable ImageLoaderPtr m_loader;
+    std::unique_ptr<std::mutex> m_loaderMutex;
+    mutable std::atomic<bool> m_pendingPixels;
 
-    inline address_t getBitsAddress() {
-      return m_bits;
+  public:
+    // Read-only access to the pixel (x, y).
+    inline const_address_t address(int x, int y) const {
+      if (m_pendingPixels.load(std::memory_order_acquire))
+        loadPixels();
+      return (const_address_t)(m_rows[y] + x / (Traits::pixels_per_byte == 0 ? 1 : Traits::pixels_per_byte));
     }
 
-    inline const_address_t getBitsAddress() const {
-      return m_bits;
+    // Access to modify the pixel (x, y). The band of row "y" is
+    // copied if it's shared with other images.
+    inline address_t address(int x, int y) {
+      if (m_pendingPixels.load(std::memory_order_acquire))
+        loadPixels();
+      if (m_shared.load(std::memory_order_relaxed) ||
+          m_clearBandsCount.load(std::memory_order_relaxed) > 0)
+        writeBand(y / kImageBandHeight);
+      return (address_t)(m_rows[y] + x / (Traits::pixels_per_byte == 0 ? 1 : Traits::pixels_per_byte));
     }
 
-    inline address_t getLineAddress(int y) {
-      ASSERT(y >= 0 && y < height());
-      return m_rows[y];
-    }
+    ImageImpl(int width, int height,
+              const ImageBufferPtr& buffer)
+      : Image(static_cast<PixelFormat>(Traits::pixel_format), width, height)
+      , m_buffer(buffer)
+      , m_rows(height)
+      , m_shared(false)
+      , m_clearBands(new std::atomic<bool>[bandsCount()])
+      , m_clearBandsCount(0)
+      , m_clearColor(0)
+      , m_pendingPixels(false)
+    {
+      for (int b=0; b<bandsCount(); ++b)
+        m_clearBands[b] = false;
 
-    inline const_address_t getLineAddress(int y) const {
-      ASSERT(y >= 0 && y < height());
-      return m_rows[y];
-    }
+      if (m_buffer) {
+        m_buffer->resizeIfNecessary(Traits::getRowStrideBytes(width)*height);
+        setRows(0, height, m_buffer->buffer());
+        return;
+      }
 
-  public:
-    inline address_t address(int x, int y) const {
-      return (address_t)(m_rows[y] + x / (Traits::pixels_per_byte == 0 ? 1 : Traits::pixels_per_byte));
+      allocateBands();
     }
 
+    // Creates an image without pixels, they are created by "loader"
+    // when they are accessed for first time.
     ImageImpl(int width, int height,
-              const ImageBufferPtr& buffer)
+              const ImageLoaderPtr& loader)
       : Image(static_cast<PixelFormat>(Traits::pixel_format), width, height)
-      , m_buffer(buffer)
+      , m_rows(height)
+      , m_shared(false)
+      , m_clearBands(new std::atomic<bool>[bandsCount()])
+      , m_clearBandsCount(0)
+      , m_clearColor(0)
+      , m_loader(loader)
+      , m_loaderMutex(new std::mutex)
+      , m_pendingPixels(true)
     {
-      std::size_t for_rows = sizeof(address_t) * height;
-      std::size_t rowstride_bytes = Traits::getRowStrideBytes(width);
-      std::size_t required_size = for_rows + rowstride_bytes*height;
-
-      if (!m_buffer)
-        m_buffer.reset(new ImageBuffer(required_size));
-      else
-        m_buffer->resizeIfNecessary(required_size);
-
-      m_rows = (address_t*)m_buffer->buffer();
-      m_bits = (address_t)(m_buffer->buffer() + for_rows);
-
-      address_t addr = m_bits;
-      for (int y=0; y<height; ++y) {
-        m_rows[y] = addr;
-        addr = (address_t)(((uint8_t*)addr) + rowstride_bytes);
+      ASSERT(loader);
+      for (int b=0; b<bandsCount(); ++b)
+        m_clearBands[b] = false;
+    }
+
+    // Creates a copy of "src" which shares all its bands.
+    explicit ImageImpl(const ImageImpl& src)
+      : Image(static_cast<PixelFormat>(Traits::pixel_format), src.width(), src.height())
+      , m_bands(src.m_bands)
+      , m_rows(src.m_rows)
+      , m_shared(true)
+      , m_clearBands(new std::atomic<bool>[bandsCount()])
+      , m_clearBandsCount(src.m_clearBandsCount.load())
+      , m_clearColor(src.m_clearColor)
+      , m_pendingPixels(false)
+    {
+      ASSERT(src.canShareBands());
+      ASSERT(!src.hasPendingPixels());
+      for (int b=0; b<bandsCount(); ++b)
+        m_clearBands[b] = src.m_clearBands[b].load();
+      src.m_shared = true;
+      setMaskColor(src.maskColor());
+    }
+
+    // False if the image uses an external ImageBuffer.
+    bool canShareBands() const {
+      return !m_buffer;
+    }
+
+    bool hasPendingPixels() const override {
+      return m_pendingPixels.load(std::memory_order_acquire);
+    }
+
+    // Several threads can access the pixels of a lazy image for
+    // first time, only one of them calls the loader and the others
+    // wait for it.
+    void loadPixels() const override {
+      if (!m_pendingPixels.load(std::memory_order_acquire))
+        return;
+
+      std::lock_guard<std::mutex> lock(*m_loaderMutex);
+      if (!m_pendingPixels.load(std::memory_order_relaxed))
+        return;
+
+      ImageLoaderPtr loader;
+      std::swap(loader, m_loader);
+      std::unique_ptr<Image> src;
+      try {
+        src.reset(loader->loadImage());
       }
+      catch (const std::exception& e) {
+        report_image_load_error(e);
+      }
+      const_cast<ImageImpl*>(this)->adoptPixels(src.get());
+
+      m_pendingPixels.store(false, std::memory_order_release);
     }
 
-    uint8_t* getPixelAddress(int x, int y) const override {
+    bool getPendingCompressedPixels(std::vector<uint8_t>& data) const override {
+      if (!m_pendingPixels.load(std::memory_order_acquire))
+        return false;
+
+      // The loader is released when the pixels are loaded
+      std::lock_guard<std::mutex> lock(*m_loaderMutex);
+      return (m_pendingPixels.load(std::memory_order_relaxed) &&
+              m_loader->getCompressedPixels(data));
+    }
+
+    void unshareRows(int y1, int y2) override {
+      y1 = std::max(y1, 0);
+      y2 = std::min(y2, height());
+      if (y1 >= y2)
+        return;
+
+      // address() unshares the band of the given row
+      for (int b=y1/kImageBandHeight; b<=(y2-1)/kImageBandHeight; ++b)
+        address(0, std::max(y1, b*kImageBandHeight));
+    }
+
+    using Image::getPixelAddress;
+
+    uint8_t* getPixelAddress(int x, int y) override {
       ASSERT(x >= 0 && x < width());
       ASSERT(y >= 0 && y < height());
 
       return (uint8_t*)address(x, y);
     }
 
+    const uint8_t* getConstPixelAddress(int x, int y) const override {
+      ASSERT(x >= 0 && x < width());
+      ASSERT(y >= 0 && y < height());
+
+      return (const uint8_t*)address(x, y);
+    }
+
+    uint8_t* getBitsAddress() override {
+      loadPixels();
+      setClearBands(false);
+
+      if (m_buffer || height() == 0)
+        return (uint8_t*)m_rows[0];
+
+      const std::size_t rowstride_bytes = Traits::getRowStrideBytes(width());
+      const std::size_t band_bytes = kImageBandHeight*rowstride_bytes;
+      const int nbands = int(m_bands.size());
+
+      bool contiguous = true;
+      for (int b=0; b<nbands && contiguous; ++b) {
+        contiguous = (m_bands[b].use_count() == 1 &&
+                      m_bands[b]->bits.get() == m_bands[0]->bits.get() + b*band_bytes);
+      }
+      if (contiguous)
+        return (uint8_t*)m_rows[0];
+
+      // Join all bands in a new block
+      std::shared_ptr<uint8_t> block(new uint8_t[rowstride_bytes*height()],
+                                     std::default_delete<uint8_t[]>());
+      for (int y=0; y<height(); ++y)
+        std::memcpy(block.get() + y*rowstride_bytes, m_rows[y], rowstride_bytes);
+
+      for (int b=0; b<nbands; ++b) {
+        m_bands[b] = std::make_shared<Band>();
+        m_bands[b]->bits = std::shared_ptr<uint8_t>(block, block.get() + b*band_bytes);
+      }
+      setRows(0, height(), block.get());
+      return block.get();
+    }
+
     color_t getPixel(int x, int y) const override {
       ASSERT(x >= 0 && x < width());
       ASSERT(y >= 0 && y < height());
@@ -102,6 +264,9 @@ namespace doc {
       int w = width();
       int h = height();
 
+      loadPixels();
+      unshareAllBands();
+
       // Fill the first line
       address_t first = address(0, 0);
       std::fill(first, first+w, color);
@@ -109,11 +274,35 @@ namespace doc {
       // Copy the first line into all other lines
       for (int y=1; y<h; ++y)
         std::copy(first, first+w, address(0, y));
+
+      setClearBands(true, color);
+    }
+
+    gfx::Rect modifiedBounds() const override {
+      if (m_clearBandsCount == 0)
+        return bounds();
+
+      const int nbands = bandsCount();
+      int b1 = 0, b2 = nbands-1;
+      while (b1 < nbands && m_clearBands[b1])
+        ++b1;
+      if (b1 == nbands)
+        return gfx::Rect();
+      while (m_clearBands[b2])
+        --b2;
+
+      const int y1 = b1*kImageBandHeight;
+      const int y2 = std::min(height(), (b2+1)*kImageBandHeight);
+      return gfx::Rect(0, y1, width(), y2-y1);
+    }
+
+    color_t clearColor() const override {
+      return m_clearColor;
     }
 
     void copy(const Image* _src, gfx::Clip area) override {
       const ImageImpl<Traits>* src = (const ImageImpl<Traits>*)_src;
-      address_t src_address;
+      const_address_t src_address;
       address_t dst_address;
 
       if (!area.clip(width(), height(), src->width(), src->height()))
@@ -156,6 +345,103 @@ namespace doc {
     }
 
   private:
+    int bandsCount() const {
+      return (height() + kImageBandHeight - 1) / kImageBandHeight;
+    }
+
+    void allocateBands() {
+      const std::size_t rowstride_bytes = Traits::getRowStrideBytes(width());
+      const std::size_t required_size = rowstride_bytes*height();
+
+      // All bands of a new image are allocated in one block, so its
+      // rows are contiguous.
+      std::shared_ptr<uint8_t> block(new uint8_t[std::max<std::size_t>(1, required_size)],
+                                     std::default_delete<uint8_t[]>());
+      const int nbands = bandsCount();
+      m_bands.resize(nbands);
+      for (int b=0; b<nbands; ++b) {
+        m_bands[b] = std::make_shared<Band>();
+        m_bands[b]->bits = std::shared_ptr<uint8_t>(
+          block, block.get() + b*kImageBandHeight*rowstride_bytes);
+      }
+      setRows(0, height(), block.get());
+    }
+
+    // Takes the bands of "src" (an image loaded by an ImageLoader), or
+    // fills the image with zeros if it's not valid.
+    void adoptPixels(Image* src) {
+      if (src &&
+          src->pixelFormat() == pixelFormat() &&
+          src->size() == size() &&
+          static_cast<ImageImpl*>(src)->canShareBands()) {
+        ImageImpl* impl = static_cast<ImageImpl*>(src);
+        impl->loadPixels();
+        m_bands = impl->m_bands;
+        m_rows = impl->m_rows;
+        m_shared = impl->m_shared.load();
+      }
+      else {
+        allocateBands();
+        for (int y=0; y<height(); ++y)
+          std::memset(m_rows[y], 0, Traits::getRowStrideBytes(width()));
+      }
+    }
+
+    // Called before modifying pixels of the band "b".
+    void writeBand(int b) {
+      if (m_clearBands[b] && m_clearBands[b].exchange(false))
+        --m_clearBandsCount;
+
+      if (m_shared.load(std::memory_order_relaxed))
+        unshareBand(b, true);
+    }
+
+    void setClearBands(bool state, color_t color = 0) {
+      const int nbands = bandsCount();
+      for (int b=0; b<nbands; ++b)
+        m_clearBands[b] = state;
+      m_clearBandsCount = (state ? nbands: 0);
+      if (state)
+        m_clearColor = color;
+    }
+
+    void setRows(int y1, int y2, uint8_t* addr) {
+      const std::size_t rowstride_bytes = Traits::getRowStrideBytes(width());
+      for (int y=y1; y<y2; ++y) {
+        m_rows[y] = (address_t)addr;
+        addr += rowstride_bytes;
+      }
+    }
+
+    // Gives to this image its own copy of the band "b" (if it's
+    // shared). The pixels are copied only if "copyBits" is true.
+    void unshareBand(int b, bool copyBits) {
+      BandPtr& band = m_bands[b];
+      if (!band || band.use_count() == 1)
+        return;
+
+      const std::size_t rowstride_bytes = Traits::getRowStrideBytes(width());
+      const int y1 = b*kImageBandHeight;
+      const int y2 = std::min(height(), y1+kImageBandHeight);
+      const std::size_t size = rowstride_bytes*(y2-y1);
+
+      BandPtr newBand = std::make_shared<Band>();
+      newBand->bits.reset(new uint8_t[size], std::default_delete<uint8_t[]>());
+      if (copyBits)
+        std::memcpy(newBand->bits.get(), band->bits.get(), size);
+
+      band = newBand;
+      setRows(y1, y2, band->bits.get());
+    }
+
+    // Used when all pixels are going to be overwritten.
+    void unshareAllBands() {
+      if (m_shared.load(std::memory_order_relaxed)) {
+        for (int b=0; b<int(m_bands.size()); ++b)
+          unshareBand(b, false);
+      }
+    }
+
     bool clip_rects(const Image* src, int& dst_x, int& dst_y, int& src_x, int& src_y, int& w, int& h) const {
       // Clip with destionation image
       if (dst_x < 0) {
@@ -217,16 +503,22 @@ namespace doc {
 
   template<>
   inline void ImageImpl<IndexedTraits>::clear(color_t color) {
-    std::fill(m_bits,
-              m_bits + width()*height(),
-              color);
+    loadPixels();
+    unshareAllBands();
+    for (int y=0; y<height(); ++y)
+      std::fill(m_rows[y], m_rows[y] + width(), color);
+    setClearBands(true, color);
   }
 
   template<>
   inline void ImageImpl<BitmapTraits>::clear(color_t color) {
-    std::fill(m_bits,
-              m_bits + BitmapTraits::getRowStrideBytes(width()) * height(),
-              (color ? 0xff: 0x00));
+    loadPixels();
+    unshareAllBands();
+    for (int y=0; y<height(); ++y)
+      std::fill(m_rows[y],
+                m_rows[y] + BitmapTraits::getRowStrideBytes(width()),
+                (color ? 0xff: 0x00));
+    setClearBands(true, (color ? 1: 0));
   }
 
   template<>
@@ -234,6 +526,7 @@ namespace doc {
     ASSERT(x >= 0 && x < width());
     ASSERT(y >= 0 && y < height());
 
+    loadPixels();
     std::div_t d = std::div(x, 8);
     return ((*(m_rows[y] + d.quot)) & (1<<d.rem)) ? 1: 0;
   }
@@ -244,10 +537,11 @@ namespace doc {
     ASSERT(y >= 0 && y < height());
 
     std::div_t d = std::div(x, 8);
+    address_t addr = address(x, y);
     if (color)
-      (*(m_rows[y] + d.quot)) |= (1 << d.rem);
+      (*addr) |= (1 << d.rem);
     else
-      (*(m_rows[y] + d.quot)) &= ~(1 << d.rem);
+      (*addr) &= ~(1 << d.rem);
   }
 
   template<>
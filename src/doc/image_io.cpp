@@ -18,6 +18,7 @@
 
 #include <iostream>
 #include <memory>
+#include <vector>
 
 namespace doc {
 
@@ -34,11 +35,23 @@ void write_image(std::ostream& os, const Image* image)
   write16(os, image->height());        // Height
   write32(os, image->maskColor());     // Mask color
 
+  // Pixels that weren't loaded yet are copied without decompressing
+  // them
+  std::vector<uint8_t> pending;
+  if (image->hasPendingPixels() &&
+      image->getPendingCompressedPixels(pending)) {
+    write32(os, int(pending.size()));
+    if (!pending.empty() &&
+        os.write((const char*)&pending[0], pending.size()).fail())
+      throw base::Exception("Error writing compressed image pixels.\n");
+    return;
+  }
+
   int rowSize = image->getRowStrideSize();
 #if 0
   {
     for (int c=0; c<image->height(); c++)
-      os.write((char*)image->getPixelAddress(0, c), rowSize);
+      os.write((const char*)image->getConstPixelAddress(0, c), rowSize);
   }
 #else
   {
@@ -57,7 +70,7 @@ void write_image(std::ostream& os, const Image* image)
     int total_output_bytes = 0;
 
     for (int y=0; y<image->height(); y++) {
-      zstream.next_in = (Bytef*)image->getPixelAddress(0, y);
+      zstream.next_in = (Bytef*)image->getConstPixelAddress(0, y);
       zstream.avail_in = rowSize;
       int flush = (y == image->height()-1 ? Z_FINISH: Z_NO_FLUSH);
 
@@ -134,8 +147,8 @@ Image* read_image(std::istream& is, bool setId)
     int remain = avail_bytes;
 
     std::vector<uint8_t> compressed(4096);
-    uint8_t* address = image->getPixelAddress(0, 0);
-    uint8_t* address_end = image->getPixelAddress(0, 0) + uncompressed_size;
+    uint8_t* address = image->getBitsAddress();
+    uint8_t* address_end = address + uncompressed_size;
 
     while (remain > 0) {
       int len = MIN(remain, (int)compressed.size());
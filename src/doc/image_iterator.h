@@ -13,6 +13,7 @@
 
 #include <cstdlib>
 #include <iterator>
+#include <type_traits>
 
 #include <iostream>
 
@@ -49,7 +50,7 @@ namespace doc {
 
     ImageIteratorT(const Image* image, const gfx::Rect& bounds, int x, int y) :
       m_image(const_cast<Image*>(image)),
-      m_ptr(get_pixel_address_fast<ImageTraits>(image, x, y)),
+      m_ptr(pixel_address(m_image, x, y)),
       m_x(x),
       m_y(y),
       m_xbegin(bounds.x),
@@ -103,7 +104,7 @@ namespace doc {
         ++m_y;
 
         if (m_y < m_image->height())
-          m_ptr = get_pixel_address_fast<ImageTraits>(m_image, m_x, m_y);
+          m_ptr = pixel_address(m_image, m_x, m_y);
       }
 
       return *this;
@@ -124,6 +125,15 @@ namespace doc {
     reference operator*() { return *m_ptr; }
 
   private:
+    // Const iterators use the read-only address of pixels, so they
+    // don't unshare the image memory (see Image::createCopy()).
+    static pointer pixel_address(Image* image, int x, int y) {
+      typedef typename std::conditional<
+        std::is_const<typename std::remove_pointer<pointer>::type>::value,
+        const Image*, Image*>::type image_ptr;
+      return get_pixel_address_fast<ImageTraits>(static_cast<image_ptr>(image), x, y);
+    }
+
     Image* m_image;
     pointer m_ptr;
     int m_x, m_y;
@@ -286,7 +296,7 @@ namespace doc {
 
     ImageIteratorT(const Image* image, const gfx::Rect& bounds, int x, int y) :
       m_image(const_cast<Image*>(image)),
-      m_ptr(get_pixel_address_fast<BitmapTraits>(image, x, y)),
+      m_ptr(pixel_address(m_image, x, y)),
       m_x(x),
       m_y(y),
       m_subPixel(x % 8),
@@ -340,7 +350,7 @@ namespace doc {
         ++m_y;
 
         if (m_y < m_image->height())
-          m_ptr = get_pixel_address_fast<BitmapTraits>(m_image, m_x, m_y);
+          m_ptr = pixel_address(m_image, m_x, m_y);
         else
           ++m_ptr;
       }
@@ -375,6 +385,15 @@ namespace doc {
     }
 
   private:
+    // Const iterators use the read-only address of pixels, so they
+    // don't unshare the image memory (see Image::createCopy()).
+    static pointer pixel_address(Image* image, int x, int y) {
+      typedef typename std::conditional<
+        std::is_const<typename std::remove_pointer<pointer>::type>::value,
+        const Image*, Image*>::type image_ptr;
+      return get_pixel_address_fast<BitmapTraits>(static_cast<image_ptr>(image), x, y);
+    }
+
     Image* m_image;
     pointer m_ptr;
     int m_x, m_y;
@@ -0,0 +1,37 @@
+// LibreSprite Document Library
+// Copyright (c) 2026 LibreSprite contributors
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "doc/image_loader.h"
+
+#include <mutex>
+
+namespace doc {
+
+static std::mutex handler_mutex;
+static ImageLoadErrorHandler handler;
+
+void set_image_load_error_handler(const ImageLoadErrorHandler& newHandler)
+{
+  std::lock_guard<std::mutex> lock(handler_mutex);
+  handler = newHandler;
+}
+
+void report_image_load_error(const std::exception& e)
+{
+  ImageLoadErrorHandler func;
+  {
+    std::lock_guard<std::mutex> lock(handler_mutex);
+    func = handler;
+  }
+  if (func)
+    func(e);
+}
+
+} // namespace doc
@@ -0,0 +1,55 @@
+// LibreSprite Document Library
+// Copyright (c) 2026 LibreSprite contributors
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#pragma once
+
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace doc {
+
+  class Image;
+
+  // Provides the pixels of an image created with Image::createLazy().
+  class ImageLoader {
+  public:
+    virtual ~ImageLoader() { }
+
+    // Returns a new image with the pixels, with the same format and
+    // size of the lazy image, or nullptr if the image is empty (then
+    // the lazy image is filled with zeros). It's called only once,
+    // from the first thread that needs the pixels.
+    //
+    // If the pixels cannot be loaded it throws an exception: the lazy
+    // image is filled with zeros too, and the exception is given to
+    // the handler of set_image_load_error_handler().
+    virtual Image* loadImage() = 0;
+
+    // Copies the pixels compressed with zlib (all rows, in the same
+    // format as write_image() saves them) to "data", so they can be
+    // saved without loading the image. Returns false if the loader
+    // cannot give them. It can be called from any thread.
+    virtual bool getCompressedPixels(std::vector<uint8_t>& data) {
+      return false;
+    }
+  };
+
+  typedef std::shared_ptr<ImageLoader> ImageLoaderPtr;
+
+  // Reports errors loading the pixels of lazy images to the user. It
+  // can be called from any thread that reads pixels.
+  typedef std::function<void(const std::exception& e)> ImageLoadErrorHandler;
+
+  // Sets the error handler (an empty function to ignore errors).
+  void set_image_load_error_handler(const ImageLoadErrorHandler& handler);
+
+  // Calls the error handler, used by lazy images.
+  void report_image_load_error(const std::exception& e);
+
+} // namespace doc
@@ -10,10 +10,18 @@
 
 #include <gtest/gtest.h>
 
+#include "doc/algorithm/shrink_bounds.h"
 #include "doc/image_impl.h"
+#include "doc/image_io.h"
 #include "doc/primitives.h"
+#include "base/thread_pool.h"
 
+#include <atomic>
 #include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 using namespace base;
 using namespace doc;
@@ -69,7 +77,7 @@ TYPED_TEST(ImageAllTypes, PutGetAndIterators)
 
     // Read-only iterator (whole image)
     {
-      const LockImageBits<ImageTraits> bits((const Image*)image);
+      const LockImageBits<ImageTraits> bits((const Image*)image.get());
       typename LockImageBits<ImageTraits>::const_iterator
         begin = bits.begin(),
         it = begin,
@@ -87,7 +95,7 @@ TYPED_TEST(ImageAllTypes, PutGetAndIterators)
       if (bounds.w <= 0 || bounds.h <= 0)
         break;
 
-      const LockImageBits<ImageTraits> bits((const Image*)image, bounds);
+      const LockImageBits<ImageTraits> bits((const Image*)image.get(), bounds);
       typename LockImageBits<ImageTraits>::const_iterator
         begin = bits.begin(),
         it = begin,
@@ -108,7 +116,7 @@ TYPED_TEST(ImageAllTypes, PutGetAndIterators)
 
     // Write iterator (whole image)
     {
-      LockImageBits<ImageTraits> bits(image, Image::WriteLock);
+      LockImageBits<ImageTraits> bits(image.get(), Image::WriteLock);
       typename LockImageBits<ImageTraits>::iterator
         begin = bits.begin(),
         it = begin,
@@ -216,6 +224,274 @@ TYPED_TEST(ImageAllTypes, FillRect)
   }
 }
 
+TYPED_TEST(ImageAllTypes, CopyOnWrite)
+{
+  typedef TypeParam ImageTraits;
+
+  const int w = 37;
+  const int h = 3*kImageBandHeight + 5;
+  std::unique_ptr<Image> a(Image::create(ImageTraits::pixel_format, w, h));
+  for (int y=0; y<h; ++y)
+    for (int x=0; x<w; ++x)
+      put_pixel(a.get(), x, y, (x+y) & 1);
+
+  std::unique_ptr<Image> b(Image::createCopy(a.get()));
+  ASSERT_EQ(0, count_diff_between_images(a.get(), b.get()));
+
+  // Both images share the memory until one of them is modified
+  const int y1 = kImageBandHeight + 1;
+  EXPECT_EQ(a->getConstPixelAddress(0, y1), b->getConstPixelAddress(0, y1));
+
+  put_pixel(b.get(), 3, y1, 1);
+  put_pixel(a.get(), 3, y1, 0);
+  EXPECT_NE(a->getConstPixelAddress(0, y1), b->getConstPixelAddress(0, y1));
+  EXPECT_EQ(a->getConstPixelAddress(0, 0), b->getConstPixelAddress(0, 0));
+  EXPECT_EQ(1, get_pixel(b.get(), 3, y1));
+  EXPECT_EQ(0, get_pixel(a.get(), 3, y1));
+  EXPECT_EQ(1, count_diff_between_images(a.get(), b.get()));
+
+  // Iterators
+  {
+    LockImageBits<ImageTraits> bits(b.get(), Image::WriteLock,
+                                    gfx::Rect(0, h-2, w, 2));
+    for (auto it=bits.begin(), end=bits.end(); it != end; ++it)
+      *it = 1;
+  }
+  for (int x=0; x<w; ++x) {
+    EXPECT_EQ(1, get_pixel(b.get(), x, h-1));
+    EXPECT_EQ((x+h-1) & 1, get_pixel(a.get(), x, h-1));
+  }
+
+  // A cleared copy doesn't modify the original image
+  std::unique_ptr<Image> c(Image::createCopy(a.get()));
+  c->clear(0);
+  EXPECT_EQ(1, get_pixel(a.get(), 1, 0));
+
+  // All rows are contiguous after getBitsAddress()
+  uint8_t* bits = b->getBitsAddress();
+  for (int y=0; y<h; ++y)
+    EXPECT_EQ(bits + y*b->getRowStrideSize(), b->getConstPixelAddress(0, y));
+  EXPECT_EQ(1, get_pixel(b.get(), 3, y1));
+  EXPECT_EQ((h-1) & 1, get_pixel(a.get(), 0, h-1));
+}
+
+TYPED_TEST(ImageAllTypes, UnshareRows)
+{
+  typedef TypeParam ImageTraits;
+
+  const int w = 10;
+  const int h = 4*kImageBandHeight;
+  std::unique_ptr<Image> a(Image::create(ImageTraits::pixel_format, w, h));
+  clear_image(a.get(), 1);
+
+  // Rows that are not aligned to bands, the last row is in the next
+  // band of the first row.
+  std::unique_ptr<Image> b(Image::createCopy(a.get()));
+  const int y1 = kImageBandHeight - 4;
+  const int y2 = kImageBandHeight + 6;
+  b->unshareRows(y1, y2);
+
+  for (int y=0; y<h; ++y) {
+    if (y < 2*kImageBandHeight)
+      EXPECT_NE(a->getConstPixelAddress(0, y), b->getConstPixelAddress(0, y)) << y;
+    else
+      EXPECT_EQ(a->getConstPixelAddress(0, y), b->getConstPixelAddress(0, y)) << y;
+  }
+  EXPECT_EQ(0, count_diff_between_images(a.get(), b.get()));
+}
+
+TYPED_TEST(ImageAllTypes, ModifiedBounds)
+{
+  typedef TypeParam ImageTraits;
+
+  const int w = 20;
+  const int h = 4*kImageBandHeight;
+  std::unique_ptr<Image> image(Image::create(ImageTraits::pixel_format, w, h));
+  EXPECT_EQ(image->bounds(), image->modifiedBounds());
+
+  image->clear(0);
+  EXPECT_TRUE(image->modifiedBounds().isEmpty());
+  EXPECT_TRUE(image->opaqueBounds().isEmpty());
+  EXPECT_EQ(0, image->clearColor());
+
+  // Reading pixels doesn't modify the bounds
+  get_pixel(image.get(), 3, 3);
+  {
+    const LockImageBits<ImageTraits> bits((const Image*)image.get());
+    for (auto it=bits.begin(), end=bits.end(); it != end; ++it)
+      ;
+  }
+  EXPECT_TRUE(image->modifiedBounds().isEmpty());
+
+  put_pixel(image.get(), 3, kImageBandHeight+2, 1);
+  EXPECT_EQ(gfx::Rect(0, kImageBandHeight, w, kImageBandHeight), image->modifiedBounds());
+
+  fill_rect(image.get(), 0, 3*kImageBandHeight, 4, 3*kImageBandHeight, 1);
+  EXPECT_EQ(gfx::Rect(0, kImageBandHeight, w, 3*kImageBandHeight), image->modifiedBounds());
+
+  // Copies keep the modified bounds
+  std::unique_ptr<Image> copy(Image::createCopy(image.get()));
+  EXPECT_EQ(image->modifiedBounds(), copy->modifiedBounds());
+
+  // Only transparent pixels are skipped
+  const color_t c = ImageTraits::max_value;
+  image->clear(c);
+  EXPECT_TRUE(image->modifiedBounds().isEmpty());
+  EXPECT_EQ(image->bounds(), image->opaqueBounds());
+
+  gfx::Rect rc;
+  EXPECT_FALSE(algorithm::shrink_bounds(image.get(), rc, c));
+  put_pixel(image.get(), 5, 2*kImageBandHeight+4, 0);
+  EXPECT_TRUE(algorithm::shrink_bounds(image.get(), rc, c));
+  EXPECT_EQ(gfx::Rect(5, 2*kImageBandHeight+4, 1, 1), rc);
+
+  image->getBitsAddress();
+  EXPECT_EQ(image->bounds(), image->modifiedBounds());
+}
+
+TYPED_TEST(ImageAllTypes, LazyPixels)
+{
+  typedef TypeParam ImageTraits;
+
+  class Loader : public ImageLoader {
+  public:
+    Loader(const Image* image, std::atomic<int>* calls)
+      : m_image(image), m_calls(calls) { }
+    Image* loadImage() override {
+      ++(*m_calls);
+      return (m_image ? Image::createCopy(m_image): nullptr);
+    }
+  private:
+    const Image* m_image;
+    std::atomic<int>* m_calls;
+  };
+
+  const int w = 29;
+  const int h = 2*kImageBandHeight + 3;
+  std::unique_ptr<Image> src(Image::create(ImageTraits::pixel_format, w, h));
+  for (int y=0; y<h; ++y)
+    for (int x=0; x<w; ++x)
+      put_pixel(src.get(), x, y, (x+y) & 1);
+
+  // The loader is called once, by the first thread that reads pixels
+  std::atomic<int> calls(0);
+  std::unique_ptr<Image> a(Image::createLazy(ImageTraits::pixel_format, w, h,
+                                             std::make_shared<Loader>(src.get(), &calls)));
+  EXPECT_TRUE(a->hasPendingPixels());
+  EXPECT_EQ(gfx::Size(w, h), a->size());
+  EXPECT_EQ(0, calls);
+
+  std::atomic<int> diffs(0);
+  base::thread_pool::instance().parallel_for(
+    h, [&](int y){
+      for (int x=0; x<w; ++x)
+        if (get_pixel(a.get(), x, y) != color_t((x+y) & 1))
+          ++diffs;
+    });
+  EXPECT_EQ(0, diffs);
+  EXPECT_EQ(1, calls);
+  EXPECT_FALSE(a->hasPendingPixels());
+
+  // The loaded pixels are shared with "src" until they are modified
+  put_pixel(a.get(), 0, 0, 1);
+  EXPECT_EQ(0, get_pixel(src.get(), 0, 0));
+
+  // Copies load the pixels of the lazy image
+  std::unique_ptr<Image> b(Image::createLazy(ImageTraits::pixel_format, w, h,
+                                             std::make_shared<Loader>(src.get(), &calls)));
+  std::unique_ptr<Image> c(Image::createCopy(b.get()));
+  EXPECT_FALSE(b->hasPendingPixels());
+  EXPECT_EQ(2, calls);
+  EXPECT_EQ(0, count_diff_between_images(src.get(), c.get()));
+
+  // Pixels that cannot be loaded are zeros
+  std::unique_ptr<Image> d(Image::createLazy(ImageTraits::pixel_format, w, h,
+                                             std::make_shared<Loader>(nullptr, &calls)));
+  d->loadPixels();
+  EXPECT_EQ(3, calls);
+  for (int y=0; y<h; ++y)
+    for (int x=0; x<w; ++x)
+      EXPECT_EQ(0, get_pixel(d.get(), x, y));
+}
+
+TEST(Image, LazyPixelsError)
+{
+  class Loader : public ImageLoader {
+  public:
+    Image* loadImage() override {
+      throw std::runtime_error("Corrupted pixels");
+    }
+  };
+
+  std::vector<std::string> errors;
+  set_image_load_error_handler(
+    [&errors](const std::exception& e){
+      errors.push_back(e.what());
+    });
+
+  // The pixels are zeros and the error is reported
+  std::unique_ptr<Image> a(Image::createLazy(IMAGE_RGB, 4, 4,
+                                             std::make_shared<Loader>()));
+  EXPECT_EQ(0, get_pixel(a.get(), 1, 1));
+  EXPECT_FALSE(a->hasPendingPixels());
+  ASSERT_EQ(1u, errors.size());
+  EXPECT_EQ("Corrupted pixels", errors[0]);
+
+  set_image_load_error_handler(ImageLoadErrorHandler());
+}
+
+TEST(Image, WritePendingPixels)
+{
+  class Loader : public ImageLoader {
+  public:
+    Loader(const Image* image, const std::vector<uint8_t>& compressed)
+      : m_image(image), m_compressed(compressed), m_calls(0) { }
+    Image* loadImage() override {
+      ++m_calls;
+      return Image::createCopy(m_image);
+    }
+    bool getCompressedPixels(std::vector<uint8_t>& data) override {
+      if (m_compressed.empty())
+        return false;
+      data = m_compressed;
+      return true;
+    }
+    int calls() const { return m_calls; }
+  private:
+    const Image* m_image;
+    std::vector<uint8_t> m_compressed;
+    int m_calls;
+  };
+
+  std::unique_ptr<Image> src(Image::create(IMAGE_RGB, 37, 2*kImageBandHeight+1));
+  for (int y=0; y<src->height(); ++y)
+    for (int x=0; x<src->width(); ++x)
+      put_pixel(src.get(), x, y, rgba(x, y, x+y, 255));
+
+  // Compressed pixels saved by write_image() (after the image header
+  // and the compressed size)
+  std::stringstream ss;
+  write_image(ss, src.get());
+  std::string data = ss.str();
+  std::vector<uint8_t> compressed(data.begin()+17, data.end());
+
+  // Compressed pixels of the loader are copied without loading them
+  for (bool withCompressed : { true, false }) {
+    auto loader = std::make_shared<Loader>(
+      src.get(), withCompressed ? compressed: std::vector<uint8_t>());
+    std::unique_ptr<Image> lazy(Image::createLazy(IMAGE_RGB, src->width(), src->height(), loader));
+
+    std::stringstream ss2;
+    write_image(ss2, lazy.get());
+    EXPECT_EQ(withCompressed, lazy->hasPendingPixels());
+    EXPECT_EQ(withCompressed ? 0: 1, loader->calls());
+
+    std::unique_ptr<Image> copy(read_image(ss2, false));
+    ASSERT_TRUE(copy != nullptr);
+    EXPECT_EQ(0, count_diff_between_images(src.get(), copy.get()));
+  }
+}
+
 int main(int argc, char** argv)
 {
   ::testing::InitGoogleTest(&argc, argv);
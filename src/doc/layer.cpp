@@ -114,13 +114,15 @@ int LayerImage::getMemSize() const
 void LayerImage::destroyAllCels()
 {
   m_cels.clear();
+  m_frameCels.clear();
 }
 
 std::shared_ptr<Cel> LayerImage::cel(frame_t frame) const
 {
-  CelConstIterator it = findCelIterator(frame);
-  if (it != getCelEnd())
-    return *it;
+  if (frame >= 0 &&
+      frame < frame_t(m_frameCels.size()) &&
+      m_frameCels[frame])
+    return m_frameCels[frame]->shared_from_this();
   else
     return nullptr;
 }
@@ -193,6 +195,13 @@ void LayerImage::addCel(std::shared_ptr<Cel> cel)
   CelIterator it = findFirstCelIteratorAfter(cel->frame());
   m_cels.insert(it, cel);
 
+  const frame_t frame = cel->frame();
+  ASSERT(frame >= 0);
+  if (frame >= frame_t(m_frameCels.size()))
+    m_frameCels.resize(frame+1, nullptr);
+  ASSERT(!m_frameCels[frame]);
+  m_frameCels[frame] = cel.get();
+
   cel->setParentLayer(this);
 }
 
@@ -207,6 +216,11 @@ void LayerImage::removeCel(std::shared_ptr<Cel> cel)
 
   m_cels.erase(it);
 
+  ASSERT(m_frameCels[cel->frame()] == cel.get());
+  m_frameCels[cel->frame()] = nullptr;
+  while (!m_frameCels.empty() && !m_frameCels.back())
+    m_frameCels.pop_back();
+
   cel->setParentLayer(NULL);
 }
 
@@ -14,6 +14,7 @@
 #include "doc/with_user_data.h"
 
 #include <string>
+#include <vector>
 
 namespace doc {
 
@@ -149,6 +150,10 @@ namespace doc {
     BlendMode m_blendmode;
     int m_opacity;
     CelList m_cels;   // List of all cels inside this layer used by frames.
+
+    // Cel of each frame (nullptr for empty frames) to find cels in
+    // constant time, it's kept in sync with m_cels.
+    std::vector<Cel*> m_frameCels;
   };
 
   //////////////////////////////////////////////////////////////////////
@@ -0,0 +1,78 @@
+// LibreSprite Document Library
+// Copyright (c) 2026 LibreSprite contributors
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "doc/cel.h"
+#include "doc/image.h"
+#include "doc/layer.h"
+#include "doc/sprite.h"
+
+#include <map>
+#include <memory>
+
+using namespace doc;
+
+static void expect_cels(const LayerImage* layer,
+                        const std::map<frame_t, std::shared_ptr<Cel>>& expected,
+                        frame_t nframes)
+{
+  for (frame_t frame=-1; frame<nframes+2; ++frame) {
+    auto it = expected.find(frame);
+    auto cel = layer->cel(frame);
+    if (it != expected.end())
+      EXPECT_EQ(it->second, cel) << "frame " << frame;
+    else
+      EXPECT_EQ(nullptr, cel) << "frame " << frame;
+  }
+  EXPECT_EQ(int(expected.size()), layer->getCelsCount());
+}
+
+TEST(LayerImage, CelByFrame)
+{
+  std::unique_ptr<Sprite> spr(new Sprite(IMAGE_RGB, 4, 4, 256));
+  spr->setTotalFrames(2000);
+
+  LayerImage* lay = new LayerImage(spr.get());
+  spr->folder()->addLayer(lay);
+
+  std::map<frame_t, std::shared_ptr<Cel>> cels;
+  for (frame_t frame : { 1999, 0, 5, 1000, 6 }) {
+    ImageRef img(Image::create(IMAGE_RGB, 4, 4));
+    auto cel = std::make_shared<Cel>(frame, img);
+    lay->addCel(cel);
+    cels[frame] = cel;
+  }
+  expect_cels(lay, cels, spr->totalFrames());
+
+  // Move
+  lay->moveCel(cels[5], 7);
+  cels[7] = cels[5];
+  cels.erase(5);
+  expect_cels(lay, cels, spr->totalFrames());
+
+  // Remove the last cel
+  lay->removeCel(cels[1999]);
+  cels.erase(1999);
+  expect_cels(lay, cels, spr->totalFrames());
+
+  // Insert one frame before frame 6
+  lay->displaceFrames(6, 1);
+  std::map<frame_t, std::shared_ptr<Cel>> displaced;
+  for (auto& it : cels)
+    displaced[it.first >= 6 ? it.first+1: it.first] = it.second;
+  expect_cels(lay, displaced, spr->totalFrames());
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
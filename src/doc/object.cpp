@@ -14,14 +14,63 @@
 #include "base/mutex.h"
 #include "base/scoped_lock.h"
 
-#include <map>
+#include <atomic>
 
 namespace doc {
 
-static base::mutex mutex;
-static ObjectId newId = 0;
-// TODO Profile this and see if an unordered_map is better
-static std::map<ObjectId, Object*> objects;
+namespace {
+
+// Objects are indexed directly by their ID in a table of three
+// levels. Pages are allocated when they're needed and are never
+// deallocated, so get_object() can read the table without locks.
+// Only the functions that modify the table use the mutex.
+const int kLeafBits = 10;
+const int kMidBits = 10;
+const int kRootBits = 32 - kLeafBits - kMidBits;
+
+struct LeafPage {
+  std::atomic<Object*> slots[1 << kLeafBits];
+};
+
+struct MidPage {
+  std::atomic<LeafPage*> leaves[1 << kMidBits];
+};
+
+base::mutex mutex;
+ObjectId newId = 0;
+std::atomic<MidPage*> root[1 << kRootBits];
+
+inline ObjectId root_index(ObjectId id) { return (id >> (kLeafBits + kMidBits)); }
+inline ObjectId mid_index(ObjectId id) { return (id >> kLeafBits) & ((1 << kMidBits) - 1); }
+inline ObjectId leaf_index(ObjectId id) { return (id & ((1 << kLeafBits) - 1)); }
+
+// Returns the slot of the given ID, or nullptr if its page doesn't
+// exist and "create" is false. New pages must be created with the
+// mutex locked.
+std::atomic<Object*>* find_slot(ObjectId id, bool create)
+{
+  std::atomic<MidPage*>& midRef = root[root_index(id)];
+  MidPage* mid = midRef.load(std::memory_order_acquire);
+  if (!mid) {
+    if (!create)
+      return nullptr;
+    mid = new MidPage();
+    midRef.store(mid, std::memory_order_release);
+  }
+
+  std::atomic<LeafPage*>& leafRef = mid->leaves[mid_index(id)];
+  LeafPage* leaf = leafRef.load(std::memory_order_acquire);
+  if (!leaf) {
+    if (!create)
+      return nullptr;
+    leaf = new LeafPage();
+    leafRef.store(leaf, std::memory_order_release);
+  }
+
+  return &leaf->slots[leaf_index(id)];
+}
+
+} // anonymous namespace
 
 Object::Object(ObjectType type)
   : m_type(type)
@@ -51,33 +100,39 @@ int Object::getMemSize() const
 const ObjectId Object::id() const
 {
   // The first time the ID is request, we store the object in the
-  // "objects" hash table.
-  if (!m_id) {
-    base::scoped_unlock hold(mutex);
-    m_id = ++newId;
-    objects.insert(std::make_pair(m_id, const_cast<Object*>(this)));
+  // objects table.
+  ObjectId id = m_id.load(std::memory_order_acquire);
+  if (!id) {
+    base::scoped_lock hold(mutex);
+    id = m_id.load(std::memory_order_relaxed);
+    if (!id) {
+      id = ++newId;
+      find_slot(id, true)->store(const_cast<Object*>(this), std::memory_order_release);
+      m_id.store(id, std::memory_order_release);
+    }
   }
-  return m_id;
+  return id;
 }
 
 void Object::setId(ObjectId id)
 {
-  base::scoped_unlock hold(mutex);
-
-  if (m_id) {
-    auto it = objects.find(m_id);
-    ASSERT(it != objects.end());
-    ASSERT(it->second == this);
-    if (it != objects.end())
-      objects.erase(it);
+  base::scoped_lock hold(mutex);
+
+  const ObjectId oldId = m_id.load(std::memory_order_relaxed);
+  if (oldId) {
+    std::atomic<Object*>* slot = find_slot(oldId, false);
+    ASSERT(slot && slot->load() == this);
+    if (slot)
+      slot->store(nullptr, std::memory_order_release);
   }
 
-  m_id = id;
-
-  if (m_id) {
-    ASSERT(objects.find(m_id) == objects.end());
-    objects.insert(std::make_pair(m_id, this));
+  if (id) {
+    std::atomic<Object*>* slot = find_slot(id, true);
+    ASSERT(slot->load() == nullptr);
+    slot->store(this, std::memory_order_release);
   }
+
+  m_id.store(id, std::memory_order_release);
 }
 
 void Object::setVersion(ObjectVersion version)
@@ -87,10 +142,12 @@ void Object::setVersion(ObjectVersion version)
 
 Object* get_object(ObjectId id)
 {
-  base::scoped_unlock hold(mutex);
-  auto it = objects.find(id);
-  if (it != objects.end())
-    return it->second;
+  if (!id)
+    return nullptr;
+
+  std::atomic<Object*>* slot = find_slot(id, false);
+  if (slot)
+    return slot->load(std::memory_order_acquire);
   else
     return nullptr;
 }
@@ -9,6 +9,8 @@
 #include "doc/object_id.h"
 #include "doc/object_type.h"
 
+#include <atomic>
+
 namespace doc {
 
   typedef uint32_t ObjectVersion;
@@ -38,8 +40,9 @@ namespace doc {
     ObjectType m_type;
 
     // Unique identifier for this object (it is assigned by
-    // Objects class).
-    mutable ObjectId m_id;
+    // Objects class). It's atomic because id() can be called from
+    // several threads.
+    mutable std::atomic<ObjectId> m_id;
 
     ObjectVersion m_version;
 
@@ -0,0 +1,136 @@
+// LibreSprite Document Library
+// Copyright (c) 2026 LibreSprite contributors
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "doc/object.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace doc;
+
+TEST(Object, GetObject)
+{
+  std::unique_ptr<Object> a(new Object(ObjectType::Image));
+  std::unique_ptr<Object> b(new Object(ObjectType::Palette));
+
+  ObjectId aId = a->id();
+  ObjectId bId = b->id();
+  EXPECT_NE(aId, bId);
+  EXPECT_EQ(a.get(), get_object(aId));
+  EXPECT_EQ(b.get(), get_object(bId));
+  EXPECT_EQ(nullptr, get_object(0));
+
+  a.reset();
+  EXPECT_EQ(nullptr, get_object(aId));
+  EXPECT_EQ(b.get(), get_object(bId));
+
+  // IDs restored from undo/redo or files can be anywhere
+  const ObjectId farId = 0xfffffff0;
+  b->setId(farId);
+  EXPECT_EQ(nullptr, get_object(bId));
+  EXPECT_EQ(b.get(), get_object(farId));
+  EXPECT_EQ(nullptr, get_object(farId+1));
+
+  // An object restored with an old ID
+  std::unique_ptr<Object> c(new Object(ObjectType::Image));
+  c->setId(aId);
+  EXPECT_EQ(c.get(), get_object(aId));
+
+  b->setId(0);
+  EXPECT_EQ(nullptr, get_object(farId));
+}
+
+TEST(Object, ConcurrentIds)
+{
+  const int n = 1000;
+  std::vector<std::unique_ptr<Object>> objects;
+  for (int i=0; i<n; ++i)
+    objects.emplace_back(new Object(ObjectType::Image));
+
+  // All threads ask for IDs of the same objects
+  std::vector<std::thread> threads;
+  for (int t=0; t<4; ++t)
+    threads.emplace_back([&objects]{
+        for (auto& obj : objects)
+          obj->id();
+      });
+  for (auto& thread : threads)
+    thread.join();
+
+  for (auto& obj : objects)
+    EXPECT_EQ(obj.get(), get_object(obj->id()));
+}
+
+// Measures the throughput of get_object() with several threads doing
+// lookups while another thread creates/deletes objects. It's disabled,
+// run it with --gtest_also_run_disabled_tests.
+TEST(Object, DISABLED_LookupBenchmark)
+{
+  const int n = 100000;
+  const int lookups = 2000000;
+
+  std::vector<std::unique_ptr<Object>> objects;
+  std::vector<ObjectId> ids;
+  for (int i=0; i<n; ++i) {
+    objects.emplace_back(new Object(ObjectType::Image));
+    ids.push_back(objects.back()->id());
+  }
+
+  const int maxThreads = std::max(2, int(std::thread::hardware_concurrency()));
+  for (int nthreads=1; nthreads<=maxThreads; nthreads*=2) {
+    std::atomic<bool> done(false);
+    std::thread writer([&done]{
+        while (!done) {
+          Object tmp(ObjectType::Image);
+          tmp.id();
+        }
+      });
+
+    std::atomic<int> found(0);
+    auto t0 = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> threads;
+    for (int t=0; t<nthreads; ++t)
+      threads.emplace_back([&, t]{
+          int count = 0;
+          unsigned int i = t*7919;
+          for (int j=0; j<lookups; ++j) {
+            i = i*1103515245 + 12345;
+            if (get_object(ids[i % n]))
+              ++count;
+          }
+          found += count;
+        });
+    for (auto& thread : threads)
+      thread.join();
+
+    auto t1 = std::chrono::steady_clock::now();
+    done = true;
+    writer.join();
+
+    EXPECT_EQ(nthreads*lookups, found);
+
+    double secs = std::chrono::duration<double>(t1 - t0).count();
+    std::printf("get_object() with %d thread(s): %.1f M lookups/s\n",
+                nthreads, double(nthreads)*lookups / secs / 1e6);
+  }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
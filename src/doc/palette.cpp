@@ -12,7 +12,9 @@
 
 #include "base/base.h"
 #include "doc/image.h"
+#include "doc/palette_bestfit.h"
 #include "doc/remap.h"
+#include "doc/simd_level.h"
 
 #include <algorithm>
 #include <limits>
@@ -29,6 +31,7 @@ Palette::Palette(frame_t frame, int ncolors)
   m_frame = frame;
   m_colors.resize(ncolors, doc::rgba(0, 0, 0, 255));
   m_modifications = 0;
+  updateBestfitTable();
 }
 
 Palette::Palette(const Palette& palette)
@@ -36,6 +39,7 @@ Palette::Palette(const Palette& palette)
 {
   m_frame = palette.m_frame;
   m_colors = palette.m_colors;
+  m_bestfit = palette.m_bestfit;
   m_modifications = 0;
 }
 
@@ -69,6 +73,7 @@ void Palette::resize(int ncolors)
 
   m_colors.resize(ncolors, doc::rgba(0, 0, 0, 255));
   ++m_modifications;
+  updateBestfitTable();
 }
 
 void Palette::addEntry(color_t color)
@@ -98,11 +103,15 @@ void Palette::setEntry(int i, color_t color)
 
   m_colors[i] = color;
   ++m_modifications;
+
+  if (i < bestfit::kMaxEntries)
+    bestfit::set_entry(&m_bestfit[0], i, color);
 }
 
 void Palette::copyColorsTo(Palette* dst) const
 {
   dst->m_colors = m_colors;
+  dst->m_bestfit = m_bestfit;
   ++dst->m_modifications;
 }
 
@@ -146,6 +155,7 @@ void Palette::makeBlack()
 {
   std::fill(m_colors.begin(), m_colors.end(), rgba(0, 0, 0, 255));
   ++m_modifications;
+  updateBestfitTable();
 }
 
 // Creates a linear ramp in the palette.
@@ -198,62 +208,40 @@ int Palette::findExactMatch(int r, int g, int b, int a, int mask_index) const
 //////////////////////////////////////////////////////////////////////
 // Based on Allegro's bestfit_color
 
-static std::vector<uint32_t> col_diff;
-static uint32_t* col_diff_g;
-static uint32_t* col_diff_r;
-static uint32_t* col_diff_b;
-static uint32_t* col_diff_a;
+namespace bestfit {
 
-static void initBestfit()
-{
-  col_diff.resize(4*128, 0);
-  col_diff_g = &col_diff[128*0];
-  col_diff_r = &col_diff[128*1];
-  col_diff_b = &col_diff[128*2];
-  col_diff_a = &col_diff[128*3];
-
-  for (int i=1; i<64; ++i) {
-    int k = i * i;
-    col_diff_g[i] = col_diff_g[128-i] = k * 59 * 59;
-    col_diff_r[i] = col_diff_r[128-i] = k * 30 * 30;
-    col_diff_b[i] = col_diff_b[128-i] = k * 11 * 11;
-    col_diff_a[i] = col_diff_a[128-i] = k * 8 * 8;
-  }
-}
+#ifdef DOC_HAVE_SIMD
+// Defined in palette_bestfit_sse2.cpp and palette_bestfit_avx2.cpp
+int find_sse2(const int16_t* table, int size,
+              int r, int g, int b, int a, int mask_index);
+int find_avx2(const int16_t* table, int size,
+              int r, int g, int b, int a, int mask_index);
+#endif
 
-int Palette::findBestfit(int r, int g, int b, int a, int mask_index) const
+int find_scalar(const int16_t* table, int size,
+                int r, int g, int b, int a, int mask_index)
 {
-  ASSERT(r >= 0 && r <= 255);
-  ASSERT(g >= 0 && g <= 255);
-  ASSERT(b >= 0 && b <= 255);
-  ASSERT(a >= 0 && a <= 255);
-
-  if (col_diff.empty())
-    initBestfit();
-
-  r >>= 3;
-  g >>= 3;
-  b >>= 3;
-  a >>= 3;
-
-  // Mask index is like alpha = 0, so we can use it as transparent color.
-  if (a == 0 && mask_index >= 0)
-    return mask_index;
-
+  const int qg = g*kWeightG;
+  const int qr = r*kWeightR;
+  const int qb = b*kWeightB;
+  const int qa = a*kWeightA;
   int bestfit = 0;
   int lowest = std::numeric_limits<int>::max();
-  int size = MIN(256, m_colors.size());
 
   for (int i=0; i<size; ++i) {
-    color_t rgb = m_colors[i];
+    const int16_t* p = table + (i / kGroupSize)*kGroupStride + 2*(i % kGroupSize);
 
-    int coldiff = col_diff_g[((rgba_getg(rgb)>>3) - g) & 127];
+    int d = p[0] - qg;
+    int coldiff = d*d;
     if (coldiff < lowest) {
-      coldiff += col_diff_r[(((rgba_getr(rgb)>>3) - r) & 127)];
+      d = p[1] - qr;
+      coldiff += d*d;
       if (coldiff < lowest) {
-        coldiff += col_diff_b[(((rgba_getb(rgb)>>3) - b) & 127)];
+        d = p[2*kGroupSize] - qb;
+        coldiff += d*d;
         if (coldiff < lowest) {
-          coldiff += col_diff_a[(((rgba_geta(rgb)>>3) - a) & 127)];
+          d = p[2*kGroupSize+1] - qa;
+          coldiff += d*d;
           if (coldiff < lowest && i != mask_index) {
             if (coldiff == 0)
               return i;
@@ -269,6 +257,74 @@ int Palette::findBestfit(int r, int g, int b, int a, int mask_index) const
   return bestfit;
 }
 
+FindFunc get_find_func()
+{
+  switch (simd_level()) {
+#ifdef DOC_HAVE_SIMD
+    case SimdLevel::AVX2: return find_avx2;
+    case SimdLevel::SSE2: return find_sse2;
+#endif
+    default: return find_scalar;
+  }
+}
+
+} // namespace bestfit
+
+void Palette::updateBestfitTable()
+{
+  const int size = MIN(bestfit::kMaxEntries, int(m_colors.size()));
+  const int ngroups = bestfit::groups_for(size);
+
+  m_bestfit.resize(std::max(1, ngroups) * bestfit::kGroupStride);
+  for (int i=0; i<size; ++i)
+    bestfit::set_entry(&m_bestfit[0], i, m_colors[i]);
+  for (int i=size; i<ngroups*bestfit::kGroupSize; ++i)
+    bestfit::set_padding(&m_bestfit[0], i);
+}
+
+int Palette::findBestfit(int r, int g, int b, int a, int mask_index) const
+{
+  ASSERT(r >= 0 && r <= 255);
+  ASSERT(g >= 0 && g <= 255);
+  ASSERT(b >= 0 && b <= 255);
+  ASSERT(a >= 0 && a <= 255);
+
+  // Mask index is like alpha = 0, so we can use it as transparent color.
+  if ((a>>3) == 0 && mask_index >= 0)
+    return mask_index;
+
+  static const bestfit::FindFunc find = bestfit::get_find_func();
+  return (*find)(&m_bestfit[0], MIN(bestfit::kMaxEntries, size()),
+                 r>>3, g>>3, b>>3, a>>3, mask_index);
+}
+
+void Palette::findBestfit(const color_t* src, uint8_t* dst, int n,
+                          int mask_index) const
+{
+  static const bestfit::FindFunc find = bestfit::get_find_func();
+  const int16_t* table = &m_bestfit[0];
+  const int size = MIN(bestfit::kMaxEntries, this->size());
+
+  for (int i=0; i<n; ++i) {
+    const color_t c = src[i];
+
+    // Consecutive pixels usually have the same color
+    if (i > 0 && c == src[i-1]) {
+      dst[i] = dst[i-1];
+      continue;
+    }
+
+    const int a = (rgba_geta(c)>>3);
+    if (a == 0 && mask_index >= 0)
+      dst[i] = mask_index;
+    else
+      dst[i] = (*find)(table, size,
+                       rgba_getr(c)>>3,
+                       rgba_getg(c)>>3,
+                       rgba_getb(c)>>3, a, mask_index);
+  }
+}
+
 void Palette::applyRemap(const Remap& remap)
 {
   Palette original(*this);
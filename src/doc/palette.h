@@ -11,6 +11,7 @@
 #include "doc/frame.h"
 #include "doc/object.h"
 
+#include <cstdint>
 #include <vector>
 #include <string>
 
@@ -82,11 +83,21 @@ namespace doc {
     int findExactMatch(int r, int g, int b, int a, int mask_index) const;
     int findBestfit(int r, int g, int b, int a, int mask_index) const;
 
+    // Same as findBestfit() for each color of "src", the indexes are
+    // stored in "dst". Useful to map whole rows of pixels.
+    void findBestfit(const color_t* src, uint8_t* dst, int n,
+                     int mask_index) const;
+
     void applyRemap(const Remap& remap);
 
   private:
+    void updateBestfitTable();
+
     frame_t m_frame;
     std::vector<color_t> m_colors;
+    // First 256 colors prepared for findBestfit() (see
+    // doc/palette_bestfit.h)
+    std::vector<int16_t> m_bestfit;
     int m_modifications;
     std::string m_filename; // If the palette is associated with a file.
   };
@@ -0,0 +1,73 @@
+// LibreSprite Document Library
+// Copyright (c) 2026 LibreSprite contributors
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+//
+// Nearest color search used by Palette::findBestfit(). The palette
+// keeps its first 256 colors in a table of 16-bit values prepared
+// to compare several entries at the same time:
+//
+//   group 0: [g0 r0 g1 r1 ... g7 r7] [b0 a0 b1 a1 ... b7 a7]
+//   group 1: [g8 r8 ...]             [b8 a8 ...]
+//   ...
+//
+// Each channel has 5 bits and is multiplied by its weight (59 for
+// green, 30 for red, 11 for blue, 8 for alpha), so the distance to
+// an entry is the sum of squared differences of both pairs (which is
+// what _mm_madd_epi16() calculates). The last group is completed
+// with padding entries that are farther than any real color.
+
+#pragma once
+
+#include "doc/color.h"
+
+#include <cstdint>
+
+namespace doc {
+namespace bestfit {
+
+  const int kGroupSize = 8;                 // Entries per group
+  const int kGroupStride = 4*kGroupSize;    // int16_t values per group
+  const int kMaxEntries = 256;
+  const int16_t kPadding = 16383;
+
+  const int kWeightR = 30;
+  const int kWeightG = 59;
+  const int kWeightB = 11;
+  const int kWeightA = 8;
+
+  inline int groups_for(int size) {
+    return (size + kGroupSize - 1) / kGroupSize;
+  }
+
+  // Stores the color "c" in the entry "i" of the table.
+  inline void set_entry(int16_t* table, int i, color_t c) {
+    int16_t* p = table + (i / kGroupSize)*kGroupStride + 2*(i % kGroupSize);
+    p[0] = int16_t((rgba_getg(c)>>3) * kWeightG);
+    p[1] = int16_t((rgba_getr(c)>>3) * kWeightR);
+    p[2*kGroupSize+0] = int16_t((rgba_getb(c)>>3) * kWeightB);
+    p[2*kGroupSize+1] = int16_t((rgba_geta(c)>>3) * kWeightA);
+  }
+
+  inline void set_padding(int16_t* table, int i) {
+    int16_t* p = table + (i / kGroupSize)*kGroupStride + 2*(i % kGroupSize);
+    p[0] = p[1] = p[2*kGroupSize+0] = p[2*kGroupSize+1] = kPadding;
+  }
+
+  // Returns the index of the entry nearest to the given color (5 bits
+  // per channel), excluding "mask_index". The first entry is returned
+  // if all entries have the same distance, and 0 if there is no
+  // valid entry (same results as the original Allegro's
+  // bestfit_color()).
+  typedef int (*FindFunc)(const int16_t* table, int size,
+                          int r, int g, int b, int a, int mask_index);
+
+  int find_scalar(const int16_t* table, int size,
+                  int r, int g, int b, int a, int mask_index);
+
+  // Returns the fastest function supported by the CPU.
+  FindFunc get_find_func();
+
+} // namespace bestfit
+} // namespace doc
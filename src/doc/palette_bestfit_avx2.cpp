@@ -0,0 +1,51 @@
+// LibreSprite Document Library
+// Copyright (c) 2026 LibreSprite contributors
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+//
+// Compiled with AVX2 enabled, only called when the CPU supports it
+// (see bestfit::get_find_func() in palette.cpp).
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <immintrin.h>
+
+#include "doc/palette_bestfit_simd.h"
+
+namespace doc {
+namespace bestfit {
+
+namespace {
+
+  struct Avx2 {
+    typedef __m256i I;
+    enum { N = 8 };
+
+    static I load(const int16_t* p) { return _mm256_loadu_si256((const I*)p); }
+    static void store(int* p, I v) { _mm256_storeu_si256((I*)p, v); }
+    static I set1(int v) { return _mm256_set1_epi32(v); }
+    static I iota() { return _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7); }
+    static I and_(I a, I b) { return _mm256_and_si256(a, b); }
+    static I or_(I a, I b) { return _mm256_or_si256(a, b); }
+    static I andnot(I a, I b) { return _mm256_andnot_si256(a, b); }
+    static I add(I a, I b) { return _mm256_add_epi32(a, b); }
+    static I sub16(I a, I b) { return _mm256_sub_epi16(a, b); }
+    static I madd(I a, I b) { return _mm256_madd_epi16(a, b); }
+    static I cmpeq(I a, I b) { return _mm256_cmpeq_epi32(a, b); }
+    static I cmplt(I a, I b) { return _mm256_cmpgt_epi32(b, a); }
+    template<int S> static I srl(I a) { return _mm256_srli_epi32(a, S); }
+  };
+
+} // anonymous namespace
+
+int find_avx2(const int16_t* table, int size,
+              int r, int g, int b, int a, int mask_index)
+{
+  return simd::find<Avx2>(table, size, r, g, b, a, mask_index);
+}
+
+} // namespace bestfit
+} // namespace doc
@@ -0,0 +1,89 @@
+// LibreSprite Document Library
+// Copyright (c) 2026 LibreSprite contributors
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+//
+// SIMD nearest color search. This header is included by
+// palette_bestfit_sse2.cpp and palette_bestfit_avx2.cpp, which are
+// compiled with specific instruction sets and define the "V" type
+// with the vector operations (one 32-bit distance per lane). The
+// results must be the same as bestfit::find_scalar().
+
+#pragma once
+
+#include "doc/palette_bestfit.h"
+
+#include <limits>
+
+namespace doc {
+namespace bestfit {
+namespace simd {
+
+  template<typename V>
+  inline typename V::I select(typename V::I mask, typename V::I x, typename V::I y) {
+    return V::or_(V::and_(mask, x), V::andnot(mask, y));
+  }
+
+  // Two 16-bit values repeated in each 32-bit lane.
+  template<typename V>
+  inline typename V::I set1_pair(int lo, int hi) {
+    return V::set1(int((uint32_t(hi) << 16) | (uint32_t(lo) & 0xffff)));
+  }
+
+  template<typename V>
+  int find(const int16_t* table, int size,
+           int r, int g, int b, int a, int mask_index) {
+    typedef typename V::I I;
+    static_assert(kGroupSize % V::N == 0, "Invalid number of lanes");
+
+    const I qgr = set1_pair<V>(g*kWeightG, r*kWeightR);
+    const I qba = set1_pair<V>(b*kWeightB, a*kWeightA);
+    const I maskV = V::set1(mask_index);
+    const I step = V::set1(V::N);
+    I index = V::iota();
+    I best = V::set1(std::numeric_limits<int>::max());
+    I bestIndex = V::set1(0);
+
+    const int ngroups = groups_for(size);
+    for (int i=0; i<ngroups; ++i, table += kGroupStride) {
+      for (int j=0; j<kGroupSize; j+=V::N) {
+        I gr = V::sub16(V::load(table + 2*j), qgr);
+        I ba = V::sub16(V::load(table + 2*kGroupSize + 2*j), qba);
+        I dist = V::add(V::madd(gr, gr), V::madd(ba, ba));
+
+        // The mask index gets the maximum distance
+        dist = V::or_(dist, V::template srl<1>(V::cmpeq(index, maskV)));
+
+        // Strictly less, so each lane keeps its first nearest entry
+        I lt = V::cmplt(dist, best);
+        best = select<V>(lt, dist, best);
+        bestIndex = select<V>(lt, index, bestIndex);
+        index = V::add(index, step);
+      }
+    }
+
+    int dists[V::N], indexes[V::N];
+    V::store(dists, best);
+    V::store(indexes, bestIndex);
+
+    int bestfit = indexes[0];
+    int lowest = dists[0];
+    for (int k=1; k<V::N; ++k) {
+      if (dists[k] < lowest ||
+          (dists[k] == lowest && indexes[k] < bestfit)) {
+        bestfit = indexes[k];
+        lowest = dists[k];
+      }
+    }
+
+    // Only the mask index and/or padding entries
+    if (bestfit >= size || bestfit == mask_index)
+      return 0;
+
+    return bestfit;
+  }
+
+} // namespace simd
+} // namespace bestfit
+} // namespace doc
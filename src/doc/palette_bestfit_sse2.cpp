@@ -0,0 +1,51 @@
+// LibreSprite Document Library
+// Copyright (c) 2026 LibreSprite contributors
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+//
+// Compiled with SSE2 enabled, only called when the CPU supports it
+// (see bestfit::get_find_func() in palette.cpp).
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <emmintrin.h>
+
+#include "doc/palette_bestfit_simd.h"
+
+namespace doc {
+namespace bestfit {
+
+namespace {
+
+  struct Sse2 {
+    typedef __m128i I;
+    enum { N = 4 };
+
+    static I load(const int16_t* p) { return _mm_loadu_si128((const I*)p); }
+    static void store(int* p, I v) { _mm_storeu_si128((I*)p, v); }
+    static I set1(int v) { return _mm_set1_epi32(v); }
+    static I iota() { return _mm_setr_epi32(0, 1, 2, 3); }
+    static I and_(I a, I b) { return _mm_and_si128(a, b); }
+    static I or_(I a, I b) { return _mm_or_si128(a, b); }
+    static I andnot(I a, I b) { return _mm_andnot_si128(a, b); }
+    static I add(I a, I b) { return _mm_add_epi32(a, b); }
+    static I sub16(I a, I b) { return _mm_sub_epi16(a, b); }
+    static I madd(I a, I b) { return _mm_madd_epi16(a, b); }
+    static I cmpeq(I a, I b) { return _mm_cmpeq_epi32(a, b); }
+    static I cmplt(I a, I b) { return _mm_cmplt_epi32(a, b); }
+    template<int S> static I srl(I a) { return _mm_srli_epi32(a, S); }
+  };
+
+} // anonymous namespace
+
+int find_sse2(const int16_t* table, int size,
+              int r, int g, int b, int a, int mask_index)
+{
+  return simd::find<Sse2>(table, size, r, g, b, a, mask_index);
+}
+
+} // namespace bestfit
+} // namespace doc
@@ -0,0 +1,185 @@
+// LibreSprite Document Library
+// Copyright (c) 2026 LibreSprite contributors
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "doc/palette.h"
+#include "doc/palette_bestfit.h"
+
+#include <chrono>
+#include <cstdio>
+#include <limits>
+#include <vector>
+
+using namespace doc;
+
+namespace {
+
+unsigned int rand_seed = 1234;
+
+int rand_int() {
+  rand_seed = rand_seed*1103515245 + 12345;
+  return (rand_seed >> 8);
+}
+
+color_t rand_color() {
+  int a = rand_int() % 4;
+  return rgba(rand_int() & 255,
+              rand_int() & 255,
+              rand_int() & 255,
+              a == 0 ? 0: a == 1 ? 128: 255);
+}
+
+void fill_palette(Palette& pal) {
+  for (int i=0; i<pal.size(); ++i)
+    pal.setEntry(i, rand_color());
+}
+
+// The original Allegro's bestfit_color() algorithm
+int reference_bestfit(const Palette& pal, int r, int g, int b, int a, int mask_index) {
+  r >>= 3;
+  g >>= 3;
+  b >>= 3;
+  a >>= 3;
+  if (a == 0 && mask_index >= 0)
+    return mask_index;
+
+  int bestfit = 0;
+  int lowest = std::numeric_limits<int>::max();
+  int size = std::min(256, pal.size());
+  for (int i=0; i<size; ++i) {
+    color_t c = pal.getEntry(i);
+    int dg = (rgba_getg(c)>>3) - g;
+    int dr = (rgba_getr(c)>>3) - r;
+    int db = (rgba_getb(c)>>3) - b;
+    int da = (rgba_geta(c)>>3) - a;
+    int coldiff = dg*dg*59*59 + dr*dr*30*30 + db*db*11*11 + da*da*8*8;
+    if (coldiff < lowest && i != mask_index) {
+      if (coldiff == 0)
+        return i;
+      bestfit = i;
+      lowest = coldiff;
+    }
+  }
+  return bestfit;
+}
+
+} // anonymous namespace
+
+TEST(Palette, FindBestfit)
+{
+  for (int size : { 0, 1, 2, 5, 8, 9, 17, 64, 255, 256, 300 }) {
+    Palette pal(frame_t(0), size);
+    fill_palette(pal);
+
+    // Some repeated colors to test that the first entry is used
+    if (size > 10) {
+      pal.setEntry(size-1, pal.getEntry(3));
+      pal.setEntry(7, pal.getEntry(5));
+    }
+
+    for (int mask : { -1, 0, 3, 5, size-1 }) {
+      for (int j=0; j<2000; ++j) {
+        color_t c = (j < 20 && size > 0 ? pal.getEntry(j % size): rand_color());
+        int r = rgba_getr(c), g = rgba_getg(c), b = rgba_getb(c), a = rgba_geta(c);
+        ASSERT_EQ(reference_bestfit(pal, r, g, b, a, mask),
+                  pal.findBestfit(r, g, b, a, mask))
+          << "size " << size << " mask " << mask
+          << " rgba " << r << " " << g << " " << b << " " << a;
+      }
+    }
+  }
+}
+
+TEST(Palette, FindBestfitKernels)
+{
+  Palette pal(frame_t(0), 256);
+  fill_palette(pal);
+
+  // Build the same table that the palette uses internally
+  std::vector<int16_t> table(bestfit::groups_for(256) * bestfit::kGroupStride);
+  for (int i=0; i<256; ++i)
+    bestfit::set_entry(&table[0], i, pal.getEntry(i));
+
+  bestfit::FindFunc find = bestfit::get_find_func();
+  for (int j=0; j<20000; ++j) {
+    int r = rand_int() & 31, g = rand_int() & 31, b = rand_int() & 31, a = rand_int() & 31;
+    int mask = (j & 1 ? -1: j & 255);
+    EXPECT_EQ(bestfit::find_scalar(&table[0], 256, r, g, b, a, mask),
+              (*find)(&table[0], 256, r, g, b, a, mask));
+  }
+}
+
+TEST(Palette, FindBestfitRow)
+{
+  Palette pal(frame_t(0), 200);
+  fill_palette(pal);
+
+  std::vector<color_t> src(1000);
+  for (std::size_t i=0; i<src.size(); ++i)
+    src[i] = (i > 0 && (i % 5) == 0 ? src[i-1]: rand_color());
+
+  for (int mask : { -1, 0, 10 }) {
+    std::vector<uint8_t> dst(src.size());
+    pal.findBestfit(&src[0], &dst[0], int(src.size()), mask);
+    for (std::size_t i=0; i<src.size(); ++i) {
+      color_t c = src[i];
+      EXPECT_EQ(pal.findBestfit(rgba_getr(c), rgba_getg(c), rgba_getb(c), rgba_geta(c), mask),
+                dst[i]);
+    }
+  }
+}
+
+// Compares the scalar and SIMD versions of findBestfit(). It's
+// disabled, run it with --gtest_also_run_disabled_tests.
+TEST(Palette, DISABLED_FindBestfitBenchmark)
+{
+  Palette pal(frame_t(0), 256);
+  fill_palette(pal);
+
+  std::vector<int16_t> table(bestfit::groups_for(256) * bestfit::kGroupStride);
+  for (int i=0; i<256; ++i)
+    bestfit::set_entry(&table[0], i, pal.getEntry(i));
+
+  const int n = 1000000;
+  std::vector<color_t> colors(n);
+  for (color_t& c : colors)
+    c = rgba(rand_int() & 255, rand_int() & 255, rand_int() & 255, 255);
+
+  auto measure = [&](const char* name, bestfit::FindFunc find) {
+    int sum = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (color_t c : colors)
+      sum += (*find)(&table[0], 256,
+                     rgba_getr(c)>>3, rgba_getg(c)>>3,
+                     rgba_getb(c)>>3, rgba_geta(c)>>3, -1);
+    auto t1 = std::chrono::steady_clock::now();
+    double secs = std::chrono::duration<double>(t1 - t0).count();
+    std::printf("%s: %.1f M colors/s\n", name, n / secs / 1e6);
+    return sum;
+  };
+
+  int scalar = measure("findBestfit() scalar", bestfit::find_scalar);
+  int simd = measure("findBestfit() SIMD", bestfit::get_find_func());
+  EXPECT_EQ(scalar, simd);
+
+  std::vector<uint8_t> dst(n);
+  auto t0 = std::chrono::steady_clock::now();
+  pal.findBestfit(&colors[0], &dst[0], n, -1);
+  auto t1 = std::chrono::steady_clock::now();
+  double secs = std::chrono::duration<double>(t1 - t0).count();
+  std::printf("findBestfit() row: %.1f M colors/s\n", n / secs / 1e6);
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
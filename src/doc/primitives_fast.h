@@ -12,8 +12,18 @@ namespace doc {
   class Image;
   template<typename ImageTraits> class ImageImpl;
 
+  // Read-only address of the pixel.
   template<class Traits>
-  inline typename Traits::address_t get_pixel_address_fast(const Image* image, int x, int y) {
+  inline typename Traits::const_address_t get_pixel_address_fast(const Image* image, int x, int y) {
+    ASSERT(x >= 0 && x < image->width());
+    ASSERT(y >= 0 && y < image->height());
+
+    return (((const ImageImpl<Traits>*)image)->address(x, y));
+  }
+
+  // Address to modify the pixel.
+  template<class Traits>
+  inline typename Traits::address_t get_pixel_address_fast(Image* image, int x, int y) {
     ASSERT(x >= 0 && x < image->width());
     ASSERT(y >= 0 && y < image->height());
 
@@ -25,7 +35,7 @@ namespace doc {
     ASSERT(x >= 0 && x < image->width());
     ASSERT(y >= 0 && y < image->height());
 
-    return *(((ImageImpl<Traits>*)image)->address(x, y));
+    return *(((const ImageImpl<Traits>*)image)->address(x, y));
   }
 
   template<class Traits>
@@ -44,7 +54,7 @@ namespace doc {
     ASSERT(x >= 0 && x < image->width());
     ASSERT(y >= 0 && y < image->height());
 
-    return (*image->getPixelAddress(x, y)) & (1 << (x % 8)) ? 1: 0;
+    return (*image->getConstPixelAddress(x, y)) & (1 << (x % 8)) ? 1: 0;
   }
 
   template<>
@@ -52,10 +62,11 @@ namespace doc {
     ASSERT(x >= 0 && x < image->width());
     ASSERT(y >= 0 && y < image->height());
 
+    uint8_t* addr = image->getPixelAddress(x, y);
     if (color)
-      *image->getPixelAddress(x, y) |= (1 << (x % 8));
+      *addr |= (1 << (x % 8));
     else
-      *image->getPixelAddress(x, y) &= ~(1 << (x % 8));
+      *addr &= ~(1 << (x % 8));
   }
 
 } // namespace doc
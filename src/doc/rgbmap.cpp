@@ -10,6 +10,7 @@
 
 #include "doc/rgbmap.h"
 
+#include "base/thread_pool.h"
 #include "doc/color_scales.h"
 #include "doc/palette.h"
 
@@ -36,7 +37,7 @@ bool RgbMap::match(const Palette* palette) const
     m_modifications == palette->getModifications());
 }
 
-void RgbMap::regenerate(const Palette* palette, int mask_index)
+void RgbMap::regenerate(const Palette* palette, int mask_index, Fill fill)
 {
   m_palette = palette;
   m_modifications = palette->getModifications();
@@ -45,16 +46,51 @@ void RgbMap::regenerate(const Palette* palette, int mask_index)
   // Mark all entries as invalid (need to be regenerated)
   for (uint16_t& entry : m_map)
     entry |= INVALID;
+
+  if (fill == Fill::Eager)
+    generateAllEntries();
+}
+
+int RgbMap::calculateEntry(int r5, int g5, int b5, int a3) const
+{
+  return m_palette->findBestfit(
+    scale_5bits_to_8bits(r5),
+    scale_5bits_to_8bits(g5),
+    scale_5bits_to_8bits(b5),
+    scale_3bits_to_8bits(a3), m_maskIndex);
 }
 
 int RgbMap::generateEntry(int i, int r, int g, int b, int a) const
 {
-  return m_map[i] =
-    m_palette->findBestfit(
-      scale_5bits_to_8bits(r>>3),
-      scale_5bits_to_8bits(g>>3),
-      scale_5bits_to_8bits(b>>3),
-      scale_3bits_to_8bits(a>>5), m_maskIndex);
+  return m_map[i] = calculateEntry(r>>3, g>>3, b>>3, a>>5);
+}
+
+void RgbMap::generateAllEntries()
+{
+  // Each iteration maps the consecutive entries of one red/green
+  // pair (all blue and alpha values) with one
+  // Palette::findBestfit() call.
+  base::thread_pool::instance().parallel_for(
+    RSIZE*GSIZE,
+    [this](int rg){
+      const int r = scale_5bits_to_8bits(rg / GSIZE);
+      const int g = scale_5bits_to_8bits(rg % GSIZE);
+      const int n = BSIZE*ASIZE;
+      uint16_t* entries = &m_map[rg * n];
+
+      std::vector<color_t> colors(n);
+      std::vector<uint8_t> indexes(n);
+      for (int b=0, i=0; b<BSIZE; ++b)
+        for (int a=0; a<ASIZE; ++a, ++i)
+          colors[i] = rgba(r, g, scale_5bits_to_8bits(b),
+                           scale_3bits_to_8bits(a));
+
+      m_palette->findBestfit(&colors[0], &indexes[0], n, m_maskIndex);
+
+      for (int i=0; i<n; ++i)
+        if (entries[i] & INVALID)
+          entries[i] = indexes[i];
+    });
 }
 
 } // namespace doc
@@ -22,25 +22,42 @@ namespace doc {
     const int INVALID = 256;
 
   public:
+    // How regenerate() fills the table.
+    enum class Fill {
+      // Entries are calculated the first time mapColor() needs them.
+      Lazy,
+      // All entries are calculated in regenerate() using all cores.
+      // After that mapColor() is a plain table lookup and can be
+      // called from several threads at the same time.
+      Eager,
+    };
+
     RgbMap();
 
     bool match(const Palette* palette) const;
-    void regenerate(const Palette* palette, int mask_index);
+    void regenerate(const Palette* palette, int mask_index,
+                    Fill fill = Fill::Lazy);
 
     int mapColor(int r, int g, int b, int a) const {
       ASSERT(r >= 0 && r < 256);
       ASSERT(g >= 0 && g < 256);
       ASSERT(b >= 0 && b < 256);
       ASSERT(a >= 0 && a < 256);
-      // bits -> bbbbbgggggrrrrraaa
+      // bits -> rrrrrgggggbbbbbaaa
       int i = (a>>5) | ((b>>3) << 3) | ((g>>3) << 8) | ((r>>3) << 13);
       int v = m_map[i];
       return (v & INVALID) ? generateEntry(i, r, g, b, a): v;
     }
 
+    // Calculates all entries that aren't calculated yet using all
+    // cores. Useful before mapping a lot of pixels with a table that
+    // was regenerated with Fill::Lazy (e.g. Sprite::rgbMap()).
+    void generateAllEntries();
+
     int maskIndex() const { return m_maskIndex; }
 
   private:
+    int calculateEntry(int r5, int g5, int b5, int a3) const;
     int generateEntry(int i, int r, int g, int b, int a) const;
 
     mutable std::vector<uint16_t> m_map;
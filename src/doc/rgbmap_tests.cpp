@@ -0,0 +1,71 @@
+// LibreSprite Document Library
+// Copyright (c) 2026 LibreSprite contributors
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "doc/palette.h"
+#include "doc/rgbmap.h"
+
+using namespace doc;
+
+static void fill_palette(Palette& pal)
+{
+  unsigned int seed = 1234;
+  for (int i=0; i<pal.size(); ++i) {
+    seed = seed*1103515245 + 12345;
+    pal.setEntry(i, rgba((seed >> 8) & 255,
+                         (seed >> 16) & 255,
+                         (seed >> 24) & 255,
+                         (i % 3) == 0 ? 128: 255));
+  }
+}
+
+TEST(RgbMap, EagerMatchesLazy)
+{
+  Palette pal(frame_t(0), 256);
+  fill_palette(pal);
+
+  for (int maskIndex : { -1, 0, 17 }) {
+    RgbMap lazy, eager;
+    lazy.regenerate(&pal, maskIndex, RgbMap::Fill::Lazy);
+    eager.regenerate(&pal, maskIndex, RgbMap::Fill::Eager);
+    EXPECT_TRUE(eager.match(&pal));
+    EXPECT_EQ(maskIndex, eager.maskIndex());
+
+    for (int r=0; r<256; r+=5)
+      for (int g=0; g<256; g+=3)
+        for (int b=0; b<256; b+=7)
+          for (int a : { 0, 31, 32, 100, 255 })
+            ASSERT_EQ(lazy.mapColor(r, g, b, a),
+                      eager.mapColor(r, g, b, a))
+              << "rgba " << r << " " << g << " " << b << " " << a;
+  }
+}
+
+TEST(RgbMap, RegenerateAfterPaletteChange)
+{
+  Palette pal(frame_t(0), 256);
+  fill_palette(pal);
+
+  RgbMap rgbmap;
+  rgbmap.regenerate(&pal, -1, RgbMap::Fill::Eager);
+
+  pal.setEntry(200, rgba(1, 2, 3, 255));
+  EXPECT_FALSE(rgbmap.match(&pal));
+  rgbmap.regenerate(&pal, -1, RgbMap::Fill::Eager);
+  EXPECT_TRUE(rgbmap.match(&pal));
+  EXPECT_EQ(pal.findBestfit(0, 0, 0, 255, -1), rgbmap.mapColor(0, 0, 0, 255));
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,56 @@
+// LibreSprite Document Library
+// Copyright (c) 2026 LibreSprite contributors
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "doc/simd_level.h"
+
+#if defined(DOC_HAVE_SIMD) && defined(_MSC_VER)
+  #include <immintrin.h>
+  #include <intrin.h>
+#endif
+
+namespace doc {
+
+static SimdLevel detect_simd_level()
+{
+#ifdef DOC_HAVE_SIMD
+#if defined(__GNUC__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return SimdLevel::AVX2;
+  if (__builtin_cpu_supports("sse2"))
+    return SimdLevel::SSE2;
+#elif defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 0);
+  const int nids = info[0];
+  __cpuid(info, 1);
+  const bool sse2 = ((info[3] & (1 << 26)) != 0);
+  const bool osxsave = ((info[2] & (1 << 27)) != 0);
+  const bool avx = ((info[2] & (1 << 28)) != 0);
+  // AVX2 needs the OS support to save the YMM registers
+  if (nids >= 7 && osxsave && avx && (_xgetbv(0) & 6) == 6) {
+    __cpuidex(info, 7, 0);
+    if (info[1] & (1 << 5))
+      return SimdLevel::AVX2;
+  }
+  if (sse2)
+    return SimdLevel::SSE2;
+#endif
+#endif // DOC_HAVE_SIMD
+  return SimdLevel::NONE;
+}
+
+SimdLevel simd_level()
+{
+  static const SimdLevel level = detect_simd_level();
+  return level;
+}
+
+} // namespace doc
@@ -0,0 +1,18 @@
+// LibreSprite Document Library
+// Copyright (c) 2026 LibreSprite contributors
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#pragma once
+
+namespace doc {
+
+  enum class SimdLevel { NONE, SSE2, AVX2 };
+
+  // Returns the best instruction set supported by the CPU that can be
+  // used to select a SIMD kernel at runtime. It's always NONE when
+  // the kernels aren't compiled (DOC_HAVE_SIMD isn't defined).
+  SimdLevel simd_level();
+
+} // namespace doc
@@ -11,6 +11,11 @@
 
 #include "filters/convolution_matrix.h"
 
+#include "base/ints.h"
+
+#include <algorithm>
+#include <numeric>
+
 namespace filters {
 
 ConvolutionMatrix::ConvolutionMatrix(int width, int height)
@@ -25,4 +30,45 @@ ConvolutionMatrix::ConvolutionMatrix(int width, int height)
 {
 }
 
+bool ConvolutionMatrix::separate(std::vector<int>& xFactors,
+                                 std::vector<int>& yFactors) const
+{
+  // First row with a non-zero value
+  int y0 = 0;
+  while (y0 < m_height &&
+         std::all_of(&value(0, y0), &value(0, y0)+m_width,
+                     [](int v){ return v == 0; }))
+    ++y0;
+  if (y0 == m_height)
+    return false;
+
+  // The row divided by the GCD of its values are the X factors, so
+  // all the Y factors are integers if the matrix is separable.
+  int gcd = 0;
+  for (int x=0; x<m_width; ++x)
+    gcd = std::gcd(gcd, value(x, y0));
+
+  xFactors.resize(m_width);
+  for (int x=0; x<m_width; ++x)
+    xFactors[x] = value(x, y0) / gcd;
+
+  int x0 = 0;
+  while (xFactors[x0] == 0)
+    ++x0;
+
+  yFactors.resize(m_height);
+  for (int y=0; y<m_height; ++y) {
+    if (value(x0, y) % xFactors[x0] != 0)
+      return false;
+    yFactors[y] = value(x0, y) / xFactors[x0];
+  }
+
+  for (int y=0; y<m_height; ++y)
+    for (int x=0; x<m_width; ++x)
+      if (int64_t(xFactors[x]) * yFactors[y] != value(x, y))
+        return false;
+
+  return true;
+}
+
 } // namespace filters
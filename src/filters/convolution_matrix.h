@@ -53,6 +53,13 @@ namespace filters {
     int& value(int x, int y) { return m_data[y*m_width+x]; }
     const int& value(int x, int y) const { return m_data[y*m_width+x]; }
 
+    // Returns true if the matrix is the product of a column and a row
+    // of integers (a rank-1 or separable matrix), i.e. if
+    // value(x, y) == xFactors[x] * yFactors[y] for all elements. In
+    // that case the matrix can be applied in two 1D passes.
+    bool separate(std::vector<int>& xFactors,
+                  std::vector<int>& yFactors) const;
+
   private:
     std::string m_name;          // Name
     int m_width, m_height;       // Size of the matrix
@@ -19,69 +19,189 @@
 #include "doc/image_impl.h"
 #include "doc/palette.h"
 #include "doc/rgbmap.h"
+#include "doc/simd_level.h"
+
+#include <algorithm>
 
 namespace filters {
 
+#ifdef FILTERS_HAVE_SIMD
+// Defined in convolution_rows_sse2.cpp and convolution_rows_avx2.cpp
+void add_weighted_sse2(int* dst, const int* src, int k, int n);
+void add_weighted_avx2(int* dst, const int* src, int k, int n);
+#endif
+
 using namespace doc;
 
 namespace {
 
-  struct GetPixelsDelegate {
-    uint32_t color;
-    int div;
-    const int* matrixData;
+  // Splits the pixels of a row in planes of integers (one per channel)
+  // so the weighted sums of each plane are SIMD loops (see
+  // add_weighted()). Transparent pixels aren't used by the filter so
+  // they are zero in all planes, and the last plane is 1 for the other
+  // pixels (to know the weights of transparent pixels, which are
+  // subtracted from the divisor).
+  struct RgbaPlanes {
+    enum { count = 5 };         // R, G, B, A, non-transparent
 
-    void reset(const ConvolutionMatrix* matrix) {
-      div = matrix->getDiv();
-      matrixData = &matrix->value(0, 0);
+    static void split(RgbTraits::pixel_t color, std::vector<int>* planes, int i)
+    {
+      if (rgba_geta(color) == 0) {
+        for (int p=0; p<count; ++p)
+          planes[p][i] = 0;
+      }
+      else {
+        planes[0][i] = rgba_getr(color);
+        planes[1][i] = rgba_getg(color);
+        planes[2][i] = rgba_getb(color);
+        planes[3][i] = rgba_geta(color);
+        planes[4][i] = 1;
+      }
     }
-
   };
 
-  struct GetPixelsDelegateRgba : public GetPixelsDelegate {
-    int r, g, b, a;
+  struct GrayscalePlanes {
+    enum { count = 3 };         // V, A, non-transparent
 
-    void reset(const ConvolutionMatrix* matrix) {
-      GetPixelsDelegate::reset(matrix);
-      r = g = b = a = 0;
-    }
-
-    void operator()(RgbTraits::pixel_t color)
+    static void split(GrayscaleTraits::pixel_t color, std::vector<int>* planes, int i)
     {
-      if (*matrixData) {
-        if (rgba_geta(color) == 0)
-          div -= *matrixData;
-        else {
-          r += rgba_getr(color) * (*matrixData);
-          g += rgba_getg(color) * (*matrixData);
-          b += rgba_getb(color) * (*matrixData);
-          a += rgba_geta(color) * (*matrixData);
-        }
+      if (graya_geta(color) == 0) {
+        for (int p=0; p<count; ++p)
+          planes[p][i] = 0;
+      }
+      else {
+        planes[0][i] = graya_getv(color);
+        planes[1][i] = graya_geta(color);
+        planes[2][i] = 1;
       }
-      matrixData++;
     }
-
   };
 
-  struct GetPixelsDelegateGrayscale : public GetPixelsDelegate {
-    int v, a;
+  typedef void (*AddWeightedFunc)(int* dst, const int* src, int k, int n);
 
-    void reset(const ConvolutionMatrix* matrix) {
-      GetPixelsDelegate::reset(matrix);
-      v = a = 0;
+  // dst[i] += k*src[i]
+  void add_weighted_scalar(int* dst, const int* src, int k, int n)
+  {
+    for (int i=0; i<n; ++i)
+      dst[i] += k*src[i];
+  }
+
+  AddWeightedFunc get_add_weighted_func()
+  {
+    switch (simd_level()) {
+#ifdef FILTERS_HAVE_SIMD
+      case SimdLevel::AVX2: return add_weighted_avx2;
+      case SimdLevel::SSE2: return add_weighted_sse2;
+#endif
+      default: return add_weighted_scalar;
     }
+  }
 
-    void operator()(GrayscaleTraits::pixel_t color)
-    {
-      if (*matrixData) {
-        if (graya_geta(color) == 0)
-          div -= *matrixData;
-        else {
-          v += graya_getv(color) * (*matrixData);
-          a += graya_geta(color) * (*matrixData);
+  inline void add_weighted(int* dst, const int* src, int k, int n)
+  {
+    static const AddWeightedFunc func = get_add_weighted_func();
+    (*func)(dst, src, k, n);
+  }
+
+  // Calculates the weighted sums of each plane for "width" pixels of
+  // the row "y" starting from "x". The result is exactly the same as
+  // adding the neighbors of each pixel with get_neighboring_pixels(),
+  // but the sums of each matrix element are done for the whole row.
+  // If the matrix is separable (xFactors/yFactors aren't empty), each
+  // pixel needs (width+height) multiplications instead of width*height.
+  template<typename Traits, typename Planes>
+  void convolve_row(const Image* src, const ConvolutionMatrix* matrix,
+                    const std::vector<int>& xFactors,
+                    const std::vector<int>& yFactors,
+                    TiledMode tiledMode, int x, int y, int width,
+                    std::vector<int>* sums)
+  {
+    const int mw = matrix->getWidth();
+    const int mh = matrix->getHeight();
+    const bool tiledX = ((int(tiledMode) & int(TiledMode::X_AXIS)) ? true: false);
+    const bool tiledY = ((int(tiledMode) & int(TiledMode::Y_AXIS)) ? true: false);
+
+    // Source columns used by the row (with the neighbors of the first
+    // and last pixels).
+    const int n = width + mw - 1;
+    std::vector<int> columns(n);
+    for (int i=0; i<n; ++i)
+      columns[i] = get_neighbor_coord(x - matrix->getCenterX() + i, src->width(), tiledX);
+
+    std::vector<int> planes[Planes::count];
+    for (int p=0; p<Planes::count; ++p) {
+      planes[p].resize(n);
+      sums[p].assign(width, 0);
+    }
+
+    auto splitRow = [&](int j) {
+      auto address = reinterpret_cast<typename Traits::const_address_t>(
+        src->getConstPixelAddress(
+          0, get_neighbor_coord(y - matrix->getCenterY() + j, src->height(), tiledY)));
+      for (int i=0; i<n; ++i)
+        Planes::split(address[columns[i]], planes, i);
+    };
+
+    if (!xFactors.empty()) {
+      // Vertical pass: weighted sum of the rows in each column
+      std::vector<int> vsums[Planes::count];
+      for (int p=0; p<Planes::count; ++p)
+        vsums[p].assign(n, 0);
+
+      for (int j=0; j<mh; ++j) {
+        if (yFactors[j] == 0)
+          continue;
+
+        splitRow(j);
+        for (int p=0; p<Planes::count; ++p)
+          add_weighted(&vsums[p][0], &planes[p][0], yFactors[j], n);
+      }
+
+      // Horizontal pass
+      for (int i=0; i<mw; ++i) {
+        if (xFactors[i] == 0)
+          continue;
+
+        for (int p=0; p<Planes::count; ++p)
+          add_weighted(&sums[p][0], &vsums[p][i], xFactors[i], width);
+      }
+    }
+    else {
+      for (int j=0; j<mh; ++j) {
+        const int* k = &matrix->value(0, j);
+        if (std::all_of(k, k+mw, [](int v){ return v == 0; }))
+          continue;
+
+        splitRow(j);
+        for (int i=0; i<mw; ++i) {
+          if (k[i] == 0)
+            continue;
+
+          for (int p=0; p<Planes::count; ++p)
+            add_weighted(&sums[p][0], &planes[p][i], k[i], width);
         }
       }
-      matrixData++;
+    }
+  }
+
+  // Sum of all the values of the matrix.
+  int get_matrix_weight(const ConvolutionMatrix* matrix)
+  {
+    int weight = 0;
+    for (int y=0; y<matrix->getHeight(); ++y)
+      for (int x=0; x<matrix->getWidth(); ++x)
+        weight += matrix->value(x, y);
+    return weight;
+  }
+
+  struct GetPixelsDelegate {
+    uint32_t color;
+    int div;
+    const int* matrixData;
+
+    void reset(const ConvolutionMatrix* matrix) {
+      div = matrix->getDiv();
+      matrixData = &matrix->value(0, 0);
     }
 
   };
@@ -127,7 +247,15 @@ ConvolutionMatrixFilter::ConvolutionMatrixFilter()
 void ConvolutionMatrixFilter::setMatrix(const base::SharedPtr<ConvolutionMatrix>& matrix)
 {
   m_matrix = matrix;
-  m_lines.resize(matrix->getHeight());
+
+  // Two 1D passes are faster than the 2D matrix only if the matrix
+  // has more elements than the sum of both passes (e.g. 3x3 or more).
+  const int w = matrix->getWidth();
+  const int h = matrix->getHeight();
+  if (w*h <= w+h || !matrix->separate(m_xFactors, m_yFactors)) {
+    m_xFactors.clear();
+    m_yFactors.clear();
+  }
 }
 
 void ConvolutionMatrixFilter::setTiledMode(TiledMode tiledMode)
@@ -149,61 +277,61 @@ void ConvolutionMatrixFilter::applyToRgba(FilterManager* filterMgr)
   uint32_t* dst_address = (uint32_t*)filterMgr->getDestinationAddress();
   Target target = filterMgr->getTarget();
   uint32_t color;
-  GetPixelsDelegateRgba delegate;
+  int r, g, b, a, div;
   int x = filterMgr->x();
-  int x2 = x+filterMgr->getWidth();
+  int w = filterMgr->getWidth();
   int y = filterMgr->y();
 
-  for (; x<x2; ++x) {
+  std::vector<int> sums[RgbaPlanes::count];
+  convolve_row<RgbTraits, RgbaPlanes>(src, m_matrix.get(),
+                                      m_xFactors, m_yFactors,
+                                      m_tiledMode, x, y, w, sums);
+  const int weight = get_matrix_weight(m_matrix.get());
+
+  for (int i=0; i<w; ++i, ++x) {
     // Avoid the non-selected region
     if (filterMgr->skipPixel()) {
       ++dst_address;
       continue;
     }
 
-    delegate.reset(m_matrix.get());
-    get_neighboring_pixels<RgbTraits>(src, x, y,
-                                      m_matrix->getWidth(),
-                                      m_matrix->getHeight(),
-                                      m_matrix->getCenterX(),
-                                      m_matrix->getCenterY(),
-                                      m_tiledMode, delegate);
-
+    // Transparent pixels are not used
     color = get_pixel_fast<RgbTraits>(src, x, y);
-    if (delegate.div == 0) {
+    div = m_matrix->getDiv() - (weight - sums[4][i]);
+    if (div == 0) {
       *(dst_address++) = color;
       continue;
     }
 
     if (target & TARGET_RED_CHANNEL) {
-      delegate.r = delegate.r / delegate.div + m_matrix->getBias();
-      delegate.r = MID(0, delegate.r, 255);
+      r = sums[0][i] / div + m_matrix->getBias();
+      r = MID(0, r, 255);
     }
     else
-      delegate.r = rgba_getr(color);
+      r = rgba_getr(color);
 
     if (target & TARGET_GREEN_CHANNEL) {
-      delegate.g = delegate.g / delegate.div + m_matrix->getBias();
-      delegate.g = MID(0, delegate.g, 255);
+      g = sums[1][i] / div + m_matrix->getBias();
+      g = MID(0, g, 255);
     }
     else
-      delegate.g = rgba_getg(color);
+      g = rgba_getg(color);
 
     if (target & TARGET_BLUE_CHANNEL) {
-      delegate.b = delegate.b / delegate.div + m_matrix->getBias();
-      delegate.b = MID(0, delegate.b, 255);
+      b = sums[2][i] / div + m_matrix->getBias();
+      b = MID(0, b, 255);
     }
     else
-      delegate.b = rgba_getb(color);
+      b = rgba_getb(color);
 
     if (target & TARGET_ALPHA_CHANNEL) {
-      delegate.a = delegate.a / m_matrix->getDiv() + m_matrix->getBias();
-      delegate.a = MID(0, delegate.a, 255);
+      a = sums[3][i] / m_matrix->getDiv() + m_matrix->getBias();
+      a = MID(0, a, 255);
     }
     else
-      delegate.a = rgba_geta(color);
+      a = rgba_geta(color);
 
-    *(dst_address++) = rgba(delegate.r, delegate.g, delegate.b, delegate.a);
+    *(dst_address++) = rgba(r, g, b, a);
   }
 }
 
@@ -216,47 +344,47 @@ void ConvolutionMatrixFilter::applyToGrayscale(FilterManager* filterMgr)
   uint16_t* dst_address = (uint16_t*)filterMgr->getDestinationAddress();
   Target target = filterMgr->getTarget();
   uint16_t color;
-  GetPixelsDelegateGrayscale delegate;
+  int v, a, div;
   int x = filterMgr->x();
-  int x2 = x+filterMgr->getWidth();
+  int w = filterMgr->getWidth();
   int y = filterMgr->y();
 
-  for (; x<x2; ++x) {
+  std::vector<int> sums[GrayscalePlanes::count];
+  convolve_row<GrayscaleTraits, GrayscalePlanes>(src, m_matrix.get(),
+                                                 m_xFactors, m_yFactors,
+                                                 m_tiledMode, x, y, w, sums);
+  const int weight = get_matrix_weight(m_matrix.get());
+
+  for (int i=0; i<w; ++i, ++x) {
     // Avoid the non-selected region
     if (filterMgr->skipPixel()) {
       ++dst_address;
       continue;
     }
 
-    delegate.reset(m_matrix.get());
-    get_neighboring_pixels<GrayscaleTraits>(src, x, y,
-                                            m_matrix->getWidth(),
-                                            m_matrix->getHeight(),
-                                            m_matrix->getCenterX(),
-                                            m_matrix->getCenterY(),
-                                            m_tiledMode, delegate);
-
+    // Transparent pixels are not used
     color = get_pixel_fast<GrayscaleTraits>(src, x, y);
-    if (delegate.div == 0) {
+    div = m_matrix->getDiv() - (weight - sums[2][i]);
+    if (div == 0) {
       *(dst_address++) = color;
       continue;
     }
 
     if (target & TARGET_GRAY_CHANNEL) {
-      delegate.v = delegate.v / delegate.div + m_matrix->getBias();
-      delegate.v = MID(0, delegate.v, 255);
+      v = sums[0][i] / div + m_matrix->getBias();
+      v = MID(0, v, 255);
     }
     else
-      delegate.v = graya_getv(color);
+      v = graya_getv(color);
 
     if (target & TARGET_ALPHA_CHANNEL) {
-      delegate.a = delegate.a / m_matrix->getDiv() + m_matrix->getBias();
-      delegate.a = MID(0, delegate.a, 255);
+      a = sums[1][i] / m_matrix->getDiv() + m_matrix->getBias();
+      a = MID(0, a, 255);
     }
     else
-      delegate.a = graya_geta(color);
+      a = graya_geta(color);
 
-    *(dst_address++) = graya(delegate.v, delegate.a);
+    *(dst_address++) = graya(v, a);
   }
 }
 
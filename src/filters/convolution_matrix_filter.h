@@ -33,11 +33,17 @@ namespace filters {
     void applyToRgba(FilterManager* filterMgr);
     void applyToGrayscale(FilterManager* filterMgr);
     void applyToIndexed(FilterManager* filterMgr);
+    bool isThreadSafe() const { return true; }
 
   private:
     base::SharedPtr<ConvolutionMatrix> m_matrix;
     TiledMode m_tiledMode;
-    std::vector<uint8_t*> m_lines;
+
+    // Factors of the matrix when it's separable (see
+    // ConvolutionMatrix::separate()), or empty vectors if the 2D
+    // matrix must be used.
+    std::vector<int> m_xFactors;
+    std::vector<int> m_yFactors;
   };
 
 } // namespace filters
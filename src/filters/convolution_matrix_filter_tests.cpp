@@ -0,0 +1,286 @@
+// LibreSprite
+// Copyright (C) 2026  LibreSprite contributors
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "doc/image.h"
+#include "doc/image_ref.h"
+#include "doc/primitives.h"
+#include "filters/convolution_matrix.h"
+#include "filters/convolution_matrix_filter.h"
+#include "filters/filter_manager.h"
+#include "filters/neighboring_pixels.h"
+
+#include <cstdlib>
+
+using namespace doc;
+using namespace filters;
+
+namespace {
+
+// Applies a filter to all rows of an image, skipping some pixels as
+// if there were a selection.
+class TestFilterManager : public FilterManager {
+public:
+  TestFilterManager(const Image* src, Image* dst, Target target)
+    : m_src(src), m_dst(dst), m_target(target), m_y(0), m_pixel(0) {
+  }
+
+  void apply(Filter& filter) {
+    for (m_y=0; m_y<m_src->height(); ++m_y) {
+      switch (m_src->pixelFormat()) {
+        case IMAGE_RGB:       filter.applyToRgba(this); break;
+        case IMAGE_GRAYSCALE: filter.applyToGrayscale(this); break;
+      }
+    }
+  }
+
+  // FilterManager implementation
+  const void* getSourceAddress() override { return m_src->getConstPixelAddress(0, m_y); }
+  void* getDestinationAddress() override { return m_dst->getPixelAddress(0, m_y); }
+  int getWidth() override { return m_src->width(); }
+  Target getTarget() override { return m_target; }
+  FilterIndexedData* getIndexedData() override { return nullptr; }
+  bool skipPixel() override { return ((++m_pixel % 7) == 0); }
+  const Image* getSourceImage() override { return m_src; }
+  int x() override { return 0; }
+  int y() override { return m_y; }
+
+private:
+  const Image* m_src;
+  Image* m_dst;
+  Target m_target;
+  int m_y;
+  int m_pixel;
+};
+
+// Applies the matrix to each pixel adding its neighbors one by one
+// (as ConvolutionMatrixFilter did before the row/separable passes).
+struct ReferenceDelegate {
+  const int* matrixData;
+  int div;
+  int c[4];
+  bool rgba;
+
+  void operator()(uint32_t color) {
+    const int alpha = (rgba ? rgba_geta(color): graya_geta(color));
+    if (*matrixData) {
+      if (alpha == 0)
+        div -= *matrixData;
+      else if (rgba) {
+        c[0] += rgba_getr(color) * (*matrixData);
+        c[1] += rgba_getg(color) * (*matrixData);
+        c[2] += rgba_getb(color) * (*matrixData);
+        c[3] += rgba_geta(color) * (*matrixData);
+      }
+      else {
+        c[0] += graya_getv(color) * (*matrixData);
+        c[3] += graya_geta(color) * (*matrixData);
+      }
+    }
+    ++matrixData;
+  }
+};
+
+Image* apply_reference(const Image* src, const ConvolutionMatrix& matrix,
+                       Target target, TiledMode tiledMode)
+{
+  const bool isRgba = (src->pixelFormat() == IMAGE_RGB);
+  Image* dst = Image::create(src->pixelFormat(), src->width(), src->height());
+  clear_image(dst, 0);
+
+  int pixel = 0;
+  for (int y=0; y<src->height(); ++y) {
+    for (int x=0; x<src->width(); ++x) {
+      if ((++pixel % 7) == 0)
+        continue;
+
+      ReferenceDelegate d;
+      d.matrixData = &matrix.value(0, 0);
+      d.div = matrix.getDiv();
+      d.c[0] = d.c[1] = d.c[2] = d.c[3] = 0;
+      d.rgba = isRgba;
+      if (isRgba)
+        get_neighboring_pixels<RgbTraits>(src, x, y, matrix.getWidth(), matrix.getHeight(),
+                                          matrix.getCenterX(), matrix.getCenterY(),
+                                          tiledMode, d);
+      else
+        get_neighboring_pixels<GrayscaleTraits>(src, x, y, matrix.getWidth(), matrix.getHeight(),
+                                                matrix.getCenterX(), matrix.getCenterY(),
+                                                tiledMode, d);
+
+      const color_t color = get_pixel(src, x, y);
+      if (d.div == 0) {
+        put_pixel(dst, x, y, color);
+        continue;
+      }
+
+      int v[4];
+      const Target channels[] = {
+        (isRgba ? TARGET_RED_CHANNEL: TARGET_GRAY_CHANNEL),
+        TARGET_GREEN_CHANNEL, TARGET_BLUE_CHANNEL, TARGET_ALPHA_CHANNEL };
+      const int original[] = {
+        (isRgba ? rgba_getr(color): graya_getv(color)),
+        rgba_getg(color), rgba_getb(color),
+        (isRgba ? rgba_geta(color): graya_geta(color)) };
+      for (int i=0; i<4; ++i) {
+        if (target & channels[i]) {
+          v[i] = d.c[i] / (i == 3 ? matrix.getDiv(): d.div) + matrix.getBias();
+          v[i] = MID(0, v[i], 255);
+        }
+        else
+          v[i] = original[i];
+      }
+
+      put_pixel(dst, x, y, (isRgba ? rgba(v[0], v[1], v[2], v[3]):
+                                   graya(v[0], v[3])));
+    }
+  }
+  return dst;
+}
+
+Image* apply_filter(const Image* src, const base::SharedPtr<ConvolutionMatrix>& matrix,
+                    Target target, TiledMode tiledMode)
+{
+  Image* dst = Image::create(src->pixelFormat(), src->width(), src->height());
+  clear_image(dst, 0);
+
+  ConvolutionMatrixFilter filter;
+  filter.setMatrix(matrix);
+  filter.setTiledMode(tiledMode);
+
+  TestFilterManager filterMgr(src, dst, target);
+  filterMgr.apply(filter);
+  return dst;
+}
+
+Image* create_random_image(PixelFormat format, int w, int h)
+{
+  Image* image = Image::create(format, w, h);
+  for (int y=0; y<h; ++y) {
+    for (int x=0; x<w; ++x) {
+      // Some transparent pixels
+      const int a = (std::rand() % 4 == 0 ? 0: std::rand() % 256);
+      put_pixel(image, x, y,
+                (format == IMAGE_RGB ?
+                 rgba(std::rand() % 256, std::rand() % 256, std::rand() % 256, a):
+                 graya(std::rand() % 256, a)));
+    }
+  }
+  return image;
+}
+
+// Matrix with the given values multiplied by ConvolutionMatrix::Precision
+// and div = sum of values (as the "auto" div of the stock matrices).
+base::SharedPtr<ConvolutionMatrix> create_matrix(int w, int h, int cx, int cy,
+                                                 const std::vector<int>& values)
+{
+  base::SharedPtr<ConvolutionMatrix> matrix(new ConvolutionMatrix(w, h));
+  matrix->setCenterX(cx);
+  matrix->setCenterY(cy);
+
+  int div = 0;
+  for (int y=0; y<h; ++y)
+    for (int x=0; x<w; ++x)
+      div += (matrix->value(x, y) = values[y*w+x] * ConvolutionMatrix::Precision);
+
+  if (div > 0)
+    matrix->setDiv(div);
+  else {
+    matrix->setDiv(ConvolutionMatrix::Precision);
+    matrix->setBias(128);
+  }
+  return matrix;
+}
+
+// Separable matrix from the product of the given factors.
+base::SharedPtr<ConvolutionMatrix> create_separable_matrix(const std::vector<int>& factors)
+{
+  const int n = int(factors.size());
+  std::vector<int> values(n*n);
+  for (int y=0; y<n; ++y)
+    for (int x=0; x<n; ++x)
+      values[y*n+x] = factors[x] * factors[y];
+  return create_matrix(n, n, n/2, n/2, values);
+}
+
+} // anonymous namespace
+
+TEST(ConvolutionMatrix, Separate)
+{
+  std::vector<int> xf, yf;
+
+  auto blur = create_matrix(3, 3, 1, 1, { 1, 2, 1,
+                                          2, 4, 2,
+                                          1, 2, 1 });
+  ASSERT_TRUE(blur->separate(xf, yf));
+  EXPECT_EQ(std::vector<int>({ 1, 2, 1 }), xf);
+  EXPECT_EQ(std::vector<int>({ 256, 512, 256 }), yf);
+
+  auto edges = create_matrix(3, 3, 1, 1, {  0,  0,  0,
+                                            3,  6,  3,
+                                           -1, -2, -1 });
+  ASSERT_TRUE(edges->separate(xf, yf));
+  EXPECT_EQ(std::vector<int>({ 1, 2, 1 }), xf);
+  EXPECT_EQ(std::vector<int>({ 0, 768, -256 }), yf);
+
+  auto pyramid = create_matrix(3, 3, 1, 1, { 1, 2, 1,
+                                             2, 3, 2,
+                                             1, 2, 1 });
+  EXPECT_FALSE(pyramid->separate(xf, yf));
+
+  auto zero = create_matrix(2, 2, 0, 0, { 0, 0, 0, 0 });
+  EXPECT_FALSE(zero->separate(xf, yf));
+}
+
+TEST(ConvolutionMatrixFilter, MatchesReference)
+{
+  std::vector<base::SharedPtr<ConvolutionMatrix> > matrices = {
+    create_matrix(1, 1, 0, 0, { -1 }),
+    create_matrix(3, 3, 1, 1, { 1, 2, 1, 2, 4, 2, 1, 2, 1 }),
+    create_matrix(3, 3, 1, 1, { -1, -1, -1, -1, 9, -1, -1, -1, -1 }),
+    create_matrix(5, 3, 0, 1, { 2, 3, 2, 1, 0, 6, 4, 3, 2, 1, 2, 3, 2, 1, 0 }),
+    create_matrix(2, 4, 1, 3, { 1, 0, 0, 2, 3, 0, 0, 4 }),
+    create_separable_matrix({ 1, 4, 6, 4, 1 }),
+    create_separable_matrix({ 1, 2, 4, 7, 11, 16, 11, 7, 4, 2, 1 }),
+  };
+
+  const TiledMode tiledModes[] = { TiledMode::NONE, TiledMode::X_AXIS,
+                                   TiledMode::Y_AXIS, TiledMode::BOTH };
+
+  std::srand(1);
+  for (PixelFormat format : { IMAGE_RGB, IMAGE_GRAYSCALE }) {
+    // Smaller than the biggest matrix in one axis
+    ImageRef src(create_random_image(format, 37, 9));
+
+    for (Target target : { TARGET_ALL_CHANNELS,
+                           TARGET_RED_CHANNEL | TARGET_GRAY_CHANNEL | TARGET_BLUE_CHANNEL }) {
+      for (auto& matrix : matrices) {
+        for (TiledMode tiledMode : tiledModes) {
+          ImageRef a(apply_reference(src.get(), *matrix, target, tiledMode));
+          ImageRef b(apply_filter(src.get(), matrix, target, tiledMode));
+
+          EXPECT_EQ(0, count_diff_between_images(a.get(), b.get()))
+            << "format " << int(format)
+            << " target " << target
+            << " matrix " << matrix->getWidth() << "x" << matrix->getHeight()
+            << " tiled " << int(tiledMode);
+        }
+      }
+    }
+  }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,41 @@
+// LibreSprite
+// Copyright (C) 2026  LibreSprite contributors
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation.
+//
+// Compiled with AVX2 enabled, only called when the CPU supports it
+// (see get_add_weighted_func() in convolution_matrix_filter.cpp).
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <immintrin.h>
+
+#include "filters/convolution_rows_simd.h"
+
+namespace filters {
+
+namespace {
+
+  struct Avx2 {
+    typedef __m256i I;
+    enum { N = 8 };
+
+    static I load(const int* p) { return _mm256_loadu_si256((const I*)p); }
+    static void store(int* p, I v) { _mm256_storeu_si256((I*)p, v); }
+    static I set1(int v) { return _mm256_set1_epi32(v); }
+    static I add(I a, I b) { return _mm256_add_epi32(a, b); }
+    static I mullo(I a, I b) { return _mm256_mullo_epi32(a, b); }
+  };
+
+} // anonymous namespace
+
+void add_weighted_avx2(int* dst, const int* src, int k, int n)
+{
+  simd::add_weighted<Avx2>(dst, src, k, n);
+}
+
+} // namespace filters
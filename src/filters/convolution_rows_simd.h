@@ -0,0 +1,34 @@
+// LibreSprite
+// Copyright (C) 2026  LibreSprite contributors
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation.
+//
+// SIMD weighted sums of the rows of ConvolutionMatrixFilter. This
+// header is included by convolution_rows_sse2.cpp and
+// convolution_rows_avx2.cpp, which are compiled with specific
+// instruction sets and define the "V" type with the vector operations
+// (one 32-bit integer per lane).
+
+#pragma once
+
+namespace filters {
+namespace simd {
+
+  // dst[i] += k*src[i] for each i in [0, n)
+  template<typename V>
+  void add_weighted(int* dst, const int* src, int k, int n) {
+    typedef typename V::I I;
+
+    const I kV = V::set1(k);
+    int i = 0;
+    for (; i+V::N<=n; i+=V::N)
+      V::store(dst+i, V::add(V::load(dst+i), V::mullo(V::load(src+i), kV)));
+
+    for (; i<n; ++i)
+      dst[i] += k*src[i];
+  }
+
+} // namespace simd
+} // namespace filters
@@ -0,0 +1,50 @@
+// LibreSprite
+// Copyright (C) 2026  LibreSprite contributors
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation.
+//
+// Compiled with SSE2 enabled, only called when the CPU supports it
+// (see get_add_weighted_func() in convolution_matrix_filter.cpp).
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <emmintrin.h>
+
+#include "filters/convolution_rows_simd.h"
+
+namespace filters {
+
+namespace {
+
+  struct Sse2 {
+    typedef __m128i I;
+    enum { N = 4 };
+
+    static I load(const int* p) { return _mm_loadu_si128((const I*)p); }
+    static void store(int* p, I v) { _mm_storeu_si128((I*)p, v); }
+    static I set1(int v) { return _mm_set1_epi32(v); }
+    static I add(I a, I b) { return _mm_add_epi32(a, b); }
+
+    // SSE2 doesn't have _mm_mullo_epi32(), the low 32 bits of the
+    // unsigned products of the even and odd lanes are the same as the
+    // signed ones.
+    static I mullo(I a, I b) {
+      I even = _mm_mul_epu32(a, b);
+      I odd = _mm_mul_epu32(_mm_srli_si128(a, 4), _mm_srli_si128(b, 4));
+      return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                                _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+    }
+  };
+
+} // anonymous namespace
+
+void add_weighted_sse2(int* dst, const int* src, int k, int n)
+{
+  simd::add_weighted<Sse2>(dst, src, k, n);
+}
+
+} // namespace filters
@@ -36,6 +36,12 @@ namespace filters {
     // each pixel.
     virtual void applyToIndexed(FilterManager* filterMgr) = 0;
 
+    // Returns true if the applyTo*() functions can be called at the
+    // same time from several threads (each one with its own
+    // FilterManager and row), i.e. they don't modify members of the
+    // filter. In that case the rows can be processed in parallel.
+    virtual bool isThreadSafe() const { return false; }
+
   };
 
 } // namespace filters
@@ -21,80 +21,385 @@
 #include "filters/tiled_mode.h"
 
 #include <algorithm>
+#include <vector>
 
 namespace filters {
 
 using namespace doc;
 
 namespace {
-  struct GetPixelsDelegateRgba {
-    std::vector<std::vector<uint8_t> >& channel;
-    int c;
 
-    GetPixelsDelegateRgba(std::vector<std::vector<uint8_t> >& channel) : channel(channel) { }
+  // Windows with at least this number of pixels use the sliding
+  // histogram (see the MedianFilter.Benchmark test).
+  const int kHistogramMinPixels = 9;
 
-    void reset() { c = 0; }
+  // Splits a pixel in the channels used to calculate the median
+  // (each channel is a value from 0 to 255).
+  struct RgbaChannels {
+    enum { count = 4 };
 
-    void operator()(RgbTraits::pixel_t color)
+    void operator()(RgbTraits::pixel_t color, int* v) const
     {
-      channel[0][c] = rgba_getr(color);
-      channel[1][c] = rgba_getg(color);
-      channel[2][c] = rgba_getb(color);
-      channel[3][c] = rgba_geta(color);
-      c++;
+      v[0] = rgba_getr(color);
+      v[1] = rgba_getg(color);
+      v[2] = rgba_getb(color);
+      v[3] = rgba_geta(color);
     }
   };
 
-  struct GetPixelsDelegateGrayscale {
-    std::vector<std::vector<uint8_t> >& channel;
-    int c;
+  struct GrayscaleChannels {
+    enum { count = 2 };
 
-    GetPixelsDelegateGrayscale(std::vector<std::vector<uint8_t> >& channel) : channel(channel) { }
-
-    void reset() { c = 0; }
-
-    void operator()(GrayscaleTraits::pixel_t color)
+    void operator()(GrayscaleTraits::pixel_t color, int* v) const
     {
-      channel[0][c] = graya_getv(color);
-      channel[1][c] = graya_geta(color);
-      c++;
+      v[0] = graya_getv(color);
+      v[1] = graya_geta(color);
     }
   };
 
-  struct GetPixelsDelegateIndexed {
+  struct IndexedChannels {
+    enum { count = 4 };
     const Palette* pal;
-    std::vector<std::vector<uint8_t> >& channel;
-    Target target;
-    int c;
-
-    GetPixelsDelegateIndexed(const Palette* pal, std::vector<std::vector<uint8_t> >& channel, Target target)
-      : pal(pal), channel(channel), target(target) { }
+    bool index;
 
-    void reset() { c = 0; }
+    IndexedChannels(const Palette* pal, Target target)
+      : pal(pal), index((target & TARGET_INDEX_CHANNEL) ? true: false) { }
 
-    void operator()(IndexedTraits::pixel_t color)
+    void operator()(IndexedTraits::pixel_t color, int* v) const
     {
-      if (target & TARGET_INDEX_CHANNEL) {
-        channel[0][c] = color;
+      if (index) {
+        v[0] = color;
       }
       else {
         color_t rgb = pal->getEntry(color);
-        channel[0][c] = rgba_getr(rgb);
-        channel[1][c] = rgba_getg(rgb);
-        channel[2][c] = rgba_getb(rgb);
-        channel[3][c] = rgba_geta(rgb);
+        v[0] = rgba_getr(rgb);
+        v[1] = rgba_getg(rgb);
+        v[2] = rgba_getb(rgb);
+        v[3] = rgba_geta(rgb);
       }
-      c++;
     }
   };
-};
+
+  // Window of neighbors that sorts the pixels around each pixel to get
+  // the median of each channel. It's O(k·log k) per pixel (k = number
+  // of pixels in the window), so it's used for small windows only.
+  template<typename Traits, typename Channels>
+  class SortedWindow {
+  public:
+    SortedWindow(const Image* src, int y, int width, int height,
+                 TiledMode tiledMode, const Channels& channels, int channelsMask)
+      : m_src(src), m_y(y), m_width(width), m_height(height)
+      , m_tiledMode(tiledMode), m_channels(channels), m_mask(channelsMask)
+      , m_count(0)
+      , m_values(Channels::count) {
+      for (int c=0; c<Channels::count; ++c)
+        if (m_mask & (1 << c))
+          m_values[c].resize(width*height);
+    }
+
+    void moveTo(int x) {
+      m_count = 0;
+      get_neighboring_pixels<Traits>(m_src, x, m_y, m_width, m_height,
+                                     m_width/2, m_height/2, m_tiledMode, *this);
+    }
+
+    int median(int c) {
+      std::vector<uint8_t>& values = m_values[c];
+      auto it = values.begin() + values.size()/2;
+      std::nth_element(values.begin(), it, values.end());
+      return *it;
+    }
+
+    // Called by get_neighboring_pixels() for each neighbor.
+    void operator()(typename Traits::pixel_t color) {
+      int v[Channels::count];
+      m_channels(color, v);
+      for (int c=0; c<Channels::count; ++c)
+        if (m_mask & (1 << c))
+          m_values[c][m_count] = v[c];
+      ++m_count;
+    }
+
+  private:
+    const Image* m_src;
+    int m_y;
+    int m_width, m_height;
+    TiledMode m_tiledMode;
+    Channels m_channels;
+    int m_mask;
+    int m_count;
+    std::vector<std::vector<uint8_t> > m_values;
+  };
+
+  // Histogram of one channel of the pixels in the window. The median
+  // is found from the previous one, as the window moves one pixel at
+  // a time it's usually a few steps away.
+  class ChannelHistogram {
+  public:
+    void reset(int rank) {
+      std::fill(m_bins, m_bins+256, 0);
+      m_rank = rank;
+      m_median = 0;
+      m_below = 0;
+    }
+
+    void add(int v) {
+      ++m_bins[v];
+      if (v < m_median)
+        ++m_below;
+    }
+
+    void remove(int v) {
+      --m_bins[v];
+      if (v < m_median)
+        --m_below;
+    }
+
+    // Returns the value with m_rank values below it in the sorted
+    // window (the same as the sorted vector of SortedWindow).
+    int median() {
+      while (m_below > m_rank)
+        m_below -= m_bins[--m_median];
+      while (m_below + m_bins[m_median] <= m_rank)
+        m_below += m_bins[m_median++];
+      return m_median;
+    }
+
+  private:
+    int m_bins[256];
+    int m_rank;
+    int m_median;
+    int m_below;                // Number of values < m_median
+  };
+
+  // Window of neighbors that keeps a histogram of each channel and
+  // slides to the right one column at a time (Huang's algorithm), so
+  // it's O(window height) per pixel instead of O(k·log k). The median
+  // of each channel is the same as the one from SortedWindow.
+  template<typename Traits, typename Channels>
+  class HistogramWindow {
+  public:
+    HistogramWindow(const Image* src, int y, int width, int height,
+                    TiledMode tiledMode, const Channels& channels, int channelsMask)
+      : m_src(src), m_width(width)
+      , m_tiledX((int(tiledMode) & int(TiledMode::X_AXIS)) ? true: false)
+      , m_channels(channels), m_mask(channelsMask)
+      , m_rows(height), m_x(0), m_valid(false) {
+      const bool tiledY = ((int(tiledMode) & int(TiledMode::Y_AXIS)) ? true: false);
+      for (int j=0; j<height; ++j)
+        m_rows[j] = reinterpret_cast<typename Traits::const_address_t>(
+          src->getConstPixelAddress(
+            0, get_neighbor_coord(y - height/2 + j, src->height(), tiledY)));
+    }
+
+    void moveTo(int x) {
+      if (m_valid && x > m_x && x - m_x < m_width) {
+        for (; m_x<x; ++m_x) {
+          updateColumn<false>(m_x - m_width/2);
+          updateColumn<true>(m_x - m_width/2 + m_width);
+        }
+      }
+      else {
+        const int rank = m_width*int(m_rows.size())/2;
+        for (int c=0; c<Channels::count; ++c)
+          if (m_mask & (1 << c))
+            m_hist[c].reset(rank);
+
+        for (int i=0; i<m_width; ++i)
+          updateColumn<true>(x - m_width/2 + i);
+
+        m_x = x;
+        m_valid = true;
+      }
+    }
+
+    int median(int c) {
+      return m_hist[c].median();
+    }
+
+  private:
+    template<bool add>
+    void updateColumn(int u) {
+      const int x = get_neighbor_coord(u, m_src->width(), m_tiledX);
+      int v[Channels::count];
+      for (auto row : m_rows) {
+        m_channels(row[x], v);
+        for (int c=0; c<Channels::count; ++c) {
+          if (m_mask & (1 << c)) {
+            if (add)
+              m_hist[c].add(v[c]);
+            else
+              m_hist[c].remove(v[c]);
+          }
+        }
+      }
+    }
+
+    const Image* m_src;
+    int m_width;
+    bool m_tiledX;
+    Channels m_channels;
+    int m_mask;
+    std::vector<typename Traits::const_address_t> m_rows;
+    int m_x;
+    bool m_valid;
+    ChannelHistogram m_hist[Channels::count];
+  };
+
+  template<typename Window>
+  void median_rgba_row(FilterManager* filterMgr, Window& window)
+  {
+    const Image* src = filterMgr->getSourceImage();
+    uint32_t* dst_address = (uint32_t*)filterMgr->getDestinationAddress();
+    Target target = filterMgr->getTarget();
+    int color;
+    int r, g, b, a;
+    int x = filterMgr->x();
+    int x2 = x+filterMgr->getWidth();
+    int y = filterMgr->y();
+
+    for (; x<x2; ++x) {
+      // Avoid the non-selected region
+      if (filterMgr->skipPixel()) {
+        ++dst_address;
+        continue;
+      }
+
+      window.moveTo(x);
+      color = get_pixel_fast<RgbTraits>(src, x, y);
+
+      if (target & TARGET_RED_CHANNEL)
+        r = window.median(0);
+      else
+        r = rgba_getr(color);
+
+      if (target & TARGET_GREEN_CHANNEL)
+        g = window.median(1);
+      else
+        g = rgba_getg(color);
+
+      if (target & TARGET_BLUE_CHANNEL)
+        b = window.median(2);
+      else
+        b = rgba_getb(color);
+
+      if (target & TARGET_ALPHA_CHANNEL)
+        a = window.median(3);
+      else
+        a = rgba_geta(color);
+
+      *(dst_address++) = rgba(r, g, b, a);
+    }
+  }
+
+  template<typename Window>
+  void median_grayscale_row(FilterManager* filterMgr, Window& window)
+  {
+    const Image* src = filterMgr->getSourceImage();
+    uint16_t* dst_address = (uint16_t*)filterMgr->getDestinationAddress();
+    Target target = filterMgr->getTarget();
+    int color, k, a;
+    int x = filterMgr->x();
+    int x2 = x+filterMgr->getWidth();
+    int y = filterMgr->y();
+
+    for (; x<x2; ++x) {
+      // Avoid the non-selected region
+      if (filterMgr->skipPixel()) {
+        ++dst_address;
+        continue;
+      }
+
+      window.moveTo(x);
+      color = get_pixel_fast<GrayscaleTraits>(src, x, y);
+
+      if (target & TARGET_GRAY_CHANNEL)
+        k = window.median(0);
+      else
+        k = graya_getv(color);
+
+      if (target & TARGET_ALPHA_CHANNEL)
+        a = window.median(1);
+      else
+        a = graya_geta(color);
+
+      *(dst_address++) = graya(k, a);
+    }
+  }
+
+  template<typename Window>
+  void median_indexed_row(FilterManager* filterMgr, Window& window)
+  {
+    const Image* src = filterMgr->getSourceImage();
+    uint8_t* dst_address = (uint8_t*)filterMgr->getDestinationAddress();
+    const Palette* pal = filterMgr->getIndexedData()->getPalette();
+    const RgbMap* rgbmap = filterMgr->getIndexedData()->getRgbMap();
+    Target target = filterMgr->getTarget();
+    int color, r, g, b, a;
+    int x = filterMgr->x();
+    int x2 = x+filterMgr->getWidth();
+    int y = filterMgr->y();
+
+    for (; x<x2; ++x) {
+      // Avoid the non-selected region
+      if (filterMgr->skipPixel()) {
+        ++dst_address;
+        continue;
+      }
+
+      window.moveTo(x);
+
+      if (target & TARGET_INDEX_CHANNEL) {
+        *(dst_address++) = window.median(0);
+      }
+      else {
+        color = get_pixel_fast<IndexedTraits>(src, x, y);
+        color = pal->getEntry(color);
+
+        if (target & TARGET_RED_CHANNEL)
+          r = window.median(0);
+        else
+          r = rgba_getr(color);
+
+        if (target & TARGET_GREEN_CHANNEL)
+          g = window.median(1);
+        else
+          g = rgba_getg(color);
+
+        if (target & TARGET_BLUE_CHANNEL)
+          b = window.median(2);
+        else
+          b = rgba_getb(color);
+
+        if (target & TARGET_ALPHA_CHANNEL)
+          a = window.median(3);
+        else
+          a = rgba_geta(color);
+
+        *(dst_address++) = rgbmap->mapColor(r, g, b, a);
+      }
+    }
+  }
+
+  // Channels of RgbaChannels/IndexedChannels that are modified by the
+  // given target.
+  int rgba_channels_mask(Target target)
+  {
+    return
+      ((target & TARGET_RED_CHANNEL  ) ? 1: 0) |
+      ((target & TARGET_GREEN_CHANNEL) ? 2: 0) |
+      ((target & TARGET_BLUE_CHANNEL ) ? 4: 0) |
+      ((target & TARGET_ALPHA_CHANNEL) ? 8: 0);
+  }
+
+}
 
 MedianFilter::MedianFilter()
   : m_tiledMode(TiledMode::NONE)
   , m_width(0)
   , m_height(0)
   , m_ncolors(0)
-  , m_channel(4)
+  , m_algorithm(Algorithm::Auto)
 {
 }
 
@@ -108,9 +413,11 @@ void MedianFilter::setSize(int width, int height)
   m_width = width;
   m_height = height;
   m_ncolors = width*height;
+}
 
-  for (int c = 0; c < 4; ++c)
-    m_channel[c].resize(m_ncolors);
+void MedianFilter::setAlgorithm(Algorithm algorithm)
+{
+  m_algorithm = algorithm;
 }
 
 const char* MedianFilter::getName()
@@ -121,164 +428,70 @@ const char* MedianFilter::getName()
 void MedianFilter::applyToRgba(FilterManager* filterMgr)
 {
   const Image* src = filterMgr->getSourceImage();
-  uint32_t* dst_address = (uint32_t*)filterMgr->getDestinationAddress();
-  Target target = filterMgr->getTarget();
-  int color;
-  int r, g, b, a;
-  GetPixelsDelegateRgba delegate(m_channel);
-  int x = filterMgr->x();
-  int x2 = x+filterMgr->getWidth();
-  int y = filterMgr->y();
-
-  for (; x<x2; ++x) {
-    // Avoid the non-selected region
-    if (filterMgr->skipPixel()) {
-      ++dst_address;
-      continue;
-    }
-
-    delegate.reset();
-    get_neighboring_pixels<RgbTraits>(src, x, y, m_width, m_height, m_width/2, m_height/2,
-                                      m_tiledMode, delegate);
-
-    color = get_pixel_fast<RgbTraits>(src, x, y);
-
-    if (target & TARGET_RED_CHANNEL) {
-      std::sort(m_channel[0].begin(), m_channel[0].end());
-      r = m_channel[0][m_ncolors/2];
-    }
-    else
-      r = rgba_getr(color);
-
-    if (target & TARGET_GREEN_CHANNEL) {
-      std::sort(m_channel[1].begin(), m_channel[1].end());
-      g = m_channel[1][m_ncolors/2];
-    }
-    else
-      g = rgba_getg(color);
-
-    if (target & TARGET_BLUE_CHANNEL) {
-      std::sort(m_channel[2].begin(), m_channel[2].end());
-      b = m_channel[2][m_ncolors/2];
-    }
-    else
-      b = rgba_getb(color);
-
-    if (target & TARGET_ALPHA_CHANNEL) {
-      std::sort(m_channel[3].begin(), m_channel[3].end());
-      a = m_channel[3][m_ncolors/2];
-    }
-    else
-      a = rgba_geta(color);
-
-    *(dst_address++) = rgba(r, g, b, a);
+  const int y = filterMgr->y();
+  const int mask = rgba_channels_mask(filterMgr->getTarget());
+  RgbaChannels channels;
+
+  if (useHistogram()) {
+    HistogramWindow<RgbTraits, RgbaChannels> window(
+      src, y, m_width, m_height, m_tiledMode, channels, mask);
+    median_rgba_row(filterMgr, window);
+  }
+  else {
+    SortedWindow<RgbTraits, RgbaChannels> window(
+      src, y, m_width, m_height, m_tiledMode, channels, mask);
+    median_rgba_row(filterMgr, window);
   }
 }
 
 void MedianFilter::applyToGrayscale(FilterManager* filterMgr)
 {
   const Image* src = filterMgr->getSourceImage();
-  uint16_t* dst_address = (uint16_t*)filterMgr->getDestinationAddress();
-  Target target = filterMgr->getTarget();
-  int color, k, a;
-  GetPixelsDelegateGrayscale delegate(m_channel);
-  int x = filterMgr->x();
-  int x2 = x+filterMgr->getWidth();
-  int y = filterMgr->y();
-
-  for (; x<x2; ++x) {
-    // Avoid the non-selected region
-    if (filterMgr->skipPixel()) {
-      ++dst_address;
-      continue;
-    }
-
-    delegate.reset();
-    get_neighboring_pixels<GrayscaleTraits>(src, x, y, m_width, m_height, m_width/2, m_height/2,
-                                            m_tiledMode, delegate);
-
-    color = get_pixel_fast<GrayscaleTraits>(src, x, y);
-
-    if (target & TARGET_GRAY_CHANNEL) {
-      std::sort(m_channel[0].begin(), m_channel[0].end());
-      k = m_channel[0][m_ncolors/2];
-    }
-    else
-      k = graya_getv(color);
-
-    if (target & TARGET_ALPHA_CHANNEL) {
-      std::sort(m_channel[1].begin(), m_channel[1].end());
-      a = m_channel[1][m_ncolors/2];
-    }
-    else
-      a = graya_geta(color);
-
-    *(dst_address++) = graya(k, a);
+  const int y = filterMgr->y();
+  const Target target = filterMgr->getTarget();
+  const int mask =
+    ((target & TARGET_GRAY_CHANNEL ) ? 1: 0) |
+    ((target & TARGET_ALPHA_CHANNEL) ? 2: 0);
+  GrayscaleChannels channels;
+
+  if (useHistogram()) {
+    HistogramWindow<GrayscaleTraits, GrayscaleChannels> window(
+      src, y, m_width, m_height, m_tiledMode, channels, mask);
+    median_grayscale_row(filterMgr, window);
+  }
+  else {
+    SortedWindow<GrayscaleTraits, GrayscaleChannels> window(
+      src, y, m_width, m_height, m_tiledMode, channels, mask);
+    median_grayscale_row(filterMgr, window);
   }
 }
 
 void MedianFilter::applyToIndexed(FilterManager* filterMgr)
 {
   const Image* src = filterMgr->getSourceImage();
-  uint8_t* dst_address = (uint8_t*)filterMgr->getDestinationAddress();
-  const Palette* pal = filterMgr->getIndexedData()->getPalette();
-  const RgbMap* rgbmap = filterMgr->getIndexedData()->getRgbMap();
-  Target target = filterMgr->getTarget();
-  int color, r, g, b, a;
-  GetPixelsDelegateIndexed delegate(pal, m_channel, target);
-  int x = filterMgr->x();
-  int x2 = x+filterMgr->getWidth();
-  int y = filterMgr->y();
-
-  for (; x<x2; ++x) {
-    // Avoid the non-selected region
-    if (filterMgr->skipPixel()) {
-      ++dst_address;
-      continue;
-    }
-
-    delegate.reset();
-    get_neighboring_pixels<IndexedTraits>(src, x, y, m_width, m_height, m_width/2, m_height/2,
-                                          m_tiledMode, delegate);
-
-    if (target & TARGET_INDEX_CHANNEL) {
-      std::sort(m_channel[0].begin(), m_channel[0].end());
-      *(dst_address++) = m_channel[0][m_ncolors/2];
-    }
-    else {
-      color = get_pixel_fast<IndexedTraits>(src, x, y);
-      color = pal->getEntry(color);
-
-      if (target & TARGET_RED_CHANNEL) {
-        std::sort(m_channel[0].begin(), m_channel[0].end());
-        r = m_channel[0][m_ncolors/2];
-      }
-      else
-        r = rgba_getr(color);
-
-      if (target & TARGET_GREEN_CHANNEL) {
-        std::sort(m_channel[1].begin(), m_channel[1].end());
-        g = m_channel[1][m_ncolors/2];
-      }
-      else
-        g = rgba_getg(pal->getEntry(color));
-
-      if (target & TARGET_BLUE_CHANNEL) {
-        std::sort(m_channel[2].begin(), m_channel[2].end());
-        b = m_channel[2][m_ncolors/2];
-      }
-      else
-        b = rgba_getb(color);
-
-      if (target & TARGET_ALPHA_CHANNEL) {
-        std::sort(m_channel[3].begin(), m_channel[3].end());
-        a = m_channel[3][m_ncolors/2];
-      }
-      else
-        a = rgba_geta(color);
+  const int y = filterMgr->y();
+  const Target target = filterMgr->getTarget();
+  const int mask = ((target & TARGET_INDEX_CHANNEL) ? 1: rgba_channels_mask(target));
+  IndexedChannels channels(filterMgr->getIndexedData()->getPalette(), target);
+
+  if (useHistogram()) {
+    HistogramWindow<IndexedTraits, IndexedChannels> window(
+      src, y, m_width, m_height, m_tiledMode, channels, mask);
+    median_indexed_row(filterMgr, window);
+  }
+  else {
+    SortedWindow<IndexedTraits, IndexedChannels> window(
+      src, y, m_width, m_height, m_tiledMode, channels, mask);
+    median_indexed_row(filterMgr, window);
+  }
+}
 
-      *(dst_address++) = rgbmap->mapColor(r, g, b, a);
-    }
+bool MedianFilter::useHistogram() const
+{
+  switch (m_algorithm) {
+    case Algorithm::Sort:      return false;
+    case Algorithm::Histogram: return true;
+    default:                   return (m_ncolors >= kHistogramMinPixels);
   }
 }
 
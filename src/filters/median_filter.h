@@ -17,27 +17,40 @@ namespace filters {
 
   class MedianFilter : public Filter {
   public:
+    // How the median of each pixel is calculated. Both algorithms give
+    // the same result, Auto uses the fastest one for the window size.
+    enum class Algorithm {
+      Auto,
+      Sort,                     // Sort the neighbors of each pixel
+      Histogram,                // Sliding histogram of the neighbors
+    };
+
     MedianFilter();
 
     void setTiledMode(TiledMode tiled);
     void setSize(int width, int height);
+    void setAlgorithm(Algorithm algorithm);
 
     TiledMode getTiledMode() const { return m_tiledMode; }
     int getWidth() const { return m_width; }
     int getHeight() const { return m_height; }
+    Algorithm getAlgorithm() const { return m_algorithm; }
 
     // Filter implementation
     const char* getName();
     void applyToRgba(FilterManager* filterMgr);
     void applyToGrayscale(FilterManager* filterMgr);
     void applyToIndexed(FilterManager* filterMgr);
+    bool isThreadSafe() const { return true; }
 
   private:
+    bool useHistogram() const;
+
     TiledMode m_tiledMode;
     int m_width;
     int m_height;
     int m_ncolors;
-    std::vector<std::vector<uint8_t> > m_channel;
+    Algorithm m_algorithm;
   };
 
 } // namespace filters
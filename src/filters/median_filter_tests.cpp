@@ -0,0 +1,193 @@
+// LibreSprite
+// Copyright (C) 2026  LibreSprite contributors
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "doc/image.h"
+#include "doc/image_ref.h"
+#include "doc/palette.h"
+#include "doc/primitives.h"
+#include "doc/rgbmap.h"
+#include "filters/filter_indexed_data.h"
+#include "filters/filter_manager.h"
+#include "filters/median_filter.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace doc;
+using namespace filters;
+
+namespace {
+
+// Applies a filter to all rows of an image, skipping some pixels as
+// if there were a selection.
+class TestFilterManager : public FilterManager
+                        , public FilterIndexedData {
+public:
+  TestFilterManager(const Image* src, Image* dst, Target target,
+                    Palette* palette, RgbMap* rgbmap)
+    : m_src(src), m_dst(dst), m_target(target)
+    , m_palette(palette), m_rgbmap(rgbmap)
+    , m_y(0), m_pixel(0) {
+  }
+
+  void apply(Filter& filter) {
+    for (m_y=0; m_y<m_src->height(); ++m_y) {
+      switch (m_src->pixelFormat()) {
+        case IMAGE_RGB:       filter.applyToRgba(this); break;
+        case IMAGE_GRAYSCALE: filter.applyToGrayscale(this); break;
+        case IMAGE_INDEXED:   filter.applyToIndexed(this); break;
+      }
+    }
+  }
+
+  // FilterManager implementation
+  const void* getSourceAddress() override { return m_src->getConstPixelAddress(0, m_y); }
+  void* getDestinationAddress() override { return m_dst->getPixelAddress(0, m_y); }
+  int getWidth() override { return m_src->width(); }
+  Target getTarget() override { return m_target; }
+  FilterIndexedData* getIndexedData() override { return this; }
+  bool skipPixel() override { return ((++m_pixel % 7) == 0); }
+  const Image* getSourceImage() override { return m_src; }
+  int x() override { return 0; }
+  int y() override { return m_y; }
+
+  // FilterIndexedData implementation
+  Palette* getPalette() override { return m_palette; }
+  RgbMap* getRgbMap() override { return m_rgbmap; }
+
+private:
+  const Image* m_src;
+  Image* m_dst;
+  Target m_target;
+  Palette* m_palette;
+  RgbMap* m_rgbmap;
+  int m_y;
+  int m_pixel;
+};
+
+// Random image with few different values in each channel, so there
+// are a lot of repeated values in each window.
+Image* create_random_image(PixelFormat format, int w, int h)
+{
+  Image* image = Image::create(format, w, h);
+  for (int y=0; y<h; ++y) {
+    for (int x=0; x<w; ++x) {
+      color_t c;
+      switch (format) {
+        case IMAGE_RGB:
+          c = rgba(std::rand() % 8 * 32, std::rand() % 256,
+                   std::rand() % 4 * 64, std::rand() % 2 * 255);
+          break;
+        case IMAGE_GRAYSCALE:
+          c = graya(std::rand() % 256, std::rand() % 3 * 127);
+          break;
+        default:
+          c = std::rand() % 16;
+          break;
+      }
+      put_pixel(image, x, y, c);
+    }
+  }
+  return image;
+}
+
+Image* apply_median(const Image* src, Target target,
+                    int w, int h, TiledMode tiledMode,
+                    MedianFilter::Algorithm algorithm,
+                    Palette* palette, RgbMap* rgbmap)
+{
+  Image* dst = Image::create(src->pixelFormat(), src->width(), src->height());
+  clear_image(dst, 0);
+
+  MedianFilter filter;
+  filter.setSize(w, h);
+  filter.setTiledMode(tiledMode);
+  filter.setAlgorithm(algorithm);
+
+  TestFilterManager filterMgr(src, dst, target, palette, rgbmap);
+  filterMgr.apply(filter);
+  return dst;
+}
+
+} // anonymous namespace
+
+TEST(MedianFilter, HistogramMatchesSort)
+{
+  Palette palette(frame_t(0), 16);
+  for (int i=0; i<16; ++i)
+    palette.setEntry(i, rgba(i*16, 255-i*16, i*i, i < 8 ? 255: 128));
+  RgbMap rgbmap;
+  rgbmap.regenerate(&palette, -1);
+
+  const int sizes[][2] = { { 1, 1 }, { 3, 3 }, { 2, 4 }, { 7, 5 },
+                           { 15, 15 }, { 40, 3 }, { 3, 30 } };
+  const TiledMode tiledModes[] = { TiledMode::NONE, TiledMode::X_AXIS,
+                                   TiledMode::Y_AXIS, TiledMode::BOTH };
+
+  std::srand(1);
+  for (PixelFormat format : { IMAGE_RGB, IMAGE_GRAYSCALE, IMAGE_INDEXED }) {
+    ImageRef src(create_random_image(format, 31, 23));
+
+    for (Target target : { TARGET_ALL_CHANNELS,
+                           TARGET_RED_CHANNEL | TARGET_GRAY_CHANNEL,
+                           TARGET_INDEX_CHANNEL }) {
+      if (target == TARGET_INDEX_CHANNEL && format != IMAGE_INDEXED)
+        continue;
+
+      for (auto& size : sizes) {
+        for (TiledMode tiledMode : tiledModes) {
+          ImageRef a(apply_median(src.get(), target, size[0], size[1], tiledMode,
+                                  MedianFilter::Algorithm::Sort, &palette, &rgbmap));
+          ImageRef b(apply_median(src.get(), target, size[0], size[1], tiledMode,
+                                  MedianFilter::Algorithm::Histogram, &palette, &rgbmap));
+
+          EXPECT_EQ(0, count_diff_between_images(a.get(), b.get()))
+            << "format " << int(format)
+            << " target " << target
+            << " size " << size[0] << "x" << size[1]
+            << " tiled " << int(tiledMode);
+        }
+      }
+    }
+  }
+}
+
+// Compares the time of both median algorithms with several window
+// sizes. It's disabled, run it with --gtest_also_run_disabled_tests.
+TEST(MedianFilter, DISABLED_Benchmark)
+{
+  std::srand(2);
+  ImageRef src(create_random_image(IMAGE_RGB, 256, 256));
+
+  for (int size : { 3, 5, 7, 15, 31 }) {
+    double secs[2];
+    int i = 0;
+    for (auto algorithm : { MedianFilter::Algorithm::Sort,
+                            MedianFilter::Algorithm::Histogram }) {
+      auto t0 = std::chrono::steady_clock::now();
+      ImageRef dst(apply_median(src.get(), TARGET_ALL_CHANNELS, size, size,
+                                TiledMode::NONE, algorithm, nullptr, nullptr));
+      auto t1 = std::chrono::steady_clock::now();
+      secs[i++] = std::chrono::duration<double>(t1 - t0).count();
+    }
+    std::printf("%dx%d window: sort %.3f s, histogram %.3f s\n",
+                size, size, secs[0], secs[1]);
+  }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
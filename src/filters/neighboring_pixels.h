@@ -16,6 +16,19 @@
 namespace filters {
   using namespace doc;
 
+  // Returns the coordinate (x or y) of a neighbor in an image of the
+  // given size, clamped or tiled as get_neighboring_pixels() does
+  // when the neighbor is outside the image.
+  inline int get_neighbor_coord(int u, int size, bool tiled)
+  {
+    if (tiled) {
+      u %= size;
+      return (u < 0 ? u+size: u);
+    }
+    else
+      return (u < 0 ? 0: (u >= size ? size-1: u));
+  }
+
   // Calls the specified "delegate" for all neighboring pixels in a 2D
   // (width*height) matrix located in (x,y) where its center is the
   // (centerX,centerY) element of the matrix.
@@ -64,24 +77,23 @@ namespace filters {
       }
 
       typename Traits::const_address_t srcAddress =
-        reinterpret_cast<typename Traits::const_address_t>(sourceImage->getPixelAddress(getx, gety));
+        reinterpret_cast<typename Traits::const_address_t>(sourceImage->getConstPixelAddress(getx, gety));
 
       for (int dx=0; dx<width; dx++) {
         // Call the delegate for each pixel value.
         delegate(*srcAddress);
 
         // Update X position to get pixel.
-        if (getx < sourceImage->width()-1) {
+        if (addx > 0)
+          --addx;
+        else if (getx < sourceImage->width()-1) {
           ++getx;
-          if (addx == 0)
-            ++srcAddress;
-          else
-            --addx;
+          ++srcAddress;
         }
         else if (int(tiledMode) & int(TiledMode::X_AXIS)) {
           getx = 0;
           srcAddress =
-            reinterpret_cast<typename Traits::const_address_t>(sourceImage->getPixelAddress(getx, gety));
+            reinterpret_cast<typename Traits::const_address_t>(sourceImage->getConstPixelAddress(getx, gety));
         }
       }
 
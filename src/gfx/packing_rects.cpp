@@ -10,19 +10,112 @@
 
 #include "gfx/packing_rects.h"
 
-#include "gfx/region.h"
+#include "gfx/point.h"
 #include "gfx/size.h"
 
+#include <algorithm>
+#include <numeric>
+
 namespace gfx {
 
+namespace {
+
+// Free space of the texture as a list of maximal free rectangles
+// (MaxRects algorithm). They can overlap each other. A rectangle can
+// be placed in the free space only if it's inside one of them, so
+// their top-left corners are the only positions to check to find
+// the top-most/left-most place for a rectangle.
+class FreeRects {
+public:
+  explicit FreeRects(const Size& size) {
+    if (size.w > 0 && size.h > 0)
+      m_rects.push_back(Rect(size));
+  }
+
+  // Finds the top-most (and then left-most) position where a
+  // rectangle of the given size fits.
+  bool find(const Size& sz, Point& pt) const {
+    bool found = false;
+    for (const Rect& rc : m_rects) {
+      if (rc.w >= sz.w && rc.h >= sz.h &&
+          (!found || rc.y < pt.y || (rc.y == pt.y && rc.x < pt.x))) {
+        pt = rc.origin();
+        found = true;
+      }
+    }
+    return found;
+  }
+
+  // Removes the "used" area from the free space.
+  void place(const Rect& used) {
+    std::vector<Rect> splits;
+    for (std::size_t i=0; i<m_rects.size(); ) {
+      const Rect rc = m_rects[i];
+      if (!rc.intersects(used)) {
+        ++i;
+        continue;
+      }
+
+      // Maximal free rectangles of "rc" around "used"
+      if (used.x > rc.x)
+        splits.push_back(Rect(rc.x, rc.y, used.x-rc.x, rc.h));
+      if (used.x2() < rc.x2())
+        splits.push_back(Rect(used.x2(), rc.y, rc.x2()-used.x2(), rc.h));
+      if (used.y > rc.y)
+        splits.push_back(Rect(rc.x, rc.y, rc.w, used.y-rc.y));
+      if (used.y2() < rc.y2())
+        splits.push_back(Rect(rc.x, used.y2(), rc.w, rc.y2()-used.y2()));
+
+      m_rects[i] = m_rects.back();
+      m_rects.pop_back();
+    }
+
+    // Keep only the new rectangles that are not contained by other
+    // ones. (A previous free rectangle cannot be inside a new one,
+    // because it was maximal.)
+    const std::size_t oldCount = m_rects.size();
+    for (std::size_t i=0; i<splits.size(); ++i) {
+      const Rect& rc = splits[i];
+      bool contained = false;
+
+      for (std::size_t j=0; j<splits.size() && !contained; ++j) {
+        if (j != i && splits[j].contains(rc) &&
+            (splits[j] != rc || j < i))
+          contained = true;
+      }
+      for (std::size_t j=0; j<oldCount && !contained; ++j) {
+        if (m_rects[j].contains(rc))
+          contained = true;
+      }
+
+      if (!contained)
+        m_rects.push_back(rc);
+    }
+  }
+
+private:
+  std::vector<Rect> m_rects;
+};
+
+} // anonymous namespace
+
+PackingRects::PackingRects(int padding, bool rotation)
+  : m_padding(std::max(0, padding))
+  , m_rotation(rotation)
+{
+}
+
 void PackingRects::add(const Size& sz)
 {
-  m_rects.push_back(Rect(sz));
+  add(Rect(sz));
 }
 
 void PackingRects::add(const Rect& rc)
 {
   m_rects.push_back(rc);
+  m_sizes.push_back(rc.size());
+  m_rotated.push_back(false);
+  m_packed.push_back(false);
 }
 
 Size PackingRects::bestFit()
@@ -32,8 +125,8 @@ Size PackingRects::bestFit()
   // Calculate the amount of pixels that we need, the texture cannot
   // be smaller than that.
   int neededArea = 0;
-  for (const auto& rc : m_rects) {
-    neededArea += rc.w * rc.h;
+  for (const auto& sz : m_sizes) {
+    neededArea += (sz.w+m_padding) * (sz.h+m_padding);
   }
 
   int w = 1;
@@ -41,7 +134,7 @@ Size PackingRects::bestFit()
   int z = 0;
   bool fit = false;
   while (true) {
-    if (w*h >= neededArea) {
+    if ((w+m_padding)*(h+m_padding) >= neededArea) {
       fit = pack(Size(w, h));
       if (fit) {
         size = Size(w, h);
@@ -58,41 +151,77 @@ Size PackingRects::bestFit()
   return size;
 }
 
-static bool by_area(const Rect* a, const Rect* b) {
-  return a->w*a->h > b->w*b->h;
+bool PackingRects::pack(const Size& size)
+{
+  return (doPack(size, false) == int(m_rects.size()));
 }
 
-bool PackingRects::pack(const Size& size)
+int PackingRects::packPartially(const Size& size)
+{
+  return doPack(size, true);
+}
+
+int PackingRects::doPack(const Size& size, bool partially)
 {
   m_bounds = Rect(size);
+  m_packed.assign(m_rects.size(), false);
+
+  // Bigger rectangles are placed first. We cannot sort m_rects
+  // because we want to keep the order given in add() calls.
+  std::vector<int> order(m_sizes.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(
+    order.begin(), order.end(),
+    [this](int a, int b){
+      return m_sizes[a].w*m_sizes[a].h > m_sizes[b].w*m_sizes[b].h;
+    });
+
+  // The padding is added to the right/bottom sides of each rectangle
+  // and of the texture, so rectangles can touch the texture borders.
+  const int p = m_padding;
+  FreeRects freeRects(Size(size.w+p, size.h+p));
+  int packed = 0;
+
+  for (int i : order) {
+    const Size& sz = m_sizes[i];
+    m_rotated[i] = false;
+
+    if (sz.w <= 0 || sz.h <= 0) {
+      m_rects[i] = Rect(Point(0, 0), sz);
+      m_packed[i] = true;
+      ++packed;
+      continue;
+    }
 
-  // We cannot sort m_rects because we want to 
-  std::vector<Rect*> rectPtrs(m_rects.size());
-  int i = 0;
-  for (auto& rc : m_rects)
-    rectPtrs[i++] = &rc;
-  std::sort(rectPtrs.begin(), rectPtrs.end(), by_area);
-
-  gfx::Region rgn(m_bounds);
-  for (auto rcPtr : rectPtrs) {
-    gfx::Rect& rc = *rcPtr;
-
-    for (int v=0; v<=m_bounds.h-rc.h; ++v) {
-      for (int u=0; u<=m_bounds.w-rc.w; ++u) {
-        gfx::Rect possible(u, v, rc.w, rc.h);
-        Region::Overlap overlap = rgn.contains(possible);
-        if (overlap == Region::In) {
-          rc = possible;
-          rgn.createSubtraction(rgn, gfx::Region(rc));
-          goto next_rc;
-        }
-      }
+    Point pt, rotatedPt;
+    bool found = freeRects.find(Size(sz.w+p, sz.h+p), pt);
+    bool rotated = false;
+
+    if (m_rotation && sz.w != sz.h &&
+        freeRects.find(Size(sz.h+p, sz.w+p), rotatedPt) &&
+        (!found ||
+         rotatedPt.y < pt.y ||
+         (rotatedPt.y == pt.y && rotatedPt.x < pt.x))) {
+      pt = rotatedPt;
+      found = rotated = true;
+    }
+
+    if (!found) {
+      // There is not enough room for this rectangle
+      if (partially)
+        continue;
+      break;
     }
-    return false; // There is not enough room for "rc"
-  next_rc:;
+
+    const Size used = (rotated ? Size(sz.h, sz.w): sz);
+    m_rects[i] = Rect(pt, used);
+    m_rotated[i] = rotated;
+    m_packed[i] = true;
+    ++packed;
+    freeRects.place(Rect(pt, Size(used.w+p, used.h+p)));
   }
 
-  return true;
+  return packed;
 }
 
 } // namespace gfx
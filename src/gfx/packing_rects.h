@@ -8,16 +8,21 @@
 
 #include "gfx/fwd.h"
 #include "gfx/rect.h"
+#include "gfx/size.h"
 #include <vector>
 
 namespace gfx {
 
-  // TODO add support for rotations
   class PackingRects {
   public:
     typedef std::vector<Rect> Rects;
     typedef Rects::const_iterator const_iterator;
 
+    // "padding" is the space between rectangles (not between
+    // rectangles and the texture borders). If "rotation" is true,
+    // rectangles can be rotated 90 degrees to fit better.
+    PackingRects(int padding = 0, bool rotation = false);
+
     // Iterate over all given rectangles (in the same order they where
     // given in addSize() calls).
     const_iterator begin() const { return m_rects.begin(); }
@@ -26,6 +31,14 @@ namespace gfx {
     std::size_t size() const { return m_rects.size(); }
     const Rect& operator[](int i) const { return m_rects[i]; }
 
+    // True if the rectangle "i" was rotated, then its width and
+    // height are swapped in the texture.
+    bool isRotated(int i) const { return m_rotated[i]; }
+
+    // False if the rectangle "i" didn't fit in the last pack() or
+    // packPartially() call.
+    bool isPacked(int i) const { return m_packed[i]; }
+
     // Adds a new rectangle.
     void add(const Size& sz);
     void add(const Rect& rc);
@@ -38,12 +51,24 @@ namespace gfx {
     // if there is not enough space.
     bool pack(const Size& size);
 
+    // Like pack(), but the rectangles that don't fit are skipped (see
+    // isPacked()), so they can be packed in another texture. Returns
+    // the number of packed rectangles.
+    int packPartially(const Size& size);
+
     // Returns the bounds of the packed area.
     const Rect& bounds() const { return m_bounds; }
 
   private:
+    int doPack(const Size& size, bool partially);
+
+    int m_padding;
+    bool m_rotation;
     Rect m_bounds;
     Rects m_rects;
+    std::vector<Size> m_sizes;
+    std::vector<bool> m_rotated;
+    std::vector<bool> m_packed;
   };
 
 } // namespace gfx
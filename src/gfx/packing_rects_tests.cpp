@@ -14,8 +14,73 @@
 #include "gfx/rect_io.h"
 #include "gfx/size.h"
 
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
 using namespace gfx;
 
+namespace {
+
+// Places each rectangle (from the biggest to the smallest) in the
+// first free pixel position (top-to-bottom, left-to-right), as the
+// first implementation of PackingRects did.
+bool pack_pixel_by_pixel(const std::vector<Size>& sizes, const Size& size,
+                         std::vector<Rect>& rects)
+{
+  std::vector<int> order(sizes.size());
+  for (int i=0; i<int(order.size()); ++i)
+    order[i] = i;
+  std::stable_sort(order.begin(), order.end(), [&](int a, int b){
+      return sizes[a].w*sizes[a].h > sizes[b].w*sizes[b].h;
+    });
+
+  std::vector<bool> used(size.w*size.h, false);
+  rects.resize(sizes.size());
+  for (int i : order) {
+    const Size& sz = sizes[i];
+    bool found = false;
+    for (int v=0; v<=size.h-sz.h && !found; ++v) {
+      for (int u=0; u<=size.w-sz.w && !found; ++u) {
+        bool free = true;
+        for (int y=v; y<v+sz.h && free; ++y)
+          for (int x=u; x<u+sz.w && free; ++x)
+            free = !used[y*size.w+x];
+        if (free) {
+          rects[i] = Rect(u, v, sz.w, sz.h);
+          found = true;
+        }
+      }
+    }
+    if (!found)
+      return false;
+    for (int y=rects[i].y; y<rects[i].y2(); ++y)
+      for (int x=rects[i].x; x<rects[i].x2(); ++x)
+        used[y*size.w+x] = true;
+  }
+  return true;
+}
+
+void expect_no_overlaps(const PackingRects& pr, int padding)
+{
+  for (int i=0; i<int(pr.size()); ++i) {
+    if (!pr.isPacked(i))
+      continue;
+    EXPECT_TRUE(pr.bounds().contains(pr[i])) << pr[i];
+    Rect a = pr[i];
+    a.w += padding;
+    a.h += padding;
+    for (int j=i+1; j<int(pr.size()); ++j) {
+      if (pr.isPacked(j)) {
+        EXPECT_FALSE(a.intersects(pr[j])) << pr[i] << " " << pr[j];
+      }
+    }
+  }
+}
+
+} // anonymous namespace
+
 TEST(PackingRects, Simple)
 {
   PackingRects pr;
@@ -93,6 +158,127 @@ TEST(PackingRects, KeepSameRectsOrder)
   EXPECT_EQ(Rect(0, 0, 30, 30), pr[2]);
 }
 
+TEST(PackingRects, SameAsPixelByPixel)
+{
+  std::srand(1);
+  for (int t=0; t<100; ++t) {
+    PackingRects pr;
+    std::vector<Size> sizes;
+    int n = 1 + std::rand() % 12;
+    for (int i=0; i<n; ++i) {
+      sizes.push_back(Size(1 + std::rand() % 12, 1 + std::rand() % 12));
+      pr.add(sizes.back());
+    }
+
+    Size size(16 + std::rand() % 24, 16 + std::rand() % 24);
+    std::vector<Rect> expected;
+    bool fit = pack_pixel_by_pixel(sizes, size, expected);
+    ASSERT_EQ(fit, pr.pack(size));
+    if (fit) {
+      for (int i=0; i<n; ++i)
+        EXPECT_EQ(expected[i], pr[i]);
+    }
+  }
+}
+
+TEST(PackingRects, Padding)
+{
+  PackingRects pr(2);
+  pr.add(Size(10, 10));
+  pr.add(Size(10, 10));
+  pr.add(Size(10, 10));
+  EXPECT_FALSE(pr.pack(Size(31, 10)));
+  EXPECT_TRUE(pr.pack(Size(34, 10)));
+  EXPECT_EQ(Rect(0, 0, 10, 10), pr[0]);
+  EXPECT_EQ(Rect(12, 0, 10, 10), pr[1]);
+  EXPECT_EQ(Rect(24, 0, 10, 10), pr[2]);
+}
+
+TEST(PackingRects, Rotation)
+{
+  PackingRects pr(0, true);
+  pr.add(Size(20, 10));
+  pr.add(Size(10, 20));
+  EXPECT_TRUE(pr.pack(Size(10, 40)));
+  EXPECT_TRUE(pr.isRotated(0));
+  EXPECT_FALSE(pr.isRotated(1));
+  EXPECT_EQ(Rect(0, 0, 10, 20), pr[0]);
+  EXPECT_EQ(Rect(0, 20, 10, 20), pr[1]);
+
+  PackingRects noRotation;
+  noRotation.add(Size(20, 10));
+  EXPECT_FALSE(noRotation.pack(Size(10, 40)));
+}
+
+TEST(PackingRects, PackPartially)
+{
+  PackingRects pr;
+  pr.add(Size(10, 10));
+  pr.add(Size(30, 30));
+  pr.add(Size(20, 20));
+  pr.add(Size(10, 5));
+  EXPECT_FALSE(pr.pack(Size(40, 40)));
+  EXPECT_EQ(3, pr.packPartially(Size(40, 40)));
+  EXPECT_TRUE(pr.isPacked(0));
+  EXPECT_TRUE(pr.isPacked(1));
+  EXPECT_FALSE(pr.isPacked(2));
+  EXPECT_TRUE(pr.isPacked(3));
+  EXPECT_EQ(Rect(0, 0, 30, 30), pr[1]);
+  expect_no_overlaps(pr, 0);
+}
+
+TEST(PackingRects, ManyRects)
+{
+  std::srand(2);
+  for (int n : { 100, 1000 }) {
+    for (int padding : { 0, 2 }) {
+      PackingRects pr(padding, padding > 0);
+      for (int i=0; i<n; ++i)
+        pr.add(Size(4 + std::rand() % 60, 4 + std::rand() % 60));
+
+      pr.bestFit();
+      expect_no_overlaps(pr, padding);
+    }
+  }
+}
+
+// Compares the time to pack random rectangles with MaxRects and with
+// the old pixel by pixel search (only up to 1000 rectangles, it takes
+// too long with more). It's disabled, run it with
+// --gtest_also_run_disabled_tests.
+TEST(PackingRects, DISABLED_Benchmark)
+{
+  std::srand(2);
+  for (int n : { 100, 1000, 5000 }) {
+    PackingRects pr;
+    std::vector<Size> sizes;
+    for (int i=0; i<n; ++i) {
+      sizes.push_back(Size(4 + std::rand() % 60, 4 + std::rand() % 60));
+      pr.add(sizes.back());
+    }
+
+    auto t0 = std::chrono::steady_clock::now();
+    Size size = pr.bestFit();
+    auto t1 = std::chrono::steady_clock::now();
+    EXPECT_TRUE(pr.pack(size));
+    auto t2 = std::chrono::steady_clock::now();
+    std::printf("%d rects in %dx%d: bestFit() %.3f s, pack() %.3f s\n",
+                n, size.w, size.h,
+                std::chrono::duration<double>(t1 - t0).count(),
+                std::chrono::duration<double>(t2 - t1).count());
+
+    if (n <= 1000) {
+      std::vector<Rect> rects;
+      t0 = std::chrono::steady_clock::now();
+      EXPECT_TRUE(pack_pixel_by_pixel(sizes, size, rects));
+      t1 = std::chrono::steady_clock::now();
+      std::printf("%d rects in %dx%d: pixel by pixel %.3f s\n",
+                  n, size.w, size.h,
+                  std::chrono::duration<double>(t1 - t0).count());
+    }
+  }
+}
+
 int main(int argc, char** argv)
 {
   ::testing::InitGoogleTest(&argc, argv);
@@ -0,0 +1,51 @@
+// LibreSprite Render Library
+// Copyright (c) 2026 LibreSprite contributors
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "render/layers_cache.h"
+
+namespace render {
+
+LayersCache::LayersCache(std::size_t maxTiles)
+  : m_maxTiles(maxTiles)
+{
+}
+
+void LayersCache::invalidate()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_tiles.clear();
+}
+
+std::size_t LayersCache::tilesCount() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_tiles.size();
+}
+
+std::shared_ptr<LayersCache::Tile> LayersCache::tile(int col, int row)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  auto key = std::make_pair(col, row);
+  auto it = m_tiles.find(key);
+  if (it != m_tiles.end())
+    return it->second;
+
+  // Tiles that are still in use by other threads are kept alive by
+  // their shared_ptr.
+  if (m_tiles.size() >= m_maxTiles)
+    m_tiles.clear();
+
+  auto t = std::make_shared<Tile>();
+  m_tiles[key] = t;
+  return t;
+}
+
+} // namespace render
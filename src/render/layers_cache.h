@@ -0,0 +1,65 @@
+// LibreSprite Render Library
+// Copyright (c) 2026 LibreSprite contributors
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#pragma once
+
+#include "base/disable_copying.h"
+#include "doc/image_ref.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+namespace render {
+
+  // Keeps the background and all layers below a "split" layer (e.g.
+  // the active layer in the editor) already composited, so
+  // Render::renderSprite() only has to composite the layers from the
+  // split layer to the top. The zoomed sprite area is divided in
+  // tiles, and each tile is tagged with a key calculated from the
+  // render options and the versions of the layers/cels/images below
+  // the split layer. A tile is re-rendered only when its key changes.
+  //
+  // The cache is opt-in (see Render::setLayersCache()): it can be
+  // used only when all modifications of those objects increment
+  // their versions (as app::cmd commands do).
+  class LayersCache {
+  public:
+    // Maximum number of tiles before the whole cache is discarded.
+    explicit LayersCache(std::size_t maxTiles = 512);
+
+    // Discards all tiles.
+    void invalidate();
+
+    std::size_t tilesCount() const;
+
+  private:
+    friend class Render;
+
+    struct Tile {
+      std::mutex mutex;
+      bool valid;
+      std::uint64_t key;
+      doc::ImageRef image;
+      Tile() : valid(false), key(0) { }
+    };
+
+    // Returns the tile in the given column/row of the tile grid,
+    // creating a new (invalid) tile if it doesn't exist. It can be
+    // called from several threads.
+    std::shared_ptr<Tile> tile(int col, int row);
+
+    std::size_t m_maxTiles;
+    std::map<std::pair<int, int>, std::shared_ptr<Tile> > m_tiles;
+    mutable std::mutex m_mutex;
+
+    DISABLE_COPYING(LayersCache);
+  };
+
+} // namespace render
@@ -11,6 +11,7 @@
 #include "render/render.h"
 
 #include "base/base.h"
+#include "base/thread_pool.h"
 #include "doc/blend_internals.h"
 #include "doc/blend_mode.h"
 #include "doc/doc.h"
@@ -18,6 +19,11 @@
 #include "doc/image_impl.h"
 #include "gfx/clip.h"
 #include "gfx/region.h"
+#include "render/layers_cache.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
 
 namespace render {
 
@@ -185,6 +191,39 @@ void composite_image_without_scale(
   }
 }
 
+// RGB to RGB compositing blends whole rows (SIMD kernels are used
+// for the most common blend modes).
+template<>
+void composite_image_without_scale<RgbTraits, RgbTraits>(
+  Image* dst,
+  const Image* src,
+  const Palette* pal,
+  const gfx::Clip& _area,
+  const int opacity,
+  const BlendMode blendMode,
+  const Zoom& zoom)
+{
+  ASSERT(dst);
+  ASSERT(src);
+  ASSERT(dst->pixelFormat() == IMAGE_RGB);
+  ASSERT(src->pixelFormat() == IMAGE_RGB);
+
+  gfx::Clip area = _area;
+  if (!area.clip(dst->width(), dst->height(),
+                 src->width(), src->height()))
+    return;
+
+  BlendRowFunc blendRow = get_rgba_row_blender(blendMode);
+  const color_t maskColor = src->maskColor();
+
+  for (int y=0; y<area.size.h; ++y) {
+    (*blendRow)(
+      (color_t*)dst->getPixelAddress(area.dst.x, area.dst.y+y),
+      (const color_t*)src->getConstPixelAddress(area.src.x, area.src.y+y),
+      area.size.w, opacity, maskColor);
+  }
+}
+
 template<class DstTraits, class SrcTraits>
 void composite_image_scale_up(
   Image* dst,
@@ -433,6 +472,139 @@ CompositeImageFunc get_image_composition(PixelFormat dstFormat,
   return NULL;
 }
 
+//////////////////////////////////////////////////////////////////////
+// Parallel render
+
+// Size (in destination pixels) of each tile rendered by one thread
+// in Render::renderSpriteTiles(), 128x128 RGBA pixels fit in L2.
+const int kTileSize = 128;
+
+// Returns the size of tiles for the given zoom. Tiles must contain
+// whole zoomed pixels.
+int tile_step(const Zoom& zoom)
+{
+  if (zoom.scale() > 1.0) {
+    const int px = zoom.apply(1);
+    return std::max(1, kTileSize / px) * px;
+  }
+  else
+    return kTileSize;
+}
+
+// True if each source pixel is rendered as NxN pixels, or each
+// destination pixel samples one of NxN source pixels.
+bool is_integer_zoom(const Zoom& zoom)
+{
+  return (zoom.apply(zoom.remove(1)) == 1 ||
+          zoom.remove(zoom.apply(1)) == 1);
+}
+
+// Index of the tile that contains the "pos" coordinate.
+int tile_index(int pos, int step)
+{
+  int q = pos / step;
+  if (pos < 0 && pos % step != 0)
+    --q;
+  return q;
+}
+
+// Splits the [begin, begin+size) range in spans whose internal edges
+// are multiples of "step" (so zoomed pixels are not split between
+// two tiles and each tile blends exactly the same pixels).
+void split_range(int begin, int size, int step,
+                 std::vector<std::pair<int, int> >& spans)
+{
+  const int end = begin+size;
+  int pos = begin;
+  while (pos < end) {
+    int next = std::min((tile_index(pos, step)+1)*step, end);
+    spans.push_back(std::make_pair(pos, next-pos));
+    pos = next;
+  }
+}
+
+//////////////////////////////////////////////////////////////////////
+// Layers cache
+
+// Adds to "layers" all layers that are rendered before "split" (in
+// rendering order, including folders). Returns true if "split" was
+// found.
+bool collect_lower_layers(const Layer* layer,
+                          const Layer* split,
+                          std::vector<const Layer*>& layers)
+{
+  if (layer == split)
+    return true;
+
+  layers.push_back(layer);
+
+  if (layer->isFolder()) {
+    LayerConstIterator it = static_cast<const LayerFolder*>(layer)->getLayerBegin();
+    LayerConstIterator end = static_cast<const LayerFolder*>(layer)->getLayerEnd();
+    for (; it != end; ++it) {
+      if (collect_lower_layers(*it, split, layers))
+        return true;
+    }
+  }
+  return false;
+}
+
+class KeyHash {
+public:
+  KeyHash() : m_hash(14695981039346656037ull) { }
+
+  template<typename T>
+  void add(T value) {
+    m_hash ^= std::uint64_t(value);
+    m_hash *= 1099511628211ull;
+    m_hash ^= (m_hash >> 29);
+  }
+
+  std::uint64_t hash() const { return m_hash; }
+
+private:
+  std::uint64_t m_hash;
+};
+
+// Adds to the hash the palette of the given frame and the properties
+// of the given layers and their cels in that frame.
+void hash_layers(KeyHash& h,
+                 const Sprite* sprite,
+                 const std::vector<const Layer*>& layers,
+                 frame_t frame)
+{
+  const Palette* pal = sprite->palette(frame);
+  h.add(pal->id());
+  h.add(pal->version());
+
+  for (const Layer* layer : layers) {
+    h.add(layer->id());
+    h.add(layer->version());
+    h.add(int(layer->flags()));
+    if (!layer->isImage())
+      continue;
+
+    const LayerImage* imgLayer = static_cast<const LayerImage*>(layer);
+    h.add(int(imgLayer->blendMode()));
+    h.add(imgLayer->opacity());
+
+    auto cel = layer->cel(frame);
+    if (cel) {
+      h.add(cel->id());
+      h.add(cel->version());
+      h.add(cel->data()->id());
+      h.add(cel->data()->version());
+      if (cel->image()) {
+        h.add(cel->image()->id());
+        h.add(cel->image()->version());
+      }
+      h.add(cel->position().x);
+      h.add(cel->position().y);
+      h.add(cel->opacity());
+    }
+  }
+}
+
 } // anonymous namespace
 
 Render::Render()
@@ -443,6 +615,9 @@ Render::Render()
   , m_extraCel(NULL)
   , m_extraImage(NULL)
   , m_bgType(BgType::TRANSPARENT)
+  , m_bgZoom(false)
+  , m_bgColor1(0)
+  , m_bgColor2(0)
   , m_bgCheckedSize(16, 16)
   , m_globalOpacity(255)
   , m_selectedLayer(nullptr)
@@ -450,6 +625,10 @@ Render::Render()
   , m_previewImage(nullptr)
   , m_previewBlendMode(BlendMode::NORMAL)
   , m_onionskin(OnionskinType::NONE)
+  , m_parallel(false)
+  , m_layersCache(nullptr)
+  , m_splitLayer(nullptr)
+  , m_layerFilter(LayerFilter::ALL)
 {
 }
 
@@ -526,6 +705,17 @@ void Render::disableOnionskin()
   m_onionskin.type(OnionskinType::NONE);
 }
 
+void Render::setParallel(bool state)
+{
+  m_parallel = state;
+}
+
+void Render::setLayersCache(LayersCache* cache, const Layer* splitLayer)
+{
+  m_layersCache = cache;
+  m_splitLayer = splitLayer;
+}
+
 void Render::renderSprite(
   Image* dstImage,
   const Sprite* sprite,
@@ -583,6 +773,11 @@ void Render::renderSprite(
   const gfx::Clip& area,
   Zoom zoom)
 {
+  if (m_parallel) {
+    renderSpriteTiles(dstImage, sprite, frame, area, zoom);
+    return;
+  }
+
   m_sprite = sprite;
 
   CompositeImageFunc compositeImage =
@@ -592,6 +787,24 @@ void Render::renderSprite(
   if (!compositeImage)
     return;
 
+  // Get the background and the layers below m_splitLayer from the
+  // cache, and composite only the rest of layers.
+  if (m_layersCache &&
+      m_splitLayer &&
+      m_layerFilter == LayerFilter::ALL) {
+    std::vector<const Layer*> layers;
+    if (collect_lower_layers(m_sprite->folder(), m_splitLayer, layers)) {
+      m_lowerLayers = layers;
+      std::sort(m_lowerLayers.begin(), m_lowerLayers.end());
+
+      if (canUseLayersCache(frame)) {
+        renderLayersCache(dstImage, area, frame, zoom,
+                          layersCacheKey(dstImage, layers, frame, zoom));
+        m_layerFilter = LayerFilter::FROM_SPLIT;
+      }
+    }
+  }
+
   const LayerImage* bgLayer = m_sprite->backgroundLayer();
   color_t bg_color = 0;
   if (m_sprite->pixelFormat() == IMAGE_INDEXED) {
@@ -607,27 +820,29 @@ void Render::renderSprite(
     }
   }
 
-  // Draw checked background
-  switch (m_bgType) {
+  // Draw checked background (if it is not already in the cache)
+  if (m_layerFilter != LayerFilter::FROM_SPLIT) {
+    switch (m_bgType) {
 
-    case BgType::CHECKED:
-      if (bgLayer && bgLayer->isVisible() && rgba_geta(bg_color) == 255) {
-        fill_rect(dstImage, area.dstBounds(), bg_color);
-      }
-      else {
-        renderBackground(dstImage, area, zoom);
-        if (bgLayer && bgLayer->isVisible() && rgba_geta(bg_color) > 0) {
-          blend_rect(dstImage, area.dst.x, area.dst.y,
-                     area.dst.x+area.size.w-1,
-                     area.dst.y+area.size.h-1,
-                     bg_color, 255);
+      case BgType::CHECKED:
+        if (bgLayer && bgLayer->isVisible() && rgba_geta(bg_color) == 255) {
+          fill_rect(dstImage, area.dstBounds(), bg_color);
         }
-      }
-      break;
+        else {
+          renderBackground(dstImage, area, zoom);
+          if (bgLayer && bgLayer->isVisible() && rgba_geta(bg_color) > 0) {
+            blend_rect(dstImage, area.dst.x, area.dst.y,
+                       area.dst.x+area.size.w-1,
+                       area.dst.y+area.size.h-1,
+                       bg_color, 255);
+          }
+        }
+        break;
 
-    case BgType::TRANSPARENT:
-      fill_rect(dstImage, area.dstBounds(), bg_color);
-      break;
+      case BgType::TRANSPARENT:
+        fill_rect(dstImage, area.dstBounds(), bg_color);
+        break;
+    }
   }
 
   // Draw the background layer.
@@ -652,6 +867,9 @@ void Render::renderSprite(
     true,
     BlendMode::UNSPECIFIED);
 
+  if (m_layerFilter == LayerFilter::FROM_SPLIT)
+    m_layerFilter = LayerFilter::ALL;
+
   // Draw onion skin in front of the sprite.
   if (m_onionskin.position() == OnionskinPosition::INFRONT)
     renderOnionskin(dstImage, area, frame, zoom, compositeImage);
@@ -674,6 +892,233 @@ void Render::renderSprite(
   }
 }
 
+void Render::renderSpriteTiles(
+  Image* dstImage,
+  const Sprite* sprite,
+  frame_t frame,
+  const gfx::Clip& area,
+  Zoom zoom)
+{
+  const int step = tile_step(zoom);
+  std::vector<std::pair<int, int> > cols, rows;
+  split_range(area.src.x, area.size.w, step, cols);
+  split_range(area.src.y, area.size.h, step, rows);
+
+  const int ntiles = int(cols.size() * rows.size());
+  base::thread_pool& pool = base::thread_pool::instance();
+
+  // Each tile uses its own copy of this Render (renderLayer() and
+  // renderOnionskin() modify m_globalOpacity).
+  Render serial(*this);
+  serial.m_parallel = false;
+
+  if (ntiles < 2) {
+    serial.renderSprite(dstImage, sprite, frame, area, zoom);
+    return;
+  }
+
+  pool.parallel_for(
+    ntiles,
+    [&](int i){
+      const auto& col = cols[i % cols.size()];
+      const auto& row = rows[i / cols.size()];
+      Render tileRender(serial);
+      tileRender.renderSprite(
+        dstImage, sprite, frame,
+        gfx::Clip(area.dst.x + col.first - area.src.x,
+                  area.dst.y + row.first - area.src.y,
+                  col.first, row.first,
+                  col.second, row.second),
+        zoom);
+    });
+}
+
+bool Render::isLowerLayer(const Layer* layer) const
+{
+  return std::binary_search(m_lowerLayers.begin(),
+                            m_lowerLayers.end(), layer);
+}
+
+bool Render::isLayerFiltered(const Layer* layer) const
+{
+  switch (m_layerFilter) {
+    case LayerFilter::BELOW_SPLIT: return !isLowerLayer(layer);
+    case LayerFilter::FROM_SPLIT: return isLowerLayer(layer);
+  }
+  return false;
+}
+
+bool Render::canUseLayersCache(frame_t frame) const
+{
+  // Onion skin is drawn between the background layer and the
+  // transparent layers.
+  if (m_onionskin.type() != OnionskinType::NONE &&
+      m_onionskin.position() == OnionskinPosition::BEHIND)
+    return false;
+
+  // The preview image or the extra cel replace/modify a layer below
+  // the split layer.
+  if (m_previewImage &&
+      m_selectedLayer &&
+      m_selectedFrame == frame &&
+      isLowerLayer(m_selectedLayer))
+    return false;
+
+  if (m_extraCel &&
+      m_extraType != ExtraType::NONE &&
+      m_currentFrame == frame &&
+      isLowerLayer(m_currentLayer))
+    return false;
+
+  return true;
+}
+
+std::uint64_t Render::optionsKey(
+  PixelFormat dstFormat,
+  frame_t frame, Zoom zoom) const
+{
+  KeyHash h;
+
+  h.add(int(dstFormat));
+  h.add(zoom.apply(1));
+  h.add(zoom.remove(1));
+  h.add(frame);
+
+  h.add(int(m_bgType));
+  h.add(m_bgZoom);
+  h.add(m_bgColor1);
+  h.add(m_bgColor2);
+  h.add(m_bgCheckedSize.w);
+  h.add(m_bgCheckedSize.h);
+
+  const LayerImage* bgLayer = m_sprite->backgroundLayer();
+  // Object IDs are used instead of pointers because a new object can
+  // be allocated in the same address of a deleted one.
+  h.add(m_sprite->id());
+  h.add(m_sprite->version());
+  h.add(int(m_sprite->pixelFormat()));
+  h.add(m_sprite->transparentColor());
+  h.add(bgLayer && bgLayer->isVisible());
+
+  return h.hash();
+}
+
+std::uint64_t Render::layersCacheKey(
+  const Image* dstImage,
+  const std::vector<const Layer*>& layers,
+  frame_t frame, Zoom zoom) const
+{
+  KeyHash h;
+  h.add(optionsKey(dstImage->pixelFormat(), frame, zoom));
+  hash_layers(h, m_sprite, layers, frame);
+  return h.hash();
+}
+
+std::uint64_t Render::renderKey(
+  const Sprite* sprite,
+  frame_t frame, Zoom zoom,
+  PixelFormat dstFormat)
+{
+  m_sprite = sprite;
+
+  std::vector<const Layer*> layers;
+  collect_lower_layers(sprite->folder(), nullptr, layers);
+
+  KeyHash h;
+  h.add(optionsKey(dstFormat, frame, zoom));
+  hash_layers(h, sprite, layers, frame);
+
+  // The preview image pixels are not included (they are modified
+  // with its own notifications), only what image is used and where
+  if (m_previewImage) {
+    h.add(m_previewImage->id());
+    h.add(m_selectedLayer ? m_selectedLayer->id(): 0);
+    h.add(m_selectedFrame);
+    h.add(m_previewPos.x);
+    h.add(m_previewPos.y);
+    h.add(int(m_previewBlendMode));
+  }
+
+  if (m_onionskin.type() != OnionskinType::NONE) {
+    h.add(int(m_onionskin.type()));
+    h.add(int(m_onionskin.position()));
+    h.add(m_onionskin.opacityBase());
+    h.add(m_onionskin.opacityStep());
+    h.add(m_onionskin.loopTag() ? m_onionskin.loopTag()->id(): 0);
+    h.add(m_onionskin.layer() ? m_onionskin.layer()->id(): 0);
+
+    // Frames that can be used by renderOnionskin() (the loop tag can
+    // only reduce this range)
+    const frame_t first = std::max(frame_t(0), frame - m_onionskin.prevFrames());
+    const frame_t last = std::min(sprite->lastFrame(), frame + m_onionskin.nextFrames());
+    for (frame_t f=first; f<=last; ++f) {
+      h.add(f);
+      hash_layers(h, sprite, layers, f);
+    }
+  }
+
+  return h.hash();
+}
+
+void Render::renderLayersCache(
+  Image* dstImage,
+  const gfx::Clip& area,
+  frame_t frame, Zoom zoom,
+  std::uint64_t key)
+{
+  const int step = tile_step(zoom);
+  std::vector<std::pair<int, int> > cols, rows;
+  split_range(area.src.x, area.size.w, step, cols);
+  split_range(area.src.y, area.size.h, step, rows);
+
+  // Render used to fill the cache tiles: only the background and the
+  // layers below the split layer.
+  Render lower(*this);
+  lower.m_parallel = false;
+  lower.m_layersCache = nullptr;
+  lower.m_layerFilter = LayerFilter::BELOW_SPLIT;
+  lower.disableOnionskin();
+  lower.removePreviewImage();
+  lower.removeExtraImage();
+
+  for (const auto& row : rows) {
+    const int v = tile_index(row.first, step);
+
+    for (const auto& col : cols) {
+      const int u = tile_index(col.first, step);
+
+      auto tile = m_layersCache->tile(u, v);
+      std::lock_guard<std::mutex> lock(tile->mutex);
+
+      if (!tile->valid || tile->key != key) {
+        if (!tile->image ||
+            tile->image->pixelFormat() != dstImage->pixelFormat() ||
+            tile->image->width() != step ||
+            tile->image->height() != step) {
+          tile->image.reset(Image::create(dstImage->pixelFormat(), step, step));
+        }
+
+        Render tileRender(lower);
+        tileRender.renderSprite(
+          tile->image.get(), m_sprite, frame,
+          gfx::Clip(0, 0, u*step, v*step, step, step),
+          zoom);
+
+        tile->key = key;
+        tile->valid = true;
+      }
+
+      dstImage->copy(
+        tile->image.get(),
+        gfx::Clip(area.dst.x + col.first - area.src.x,
+                  area.dst.y + row.first - area.src.y,
+                  col.first - u*step,
+                  row.first - v*step,
+                  col.second, row.second));
+    }
+  }
+}
+
 void Render::renderOnionskin(
   Image* dstImage,
   const gfx::Clip& area,
@@ -761,9 +1206,11 @@ void Render::renderBackground(Image* image,
   u = (area.src.x / tile_w);
   v = (area.src.y / tile_h);
 
-  // Position where we start drawing the first tile in "image"
-  int x_start = -(area.src.x % tile_w);
-  int y_start = -(area.src.y % tile_h);
+  // Position where we start drawing the first tile in "image" (it
+  // depends on area.dst so the pattern doesn't change when the area
+  // is split in several parts, e.g. in renderSpriteTiles())
+  int x_start = area.dst.x - (area.src.x % tile_w);
+  int y_start = area.dst.y - (area.src.y % tile_h);
 
   gfx::Rect dstBounds = area.dstBounds();
 
@@ -815,6 +1262,10 @@ void Render::renderLayer(
   if (!layer->isVisible())
     return;
 
+  // The layer is in (or out of) the layers cache
+  if (layer->isImage() && isLayerFiltered(layer))
+    return;
+
   gfx::Rect extraArea;
   bool drawExtra = (m_extraCel &&
                     m_extraCel->frame() == frame &&
@@ -986,6 +1437,24 @@ void Render::renderImage(
         cel_y,
         zoom.apply(cel_image->width()),
         zoom.apply(cel_image->height())));
+
+  // Skip transparent rows of the image (one extra row/column is
+  // included because of rounding in zoom.apply()). Only the SRC
+  // blend mode copies transparent pixels, and with fractional zoom
+  // levels the sampled pixels depend on the first rendered row.
+  const gfx::Rect opaque = cel_image->opaqueBounds();
+  if (opaque != cel_image->bounds() &&
+      blendMode != BlendMode::SRC &&
+      is_integer_zoom(zoom)) {
+    if (opaque.isEmpty())
+      return;
+
+    src_bounds &= gfx::Rect(
+      cel_x + zoom.apply(opaque.x),
+      cel_y + zoom.apply(opaque.y),
+      zoom.apply(opaque.x2()) - zoom.apply(opaque.x) + 1,
+      zoom.apply(opaque.y2()) - zoom.apply(opaque.y) + 1);
+  }
   if (src_bounds.isEmpty())
     return;
 
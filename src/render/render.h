@@ -17,6 +17,9 @@
 #include "render/onionskin_position.h"
 #include "render/zoom.h"
 
+#include <cstdint>
+#include <vector>
+
 namespace gfx {
   class Clip;
 }
@@ -33,6 +36,8 @@ namespace doc {
 namespace render {
   using namespace doc;
 
+  class LayersCache;
+
   enum class BgType {
     NONE,
     TRANSPARENT,
@@ -128,6 +133,17 @@ namespace render {
     void setOnionskin(const OnionskinOptions& options);
     void disableOnionskin();
 
+    // Splits renderSprite() calls in tiles that are composited
+    // concurrently by the base::thread_pool. The output is the same
+    // as in the serial path.
+    void setParallel(bool state);
+
+    // Uses the given cache to get the background and the layers below
+    // "splitLayer" already composited in renderSprite() calls (only
+    // the layers from "splitLayer" to the top are composited each
+    // time). Use nullptr to disable the cache.
+    void setLayersCache(LayersCache* cache, const Layer* splitLayer);
+
     void renderSprite(
       Image* dstImage,
       const Sprite* sprite,
@@ -161,6 +177,17 @@ namespace render {
       const gfx::Clip& area,
       Zoom zoom);
 
+    // Returns a hash of the render options and all the objects
+    // (layers, cels, images, palettes, including the frames used by
+    // the onion skin) that renderSprite() uses to render the given
+    // frame. It can be used to know if a previous render is still
+    // valid. The pixels of the preview image and the extra cel are
+    // not included.
+    std::uint64_t renderKey(
+      const Sprite* sprite,
+      frame_t frame, Zoom zoom,
+      PixelFormat dstFormat);
+
     // Extra functions
     void renderBackground(Image* image,
       const gfx::Clip& area,
@@ -171,6 +198,35 @@ namespace render {
       int opacity, BlendMode blendMode);
 
   private:
+    enum class LayerFilter {
+      ALL,            // Render all layers
+      BELOW_SPLIT,    // Only layers in m_lowerLayers
+      FROM_SPLIT,     // Only layers that are not in m_lowerLayers
+    };
+
+    bool isLowerLayer(const Layer* layer) const;
+    bool isLayerFiltered(const Layer* layer) const;
+    bool canUseLayersCache(frame_t frame) const;
+    std::uint64_t optionsKey(
+      PixelFormat dstFormat,
+      frame_t frame, Zoom zoom) const;
+    std::uint64_t layersCacheKey(
+      const Image* dstImage,
+      const std::vector<const Layer*>& layers,
+      frame_t frame, Zoom zoom) const;
+    void renderLayersCache(
+      Image* dstImage,
+      const gfx::Clip& area,
+      frame_t frame, Zoom zoom,
+      std::uint64_t key);
+
+    void renderSpriteTiles(
+      Image* dstImage,
+      const Sprite* sprite,
+      frame_t frame,
+      const gfx::Clip& area,
+      Zoom zoom);
+
     void renderOnionskin(
       Image* image,
       const gfx::Clip& area,
@@ -226,6 +282,11 @@ namespace render {
     gfx::Point m_previewPos;
     BlendMode m_previewBlendMode;
     OnionskinOptions m_onionskin;
+    bool m_parallel;
+    LayersCache* m_layersCache;
+    const Layer* m_splitLayer;
+    LayerFilter m_layerFilter;
+    std::vector<const Layer*> m_lowerLayers; // Sorted by address
   };
 
   void composite_image(Image* dst,
@@ -12,6 +12,8 @@
 
 #include "render/render.h"
 
+#include "render/layers_cache.h"
+
 #include "doc/cel.h"
 #include "doc/context.h"
 #include "doc/document.h"
@@ -19,6 +21,9 @@
 #include "doc/layer.h"
 #include "doc/palette.h"
 #include "doc/primitives.h"
+#include "doc/sprite.h"
+
+#include <memory>
 
 using namespace doc;
 using namespace render;
@@ -71,12 +76,12 @@ TEST(Render, Basic)
   clear_image(src, 2);
 
   std::unique_ptr<Image> dst(Image::create(IMAGE_RGB, 2, 2));
-  clear_image(dst, 1);
-  EXPECT_2X2_PIXELS(dst, 1, 1, 1, 1);
+  clear_image(dst.get(), 1);
+  EXPECT_2X2_PIXELS(dst.get(), 1, 1, 1, 1);
 
   Render render;
-  render.renderSprite(dst, doc->sprite(), frame_t(0));
-  EXPECT_2X2_PIXELS(dst, 2, 2, 2, 2);
+  render.renderSprite(dst.get(), doc->sprite(), frame_t(0));
+  EXPECT_2X2_PIXELS(dst.get(), 2, 2, 2, 2);
 }
 
 TYPED_TEST(RenderAllModes, CheckDefaultBackgroundMode)
@@ -93,13 +98,13 @@ TYPED_TEST(RenderAllModes, CheckDefaultBackgroundMode)
   put_pixel(src, 1, 1, 1);
 
   std::unique_ptr<Image> dst(Image::create(ImageTraits::pixel_format, 2, 2));
-  clear_image(dst, 1);
-  EXPECT_2X2_PIXELS(dst, 1, 1, 1, 1);
+  clear_image(dst.get(), 1);
+  EXPECT_2X2_PIXELS(dst.get(), 1, 1, 1, 1);
 
   Render render;
-  render.renderSprite(dst, doc->sprite(), frame_t(0));
+  render.renderSprite(dst.get(), doc->sprite(), frame_t(0));
   // Default background mode is to set all pixels to transparent color
-  EXPECT_2X2_PIXELS(dst, 0, 0, 0, 1);
+  EXPECT_2X2_PIXELS(dst.get(), 0, 0, 0, 1);
 }
 
 TEST(Render, DefaultBackgroundModeWithNonzeroTransparentIndex)
@@ -114,20 +119,20 @@ TEST(Render, DefaultBackgroundModeWithNonzeroTransparentIndex)
   put_pixel(src, 1, 1, 1);
 
   std::unique_ptr<Image> dst(Image::create(IMAGE_INDEXED, 2, 2));
-  clear_image(dst, 1);
-  EXPECT_2X2_PIXELS(dst, 1, 1, 1, 1);
+  clear_image(dst.get(), 1);
+  EXPECT_2X2_PIXELS(dst.get(), 1, 1, 1, 1);
 
   Render render;
-  render.renderSprite(dst, doc->sprite(), frame_t(0));
-  EXPECT_2X2_PIXELS(dst, 2, 2, 2, 1); // Indexed transparent
+  render.renderSprite(dst.get(), doc->sprite(), frame_t(0));
+  EXPECT_2X2_PIXELS(dst.get(), 2, 2, 2, 1); // Indexed transparent
 
   dst.reset(Image::create(IMAGE_RGB, 2, 2));
-  clear_image(dst, 1);
-  EXPECT_2X2_PIXELS(dst, 1, 1, 1, 1);
-  render.renderSprite(dst, doc->sprite(), frame_t(0));
+  clear_image(dst.get(), 1);
+  EXPECT_2X2_PIXELS(dst.get(), 1, 1, 1, 1);
+  render.renderSprite(dst.get(), doc->sprite(), frame_t(0));
   color_t c1 = doc->sprite()->palette(0)->entry(1);
   EXPECT_NE(0, c1);
-  EXPECT_2X2_PIXELS(dst, 0, 0, 0, c1); // RGB transparent
+  EXPECT_2X2_PIXELS(dst.get(), 0, 0, 0, c1); // RGB transparent
 }
 
 TEST(Render, CheckedBackground)
@@ -136,7 +141,7 @@ TEST(Render, CheckedBackground)
   Document* doc = ctx.documents().add(4, 4, ColorMode::RGB);
 
   std::unique_ptr<Image> dst(Image::create(IMAGE_RGB, 4, 4));
-  clear_image(dst, 0);
+  clear_image(dst.get(), 0);
 
   Render render;
   render.setBgType(BgType::CHECKED);
@@ -145,35 +150,35 @@ TEST(Render, CheckedBackground)
   render.setBgColor2(2);
 
   render.setBgCheckedSize(gfx::Size(1, 1));
-  render.renderSprite(dst, doc->sprite(), frame_t(0));
-  EXPECT_4X4_PIXELS(dst,
+  render.renderSprite(dst.get(), doc->sprite(), frame_t(0));
+  EXPECT_4X4_PIXELS(dst.get(),
     1, 2, 1, 2,
     2, 1, 2, 1,
     1, 2, 1, 2,
     2, 1, 2, 1);
 
   render.setBgCheckedSize(gfx::Size(2, 2));
-  render.renderSprite(dst, doc->sprite(), frame_t(0));
-  EXPECT_4X4_PIXELS(dst,
+  render.renderSprite(dst.get(), doc->sprite(), frame_t(0));
+  EXPECT_4X4_PIXELS(dst.get(),
     1, 1, 2, 2,
     1, 1, 2, 2,
     2, 2, 1, 1,
     2, 2, 1, 1);
 
   render.setBgCheckedSize(gfx::Size(3, 3));
-  render.renderSprite(dst, doc->sprite(), frame_t(0));
-  EXPECT_4X4_PIXELS(dst,
+  render.renderSprite(dst.get(), doc->sprite(), frame_t(0));
+  EXPECT_4X4_PIXELS(dst.get(),
     1, 1, 1, 2,
     1, 1, 1, 2,
     1, 1, 1, 2,
     2, 2, 2, 1);
 
   render.setBgCheckedSize(gfx::Size(1, 1));
-  render.renderSprite(dst,
+  render.renderSprite(dst.get(),
     doc->sprite(), frame_t(0),
     gfx::Clip(dst->bounds()),
     Zoom(2, 1));
-  EXPECT_4X4_PIXELS(dst,
+  EXPECT_4X4_PIXELS(dst.get(),
     1, 1, 2, 2,
     1, 1, 2, 2,
     2, 2, 1, 1,
@@ -194,7 +199,7 @@ TEST(Render, ZoomAndDstBounds)
   fill_rect(src, 1, 1, 2, 2, 4);
 
   std::unique_ptr<Image> dst(Image::create(IMAGE_RGB, 4, 4));
-  clear_image(dst, 0);
+  clear_image(dst.get(), 0);
 
   Render render;
   render.setBgType(BgType::CHECKED);
@@ -203,16 +208,223 @@ TEST(Render, ZoomAndDstBounds)
   render.setBgColor2(2);
   render.setBgCheckedSize(gfx::Size(1, 1));
 
-  render.renderSprite(dst, doc->sprite(), frame_t(0),
+  render.renderSprite(dst.get(), doc->sprite(), frame_t(0),
     gfx::Clip(1, 1, 0, 0, 2, 2),
     Zoom(1, 1));
-  EXPECT_4X4_PIXELS(dst,
+  EXPECT_4X4_PIXELS(dst.get(),
     0, 0, 0, 0,
     0, 1, 2, 0,
     0, 2, 4, 0,
     0, 0, 0, 0);
 }
 
+// Adds three layers with different blend modes and overlapping cels
+static void add_blended_layers(Sprite* spr)
+{
+  const BlendMode modes[] = {
+    BlendMode::MULTIPLY,
+    BlendMode::SCREEN,
+    BlendMode::OVERLAY };
+  int i = 1;
+  for (BlendMode mode : modes) {
+    LayerImage* lay = new LayerImage(spr);
+    lay->setBlendMode(mode);
+    lay->setOpacity(192);
+    spr->folder()->addLayer(lay);
+
+    ImageRef img(Image::create(IMAGE_RGB, 250, 150));
+    for (int y=0; y<img->height(); ++y)
+      for (int x=0; x<img->width(); ++x)
+        put_pixel(img.get(), x, y,
+                  rgba((x*i) & 255, (y*7) & 255, (x^y) & 255, (x+y*i) & 255));
+
+    auto cel = std::make_shared<Cel>(frame_t(0), img);
+    cel->setPosition(i*13, i*9);
+    lay->addCel(cel);
+    ++i;
+  }
+}
+
+TEST(Render, ParallelTilesMatchSerial)
+{
+  Context ctx;
+  Document* doc = ctx.documents().add(300, 200, ColorMode::RGB);
+  Sprite* spr = doc->sprite();
+  add_blended_layers(spr);
+
+  Render render;
+  render.setBgType(BgType::CHECKED);
+  render.setBgZoom(false);
+  render.setBgColor1(rgba(128, 128, 128, 255));
+  render.setBgColor2(rgba(192, 192, 192, 255));
+  render.setBgCheckedSize(gfx::Size(16, 16));
+
+  for (Zoom zoom : { Zoom(1, 1), Zoom(3, 1), Zoom(1, 2) }) {
+    gfx::Rect bounds = zoom.apply(spr->bounds());
+    std::unique_ptr<Image> serial(Image::create(IMAGE_RGB, bounds.w, bounds.h));
+    std::unique_ptr<Image> parallel(Image::create(IMAGE_RGB, bounds.w, bounds.h));
+
+    for (const gfx::Clip& area : { gfx::Clip(bounds),
+                                   gfx::Clip(5, 3, 37, 21, 250, 170) }) {
+      clear_image(serial.get(), 0);
+      clear_image(parallel.get(), 0);
+
+      render.setParallel(false);
+      render.renderSprite(serial.get(), spr, frame_t(0), area, zoom);
+      render.setParallel(true);
+      render.renderSprite(parallel.get(), spr, frame_t(0), area, zoom);
+
+      EXPECT_EQ(0, count_diff_between_images(serial.get(), parallel.get()));
+    }
+  }
+}
+
+TEST(Render, LayersCacheMatchesFullRender)
+{
+  Context ctx;
+  Document* doc = ctx.documents().add(300, 200, ColorMode::RGB);
+  Sprite* spr = doc->sprite();
+  add_blended_layers(spr);
+
+  LayerList layers;
+  spr->getLayersList(layers);
+  ASSERT_EQ(4, int(layers.size()));
+
+  Render render;
+  render.setBgType(BgType::CHECKED);
+  render.setBgZoom(true);
+  render.setBgColor1(rgba(128, 128, 128, 255));
+  render.setBgColor2(rgba(192, 192, 192, 255));
+  render.setBgCheckedSize(gfx::Size(8, 8));
+
+  LayersCache cache;
+
+  for (Zoom zoom : { Zoom(1, 1), Zoom(3, 1), Zoom(1, 2) }) {
+    gfx::Rect bounds = zoom.apply(spr->bounds());
+    std::unique_ptr<Image> expected(Image::create(IMAGE_RGB, bounds.w, bounds.h));
+    std::unique_ptr<Image> cached(Image::create(IMAGE_RGB, bounds.w, bounds.h));
+    const gfx::Clip area(5, 3, 37, 21, 250, 170);
+
+    for (Layer* split : layers) {
+      render.setLayersCache(nullptr, nullptr);
+      clear_image(expected.get(), 0);
+      render.renderSprite(expected.get(), spr, frame_t(0), area, zoom);
+
+      // First call fills the cache, the second one uses it
+      render.setLayersCache(&cache, split);
+      for (int j=0; j<2; ++j) {
+        clear_image(cached.get(), 0);
+        render.renderSprite(cached.get(), spr, frame_t(0), area, zoom);
+        EXPECT_EQ(0, count_diff_between_images(expected.get(), cached.get()));
+      }
+      EXPECT_LT(0, int(cache.tilesCount()));
+
+      render.setParallel(true);
+      clear_image(cached.get(), 0);
+      render.renderSprite(cached.get(), spr, frame_t(0), area, zoom);
+      EXPECT_EQ(0, count_diff_between_images(expected.get(), cached.get()));
+      render.setParallel(false);
+    }
+  }
+
+  // Modify the bottom layer, the cache must be refreshed with the
+  // new image version.
+  render.setLayersCache(&cache, layers[3]);
+
+  std::unique_ptr<Image> expected(Image::create(IMAGE_RGB, 300, 200));
+  std::unique_ptr<Image> cached(Image::create(IMAGE_RGB, 300, 200));
+  clear_image(cached.get(), 0);
+  render.renderSprite(cached.get(), spr, frame_t(0));
+
+  Image* bottom = layers[1]->cel(frame_t(0))->image();
+  fill_rect(bottom, 0, 0, 99, 99, rgba(255, 0, 0, 255));
+  bottom->incrementVersion();
+
+  render.setLayersCache(nullptr, nullptr);
+  clear_image(expected.get(), 0);
+  render.renderSprite(expected.get(), spr, frame_t(0));
+
+  render.setLayersCache(&cache, layers[3]);
+  clear_image(cached.get(), 0);
+  render.renderSprite(cached.get(), spr, frame_t(0));
+  EXPECT_EQ(0, count_diff_between_images(expected.get(), cached.get()));
+}
+
+TEST(Render, RenderKey)
+{
+  Context ctx;
+  Document* doc = ctx.documents().add(300, 200, ColorMode::RGB);
+  Sprite* spr = doc->sprite();
+  add_blended_layers(spr);
+
+  LayerList layers;
+  spr->getLayersList(layers);
+
+  Render render;
+  const std::uint64_t key = render.renderKey(spr, frame_t(0), Zoom(1, 1), IMAGE_RGB);
+  EXPECT_EQ(key, render.renderKey(spr, frame_t(0), Zoom(1, 1), IMAGE_RGB));
+  EXPECT_NE(key, render.renderKey(spr, frame_t(0), Zoom(2, 1), IMAGE_RGB));
+
+  render.setBgType(BgType::CHECKED);
+  EXPECT_NE(key, render.renderKey(spr, frame_t(0), Zoom(1, 1), IMAGE_RGB));
+  render.setBgType(BgType::TRANSPARENT);
+  EXPECT_EQ(key, render.renderKey(spr, frame_t(0), Zoom(1, 1), IMAGE_RGB));
+
+  layers[2]->setVisible(false);
+  EXPECT_NE(key, render.renderKey(spr, frame_t(0), Zoom(1, 1), IMAGE_RGB));
+  layers[2]->setVisible(true);
+
+  layers[1]->cel(frame_t(0))->image()->incrementVersion();
+  EXPECT_NE(key, render.renderKey(spr, frame_t(0), Zoom(1, 1), IMAGE_RGB));
+}
+
+TEST(Render, SkipTransparentRows)
+{
+  Context ctx;
+  Document* doc = ctx.documents().add(300, 400, ColorMode::RGB);
+  Sprite* spr = doc->sprite();
+  add_blended_layers(spr);
+
+  // Image with only a few modified rows after clearing it
+  ImageRef img(Image::create(IMAGE_RGB, 280, 350));
+  clear_image(img.get(), img->maskColor());
+  fill_rect(img.get(), 20, 130, 200, 140, rgba(255, 0, 0, 128));
+  put_pixel(img.get(), 7, 200, rgba(0, 255, 0, 255));
+  ASSERT_EQ(gfx::Rect(0, 128, 280, 128), img->opaqueBounds());
+
+  LayerImage* lay = new LayerImage(spr);
+  lay->setBlendMode(BlendMode::MULTIPLY);
+  spr->folder()->addLayer(lay);
+  Cel* cel = new Cel(frame_t(0), img);
+  cel->setPosition(3, 5);
+  lay->addCel(std::shared_ptr<Cel>(cel));
+
+  // Same image without information about cleared rows
+  ImageRef full(Image::createCopy(img.get()));
+  full->getBitsAddress();
+  ASSERT_EQ(full->bounds(), full->opaqueBounds());
+
+  Render render;
+  for (Zoom zoom : { Zoom(1, 1), Zoom(3, 1), Zoom(1, 2), Zoom(3, 2) }) {
+    gfx::Rect bounds = zoom.apply(spr->bounds());
+    std::unique_ptr<Image> expected(Image::create(IMAGE_RGB, bounds.w, bounds.h));
+    std::unique_ptr<Image> result(Image::create(IMAGE_RGB, bounds.w, bounds.h));
+
+    for (const gfx::Clip& area : { gfx::Clip(bounds),
+                                   gfx::Clip(5, 3, 37, 101, 250, 170) }) {
+      cel->data()->setImage(full);
+      clear_image(expected.get(), 0);
+      render.renderSprite(expected.get(), spr, frame_t(0), area, zoom);
+
+      cel->data()->setImage(img);
+      clear_image(result.get(), 0);
+      render.renderSprite(result.get(), spr, frame_t(0), area, zoom);
+
+      EXPECT_EQ(0, count_diff_between_images(expected.get(), result.get()));
+    }
+  }
+}
+
 int main(int argc, char** argv)
 {
   ::testing::InitGoogleTest(&argc, argv);